@@ -0,0 +1,504 @@
+#include <algorithm>                    // sort, minmax_element
+#include <chrono>
+#include <cmath>                        // sqrt, lgamma, isfinite
+#include <cctype>                       // isspace
+#include <cstdlib>                      // strtod
+#include <fstream>
+#include <limits>                       // quiet_NaN
+#include <iomanip>                      // setprecision
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include "bench_utils.hpp"
+
+
+using namespace std;
+
+
+namespace deblur {
+
+    sampleStatistics computeStatistics(const vector<double>& samples) {
+        sampleStatistics stats;
+        stats.n = samples.size();
+
+        if (samples.empty()) {
+            return stats;
+        }
+
+        double sum = 0;
+
+        for (const double sample : samples) {
+            sum += sample;
+        }
+
+        stats.mean = sum / stats.n;
+
+        double squares = 0;
+
+        for (const double sample : samples) {
+            squares += (sample - stats.mean) * (sample - stats.mean);
+        }
+
+        stats.variance = (stats.n > 1) ? squares / (stats.n - 1) : 0;
+        stats.stddev = sqrt(stats.variance);
+
+        vector<double> sorted(samples);
+        sort(sorted.begin(), sorted.end());
+
+        stats.min = sorted.front();
+        stats.max = sorted.back();
+        stats.median = (stats.n % 2 == 1) ? sorted[stats.n / 2]
+                                          : (sorted[stats.n / 2 - 1] + sorted[stats.n / 2]) / 2;
+
+        return stats;
+    }
+
+
+    /**
+     * Continued fraction of the incomplete beta function (modified Lentz's method)
+     */
+    static double betaContinuedFraction(const double a, const double b, const double x) {
+        const double tiny = 1e-300;
+        double c = 1;
+        double d = 1 - (a + b) * x / (a + 1);
+        d = 1 / ((fabs(d) < tiny) ? tiny : d);
+        double h = d;
+
+        for (int m = 1; m <= 300; m++) {
+            // even step
+            double aa = m * (b - m) * x / ((a + 2 * m - 1) * (a + 2 * m));
+            d = 1 + aa * d;
+            c = 1 + aa / c;
+            d = 1 / ((fabs(d) < tiny) ? tiny : d);
+            c = (fabs(c) < tiny) ? tiny : c;
+            h *= d * c;
+
+            // odd step
+            aa = -(a + m) * (a + b + m) * x / ((a + 2 * m) * (a + 2 * m + 1));
+            d = 1 + aa * d;
+            c = 1 + aa / c;
+            d = 1 / ((fabs(d) < tiny) ? tiny : d);
+            c = (fabs(c) < tiny) ? tiny : c;
+            h *= d * c;
+
+            if (fabs(d * c - 1) < 1e-12) {
+                break;
+            }
+        }
+
+        return h;
+    }
+
+
+    /**
+     * Regularized incomplete beta function I_x(a, b)
+     */
+    static double regularizedBeta(const double x, const double a, const double b) {
+        if (x <= 0) {
+            return 0;
+        }
+
+        if (x >= 1) {
+            return 1;
+        }
+
+        const double front = exp(lgamma(a + b) - lgamma(a) - lgamma(b) + a * log(x) + b * log(1 - x));
+
+        // the continued fraction converges fast for x < (a + 1) / (a + b + 2)
+        if (x < (a + 1) / (a + b + 2)) {
+            return front * betaContinuedFraction(a, b, x) / a;
+        } else {
+            return 1 - front * betaContinuedFraction(b, a, 1 - x) / b;
+        }
+    }
+
+
+    welchTest welchTTest(const sampleStatistics& a, const sampleStatistics& b) {
+        welchTest test;
+
+        if (a.n < 2 || b.n < 2) {
+            test.p = -1;
+            return test;
+        }
+
+        // squared standard errors of the means
+        const double errorA = a.variance / a.n;
+        const double errorB = b.variance / b.n;
+        const double error = errorA + errorB;
+
+        if (error == 0) {
+            test.df = a.n + b.n - 2;
+            test.p = (a.mean == b.mean) ? 1 : 0;
+            test.t = (a.mean == b.mean) ? 0 : ((b.mean > a.mean) ? HUGE_VAL : -HUGE_VAL);
+            return test;
+        }
+
+        test.t = (b.mean - a.mean) / sqrt(error);
+        test.df = error * error / (errorA * errorA / (a.n - 1) + errorB * errorB / (b.n - 1));
+
+        // two-sided p-value of Student's t-distribution
+        test.p = regularizedBeta(test.df / (test.df + test.t * test.t), test.df / 2, 0.5);
+
+        return test;
+    }
+
+
+    vector<double> timeRepeated(const function<void(int)>& run, const int warmup,
+                                const int repetitions, const int threads) {
+        vector<double> samples;
+        samples.reserve(repetitions);
+
+        for (int i = 0; i < warmup + repetitions; i++) {
+            auto start = chrono::steady_clock::now();
+
+            if (threads > 1) {
+                vector<thread> workers;
+
+                for (int id = 0; id < threads; id++) {
+                    workers.push_back(thread(run, id));
+                }
+
+                for (auto& worker : workers) {
+                    worker.join();
+                }
+            } else {
+                run(0);
+            }
+
+            const double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+            if (i >= warmup) {
+                samples.push_back(ms);
+            }
+        }
+
+        return samples;
+    }
+
+
+    /**
+     * Writes a JSON number. JSON has no NaN or infinity, they are written as null.
+     */
+    static void writeNumber(ostream& out, const double value) {
+        if (std::isfinite(value)) {
+            out << value;
+        } else {
+            out << "null";
+        }
+    }
+
+
+    /**
+     * Writes key-value pairs as JSON object ({"key": value, ...})
+     */
+    static void writeObject(ostream& out, const vector<pair<string, double>>& members) {
+        out << "{";
+
+        for (size_t i = 0; i < members.size(); i++) {
+            out << ((i == 0) ? "" : ", ") << "\"" << members[i].first << "\": ";
+            writeNumber(out, members[i].second);
+        }
+
+        out << "}";
+    }
+
+
+    static void writeArray(ostream& out, const vector<double>& values) {
+        out << "[";
+
+        for (size_t i = 0; i < values.size(); i++) {
+            out << ((i == 0) ? "" : ", ");
+            writeNumber(out, values[i]);
+        }
+
+        out << "]";
+    }
+
+
+    void writeBenchmarkJSON(ostream& out, const string& suite, const int warmup,
+                            const int repetitions, const vector<benchmarkResult>& results) {
+        out << fixed << setprecision(4);
+        out << "{" << endl;
+        out << "  \"suite\": \"" << suite << "\"," << endl;
+        out << "  \"warmup\": " << warmup << "," << endl;
+        out << "  \"repetitions\": " << repetitions << "," << endl;
+        out << "  \"results\": [";
+
+        for (size_t i = 0; i < results.size(); i++) {
+            const benchmarkResult& result = results[i];
+            const sampleStatistics& s = result.stats;
+
+            out << ((i == 0) ? "" : ",") << endl;
+            out << "    {\"name\": \"" << result.name << "\", \"parameters\": ";
+            writeObject(out, result.parameters);
+            out << ", \"values\": ";
+            writeObject(out, result.values);
+            out << ", \"series\": {";
+
+            for (size_t j = 0; j < result.series.size(); j++) {
+                out << ((j == 0) ? "" : ", ") << "\"" << result.series[j].first << "\": ";
+                writeArray(out, result.series[j].second);
+            }
+
+            const vector<pair<string, double>> statistics = {
+                {"mean_ms", s.mean}, {"variance_ms2", s.variance}, {"stddev_ms", s.stddev},
+                {"median_ms", s.median}, {"min_ms", s.min}, {"max_ms", s.max}
+            };
+
+            out << "}, \"n\": " << s.n;
+
+            for (const auto& statistic : statistics) {
+                out << ", \"" << statistic.first << "\": ";
+                writeNumber(out, statistic.second);
+            }
+
+            out << ", \"samples_ms\": ";
+            writeArray(out, result.samplesMs);
+            out << "}";
+        }
+
+        out << endl << "  ]" << endl;
+        out << "}" << endl;
+    }
+
+
+    void saveBenchmarkJSON(const string& filename, const string& suite, const int warmup,
+                           const int repetitions, const vector<benchmarkResult>& results) {
+        ofstream file(filename);
+
+        if (!file) {
+            throw runtime_error("Can not write benchmark results: " + filename);
+        }
+
+        writeBenchmarkJSON(file, suite, warmup, repetitions, results);
+    }
+
+
+    /**
+     * Value of the JSON reader (objects keep the order of their members)
+     */
+    struct jsonValue {
+        enum kind {NUMBER, STRING, ARRAY, OBJECT, LITERAL};
+
+        kind type = LITERAL;
+        double number = 0;
+        string text;
+        vector<jsonValue> items;
+        vector<pair<string, jsonValue>> members;
+
+        const jsonValue* member(const string& key) const {
+            for (const auto& m : members) {
+                if (m.first == key) {
+                    return &m.second;
+                }
+            }
+
+            return nullptr;
+        }
+    };
+
+
+    /**
+     * Recursive descent parser of the JSON written by writeBenchmarkJSON
+     * (strings without escapes besides \" and \\)
+     */
+    static jsonValue parseJSON(const string& json, size_t& pos) {
+        while (pos < json.size() && isspace(json[pos])) {
+            pos++;
+        }
+
+        if (pos >= json.size()) {
+            throw runtime_error("Unexpected end of JSON");
+        }
+
+        jsonValue value;
+        const char c = json[pos];
+
+        if (c == '{' || c == '[') {
+            value.type = (c == '{') ? jsonValue::OBJECT : jsonValue::ARRAY;
+            const char close = (c == '{') ? '}' : ']';
+            pos++;
+
+            while (true) {
+                while (pos < json.size() && (isspace(json[pos]) || json[pos] == ',')) {
+                    pos++;
+                }
+
+                if (pos >= json.size()) {
+                    throw runtime_error("Unexpected end of JSON");
+                }
+
+                if (json[pos] == close) {
+                    pos++;
+                    break;
+                }
+
+                if (value.type == jsonValue::OBJECT) {
+                    const jsonValue key = parseJSON(json, pos);
+
+                    while (pos < json.size() && isspace(json[pos])) {
+                        pos++;
+                    }
+
+                    if (key.type != jsonValue::STRING || pos >= json.size() || json[pos] != ':') {
+                        throw runtime_error("Invalid JSON object at " + to_string(pos));
+                    }
+
+                    pos++;
+                    value.members.push_back({key.text, parseJSON(json, pos)});
+                } else {
+                    value.items.push_back(parseJSON(json, pos));
+                }
+            }
+        } else if (c == '"') {
+            value.type = jsonValue::STRING;
+            pos++;
+
+            while (pos < json.size() && json[pos] != '"') {
+                if (json[pos] == '\\' && pos + 1 < json.size()) {
+                    pos++;
+                }
+
+                value.text += json[pos++];
+            }
+
+            pos++;
+        } else if (c == '-' || isdigit(c)) {
+            value.type = jsonValue::NUMBER;
+            char* end;
+            value.number = strtod(json.c_str() + pos, &end);
+            pos = end - json.c_str();
+        } else {
+            // true, false, null
+            value.type = jsonValue::LITERAL;
+
+            while (pos < json.size() && isalpha(json[pos])) {
+                value.text += json[pos++];
+            }
+
+            // null stands for a NaN or infinite number (see writeNumber)
+            value.number = (value.text == "null") ? numeric_limits<double>::quiet_NaN()
+                                                  : (value.text == "true");
+
+            if (value.text.empty()) {
+                throw runtime_error("Invalid JSON at " + to_string(pos));
+            }
+        }
+
+        return value;
+    }
+
+
+    /**
+     * Numbers of a JSON object as key-value pairs
+     */
+    static vector<pair<string, double>> numberMembers(const jsonValue* object) {
+        vector<pair<string, double>> members;
+
+        if (object != nullptr) {
+            for (const auto& m : object->members) {
+                members.push_back({m.first, m.second.number});
+            }
+        }
+
+        return members;
+    }
+
+
+    static vector<double> numberItems(const jsonValue* array) {
+        vector<double> items;
+
+        if (array != nullptr) {
+            for (const auto& item : array->items) {
+                items.push_back(item.number);
+            }
+        }
+
+        return items;
+    }
+
+
+    benchmarkSuite loadBenchmarkJSON(const string& filename) {
+        ifstream file(filename);
+
+        if (!file) {
+            throw runtime_error("Can not read benchmark results: " + filename);
+        }
+
+        stringstream content;
+        content << file.rdbuf();
+        const string json = content.str();
+
+        size_t pos = 0;
+        const jsonValue root = parseJSON(json, pos);
+        const jsonValue* results = root.member("results");
+
+        if (root.type != jsonValue::OBJECT || results == nullptr) {
+            throw runtime_error("No benchmark results: " + filename);
+        }
+
+        benchmarkSuite suite;
+
+        if (root.member("suite") != nullptr) {
+            suite.suite = root.member("suite")->text;
+        }
+
+        if (root.member("warmup") != nullptr) {
+            suite.warmup = root.member("warmup")->number;
+        }
+
+        if (root.member("repetitions") != nullptr) {
+            suite.repetitions = root.member("repetitions")->number;
+        }
+
+        for (const jsonValue& item : results->items) {
+            benchmarkResult result;
+            result.name = (item.member("name") != nullptr) ? item.member("name")->text : "";
+            result.parameters = numberMembers(item.member("parameters"));
+            result.values = numberMembers(item.member("values"));
+            result.samplesMs = numberItems(item.member("samples_ms"));
+            result.stats = computeStatistics(result.samplesMs);
+
+            if (item.member("series") != nullptr) {
+                for (const auto& series : item.member("series")->members) {
+                    result.series.push_back({series.first, numberItems(&series.second)});
+                }
+            }
+
+            suite.results.push_back(result);
+        }
+
+        return suite;
+    }
+
+
+    vector<int> parseIntList(const string& list) {
+        vector<int> values;
+        stringstream stream(list);
+        string item;
+
+        while (getline(stream, item, ',')) {
+            size_t end = 0;
+            int value;
+
+            try {
+                value = stoi(item, &end);
+            } catch (const exception&) {
+                end = 0;
+            }
+
+            if (end == 0 || end != item.size()) {
+                throw runtime_error("Invalid number in list: " + list);
+            }
+
+            values.push_back(value);
+        }
+
+        if (values.empty()) {
+            throw runtime_error("Empty list");
+        }
+
+        return values;
+    }
+}
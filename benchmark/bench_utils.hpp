@@ -0,0 +1,140 @@
+/***********************************************************************
+ * Author:       Franziska Krüger
+ * Requirements: OpenCV 3
+ *
+ * Description:
+ * ------------
+ * Helpers of the benchmarks: timing with warmup and repetitions,
+ * sample statistics and the JSON output which is shared by all
+ * benchmark executables (so their outputs can be compared).
+ *
+ ************************************************************************
+*/
+
+#ifndef BENCH_UTILS_H
+#define BENCH_UTILS_H
+
+#include <string>
+#include <vector>
+#include <utility>                      // pair
+#include <functional>
+#include <iostream>
+
+
+namespace deblur {
+
+    /**
+     * Statistics of the samples of one benchmark
+     */
+    struct sampleStatistics {
+        int    n = 0;
+        double mean = 0;
+        double variance = 0;                // unbiased sample variance
+        double stddev = 0;
+        double median = 0;
+        double min = 0;
+        double max = 0;
+    };
+
+    /**
+     * Result of one benchmark with its parameters (e.g. size, psf width, threads)
+     */
+    struct benchmarkResult {
+        std::string name;
+        std::vector<std::pair<std::string, double>> parameters;
+        std::vector<double> samplesMs;     // wall time of each repetition
+        sampleStatistics stats;
+
+        /**
+         * additional values of the run (e.g. PSNR or peak RSS), written as they are
+         */
+        std::vector<std::pair<std::string, double>> values;
+
+        /**
+         * samples of parts of the run in milliseconds (e.g. the wall time of
+         * each step in each repetition), compared like the total wall time
+         */
+        std::vector<std::pair<std::string, std::vector<double>>> series;
+    };
+
+    /**
+     * Results of a benchmark executable as saved by saveBenchmarkJSON
+     */
+    struct benchmarkSuite {
+        std::string suite;
+        int warmup = 0;
+        int repetitions = 0;
+        std::vector<benchmarkResult> results;
+    };
+
+    /**
+     * Result of Welch's t-test of the means of two samples
+     */
+    struct welchTest {
+        double t = 0;
+        double df = 0;                      // Welch-Satterthwaite degrees of freedom
+        double p = 1;                       // two-sided p-value (-1: too few samples)
+    };
+
+    /**
+     * Mean, variance, median and range of the samples
+     */
+    sampleStatistics computeStatistics(const std::vector<double>& samples);
+
+    /**
+     * Welch's t-test whether two samples have the same mean (without assuming
+     * equal variances). Both samples need at least two values, otherwise the
+     * p-value is -1. Samples without variance are different if their means are.
+     */
+    welchTest welchTTest(const sampleStatistics& a, const sampleStatistics& b);
+
+    /**
+     * Runs a function warmup + repetitions times and returns the wall times
+     * of the repetitions in milliseconds. With more than one thread each
+     * repetition starts the function concurrently in all threads (the argument
+     * is the index of the thread) and takes until the last one finished.
+     *
+     * @param run         benchmarked function
+     * @param warmup      runs which aren't measured
+     * @param repetitions measured runs
+     * @param threads     concurrent calls of each run
+     * @return            wall time of each repetition
+     */
+    std::vector<double> timeRepeated(const std::function<void(int)>& run, const int warmup,
+                                     const int repetitions, const int threads = 1);
+
+    /**
+     * Writes the results of a benchmark suite as JSON:
+     * {"suite": ..., "warmup": ..., "repetitions": ..., "results": [...]}
+     *
+     * Each result is {"name": ..., "parameters": {...}, "values": {...},
+     * "series": {...}, "n": ..., "mean_ms": ..., ..., "samples_ms": [...]}.
+     *
+     * @param out         output stream
+     * @param suite       name of the benchmark executable
+     * @param warmup      runs which weren't measured
+     * @param repetitions measured runs
+     * @param results     benchmarks
+     */
+    void writeBenchmarkJSON(std::ostream& out, const std::string& suite, const int warmup,
+                            const int repetitions, const std::vector<benchmarkResult>& results);
+
+    /**
+     * Saves the results of a benchmark suite as JSON file (see writeBenchmarkJSON)
+     */
+    void saveBenchmarkJSON(const std::string& filename, const std::string& suite, const int warmup,
+                           const int repetitions, const std::vector<benchmarkResult>& results);
+
+    /**
+     * Loads the results of a benchmark suite saved by saveBenchmarkJSON.
+     * The statistics are computed again from the samples.
+     */
+    benchmarkSuite loadBenchmarkJSON(const std::string& filename);
+
+    /**
+     * Parses a comma separated list of numbers (e.g. "256,512,1024")
+     */
+    std::vector<int> parseIntList(const std::string& list);
+}
+
+#endif
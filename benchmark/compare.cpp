@@ -0,0 +1,343 @@
+/***********************************************************************
+ * Author:       Franziska Krüger
+ * Using:        argtable3 - http://www.argtable.org/
+ *
+ * Description:
+ * ------------
+ * Compares the results of two runs of a benchmark (e.g. deblur-bench or
+ * deblur-e2e before and after an upgrade). Benchmarks with the same name
+ * and parameters are matched. The wall times and the times of the steps
+ * are compared with Welch's t-test, so a change counts only if it is
+ * larger than the threshold and larger than the run-to-run variance.
+ *
+ * The exit code is 2 if there is a regression, so the tool can gate
+ * an upgrade in a script.
+ *
+ ************************************************************************
+*/
+
+#include <iostream>                     // cout, cerr, endl
+#include <iomanip>                      // setw, setprecision
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>                    // sort
+#include <cmath>                        // fabs
+#include <stdexcept>
+
+#include "argtable3.h"                  // cross platform command line parsing
+#include "bench_utils.hpp"
+
+using namespace std;
+using namespace deblur;
+
+// global structs for command line parsing
+struct arg_lit *help, *changes_only;
+struct arg_dbl *threshold, *stage_threshold, *alpha;
+struct arg_file *baseline_file, *current_file;
+struct arg_end *end_args;
+
+
+/**
+ * Parameters of the comparison
+ */
+struct compareOptions {
+    string baseline;
+    string current;
+    double threshold = 5;           // relative change of the wall time in percent
+    double stageThreshold = 10;     // relative change of a step in percent (steps are noisier)
+    double alpha = 0.05;            // significance level of the t-test
+    bool changesOnly = false;       // print only changed benchmarks
+};
+
+
+/**
+ * Outcome of a comparison
+ */
+enum verdict {SAME, NOISE, UNVERIFIED, REGRESSION, IMPROVEMENT};
+
+
+/**
+ * Comparison of one benchmark or step
+ */
+struct comparison {
+    string label;
+    sampleStatistics baseline;
+    sampleStatistics current;
+    double change = 0;              // relative change of the mean
+    welchTest test;
+    verdict result = SAME;
+};
+
+
+/**
+ * Saves the user input in the options.
+ * On error while parsing or used help option this function returns false.
+ */
+static bool parse_commandline_args(int argc, char** argv, compareOptions& options, int& exitcode) {
+    // command line options
+    // the global arg_xxx structs are initialized within the argtable
+    void *argtable[] = {
+        help            = arg_litn("h", "help",                        0, 1, "display this help and exit"),
+        threshold       = arg_dbln("t", "threshold", "<percent>",      0, 1, "smallest relevant change of a benchmark. Default: 5"),
+        stage_threshold = arg_dbln(nullptr, "stage-threshold", "<percent>", 0, 1, "smallest relevant change of a step. Default: 10"),
+        alpha           = arg_dbln("a", "alpha", "<x>",                0, 1, "significance level of Welch's t-test. Default: 0.05"),
+        changes_only    = arg_litn("c", "changes-only",                0, 1, "print only regressions and improvements (and the steps of changed benchmarks)"),
+        baseline_file   = arg_filen(nullptr, nullptr, "<baseline>",    1, 1, "results of the baseline (JSON)"),
+        current_file    = arg_filen(nullptr, nullptr, "<current>",     1, 1, "results of the compared version (JSON)"),
+        end_args        = arg_end(20),
+    };
+
+    // default values (they weren't set if there is a value given)
+    threshold->dval[0] = options.threshold;
+    stage_threshold->dval[0] = options.stageThreshold;
+    alpha->dval[0] = options.alpha;
+
+    // parsing arguments
+    int nerrors = arg_parse(argc,argv,argtable);
+
+    // special case: '--help' takes precedence over error reporting
+    if (help->count > 0)
+    {
+        cout << "Usage: " << argv[0];
+        arg_print_syntax(stdout, argtable, "\n");
+        cout << "Compares the wall times and step times of two benchmark results with Welch's t-test." << endl;
+        cout << "Exit code 2 if a benchmark or step got significantly slower." << endl << endl;
+        arg_print_glossary(stdout, argtable, "  %-25s %s\n");
+
+        // deallocate each non-null entry in argtable[]
+        arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+        exitcode = 0;
+        return false;
+    }
+
+    // If the parser returned any errors then display them and exit
+    if (nerrors > 0)
+    {
+        arg_print_errors(stdout, end_args, argv[0]);
+        cout << "Try '" << argv[0] << "--help' for more information." << endl;
+
+        // deallocate each non-null entry in argtable[]
+        arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+        exitcode = 1;
+        return false;
+    }
+
+    if (threshold->dval[0] < 0 || stage_threshold->dval[0] < 0 || alpha->dval[0] <= 0 || alpha->dval[0] >= 1) {
+        cout << "The thresholds have to be positive and alpha within (0, 1)" << endl;
+
+        arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+        exitcode = 1;
+        return false;
+    }
+
+    // saving arguments in variables
+    options.baseline = baseline_file->filename[0];
+    options.current = current_file->filename[0];
+    options.threshold = threshold->dval[0];
+    options.stageThreshold = stage_threshold->dval[0];
+    options.alpha = alpha->dval[0];
+    options.changesOnly = (changes_only->count > 0);
+
+    // deallocate each non-null entry in argtable[]
+    arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+
+    return true;
+}
+
+
+/**
+ * Name and parameters of a benchmark (e.g. "conv2 psf_width=35 size=512 threads=1")
+ */
+static string benchmarkKey(const benchmarkResult& result) {
+    vector<pair<string, double>> parameters(result.parameters);
+    sort(parameters.begin(), parameters.end());
+
+    ostringstream key;
+    key << result.name;
+
+    for (const auto& parameter : parameters) {
+        key << " " << parameter.first << "=" << parameter.second;
+    }
+
+    return key.str();
+}
+
+
+/**
+ * Compares two samples: a change counts if it is beyond the threshold and
+ * significant. Without a test (fewer than 2 samples) it is unverified.
+ */
+static comparison compareSamples(const string& label, const vector<double>& baseline,
+                                 const vector<double>& current, const double threshold,
+                                 const double alpha) {
+    comparison c;
+    c.label = label;
+    c.baseline = computeStatistics(baseline);
+    c.current = computeStatistics(current);
+    c.change = (c.baseline.mean > 0) ? (c.current.mean - c.baseline.mean) / c.baseline.mean : 0;
+    c.test = welchTTest(c.baseline, c.current);
+
+    if (fabs(c.change) * 100 <= threshold) {
+        c.result = SAME;
+    } else if (c.test.p < 0) {
+        c.result = UNVERIFIED;
+    } else if (c.test.p >= alpha) {
+        c.result = NOISE;
+    } else {
+        c.result = (c.change > 0) ? REGRESSION : IMPROVEMENT;
+    }
+
+    return c;
+}
+
+
+static string verdictName(const comparison& c) {
+    switch (c.result) {
+        case SAME:          return "same";
+        case NOISE:         return "noise";
+        case UNVERIFIED:    return (c.change > 0) ? "slower?" : "faster?";
+        case REGRESSION:    return "REGRESSION";
+        case IMPROVEMENT:   return "improvement";
+    }
+
+    return "";
+}
+
+
+int main(int argc, char** argv) {
+    compareOptions options;
+
+    // parse command line arguments
+    int exitcode = 0;
+    bool success = parse_commandline_args(argc, argv, options, exitcode);
+
+    if (success == false) {
+        return exitcode;
+    }
+
+    int regressions = 0;
+
+    try {
+        const benchmarkSuite baseline = loadBenchmarkJSON(options.baseline);
+        const benchmarkSuite current = loadBenchmarkJSON(options.current);
+
+        if (baseline.suite != current.suite) {
+            cout << "Warning: comparing " << baseline.suite << " with " << current.suite << endl;
+        }
+
+        map<string, const benchmarkResult*> baselineResults;
+
+        for (const auto& result : baseline.results) {
+            baselineResults[benchmarkKey(result)] = &result;
+        }
+
+        vector<comparison> comparisons;
+        vector<string> added;
+        map<string, bool> matched;
+
+        for (const auto& result : current.results) {
+            const string key = benchmarkKey(result);
+            auto base = baselineResults.find(key);
+
+            if (base == baselineResults.end()) {
+                added.push_back(key);
+                continue;
+            }
+
+            matched[key] = true;
+
+            // the wall time and each step contained in both results
+            comparisons.push_back(compareSamples(key, base->second->samplesMs, result.samplesMs,
+                                                 options.threshold, options.alpha));
+
+            for (const auto& series : result.series) {
+                for (const auto& baseSeries : base->second->series) {
+                    if (baseSeries.first == series.first) {
+                        comparisons.push_back(compareSamples("  " + series.first, baseSeries.second,
+                                                             series.second, options.stageThreshold,
+                                                             options.alpha));
+                    }
+                }
+            }
+        }
+
+        // summary table
+        cout << "Baseline " << options.baseline << " (" << baseline.repetitions << " repetitions), current "
+             << options.current << " (" << current.repetitions << " repetitions)" << endl;
+        cout << "Thresholds " << options.threshold << "% (steps " << options.stageThreshold
+             << "%), Welch's t-test with alpha " << options.alpha << endl << endl;
+
+        size_t width = 10;
+
+        for (const auto& c : comparisons) {
+            width = max(width, c.label.size() + 2);
+        }
+
+        cout << left << setw(width) << "benchmark" << setw(22) << "baseline [ms]" << setw(22) << "current [ms]"
+             << setw(10) << "change" << setw(10) << "p" << "verdict" << endl;
+
+        map<verdict, int> counts;
+        bool changedBenchmark = false;
+
+        for (const auto& c : comparisons) {
+            const bool step = (c.label.compare(0, 2, "  ") == 0);
+
+            // a benchmark counts once, its steps are additional hints
+            if (!step) {
+                counts[c.result]++;
+                changedBenchmark = (c.result != SAME);
+            }
+
+            if (c.result == REGRESSION) {
+                regressions++;
+            }
+
+            if (options.changesOnly && c.result != REGRESSION && c.result != IMPROVEMENT
+                && !(step && changedBenchmark)) {
+                continue;
+            }
+
+            ostringstream baselineText, currentText, changeText, pText;
+            baselineText << fixed << setprecision(2) << c.baseline.mean << " +- " << c.baseline.stddev;
+            currentText << fixed << setprecision(2) << c.current.mean << " +- " << c.current.stddev;
+            changeText << showpos << fixed << setprecision(1) << 100 * c.change << "%";
+
+            if (c.test.p >= 0) {
+                pText << setprecision(3) << c.test.p;
+            } else {
+                pText << "-";
+            }
+
+            cout << left << setw(width) << c.label << setw(22) << baselineText.str() << setw(22) << currentText.str()
+                 << setw(10) << changeText.str() << setw(10) << pText.str() << verdictName(c) << endl;
+        }
+
+        // benchmarks which are only in one of the results
+        for (const auto& result : baseline.results) {
+            if (matched.count(benchmarkKey(result)) == 0) {
+                cout << left << setw(width) << benchmarkKey(result) << "only in the baseline" << endl;
+            }
+        }
+
+        for (const string& key : added) {
+            cout << left << setw(width) << key << "only in the current results" << endl;
+        }
+
+        cout << endl << counts[REGRESSION] << " regressions, " << counts[IMPROVEMENT] << " improvements, "
+             << counts[SAME] << " unchanged, " << counts[NOISE] << " within the noise, "
+             << counts[UNVERIFIED] << " unverified (fewer than 2 samples), "
+             << baseline.results.size() - matched.size() << " removed, " << added.size() << " new" << endl;
+
+        if (regressions > 0) {
+            cout << regressions << " significant regressions (benchmarks and steps)" << endl;
+        }
+    }
+    catch(const exception& e) {
+        cerr << "ERROR: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return (regressions > 0) ? 2 : 0;
+}
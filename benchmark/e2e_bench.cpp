@@ -0,0 +1,681 @@
+/***********************************************************************
+ * Author:       Franziska Krüger
+ * Using:        argtable3 - http://www.argtable.org/
+ *
+ * Description:
+ * ------------
+ * End-to-end benchmark of runDepthDeblur over the stereo pairs of a dataset
+ * manifest and a grid of settings (layers, PSF width, FFT/IRLS, threads
+ * and passes). Each run records the wall time of the steps, the peak
+ * resident set size and the PSNR/SSIM against the sharp views if they are
+ * known (e.g. pairs of deblur-synth). The settings are ranked in a Pareto
+ * table of quality versus time.
+ *
+ * Every run is done in a child process, so the peak RSS belongs to this
+ * run alone and a crash doesn't stop the benchmark.
+ *
+ ************************************************************************
+*/
+
+#include <iostream>                     // cout, cerr, endl
+#include <iomanip>                      // setw, setprecision
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>                    // sort
+#include <stdexcept>
+#include <unistd.h>                     // fork, pipe
+#include <sys/wait.h>                   // waitpid
+
+#include <opencv2/highgui/highgui.hpp>  // imread
+#include <opencv2/imgproc/imgproc.hpp>  // cvtColor
+
+#include "argtable3.h"                  // cross platform command line parsing
+#include "depth_aware_deblurring.hpp"
+#include "utils.hpp"                    // structuralSimilarity
+#include "bench_utils.hpp"
+
+using namespace std;
+using namespace deblur;
+
+// global structs for command line parsing
+struct arg_lit *help, *no_fork, *color_result;
+struct arg_str *grid_layers, *grid_psf_widths, *grid_deconv, *grid_threads, *grid_passes, *quality_metric;
+struct arg_int *repetitions, *warmup, *max_disparity;
+struct arg_file *manifest_file, *output_file;
+struct arg_end *end_args;
+
+
+/**
+ * A stereo pair of the dataset with optional ground truth
+ */
+struct datasetEntry {
+    string name;
+    string left;
+    string right;
+    string sharpLeft;           // empty: no ground truth
+    string sharpRight;
+    string kernels = ".";       // directory of the top-level kernels
+};
+
+
+/**
+ * One point of the settings grid
+ */
+struct benchConfig {
+    int layers;
+    int psfWidth;
+    DepthDeblur::deconvAlgo deconvAlgo;
+    int threads;
+    int passes;
+
+    string label() const {
+        return "l" + to_string(layers) + "-w" + to_string(psfWidth)
+               + ((deconvAlgo == DepthDeblur::FFT) ? "-fft" : "-irls")
+               + "-t" + to_string(threads) + "-p" + to_string(passes);
+    }
+};
+
+
+/**
+ * Measurements of one run
+ */
+struct runResult {
+    double totalMs = 0;
+    long peakRssKb = 0;
+    double psnr = -1;           // -1: no ground truth
+    double ssim = -1;
+    vector<pair<string, double>> stageMs;
+};
+
+
+/**
+ * Parameters of the benchmark
+ */
+struct e2eOptions {
+    string manifest;
+    vector<int> layers = {12};
+    vector<int> psfWidths = {35};
+    vector<DepthDeblur::deconvAlgo> deconvAlgos = {DepthDeblur::IRLS};
+    vector<int> threads = {1};
+    vector<int> passes = {1};
+    int maxDisparity = 160;
+    bool color = false;
+    int repetitions = 1;
+    int warmup = 0;
+    bool fork = true;
+    bool ssim = false;          // rank the Pareto table by SSIM instead of PSNR
+    string output = "e2e.json";
+};
+
+
+/**
+ * Saves the user input in the options.
+ * On error while parsing or used help option this function returns false.
+ */
+static bool parse_commandline_args(int argc, char** argv, e2eOptions& options, int& exitcode) {
+    // command line options
+    // the global arg_xxx structs are initialized within the argtable
+    void *argtable[] = {
+        help            = arg_litn("h", "help",                        0, 1, "display this help and exit"),
+        grid_layers     = arg_strn("l", "layers", "<n,n,...>",         0, 1, "region/disparity layers. Default: 12"),
+        grid_psf_widths = arg_strn("w", "psf-widths", "<n,n,...>",     0, 1, "approximate PSF widths. Default: 35"),
+        grid_deconv     = arg_strn(nullptr, "deconv", "<fft,irls>",    0, 1, "deconvolution algorithms of the PSF selection. Default: irls"),
+        grid_threads    = arg_strn("t", "threads", "<n,n,...>",        0, 1, "thread counts. Default: 1"),
+        grid_passes     = arg_strn(nullptr, "passes", "<n,n,...>",     0, 1, "passes of the algorithm (1 or 2). Default: 1"),
+        max_disparity   = arg_intn("d", "max-disparity", "<n>",        0, 1, "estimated maximum disparity. Default: 160"),
+        color_result    = arg_litn(nullptr, "color",                   0, 1, "color results (quality against the color sharp views)"),
+        repetitions     = arg_intn("r", "repetitions", "<n>",          0, 1, "measured runs of each setting and pair. Default: 1"),
+        warmup          = arg_intn(nullptr, "warmup", "<n>",           0, 1, "runs before the measurement. Default: 0"),
+        quality_metric  = arg_strn(nullptr, "quality", "<psnr|ssim>",  0, 1, "quality of the Pareto table. Default: psnr"),
+        no_fork         = arg_litn(nullptr, "no-fork",                 0, 1, "run in this process (the peak RSS is the one of all runs)"),
+        output_file     = arg_filen("o", "output", "<file>",           0, 1, "results (JSON). Default: e2e.json"),
+        manifest_file   = arg_filen(nullptr, nullptr, "<manifest>",    1, 1, "dataset manifest"),
+        end_args        = arg_end(20),
+    };
+
+    // default values (they weren't set if there is a value given)
+    max_disparity->ival[0] = options.maxDisparity;
+    repetitions->ival[0] = options.repetitions;
+    warmup->ival[0] = options.warmup;
+    output_file->filename[0] = "e2e.json";
+
+    // parsing arguments
+    int nerrors = arg_parse(argc,argv,argtable);
+
+    // special case: '--help' takes precedence over error reporting
+    if (help->count > 0)
+    {
+        cout << "Usage: " << argv[0];
+        arg_print_syntax(stdout, argtable, "\n");
+        cout << "End-to-end benchmark of the depth-aware deblurring with a Pareto table of quality versus time." << endl;
+        cout << "Each line of the manifest is a pair: name=<n> left=<file> right=<file> [sharp-left=<file>" << endl;
+        cout << "sharp-right=<file>] [kernels=<dir>] or synthetic=<dir> for a directory of deblur-synth." << endl << endl;
+        arg_print_glossary(stdout, argtable, "  %-25s %s\n");
+
+        // deallocate each non-null entry in argtable[]
+        arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+        exitcode = 0;
+        return false;
+    }
+
+    // If the parser returned any errors then display them and exit
+    if (nerrors > 0)
+    {
+        arg_print_errors(stdout, end_args, argv[0]);
+        cout << "Try '" << argv[0] << "--help' for more information." << endl;
+
+        // deallocate each non-null entry in argtable[]
+        arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+        exitcode = 1;
+        return false;
+    }
+
+    // saving arguments in variables
+    try {
+        if (grid_layers->count > 0) {
+            options.layers = parseIntList(grid_layers->sval[0]);
+        }
+
+        if (grid_psf_widths->count > 0) {
+            options.psfWidths = parseIntList(grid_psf_widths->sval[0]);
+        }
+
+        if (grid_threads->count > 0) {
+            options.threads = parseIntList(grid_threads->sval[0]);
+        }
+
+        if (grid_passes->count > 0) {
+            options.passes = parseIntList(grid_passes->sval[0]);
+        }
+
+        if (grid_deconv->count > 0) {
+            options.deconvAlgos.clear();
+            stringstream list(grid_deconv->sval[0]);
+            string algo;
+
+            while (getline(list, algo, ',')) {
+                if (algo == "fft") {
+                    options.deconvAlgos.push_back(DepthDeblur::FFT);
+                } else if (algo == "irls") {
+                    options.deconvAlgos.push_back(DepthDeblur::IRLS);
+                } else {
+                    throw runtime_error("Unknown deconvolution algorithm: " + algo);
+                }
+            }
+        }
+
+        if (quality_metric->count > 0) {
+            const string metric = quality_metric->sval[0];
+
+            if (metric != "psnr" && metric != "ssim") {
+                throw runtime_error("Unknown quality metric: " + metric);
+            }
+
+            options.ssim = (metric == "ssim");
+        }
+    } catch (const exception& e) {
+        cout << e.what() << endl;
+
+        arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+        exitcode = 1;
+        return false;
+    }
+
+    options.manifest = manifest_file->filename[0];
+    options.maxDisparity = max_disparity->ival[0];
+    options.color = (color_result->count > 0);
+    options.repetitions = repetitions->ival[0];
+    options.warmup = warmup->ival[0];
+    options.fork = (no_fork->count == 0);
+    options.output = output_file->filename[0];
+
+    // deallocate each non-null entry in argtable[]
+    arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+
+    return true;
+}
+
+
+/**
+ * Reads the pairs of a manifest (one line of key=value pairs per pair,
+ * empty lines and lines starting with # are skipped).
+ */
+static vector<datasetEntry> loadManifest(const string& filename) {
+    ifstream file(filename);
+
+    if (!file) {
+        throw runtime_error("Can not read manifest: " + filename);
+    }
+
+    vector<datasetEntry> entries;
+    string line;
+    int number = 0;
+
+    while (getline(file, line)) {
+        number++;
+
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        datasetEntry entry;
+        entry.name = "pair-" + to_string(number);
+
+        istringstream tokens(line);
+        string token;
+
+        while (tokens >> token) {
+            size_t separator = token.find('=');
+
+            if (separator == string::npos) {
+                throw runtime_error("Invalid manifest token in line " + to_string(number) + ": " + token);
+            }
+
+            string key = token.substr(0, separator);
+            string value = token.substr(separator + 1);
+
+            if (key == "name") {
+                entry.name = value;
+            } else if (key == "left") {
+                entry.left = value;
+            } else if (key == "right") {
+                entry.right = value;
+            } else if (key == "sharp-left") {
+                entry.sharpLeft = value;
+            } else if (key == "sharp-right") {
+                entry.sharpRight = value;
+            } else if (key == "kernels") {
+                entry.kernels = value;
+            } else if (key == "synthetic") {
+                // output directory of deblur-synth
+                entry.left = value + "/left.png";
+                entry.right = value + "/right.png";
+                entry.sharpLeft = value + "/sharp-left.png";
+                entry.sharpRight = value + "/sharp-right.png";
+                entry.kernels = value;
+            } else {
+                throw runtime_error("Unknown manifest option in line " + to_string(number) + ": " + key);
+            }
+        }
+
+        if (entry.left.empty() || entry.right.empty()) {
+            throw runtime_error("Manifest line " + to_string(number) + " needs left and right!");
+        }
+
+        entries.push_back(entry);
+    }
+
+    return entries;
+}
+
+
+/**
+ * PSNR and SSIM of a result against the sharp view (converted to gray for gray results)
+ */
+static void addQuality(const cv::Mat& result, const string& sharpFile, double& psnr, double& ssim) {
+    cv::Mat sharp = cv::imread(sharpFile, (result.channels() == 1) ? CV_LOAD_IMAGE_GRAYSCALE : 1);
+
+    if (!sharp.data || sharp.size() != result.size()) {
+        throw runtime_error("Can not compare with the sharp view: " + sharpFile);
+    }
+
+    psnr += cv::PSNR(result, sharp);
+    ssim += structuralSimilarity(result, sharp);
+}
+
+
+/**
+ * Runs the algorithm once and measures it
+ */
+static runResult runOnce(const datasetEntry& entry, const benchConfig& config, const e2eOptions& e2e) {
+    cv::Mat left = cv::imread(entry.left, 1);
+    cv::Mat right = cv::imread(entry.right, 1);
+
+    if (!left.data || !right.data) {
+        throw runtime_error("Can not load images of " + entry.name);
+    }
+
+    deblurOptions options;
+    options.threads = config.threads;
+    options.psfWidth = config.psfWidth;
+    options.layers = config.layers;
+    options.deconvAlgo = config.deconvAlgo;
+    options.passes = config.passes;
+    options.maxDisparity = e2e.maxDisparity;
+    options.color = e2e.color;
+    options.colorMode = DepthDeblur::LUMINANCE;     // like --color of motion-deblurring
+    options.toplevelKernels = loadToplevelKernels(entry.kernels);
+
+    cv::Mat deblurredLeft, deblurredRight;
+    RunMetrics metrics = runDepthDeblur(left, right, deblurredLeft, deblurredRight, options);
+
+    runResult result;
+    result.totalMs = metrics.totalWallMs;
+    result.peakRssKb = metrics.peakRssKb;
+
+    for (const auto& stage : metrics.stages) {
+        result.stageMs.push_back({stage.stage, stage.wallMs});
+    }
+
+    // mean quality of both views
+    if (!entry.sharpLeft.empty() && !entry.sharpRight.empty()) {
+        result.psnr = 0;
+        result.ssim = 0;
+        addQuality(deblurredLeft, entry.sharpLeft, result.psnr, result.ssim);
+        addQuality(deblurredRight, entry.sharpRight, result.psnr, result.ssim);
+        result.psnr /= 2;
+        result.ssim /= 2;
+    }
+
+    return result;
+}
+
+
+/**
+ * Serializes a result for the pipe between the child and the benchmark
+ */
+static string serializeResult(const runResult& result) {
+    ostringstream out;
+    out << setprecision(10);
+    out << "total " << result.totalMs << endl;
+    out << "rss " << result.peakRssKb << endl;
+    out << "psnr " << result.psnr << endl;
+    out << "ssim " << result.ssim << endl;
+
+    for (const auto& stage : result.stageMs) {
+        out << "stage " << stage.first << " " << stage.second << endl;
+    }
+
+    return out.str();
+}
+
+
+static runResult parseResult(const string& text) {
+    runResult result;
+    istringstream in(text);
+    string key;
+
+    while (in >> key) {
+        if (key == "total") {
+            in >> result.totalMs;
+        } else if (key == "rss") {
+            in >> result.peakRssKb;
+        } else if (key == "psnr") {
+            in >> result.psnr;
+        } else if (key == "ssim") {
+            in >> result.ssim;
+        } else if (key == "stage") {
+            pair<string, double> stage;
+            in >> stage.first >> stage.second;
+            result.stageMs.push_back(stage);
+        } else if (key == "error") {
+            string message;
+            getline(in, message);
+            throw runtime_error(message);
+        }
+    }
+
+    return result;
+}
+
+
+/**
+ * Runs the algorithm in a child process (own peak RSS) or in this process
+ */
+static runResult runIsolated(const datasetEntry& entry, const benchConfig& config, const e2eOptions& e2e) {
+    if (!e2e.fork) {
+        return runOnce(entry, config, e2e);
+    }
+
+    int fds[2];
+
+    if (pipe(fds) != 0) {
+        throw runtime_error("Can not create pipe");
+    }
+
+    pid_t pid = fork();
+
+    if (pid < 0) {
+        throw runtime_error("Can not fork");
+    }
+
+    if (pid == 0) {
+        close(fds[0]);
+        string reply;
+        int status = 0;
+
+        try {
+            reply = serializeResult(runOnce(entry, config, e2e));
+        } catch (const exception& e) {
+            reply = string("error ") + e.what() + "\n";
+            status = 1;
+        }
+
+        size_t written = 0;
+
+        while (written < reply.size()) {
+            ssize_t n = write(fds[1], reply.data() + written, reply.size() - written);
+
+            if (n <= 0) {
+                break;
+            }
+
+            written += n;
+        }
+
+        close(fds[1]);
+        _exit(status);
+    }
+
+    close(fds[1]);
+
+    string reply;
+    char buffer[4096];
+    ssize_t n;
+
+    while ((n = read(fds[0], buffer, sizeof(buffer))) > 0) {
+        reply.append(buffer, n);
+    }
+
+    close(fds[0]);
+
+    int status;
+    waitpid(pid, &status, 0);
+
+    if (reply.empty()) {
+        throw runtime_error("Run of " + entry.name + " with " + config.label() + " crashed");
+    }
+
+    return parseResult(reply);
+}
+
+
+/**
+ * Mean time and quality of a setting over all pairs
+ */
+struct configSummary {
+    int id;                     // index in the grid
+    benchConfig config;
+    double meanMs = 0;
+    double psnr = -1;
+    double ssim = -1;
+    long peakRssKb = 0;
+    bool pareto = false;
+
+    double quality(const bool useSSIM) const {
+        return useSSIM ? ssim : psnr;
+    }
+};
+
+
+/**
+ * Marks the settings which aren't dominated by a faster setting with at least
+ * the same quality (settings without ground truth are never on the front).
+ */
+static void markParetoFront(vector<configSummary>& summaries, const bool useSSIM) {
+    sort(summaries.begin(), summaries.end(), [useSSIM](const configSummary& a, const configSummary& b) {
+        return (a.meanMs != b.meanMs) ? a.meanMs < b.meanMs : a.quality(useSSIM) > b.quality(useSSIM);
+    });
+
+    double best = -1;
+
+    for (auto& summary : summaries) {
+        if (summary.quality(useSSIM) > best) {
+            summary.pareto = true;
+            best = summary.quality(useSSIM);
+        }
+    }
+}
+
+
+int main(int argc, char** argv) {
+    e2eOptions options;
+
+    // parse command line arguments
+    int exitcode = 0;
+    bool success = parse_commandline_args(argc, argv, options, exitcode);
+
+    if (success == false) {
+        return exitcode;
+    }
+
+    try {
+        const vector<datasetEntry> dataset = loadManifest(options.manifest);
+
+        vector<benchConfig> grid;
+
+        for (const int layers : options.layers) {
+            for (const int psfWidth : options.psfWidths) {
+                for (const auto algo : options.deconvAlgos) {
+                    for (const int threads : options.threads) {
+                        for (const int passes : options.passes) {
+                            grid.push_back({layers, psfWidth, algo, threads, passes});
+                        }
+                    }
+                }
+            }
+        }
+
+        cout << "End-to-end benchmark of " << dataset.size() << " pairs and " << grid.size() << " settings ("
+             << options.repetitions << " repetitions, " << options.warmup << " warmup runs)" << endl << endl;
+
+        vector<benchmarkResult> results;
+        vector<int> resultConfigs;      // setting of each result
+        vector<configSummary> summaries;
+
+        for (int id = 0; id < grid.size(); id++) {
+            const benchConfig& config = grid[id];
+
+            configSummary summary;
+            summary.id = id;
+            summary.config = config;
+
+            double psnr = 0, ssim = 0;
+            int withTruth = 0;
+
+            for (const datasetEntry& entry : dataset) {
+                cout << "== " << entry.name << " " << config.label() << endl;
+
+                for (int i = 0; i < options.warmup; i++) {
+                    runIsolated(entry, config, options);
+                }
+
+                benchmarkResult result;
+                result.name = entry.name;
+                result.parameters = {{"layers", config.layers}, {"psf_width", config.psfWidth},
+                                     {"irls", config.deconvAlgo == DepthDeblur::IRLS},
+                                     {"threads", config.threads}, {"passes", config.passes}};
+
+                map<string, double> stageMs;
+                map<string, vector<double>> stageSamples;
+                long peakRssKb = 0;
+                runResult run;
+
+                for (int i = 0; i < options.repetitions; i++) {
+                    run = runIsolated(entry, config, options);
+                    result.samplesMs.push_back(run.totalMs);
+                    peakRssKb = max(peakRssKb, run.peakRssKb);
+
+                    for (const auto& stage : run.stageMs) {
+                        stageMs[stage.first] += stage.second / options.repetitions;
+                        stageSamples[stage.first].push_back(stage.second);
+                    }
+                }
+
+                result.stats = computeStatistics(result.samplesMs);
+                result.values.push_back({"peak_rss_kb", double(peakRssKb)});
+
+                // the quality doesn't change between the repetitions
+                if (run.psnr >= 0) {
+                    result.values.push_back({"psnr", run.psnr});
+                    result.values.push_back({"ssim", run.ssim});
+                    psnr += run.psnr;
+                    ssim += run.ssim;
+                    withTruth++;
+                }
+
+                for (const auto& stage : stageMs) {
+                    result.values.push_back({"stage_" + stage.first + "_ms", stage.second});
+                }
+
+                // the steps of all repetitions for deblur-compare
+                for (const auto& stage : stageSamples) {
+                    result.series.push_back({"stage_" + stage.first, stage.second});
+                }
+
+                results.push_back(result);
+                resultConfigs.push_back(id);
+
+                summary.meanMs += result.stats.mean / dataset.size();
+                summary.peakRssKb = max(summary.peakRssKb, peakRssKb);
+            }
+
+            if (withTruth > 0) {
+                summary.psnr = psnr / withTruth;
+                summary.ssim = ssim / withTruth;
+            }
+
+            summaries.push_back(summary);
+        }
+
+        markParetoFront(summaries, options.ssim);
+
+        // the Pareto flag of the setting for each of its results
+        vector<bool> pareto(grid.size());
+
+        for (const auto& summary : summaries) {
+            pareto[summary.id] = summary.pareto;
+        }
+
+        for (int i = 0; i < results.size(); i++) {
+            results[i].values.push_back({"pareto", double(pareto[resultConfigs[i]])});
+        }
+
+        saveBenchmarkJSON(options.output, "deblur-e2e", options.warmup, options.repetitions, results);
+
+        // Pareto table: settings sorted by time, * marks the front
+        cout << endl << "Quality versus time (mean over all pairs, * Pareto-optimal by "
+             << (options.ssim ? "SSIM" : "PSNR") << ")" << endl;
+        cout << left << setw(3) << "" << setw(24) << "setting" << setw(12) << "time [ms]"
+             << setw(10) << "PSNR" << setw(9) << "SSIM" << "peak RSS [MB]" << endl;
+
+        for (const auto& summary : summaries) {
+            cout << left << setw(3) << (summary.pareto ? "*" : "") << setw(24) << summary.config.label()
+                 << setw(12) << fixed << setprecision(1) << summary.meanMs
+                 << setw(10) << setprecision(2) << summary.psnr
+                 << setw(9) << setprecision(4) << summary.ssim
+                 << summary.peakRssKb / 1024 << endl;
+        }
+
+        cout << endl << "Results saved to " << options.output << endl;
+    }
+    catch(const exception& e) {
+        cerr << "ERROR: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return 0;
+}
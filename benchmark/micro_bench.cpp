@@ -0,0 +1,347 @@
+/***********************************************************************
+ * Author:       Franziska Krüger
+ * Using:        argtable3 - http://www.argtable.org/
+ *
+ * Description:
+ * ------------
+ * Micro-benchmarks of the hot primitives of the depth-aware deblurring
+ * (convolution, DFT, deconvolutions, shock filter, edge map, cross
+ * correlation, quantization and region tree) over a matrix of image
+ * sizes, PSF widths and thread counts. With n threads each repetition
+ * calls the primitive concurrently in n threads (like the region workers).
+ * The results are saved as JSON (see bench_utils.hpp).
+ *
+ ************************************************************************
+*/
+
+#include <iostream>                     // cout, cerr, endl
+#include <iomanip>                      // setw
+#include <string>
+#include <vector>
+#include <functional>
+#include <stdexcept>
+
+#include <opencv2/highgui/highgui.hpp>  // imread
+#include <opencv2/imgproc/imgproc.hpp>  // resize, filter2D
+
+#include "argtable3.h"                  // cross platform command line parsing
+#include "utils.hpp"                    // conv2, dft, crossCorrelation
+#include "deconvolution.hpp"            // deconvolveFFT, deconvolveIRLS
+#include "coherence_filter.hpp"
+#include "edge_map.hpp"                 // computeSalientEdgeMap
+#include "disparity_estimation.hpp"     // quantizeImage
+#include "region_tree.hpp"
+#include "bench_utils.hpp"
+#include "synthetic_stereo.hpp"         // proceduralTexture, trajectoryKernel
+
+using namespace std;
+using namespace cv;
+using namespace deblur;
+
+// global structs for command line parsing
+struct arg_lit *help;
+struct arg_str *image_sizes, *psf_widths, *thread_counts, *name_filter;
+struct arg_int *repetitions, *warmup, *d_layers;
+struct arg_file *input_image, *output_file;
+struct arg_end *end_args;
+
+
+/**
+ * Parameters of the benchmark matrix
+ */
+struct benchOptions {
+    vector<int> sizes = {256, 512};
+    vector<int> psfWidths = {15, 35};
+    vector<int> threads = {1, 4};
+    int repetitions = 10;
+    int warmup = 2;
+    int layers = 12;
+    string filter;
+    string image;
+    string output = "bench.json";
+};
+
+
+/**
+ * Inputs of the primitives for one image size and PSF width
+ */
+struct benchInput {
+    Mat gray;                   // CV_8U
+    Mat sharp;                  // CV_32F in [0,1]
+    Mat blurred;                // CV_32F in [0,1]
+    Mat kernel;                 // energy preserving
+    array<Mat, 2> disparity;    // CV_8U disparity maps
+    array<Mat, 2> quantized;    // disparity layers
+};
+
+
+/**
+ * A primitive which is benchmarked for each image size (and PSF width)
+ */
+struct primitive {
+    string name;
+    bool usesPSF;
+    function<void(benchInput&)> run;
+};
+
+
+/**
+ * Saves the user input in the options.
+ * On error while parsing or used help option this function returns false.
+ */
+static bool parse_commandline_args(int argc, char** argv, benchOptions& options, int& exitcode) {
+    // command line options
+    // the global arg_xxx structs are initialized within the argtable
+    void *argtable[] = {
+        help          = arg_litn("h", "help",                       0, 1, "display this help and exit"),
+        image_sizes   = arg_strn("s", "sizes", "<n,n,...>",         0, 1, "side lengths of the square images. Default: 256,512"),
+        psf_widths    = arg_strn("w", "psf-widths", "<n,n,...>",    0, 1, "PSF widths. Default: 15,35"),
+        thread_counts = arg_strn("t", "threads", "<n,n,...>",       0, 1, "concurrent calls of each repetition. Default: 1,4"),
+        repetitions   = arg_intn("r", "repetitions", "<n>",         0, 1, "measured runs of each benchmark. Default: 10"),
+        warmup        = arg_intn(nullptr, "warmup", "<n>",          0, 1, "runs before the measurement. Default: 2"),
+        d_layers      = arg_intn("l", "layers", "<n>",              0, 1, "disparity layers of quantization and region tree. Default: 12"),
+        name_filter   = arg_strn(nullptr, "filter", "<name>",       0, 1, "run only benchmarks whose name contains this"),
+        input_image   = arg_filen(nullptr, "image", "<file>",       0, 1, "sharp image which is resized (Default: procedural texture)"),
+        output_file   = arg_filen("o", "output", "<file>",          0, 1, "results (JSON). Default: bench.json"),
+        end_args      = arg_end(20),
+    };
+
+    // default values (they weren't set if there is a value given)
+    repetitions->ival[0] = options.repetitions;
+    warmup->ival[0] = options.warmup;
+    d_layers->ival[0] = options.layers;
+    output_file->filename[0] = "bench.json";
+
+    // parsing arguments
+    int nerrors = arg_parse(argc,argv,argtable);
+
+    // special case: '--help' takes precedence over error reporting
+    if (help->count > 0)
+    {
+        cout << "Usage: " << argv[0];
+        arg_print_syntax(stdout, argtable, "\n");
+        cout << "Micro-benchmarks of the primitives of the depth-aware deblurring." << endl << endl;
+        arg_print_glossary(stdout, argtable, "  %-25s %s\n");
+
+        // deallocate each non-null entry in argtable[]
+        arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+        exitcode = 0;
+        return false;
+    }
+
+    // If the parser returned any errors then display them and exit
+    if (nerrors > 0)
+    {
+        arg_print_errors(stdout, end_args, argv[0]);
+        cout << "Try '" << argv[0] << "--help' for more information." << endl;
+
+        // deallocate each non-null entry in argtable[]
+        arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+        exitcode = 1;
+        return false;
+    }
+
+    // saving arguments in variables
+    try {
+        if (image_sizes->count > 0) {
+            options.sizes = parseIntList(image_sizes->sval[0]);
+        }
+
+        if (psf_widths->count > 0) {
+            options.psfWidths = parseIntList(psf_widths->sval[0]);
+        }
+
+        if (thread_counts->count > 0) {
+            options.threads = parseIntList(thread_counts->sval[0]);
+        }
+    } catch (const exception& e) {
+        cout << e.what() << endl;
+
+        arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+        exitcode = 1;
+        return false;
+    }
+
+    options.repetitions = repetitions->ival[0];
+    options.warmup = warmup->ival[0];
+    options.layers = d_layers->ival[0];
+    options.filter = (name_filter->count > 0) ? name_filter->sval[0] : "";
+    options.image = (input_image->count > 0) ? input_image->filename[0] : "";
+    options.output = output_file->filename[0];
+
+    // deallocate each non-null entry in argtable[]
+    arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+
+    return true;
+}
+
+
+/**
+ * Inputs of all primitives for an image size and PSF width
+ */
+static benchInput prepareInput(const benchOptions& options, const int size, const int psfWidth) {
+    benchInput input;
+
+    if (options.image.empty()) {
+        input.gray = proceduralTexture(Size(size, size), 1);
+    } else {
+        Mat image = imread(options.image, CV_LOAD_IMAGE_GRAYSCALE);
+
+        if (!image.data) {
+            throw runtime_error("Can not load image: " + options.image);
+        }
+
+        resize(image, input.gray, Size(size, size));
+    }
+
+    input.gray.convertTo(input.sharp, CV_32F, 1 / 255.0);
+    input.kernel = trajectoryKernel(linearTrajectory(30), psfWidth);
+    filter2D(input.sharp, input.blurred, -1, input.kernel);
+
+    // disparity ramp with a foreground object, shifted in the right view
+    for (int i = 0; i < 2; i++) {
+        input.disparity[i] = Mat(size, size, CV_8U);
+
+        for (int col = 0; col < size; col++) {
+            input.disparity[i].col(col).setTo(col * 120 / size);
+        }
+
+        const int shift = (i == 0) ? 0 : size / 16;
+        rectangle(input.disparity[i], Point(size / 4 - shift, size / 4), Point(size / 2 - shift, size * 3 / 4),
+                  Scalar(160), -1);
+    }
+
+    quantizeImage(input.disparity, options.layers, input.quantized);
+
+    return input;
+}
+
+
+/**
+ * Deep copy of the inputs (one for each thread)
+ */
+static benchInput cloneInput(const benchInput& input) {
+    benchInput copy;
+    copy.gray = input.gray.clone();
+    copy.sharp = input.sharp.clone();
+    copy.blurred = input.blurred.clone();
+    copy.kernel = input.kernel.clone();
+    copy.disparity = {input.disparity[0].clone(), input.disparity[1].clone()};
+    copy.quantized = {input.quantized[0].clone(), input.quantized[1].clone()};
+
+    return copy;
+}
+
+
+int main(int argc, char** argv) {
+    benchOptions options;
+
+    // parse command line arguments
+    int exitcode = 0;
+    bool success = parse_commandline_args(argc, argv, options, exitcode);
+
+    if (success == false) {
+        return exitcode;
+    }
+
+    const int layers = options.layers;
+
+    vector<primitive> primitives = {
+        {"conv2/full", true, [](benchInput& in) {
+            Mat dst; conv2(in.sharp, dst, in.kernel, FULL);
+        }},
+        {"conv2/same", true, [](benchInput& in) {
+            Mat dst; conv2(in.sharp, dst, in.kernel, SAME);
+        }},
+        {"conv2/valid", true, [](benchInput& in) {
+            Mat dst; conv2(in.sharp, dst, in.kernel, VALID);
+        }},
+        {"dft", false, [](benchInput& in) {
+            Mat dst; dft(in.blurred, dst);
+        }},
+        {"deconvolveFFT", true, [](benchInput& in) {
+            Mat dst; deconvolveFFT(in.blurred, dst, in.kernel);
+        }},
+        {"deconvolveIRLS", true, [](benchInput& in) {
+            Mat dst; deconvolveIRLS(in.blurred, dst, in.kernel);
+        }},
+        {"coherenceFilter", false, [](benchInput& in) {
+            // works on the range [0,255]
+            Mat src, dst;
+            in.blurred.convertTo(src, CV_32F, 255);
+            coherenceFilter(src, dst);
+        }},
+        {"computeSalientEdgeMap", true, [](benchInput& in) {
+            array<Mat, 2> edgeMaps;
+            computeSalientEdgeMap(in.blurred, edgeMaps, in.kernel.cols);
+        }},
+        {"crossCorrelation", false, [](benchInput& in) {
+            crossCorrelation(in.sharp, in.blurred);
+        }},
+        {"quantizeImage", false, [layers](benchInput& in) {
+            array<Mat, 2> quantized;
+            quantizeImage(in.disparity, layers, quantized);
+        }},
+        {"RegionTree::create", false, [layers](benchInput& in) {
+            RegionTree tree;
+            tree.create(in.quantized[LEFT], in.quantized[RIGHT], layers, &in.gray, &in.gray);
+        }},
+    };
+
+    cout << "Micro-benchmarks with " << options.repetitions << " repetitions and "
+         << options.warmup << " warmup runs" << endl << endl;
+    cout << left << setw(24) << "benchmark" << setw(8) << "size" << setw(6) << "psf"
+         << setw(9) << "threads" << "mean ± stddev [ms]" << endl;
+
+    vector<benchmarkResult> results;
+
+    try {
+        for (const int size : options.sizes) {
+            for (int w = 0; w < options.psfWidths.size(); w++) {
+                const int psfWidth = options.psfWidths[w];
+                const benchInput input = prepareInput(options, size, psfWidth);
+
+                for (const int threads : options.threads) {
+                    // every thread works on its own copy of the inputs
+                    vector<benchInput> inputs;
+
+                    for (int id = 0; id < threads; id++) {
+                        inputs.push_back(cloneInput(input));
+                    }
+
+                    for (const primitive& p : primitives) {
+                        // primitives without PSF only for the first width
+                        if ((!p.usesPSF && w > 0)
+                            || (!options.filter.empty() && p.name.find(options.filter) == string::npos)) {
+                            continue;
+                        }
+
+                        benchmarkResult result;
+                        result.name = p.name;
+                        result.parameters = {{"size", size}, {"psf_width", p.usesPSF ? psfWidth : 0},
+                                             {"threads", threads}};
+                        result.samplesMs = timeRepeated([&](const int id) { p.run(inputs[id]); },
+                                                        options.warmup, options.repetitions, threads);
+                        result.stats = computeStatistics(result.samplesMs);
+                        result.values = {{"calls_per_s", threads * 1000.0 / result.stats.mean}};
+
+                        cout << left << setw(24) << p.name << setw(8) << size
+                             << setw(6) << (p.usesPSF ? to_string(psfWidth) : "-") << setw(9) << threads
+                             << result.stats.mean << " ± " << result.stats.stddev << endl;
+
+                        results.push_back(result);
+                    }
+                }
+            }
+        }
+
+        saveBenchmarkJSON(options.output, "deblur-bench", options.warmup, options.repetitions, results);
+        cout << endl << "Results saved to " << options.output << endl;
+    }
+    catch(const exception& e) {
+        cerr << "ERROR: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return 0;
+}
@@ -0,0 +1,586 @@
+/***********************************************************************
+ * Author:       Franziska Krüger
+ * Using:        argtable3 - http://www.argtable.org/
+ *
+ * Description:
+ * ------------
+ * Thread-scaling analysis of runDepthDeblur. The same stereo pair is
+ * deblurred with 1..N threads and for each thread count the tool reports
+ *     - speedup and parallel efficiency of each step
+ *     - the serial fraction of the disparity estimation fitted to its
+ *       times at all thread counts (Amdahl's limit) and the experimentally
+ *       determined serial fraction of the whole run (Karp-Flatt)
+ *     - for each parallel section the time the workers waited for the
+ *       lock of the shared queue/stack, the time they polled the empty
+ *       queue and the critical path through the region tree
+ * and names the step which limits the scaling at the largest thread count.
+ *
+ ************************************************************************
+*/
+
+#include <iostream>                     // cout, cerr, endl
+#include <iomanip>                      // setw, setprecision
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>                    // sort
+#include <thread>                       // hardware_concurrency
+#include <stdexcept>
+#include <cstdio>                       // sscanf
+
+#include <opencv2/highgui/highgui.hpp>  // imread
+
+#include "argtable3.h"                  // cross platform command line parsing
+#include "depth_aware_deblurring.hpp"
+#include "bench_utils.hpp"
+#include "synthetic_stereo.hpp"
+
+using namespace std;
+using namespace deblur;
+
+// global structs for command line parsing
+struct arg_lit *help;
+struct arg_str *thread_list, *image_size;
+struct arg_int *max_threads, *d_layers, *psf_width, *max_disparity, *n_passes, *repetitions, *warmup;
+struct arg_file *synthetic_dir, *left_image, *right_image, *kernel_dir, *output_file;
+struct arg_end *end_args;
+
+
+/**
+ * Parameters of the analysis
+ */
+struct scalingOptions {
+    vector<int> threads;
+    string left;                // empty: synthetic pair
+    string right;
+    string kernels = ".";
+    string synthetic;           // directory of deblur-synth
+    cv::Size size = cv::Size(640, 480);
+    int layers = 12;
+    int psfWidth = 35;
+    int maxDisparity = 160;
+    bool maxDisparityGiven = false;
+    int passes = 1;
+    int repetitions = 1;
+    int warmup = 0;
+    string output = "scaling.json";
+};
+
+
+/**
+ * Measurements of a parallel section (summed over the passes, mean of the repetitions)
+ */
+struct sectionTimes {
+    double wallMs = 0;
+    double busyMs = 0;
+    double waitMs = 0;
+    double spinMs = 0;
+    double criticalPathMs = 0;
+    double accesses = 0;
+    double emptyAccesses = 0;
+    vector<int> criticalPath;   // of the first pass
+
+    double utilization(const int threads) const {
+        return (wallMs > 0) ? busyMs / (threads * wallMs) : 0;
+    }
+};
+
+
+/**
+ * Measurements of one thread count
+ */
+struct scalingRun {
+    int threads;
+    vector<double> samplesMs;
+    double totalMs = 0;
+    map<string, double> stageMs;
+    map<string, vector<double>> stageSamples;
+    map<string, sectionTimes> sections;
+    vector<string> sectionOrder;
+};
+
+
+/**
+ * Saves the user input in the options.
+ * On error while parsing or used help option this function returns false.
+ */
+static bool parse_commandline_args(int argc, char** argv, scalingOptions& options, int& exitcode) {
+    // command line options
+    // the global arg_xxx structs are initialized within the argtable
+    void *argtable[] = {
+        help          = arg_litn("h", "help",                        0, 1, "display this help and exit"),
+        thread_list   = arg_strn("t", "threads", "<n,n,...>",        0, 1, "thread counts (the first one is the reference). Default: 1,2,4,... up to the cores"),
+        max_threads   = arg_intn("n", "max-threads", "<n>",          0, 1, "every thread count from 1 to n (overrides --threads)"),
+        synthetic_dir = arg_filen(nullptr, "synthetic", "<dir>",     0, 1, "stereo pair of deblur-synth"),
+        image_size    = arg_strn("s", "size", "<w>x<h>",             0, 1, "resolution of the generated pair (no views given). Default: 640x480"),
+        kernel_dir    = arg_filen("k", "kernels", "<dir>",           0, 1, "directory of the top-level kernels of the views. Default: ."),
+        d_layers      = arg_intn("l", "layers", "<n>",               0, 1, "region/disparity layers. Default: 12"),
+        psf_width     = arg_intn("w", "psf-width", "<n>",            0, 1, "approximate PSF width. Default: 35"),
+        max_disparity = arg_intn("d", "max-disparity", "<n>",        0, 1, "estimated maximum disparity. Default: 160 (generated pair: 64)"),
+        n_passes      = arg_intn(nullptr, "passes", "<n>",           0, 1, "passes of the algorithm (1 or 2). Default: 1"),
+        repetitions   = arg_intn("r", "repetitions", "<n>",          0, 1, "measured runs of each thread count. Default: 1"),
+        warmup        = arg_intn(nullptr, "warmup", "<n>",           0, 1, "runs before the measurement. Default: 0"),
+        output_file   = arg_filen("o", "output", "<file>",           0, 1, "results (JSON). Default: scaling.json"),
+        left_image    = arg_filen(nullptr, nullptr, "<left view>",   0, 1, "blurred left view"),
+        right_image   = arg_filen(nullptr, nullptr, "<right view>",  0, 1, "blurred right view"),
+        end_args      = arg_end(20),
+    };
+
+    // default values (they weren't set if there is a value given)
+    d_layers->ival[0] = options.layers;
+    psf_width->ival[0] = options.psfWidth;
+    max_disparity->ival[0] = options.maxDisparity;
+    n_passes->ival[0] = options.passes;
+    repetitions->ival[0] = options.repetitions;
+    warmup->ival[0] = options.warmup;
+    kernel_dir->filename[0] = ".";
+    output_file->filename[0] = "scaling.json";
+
+    // parsing arguments
+    int nerrors = arg_parse(argc,argv,argtable);
+
+    // special case: '--help' takes precedence over error reporting
+    if (help->count > 0)
+    {
+        cout << "Usage: " << argv[0];
+        arg_print_syntax(stdout, argtable, "\n");
+        cout << "Thread-scaling analysis of the depth-aware deblurring: speedup and efficiency of each step," << endl;
+        cout << "lock waits and idle polling of the workers, critical path and serial fraction." << endl;
+        cout << "Without views (or --synthetic) a synthetic pair is generated." << endl << endl;
+        arg_print_glossary(stdout, argtable, "  %-25s %s\n");
+
+        // deallocate each non-null entry in argtable[]
+        arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+        exitcode = 0;
+        return false;
+    }
+
+    // If the parser returned any errors then display them and exit
+    if (nerrors > 0)
+    {
+        arg_print_errors(stdout, end_args, argv[0]);
+        cout << "Try '" << argv[0] << "--help' for more information." << endl;
+
+        // deallocate each non-null entry in argtable[]
+        arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+        exitcode = 1;
+        return false;
+    }
+
+    // saving arguments in variables
+    try {
+        if (left_image->count != right_image->count) {
+            throw runtime_error("Both views are needed");
+        }
+
+        if (image_size->count > 0) {
+            if (sscanf(image_size->sval[0], "%dx%d", &options.size.width, &options.size.height) != 2
+                || options.size.width < 1 || options.size.height < 1) {
+                throw runtime_error(string("Invalid size: ") + image_size->sval[0] + " (<w>x<h> expected)");
+            }
+        }
+
+        if (max_threads->count > 0) {
+            for (int n = 1; n <= max_threads->ival[0]; n++) {
+                options.threads.push_back(n);
+            }
+        } else if (thread_list->count > 0) {
+            options.threads = parseIntList(thread_list->sval[0]);
+        } else {
+            const int cores = std::max(1u, thread::hardware_concurrency());
+
+            for (int n = 1; n < cores; n *= 2) {
+                options.threads.push_back(n);
+            }
+
+            options.threads.push_back(cores);
+        }
+
+        if (options.threads.empty()) {
+            throw runtime_error("No thread counts given");
+        }
+
+        for (const int n : options.threads) {
+            if (n < 1) {
+                throw runtime_error("Invalid thread count: " + to_string(n));
+            }
+        }
+    } catch (const exception& e) {
+        cout << e.what() << endl;
+
+        arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+        exitcode = 1;
+        return false;
+    }
+
+    if (left_image->count > 0) {
+        options.left = left_image->filename[0];
+        options.right = right_image->filename[0];
+    }
+
+    options.kernels = kernel_dir->filename[0];
+    options.synthetic = (synthetic_dir->count > 0) ? synthetic_dir->filename[0] : "";
+    options.layers = d_layers->ival[0];
+    options.psfWidth = psf_width->ival[0];
+    options.maxDisparity = max_disparity->ival[0];
+    options.maxDisparityGiven = (max_disparity->count > 0);
+    options.passes = n_passes->ival[0];
+    options.repetitions = repetitions->ival[0];
+    options.warmup = warmup->ival[0];
+    options.output = output_file->filename[0];
+
+    // deallocate each non-null entry in argtable[]
+    arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+
+    return true;
+}
+
+
+/**
+ * Runs the algorithm once and adds its times (divided by the repetitions) to the run
+ */
+static double runOnce(const cv::Mat& left, const cv::Mat& right, const deblurOptions& options,
+                      const int repetitions, scalingRun& run) {
+    cv::Mat deblurredLeft, deblurredRight;
+    RunMetrics metrics = runDepthDeblur(left, right, deblurredLeft, deblurredRight, options);
+
+    for (const auto& stage : metrics.stages) {
+        run.stageMs[stage.stage] += stage.wallMs / repetitions;
+        run.stageSamples[stage.stage].push_back(stage.wallMs);
+    }
+
+    // sections with the same name (passes, views) are summed
+    for (const auto& p : metrics.parallel) {
+        if (run.sections.count(p.section) == 0) {
+            run.sectionOrder.push_back(p.section);
+        }
+
+        sectionTimes& section = run.sections[p.section];
+        section.wallMs += p.wallMs / repetitions;
+        section.busyMs += p.busyMs / repetitions;
+        section.waitMs += p.waitMs / repetitions;
+        section.spinMs += p.spinMs / repetitions;
+        section.criticalPathMs += p.criticalPathMs / repetitions;
+        section.accesses += double(p.accesses) / repetitions;
+        section.emptyAccesses += double(p.emptyAccesses) / repetitions;
+
+        if (section.criticalPath.empty()) {
+            section.criticalPath = p.criticalPath;
+        }
+    }
+
+    return metrics.totalWallMs;
+}
+
+
+/**
+ * What limits a parallel section: the critical path, the lock of the shared
+ * queue/stack, idle workers or the work itself (memory bandwidth, imbalance)
+ */
+static string sectionLimit(const sectionTimes& section, const int threads) {
+    if (threads == 1) {
+        return "serial";
+    }
+
+    if (section.criticalPathMs >= 0.8 * section.wallMs) {
+        return "critical path";
+    }
+
+    if (section.waitMs >= 0.1 * section.busyMs) {
+        return "lock contention";
+    }
+
+    if (section.spinMs >= 0.25 * threads * section.wallMs) {
+        return "idle workers";
+    }
+
+    if (section.utilization(threads) < 0.75) {
+        return "load imbalance";
+    }
+
+    return "work (memory bound?)";
+}
+
+
+static string joinIds(const vector<int>& ids) {
+    string text;
+
+    for (int i = 0; i < ids.size(); i++) {
+        text += ((i > 0) ? "-" : "") + to_string(ids[i]);
+    }
+
+    return text;
+}
+
+
+/**
+ * Serial fraction s of a step, fitted with least squares to its times at
+ * all thread counts with Amdahl's law T(p) = T(ref) * (s + (1 - s) * ref / p).
+ * Returns -1 if there is only one thread count.
+ */
+static double fitSerialFraction(const vector<scalingRun>& runs, const string& stage) {
+    const scalingRun& reference = runs.front();
+    const double referenceMs = reference.stageMs.at(stage);
+    double numerator = 0;
+    double denominator = 0;
+
+    for (const scalingRun& run : runs) {
+        // parallel part of the time which is gone with p threads
+        const double gone = 1 - double(reference.threads) / run.threads;
+
+        numerator += (run.stageMs.at(stage) / referenceMs - 1 + gone) * gone;
+        denominator += gone * gone;
+    }
+
+    if (denominator <= 0 || referenceMs <= 0) {
+        return -1;
+    }
+
+    return min(1.0, max(0.0, numerator / denominator));
+}
+
+
+int main(int argc, char** argv) {
+    scalingOptions options;
+
+    // parse command line arguments
+    int exitcode = 0;
+    bool success = parse_commandline_args(argc, argv, options, exitcode);
+
+    if (success == false) {
+        return exitcode;
+    }
+
+    try {
+        cv::Mat leftView, rightView;
+        deblurOptions deblurring;
+
+        if (!options.left.empty() || !options.synthetic.empty()) {
+            const string directory = options.synthetic.empty() ? options.kernels : options.synthetic;
+            leftView = cv::imread(options.synthetic.empty() ? options.left : options.synthetic + "/left.png", 1);
+            rightView = cv::imread(options.synthetic.empty() ? options.right : options.synthetic + "/right.png", 1);
+
+            if (!leftView.data || !rightView.data) {
+                throw runtime_error("Can not load images!");
+            }
+
+            deblurring.toplevelKernels = loadToplevelKernels(directory);
+        } else {
+            // procedural pair with the default camera shake
+            syntheticOptions synthetic;
+            synthetic.size = options.size;
+            synthetic.psfWidth = options.psfWidth;
+
+            syntheticStereo stereo;
+            synthesizeStereo(proceduralTexture(synthetic.size, 3, synthetic.seed),
+                             proceduralDisparity(synthetic), synthetic, stereo);
+
+            leftView = stereo.blurred[0];
+            rightView = stereo.blurred[1];
+            deblurring.toplevelKernels = stereo.topLevelKernels;
+
+            if (!options.maxDisparityGiven) {
+                options.maxDisparity = synthetic.maxDisparity;
+            }
+        }
+
+        deblurring.psfWidth = options.psfWidth;
+        deblurring.layers = options.layers;
+        deblurring.maxDisparity = options.maxDisparity;
+        deblurring.passes = options.passes;
+
+        cout << "Thread scaling of a " << leftView.cols << "x" << leftView.rows << " pair with " << options.layers
+             << " layers (" << options.repetitions << " repetitions, " << options.warmup << " warmup runs)"
+             << endl << endl;
+
+        vector<scalingRun> runs;
+
+        for (const int threads : options.threads) {
+            cout << "== " << threads << " threads" << endl;
+            deblurring.threads = threads;
+
+            scalingRun run;
+            run.threads = threads;
+
+            for (int i = 0; i < options.warmup; i++) {
+                scalingRun ignored;
+                runOnce(leftView, rightView, deblurring, 1, ignored);
+            }
+
+            for (int i = 0; i < options.repetitions; i++) {
+                run.samplesMs.push_back(runOnce(leftView, rightView, deblurring, options.repetitions, run));
+            }
+
+            run.totalMs = computeStatistics(run.samplesMs).mean;
+            runs.push_back(run);
+        }
+
+        // the first thread count is the reference (usually 1 thread)
+        const scalingRun& reference = runs.front();
+        const scalingRun& widest = runs.back();
+
+        auto relative = [&reference](const scalingRun& run) {
+            return double(run.threads) / reference.threads;
+        };
+
+        // serial part of the disparity estimation as fraction of the whole run
+        // (the SGBM directions and the post-processing of the matching run in
+        // parallel, the KZ2 expansions don't, so the part is measured)
+        const double disparitySerial = fitSerialFraction(runs, "disparity");
+        const double disparityFraction = (reference.totalMs > 0 && disparitySerial >= 0)
+                                         ? disparitySerial * reference.stageMs.at("disparity") / reference.totalMs
+                                         : -1;
+
+        vector<benchmarkResult> results;
+
+        for (const scalingRun& run : runs) {
+            const double speedup = reference.totalMs / run.totalMs;
+            const double p = relative(run);
+
+            benchmarkResult result;
+            result.name = "scaling";
+            result.parameters = {{"threads", run.threads}, {"layers", options.layers},
+                                 {"psf_width", options.psfWidth}, {"passes", options.passes}};
+            result.samplesMs = run.samplesMs;
+            result.stats = computeStatistics(run.samplesMs);
+            result.values.push_back({"speedup", speedup});
+            result.values.push_back({"efficiency", speedup / p});
+
+            // Karp-Flatt metric: serial fraction that explains the measured speedup
+            if (p > 1) {
+                result.values.push_back({"karp_flatt", (1 / speedup - 1 / p) / (1 - 1 / p)});
+            }
+
+            if (disparityFraction >= 0) {
+                result.values.push_back({"serial_fraction_disparity", disparityFraction});
+            }
+
+            for (const auto& stage : run.stageMs) {
+                const double stageSpeedup = reference.stageMs.at(stage.first) / stage.second;
+                result.values.push_back({"stage_" + stage.first + "_ms", stage.second});
+                result.values.push_back({"stage_" + stage.first + "_speedup", stageSpeedup});
+                result.values.push_back({"stage_" + stage.first + "_efficiency", stageSpeedup / p});
+            }
+
+            for (const auto& stage : run.stageSamples) {
+                result.series.push_back({"stage_" + stage.first, stage.second});
+            }
+
+            for (const string& name : run.sectionOrder) {
+                const sectionTimes& section = run.sections.at(name);
+                result.values.push_back({"section_" + name + "_wall_ms", section.wallMs});
+                result.values.push_back({"section_" + name + "_busy_ms", section.busyMs});
+                result.values.push_back({"section_" + name + "_utilization", section.utilization(run.threads)});
+                result.values.push_back({"section_" + name + "_wait_ms", section.waitMs});
+                result.values.push_back({"section_" + name + "_spin_ms", section.spinMs});
+                result.values.push_back({"section_" + name + "_empty_accesses", section.emptyAccesses});
+                result.values.push_back({"section_" + name + "_critical_path_ms", section.criticalPathMs});
+            }
+
+            results.push_back(result);
+        }
+
+        saveBenchmarkJSON(options.output, "deblur-scaling", options.warmup, options.repetitions, results);
+
+        // speedup and efficiency of each step
+        cout << endl << "Steps (speedup and efficiency relative to " << reference.threads << " thread"
+             << ((reference.threads > 1) ? "s" : "") << ")" << endl;
+        cout << left << setw(16) << "step" << setw(9) << "threads" << setw(12) << "time [ms]"
+             << setw(10) << "speedup" << "efficiency" << endl;
+
+        auto printRow = [&](const string& name, const scalingRun& run, const double ms, const double referenceMs) {
+            cout << left << setw(16) << name << setw(9) << run.threads
+                 << setw(12) << fixed << setprecision(1) << ms
+                 << setw(10) << setprecision(2) << referenceMs / ms
+                 << setprecision(0) << 100 * referenceMs / ms / relative(run) << "%" << endl;
+        };
+
+        for (const auto& stage : reference.stageMs) {
+            for (const scalingRun& run : runs) {
+                printRow((&run == &reference) ? stage.first : "", run, run.stageMs.at(stage.first), stage.second);
+            }
+        }
+
+        for (const scalingRun& run : runs) {
+            printRow((&run == &reference) ? "total" : "", run, run.totalMs, reference.totalMs);
+        }
+
+        // queue accesses and critical path of the parallel sections
+        cout << endl << "Parallel sections (wait: lock of the shared queue/stack, spin: polling the empty queue)" << endl;
+        cout << left << setw(26) << "section" << setw(9) << "threads" << setw(11) << "wall [ms]"
+             << setw(8) << "util" << setw(11) << "wait [ms]" << setw(11) << "spin [ms]"
+             << setw(16) << "crit. path [ms]" << "limited by" << endl;
+
+        for (const string& name : reference.sectionOrder) {
+            for (const scalingRun& run : runs) {
+                const sectionTimes& section = run.sections.at(name);
+
+                cout << left << setw(26) << ((&run == &reference) ? name : "") << setw(9) << run.threads
+                     << setw(11) << fixed << setprecision(1) << section.wallMs
+                     << setw(8) << setprecision(2) << section.utilization(run.threads)
+                     << setw(11) << setprecision(1) << section.waitMs
+                     << setw(11) << section.spinMs
+                     << setw(16) << section.criticalPathMs
+                     << sectionLimit(section, run.threads) << endl;
+            }
+        }
+
+        cout << endl << "Critical paths through the region tree (" << widest.threads << " threads, first pass)" << endl;
+
+        for (const string& name : widest.sectionOrder) {
+            cout << "   " << left << setw(26) << name << joinIds(widest.sections.at(name).criticalPath) << endl;
+        }
+
+        // serial fraction and the step which limits the scaling
+        if (disparityFraction < 0) {
+            cout << endl << "Serial fraction of the disparity estimation: not measured (needs two thread counts)" << endl;
+        } else {
+            cout << endl << "Serial fraction of the disparity estimation: " << setprecision(1)
+                 << 100 * disparityFraction << "% of the run (" << 100 * disparitySerial
+                 << "% of the step, fitted over " << runs.size() << " thread counts; Amdahl's limit: ";
+
+            if (disparityFraction > 0) {
+                cout << setprecision(1) << 1 / disparityFraction << "x)" << endl;
+            } else {
+                cout << "none)" << endl;
+            }
+        }
+
+        if (runs.size() > 1) {
+            const double speedup = reference.totalMs / widest.totalMs;
+            const double p = relative(widest);
+
+            cout << "Speedup with " << widest.threads << " threads: " << setprecision(2) << speedup
+                 << "x, efficiency " << setprecision(0) << 100 * speedup / p << "%";
+
+            if (p > 1) {
+                cout << ", Karp-Flatt serial fraction " << setprecision(1)
+                     << 100 * (1 / speedup - 1 / p) / (1 - 1 / p) << "%";
+            }
+
+            cout << endl;
+
+            // the step with the largest share of the time at the largest thread count
+            vector<pair<string, double>> stages(widest.stageMs.begin(), widest.stageMs.end());
+            sort(stages.begin(), stages.end(), [](const pair<string, double>& a, const pair<string, double>& b) {
+                return a.second > b.second;
+            });
+
+            const string& limiting = stages.front().first;
+            const double stageSpeedup = reference.stageMs.at(limiting) / stages.front().second;
+
+            cout << "Limiting step with " << widest.threads << " threads: " << limiting << " ("
+                 << setprecision(0) << 100 * stages.front().second / widest.totalMs << "% of the time, speedup "
+                 << setprecision(2) << stageSpeedup << "x, efficiency " << setprecision(0)
+                 << 100 * stageSpeedup / p << "%)" << endl;
+        }
+
+        cout << endl << "Results saved to " << options.output << endl;
+    }
+    catch(const exception& e) {
+        cerr << "ERROR: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return 0;
+}
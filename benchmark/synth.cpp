@@ -0,0 +1,229 @@
+/***********************************************************************
+ * Author:       Franziska Krüger
+ * Using:        argtable3 - http://www.argtable.org/
+ *
+ * Description:
+ * ------------
+ * Generates a blurred stereo pair with depth-dependent blur and its ground
+ * truth (sharp views, disparities, PSFs) at an arbitrary resolution from
+ * a sharp image or a procedural texture (see synthetic_stereo.hpp).
+ *
+ ************************************************************************
+*/
+
+#include <iostream>                     // cout, cerr, endl
+#include <string>
+#include <stdexcept>
+#include <cmath>                        // sqrt
+#include <cerrno>
+#include <cstdio>                       // sscanf
+#include <sys/stat.h>                   // mkdir
+
+#include <opencv2/highgui/highgui.hpp>  // imread
+#include <opencv2/imgproc/imgproc.hpp>  // resize
+
+#include "argtable3.h"                  // cross platform command line parsing
+#include "synthetic_stereo.hpp"
+
+using namespace std;
+
+// global structs for command line parsing
+struct arg_lit *help, *linear, *gray;
+struct arg_file *sharp_image, *disparity_map, *out_dir;
+struct arg_str *image_size;
+struct arg_dbl *megapixels, *motion_angle;
+struct arg_int *d_layers, *min_disparity, *max_disparity, *psf_width, *top_nodes, *seed;
+struct arg_end *end_args;
+
+
+/**
+ * Saves the user input in the options.
+ * On error while parsing or used help option this function returns false.
+ */
+static bool parse_commandline_args(int argc, char** argv, deblur::syntheticOptions& options,
+                                   string& image, string& disparity, string& directory,
+                                   bool& grayViews, int& exitcode) {
+    // command line options
+    // the global arg_xxx structs are initialized within the argtable
+    void *argtable[] = {
+        help          = arg_litn("h", "help",                        0, 1, "display this help and exit"),
+        sharp_image   = arg_filen(nullptr, "image", "<file>",        0, 1, "sharp left view (Default: procedural texture)"),
+        disparity_map = arg_filen(nullptr, "disparity", "<file>",    0, 1, "disparities of the left view in pixel (Default: procedural)"),
+        image_size    = arg_strn("s", "size", "<w>x<h>",             0, 1, "resolution of the views. Default: 1024x768"),
+        megapixels    = arg_dbln(nullptr, "megapixels", "<x>",       0, 1, "resolution in megapixel with aspect ratio 4:3 (overrides --size)"),
+        d_layers      = arg_intn("l", "layers", "<n>",               0, 1, "depth layers. Default: 4"),
+        min_disparity = arg_intn(nullptr, "min-disparity", "<n>",    0, 1, "disparity of the farthest layer (procedural map). Default: 8"),
+        max_disparity = arg_intn("d", "max-disparity", "<n>",        0, 1, "disparity of the nearest layer (procedural map). Default: 64"),
+        psf_width     = arg_intn("w", "psf-width", "<n>",            0, 1, "PSF width of the nearest layer. Default: 35"),
+        linear        = arg_litn(nullptr, "linear",                  0, 1, "linear camera motion instead of a random shake"),
+        motion_angle  = arg_dbln(nullptr, "angle", "<degree>",       0, 1, "direction of the linear motion. Default: 30"),
+        top_nodes     = arg_intn("m", "max-top-nodes", "<n>",        0, 1, "number of top-level kernels (kernels.psfb). Default: 3"),
+        seed          = arg_intn(nullptr, "seed", "<n>",             0, 1, "seed of texture, disparities and camera shake. Default: 42"),
+        gray          = arg_litn(nullptr, "gray",                    0, 1, "gray value views"),
+        out_dir       = arg_filen("o", "out", "<dir>",               0, 1, "output directory. Default: synthetic"),
+        end_args      = arg_end(20),
+    };
+
+    // default values (they weren't set if there is a value given)
+    d_layers->ival[0] = options.layers;
+    min_disparity->ival[0] = options.minDisparity;
+    max_disparity->ival[0] = options.maxDisparity;
+    psf_width->ival[0] = options.psfWidth;
+    motion_angle->dval[0] = options.angle;
+    top_nodes->ival[0] = options.topLevelNodes;
+    seed->ival[0] = options.seed;
+    out_dir->filename[0] = "synthetic";
+
+    // parsing arguments
+    int nerrors = arg_parse(argc,argv,argtable);
+
+    // special case: '--help' takes precedence over error reporting
+    if (help->count > 0)
+    {
+        cout << "Usage: " << argv[0];
+        arg_print_syntax(stdout, argtable, "\n");
+        cout << "Blurred stereo pair with depth-dependent PSFs and ground truth." << endl << endl;
+        arg_print_glossary(stdout, argtable, "  %-25s %s\n");
+
+        // deallocate each non-null entry in argtable[]
+        arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+        exitcode = 0;
+        return false;
+    }
+
+    // If the parser returned any errors then display them and exit
+    if (nerrors > 0)
+    {
+        arg_print_errors(stdout, end_args, argv[0]);
+        cout << "Try '" << argv[0] << "--help' for more information." << endl;
+
+        // deallocate each non-null entry in argtable[]
+        arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+        exitcode = 1;
+        return false;
+    }
+
+    if (image_size->count > 0) {
+        if (sscanf(image_size->sval[0], "%dx%d", &options.size.width, &options.size.height) != 2
+            || options.size.width < 1 || options.size.height < 1) {
+            cout << "Invalid size: " << image_size->sval[0] << " (<w>x<h> expected)" << endl;
+
+            arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+            exitcode = 1;
+            return false;
+        }
+    }
+
+    if (megapixels->count > 0) {
+        const double width = sqrt(megapixels->dval[0] * 1e6 * 4 / 3);
+        options.size = cv::Size(cvRound(width), cvRound(width * 3 / 4));
+    }
+
+    if (max_disparity->ival[0] > 255 || min_disparity->ival[0] > max_disparity->ival[0]) {
+        cout << "The disparities have to be within [0, 255] with min <= max" << endl;
+
+        arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+        exitcode = 1;
+        return false;
+    }
+
+    // saving arguments in variables
+    options.layers = d_layers->ival[0];
+    options.minDisparity = min_disparity->ival[0];
+    options.maxDisparity = max_disparity->ival[0];
+    options.psfWidth = psf_width->ival[0];
+    options.shake = (linear->count == 0);
+    options.angle = motion_angle->dval[0];
+    options.topLevelNodes = top_nodes->ival[0];
+    options.seed = seed->ival[0];
+    image = (sharp_image->count > 0) ? sharp_image->filename[0] : "";
+    disparity = (disparity_map->count > 0) ? disparity_map->filename[0] : "";
+    directory = out_dir->filename[0];
+    grayViews = (gray->count > 0);
+
+    // deallocate each non-null entry in argtable[]
+    arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+
+    return true;
+}
+
+
+int main(int argc, char** argv) {
+    deblur::syntheticOptions options;
+    string image;
+    string disparityFile;
+    string directory;
+    bool grayViews;
+
+    // parse command line arguments
+    int exitcode = 0;
+    bool success = parse_commandline_args(argc, argv, options, image, disparityFile, directory,
+                                          grayViews, exitcode);
+
+    if (success == false) {
+        return exitcode;
+    }
+
+    cout << "Synthetic stereo pair with" << endl;
+    cout << "   sharp view:          " << (image.empty() ? "procedural texture" : image) << endl;
+    cout << "   disparities:         " << (disparityFile.empty() ? "procedural" : disparityFile) << endl;
+    cout << "   size:                " << options.size.width << "x" << options.size.height << endl;
+    cout << "   layers:              " << options.layers << endl;
+    cout << "   PSF width:           " << options.psfWidth << endl;
+    cout << "   camera motion:       " << (options.shake ? "shake" : "linear") << endl;
+    cout << "   output:              " << directory << endl;
+    cout << endl;
+
+    try {
+        if (mkdir(directory.c_str(), 0775) != 0 && errno != EEXIST) {
+            throw runtime_error("Can not create directory: " + directory);
+        }
+
+        const int channels = grayViews ? 1 : 3;
+
+        cv::Mat sharp;
+
+        if (image.empty()) {
+            sharp = deblur::proceduralTexture(options.size, channels, options.seed);
+        } else {
+            cv::Mat loaded = cv::imread(image, grayViews ? CV_LOAD_IMAGE_GRAYSCALE : 1);
+
+            if (!loaded.data) {
+                throw runtime_error("Can not load image: " + image);
+            }
+
+            cv::resize(loaded, sharp, options.size, 0, 0, cv::INTER_AREA);
+        }
+
+        cv::Mat disparity;
+
+        if (disparityFile.empty()) {
+            disparity = deblur::proceduralDisparity(options);
+        } else {
+            cv::Mat loaded = cv::imread(disparityFile, CV_LOAD_IMAGE_GRAYSCALE);
+
+            if (!loaded.data) {
+                throw runtime_error("Can not load disparity map: " + disparityFile);
+            }
+
+            // disparities scale with the width
+            cv::resize(loaded, disparity, options.size, 0, 0, cv::INTER_NEAREST);
+            disparity.convertTo(disparity, CV_8U, double(options.size.width) / loaded.cols);
+        }
+
+        deblur::syntheticStereo stereo;
+        deblur::synthesizeStereo(sharp, disparity, options, stereo);
+        deblur::saveSyntheticStereo(directory, stereo, options);
+
+        for (int l = 0; l < stereo.layerDisparities.size(); l++) {
+            cout << "layer " << l << ": disparity " << stereo.layerDisparities[l]
+                 << ", PSF " << stereo.psfs[l].cols << "x" << stereo.psfs[l].rows << endl;
+        }
+    }
+    catch(const exception& e) {
+        cerr << "ERROR: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return 0;
+}
@@ -0,0 +1,488 @@
+#include <algorithm>                    // min, max
+#include <cmath>                        // cos, sin, floor, round
+#include <fstream>
+#include <stdexcept>
+
+#include <opencv2/highgui/highgui.hpp>  // imwrite
+#include <opencv2/photo/photo.hpp>      // inpaint
+
+#include "psf_bank.hpp"                 // savePSFBank
+#include "synthetic_stereo.hpp"
+
+
+using namespace cv;
+using namespace std;
+
+
+namespace deblur {
+
+    Mat proceduralTexture(const Size size, const int channels, const unsigned seed) {
+        RNG rng(seed);
+
+        Mat texture(size, CV_8UC(channels));
+        rng.fill(texture, RNG::UNIFORM, Scalar::all(0), Scalar::all(256));
+        GaussianBlur(texture, texture, Size(5, 5), 1.5);
+
+        const int side = std::min(size.width, size.height);
+        const int shapes = std::max(16, int(size.area() / 65536));
+
+        for (int i = 0; i < shapes; i++) {
+            Point center(rng.uniform(0, size.width), rng.uniform(0, size.height));
+            Size axes(rng.uniform(side / 64 + 1, side / 8 + 2), rng.uniform(side / 64 + 1, side / 8 + 2));
+            Scalar color(rng.uniform(0, 256), rng.uniform(0, 256), rng.uniform(0, 256));
+
+            if (i % 2 == 0) {
+                rectangle(texture, Point(center.x - axes.width, center.y - axes.height),
+                          Point(center.x + axes.width, center.y + axes.height), color, -1);
+            } else {
+                ellipse(texture, center, axes, rng.uniform(0, 180), 0, 360, color, -1);
+            }
+        }
+
+        return texture;
+    }
+
+
+    Mat proceduralDisparity(const syntheticOptions& options) {
+        assert(options.maxDisparity < 256 && "disparities are saved as uchar");
+
+        RNG rng(options.seed + 1);
+        const Size size = options.size;
+        const int side = std::min(size.width, size.height);
+
+        Mat disparity(size, CV_8U, Scalar(options.minDisparity));
+
+        // objects of the nearer layers are drawn over the farther ones
+        for (int l = 1; l < options.layers; l++) {
+            const int value = options.minDisparity
+                              + l * (options.maxDisparity - options.minDisparity) / std::max(1, options.layers - 1);
+
+            // the nearer the layer, the smaller its objects
+            const int extent = std::max(2, side / (2 + 2 * l));
+
+            for (int i = 0; i < 2; i++) {
+                Point center(rng.uniform(0, size.width), rng.uniform(0, size.height));
+                Size axes(rng.uniform(extent / 2, extent + 1), rng.uniform(extent / 2, extent + 1));
+
+                if ((l + i) % 2 == 0) {
+                    rectangle(disparity, Point(center.x - axes.width, center.y - axes.height),
+                              Point(center.x + axes.width, center.y + axes.height), Scalar(value), -1);
+                } else {
+                    ellipse(disparity, center, axes, 0, 0, 360, Scalar(value), -1);
+                }
+            }
+        }
+
+        return disparity;
+    }
+
+
+    vector<Point2f> linearTrajectory(const float angle) {
+        const float radians = angle * CV_PI / 180;
+        vector<Point2f> trajectory = {Point2f(0, 0), Point2f(cos(radians), sin(radians))};
+        normalizeTrajectory(trajectory);
+
+        return trajectory;
+    }
+
+
+    vector<Point2f> shakeTrajectory(const unsigned seed) {
+        RNG rng(seed + 2);
+
+        vector<Point2f> trajectory;
+        Point2f position(0, 0);
+        Point2f velocity(rng.gaussian(1), rng.gaussian(1));
+
+        for (int i = 0; i < 64; i++) {
+            trajectory.push_back(position);
+
+            // the hand keeps most of its momentum
+            velocity = velocity * 0.8f + Point2f(rng.gaussian(0.5), rng.gaussian(0.5));
+            position += velocity;
+        }
+
+        normalizeTrajectory(trajectory);
+
+        return trajectory;
+    }
+
+
+    void normalizeTrajectory(vector<Point2f>& trajectory) {
+        Point2f low = trajectory[0];
+        Point2f high = trajectory[0];
+
+        for (const Point2f& p : trajectory) {
+            low.x = std::min(low.x, p.x);
+            low.y = std::min(low.y, p.y);
+            high.x = std::max(high.x, p.x);
+            high.y = std::max(high.y, p.y);
+        }
+
+        const Point2f center((low.x + high.x) / 2, (low.y + high.y) / 2);
+        const float extent = std::max(high.x - low.x, high.y - low.y);
+
+        for (Point2f& p : trajectory) {
+            p = (extent > 0) ? (p - center) * (1 / extent) : Point2f(0, 0);
+        }
+    }
+
+
+    /**
+     * Adds a value to the four pixels around a sub-pixel position
+     */
+    static void splat(Mat& kernel, const Point2f p, const float value) {
+        const int x = floor(p.x);
+        const int y = floor(p.y);
+        const float fx = p.x - x;
+        const float fy = p.y - y;
+
+        const float weights[4] = {(1 - fx) * (1 - fy), fx * (1 - fy), (1 - fx) * fy, fx * fy};
+        const Point offsets[4] = {Point(0, 0), Point(1, 0), Point(0, 1), Point(1, 1)};
+
+        for (int i = 0; i < 4; i++) {
+            const int col = x + offsets[i].x;
+            const int row = y + offsets[i].y;
+
+            if (col >= 0 && row >= 0 && col < kernel.cols && row < kernel.rows) {
+                kernel.at<float>(row, col) += weights[i] * value;
+            }
+        }
+    }
+
+
+    Mat trajectoryKernel(const vector<Point2f>& trajectory, const int width) {
+        const int size = (width % 2 == 0) ? width + 1 : width;
+        const float center = size / 2;
+        const float scale = size - 1;
+
+        Mat kernel = Mat::zeros(size, size, CV_32F);
+
+        if (trajectory.size() < 2 || size == 1) {
+            kernel.at<float>(size / 2, size / 2) = 1;
+            return kernel;
+        }
+
+        // equally spaced samples along each segment of the path
+        for (int i = 0; i + 1 < trajectory.size(); i++) {
+            const Point2f a = trajectory[i] * scale + Point2f(center, center);
+            const Point2f b = trajectory[i + 1] * scale + Point2f(center, center);
+            const int steps = std::max(1, int(ceil(norm(b - a) * 4)));
+
+            for (int s = 0; s < steps; s++) {
+                splat(kernel, a + (b - a) * ((s + 0.5f) / steps), 1.0f / steps);
+            }
+        }
+
+        kernel /= sum(kernel)[0];
+
+        return kernel;
+    }
+
+
+    void quantizeDisparity(const Mat& disparity, const int layers, Mat& layerMap,
+                           vector<int>& layerDisparities) {
+        assert(disparity.type() == CV_8U && "disparities in pixel expected");
+
+        double low, high;
+        minMaxLoc(disparity, &low, &high);
+
+        // equal disparity range for each layer
+        const double range = std::max(1.0, (high - low + 1) / layers);
+
+        Mat bins(1, 256, CV_8U);
+
+        for (int d = 0; d < 256; d++) {
+            bins.at<uchar>(d) = std::min(layers - 1, std::max(0, int((d - low) / range)));
+        }
+
+        Mat binMap;
+        LUT(disparity, bins, binMap);
+
+        // mean disparity of each non-empty layer
+        layerMap = Mat::zeros(disparity.size(), CV_8U);
+        layerDisparities.clear();
+
+        for (int bin = 0; bin < layers; bin++) {
+            Mat mask;
+            compare(binMap, bin, mask, CMP_EQ);
+
+            if (countNonZero(mask) == 0) {
+                continue;
+            }
+
+            layerMap.setTo(int(layerDisparities.size()), mask);
+            layerDisparities.push_back(cvRound(mean(disparity, mask)[0]));
+        }
+    }
+
+
+    /**
+     * Renders the right view and its disparity map by shifting the layers of the
+     * left view from far to near. Uncovered pixels are inpainted, their disparity
+     * is the one of the farther neighbor in the row (they belong to the background).
+     */
+    static void renderRightView(const Mat& left, const Mat& layerMap, const vector<int>& layerDisparities,
+                                Mat& right, Mat& rightDisparity, Mat& rightLayerMap) {
+        right = Mat::zeros(left.size(), left.type());
+        rightDisparity = Mat::zeros(left.size(), CV_8U);
+        rightLayerMap = Mat::zeros(left.size(), CV_8U);
+
+        Mat painted = Mat::zeros(left.size(), CV_8U);
+
+        for (int l = 0; l < layerDisparities.size(); l++) {
+            const int d = layerDisparities[l];
+            const Mat shift = (Mat_<double>(2, 3) << 1, 0, -d, 0, 1, 0);
+
+            Mat mask, shiftedMask, shifted;
+            compare(layerMap, l, mask, CMP_EQ);
+            warpAffine(mask, shiftedMask, shift, left.size(), INTER_NEAREST, BORDER_CONSTANT, Scalar(0));
+            warpAffine(left, shifted, shift, left.size(), INTER_NEAREST, BORDER_CONSTANT, Scalar::all(0));
+
+            shifted.copyTo(right, shiftedMask);
+            rightDisparity.setTo(d, shiftedMask);
+            rightLayerMap.setTo(l, shiftedMask);
+            painted.setTo(255, shiftedMask);
+        }
+
+        Mat holes;
+        compare(painted, 0, holes, CMP_EQ);
+
+        if (countNonZero(holes) == 0) {
+            return;
+        }
+
+        inpaint(right, holes, right, 3, INPAINT_TELEA);
+
+        for (int row = 0; row < holes.rows; row++) {
+            const uchar* hole = holes.ptr<uchar>(row);
+            uchar* disparity = rightDisparity.ptr<uchar>(row);
+            uchar* layer = rightLayerMap.ptr<uchar>(row);
+
+            int col = 0;
+
+            while (col < holes.cols) {
+                if (hole[col] == 0) {
+                    col++;
+                    continue;
+                }
+
+                // run of holes [col, end)
+                int end = col;
+                while (end < holes.cols && hole[end] != 0) {
+                    end++;
+                }
+
+                int neighbor = -1;
+
+                if (col > 0 && (end == holes.cols || disparity[col - 1] <= disparity[end])) {
+                    neighbor = col - 1;
+                } else if (end < holes.cols) {
+                    neighbor = end;
+                }
+
+                for (int i = col; i < end; i++) {
+                    disparity[i] = (neighbor < 0) ? layerDisparities[0] : disparity[neighbor];
+                    layer[i] = (neighbor < 0) ? 0 : layer[neighbor];
+                }
+
+                col = end;
+            }
+        }
+    }
+
+
+    /**
+     * Blurs a view layer by layer from far to near. A layer covers its own pixels
+     * and the ones of all nearer layers (which hide it), so there are no dark
+     * seams at the depth edges. Only the bounding box of a layer plus the PSF
+     * radius is filtered.
+     */
+    static void blurView(const Mat& sharp, const Mat& layerMap, const vector<Mat>& psfs, Mat& blurred) {
+        Mat image;
+        sharp.convertTo(image, CV_32F);
+
+        Mat result = Mat::zeros(image.size(), image.type());
+        const Rect frame(0, 0, image.cols, image.rows);
+
+        for (int l = 0; l < psfs.size(); l++) {
+            Mat mask;
+            compare(layerMap, l, mask, CMP_GE);
+
+            const Rect bounds = boundingRect(mask);
+
+            if (bounds.area() == 0) {
+                continue;
+            }
+
+            // filter2D correlates, the PSF convolves
+            Mat kernel;
+            flip(psfs[l], kernel, -1);
+
+            const int radius = kernel.cols / 2;
+            const Rect box = Rect(bounds.x - radius, bounds.y - radius,
+                                  bounds.width + 2 * radius, bounds.height + 2 * radius) & frame;
+
+            Mat alpha;
+            mask(box).convertTo(alpha, CV_32F, 1 / 255.0);
+
+            Mat alphas;
+            if (image.channels() == 3) {
+                merge(vector<Mat>{alpha, alpha, alpha}, alphas);
+            } else {
+                alphas = alpha;
+            }
+
+            Mat layer = image(box).mul(alphas);
+            Mat blurredLayer, blurredAlpha;
+            filter2D(layer, blurredLayer, -1, kernel, Point(-1, -1), 0, BORDER_REPLICATE);
+            filter2D(alphas, blurredAlpha, -1, kernel, Point(-1, -1), 0, BORDER_REPLICATE);
+
+            // composite over the farther layers
+            Mat region = result(box);
+            Mat composite = region.mul(Scalar::all(1) - blurredAlpha) + blurredLayer;
+            composite.copyTo(region);
+        }
+
+        result.convertTo(blurred, sharp.type());
+    }
+
+
+    /**
+     * Width of the PSF of a disparity (the nearest layer has the full PSF width)
+     */
+    static int psfWidthOf(const int disparity, const int maxDisparity, const int psfWidth) {
+        return std::max(1, cvRound(double(psfWidth) * disparity / std::max(1, maxDisparity)));
+    }
+
+
+    void synthesizeStereo(const Mat& sharpLeft, const Mat& disparity,
+                          const syntheticOptions& options, syntheticStereo& result) {
+        assert(sharpLeft.size() == disparity.size() && "view and disparity map of the same size");
+        assert((sharpLeft.type() == CV_8U || sharpLeft.type() == CV_8UC3) && "uchar image expected");
+
+        quantizeDisparity(disparity, options.layers, result.layerMaps[0], result.layerDisparities);
+
+        const vector<int>& disparities = result.layerDisparities;
+        const int maxDisparity = disparities.back();
+
+        // the same camera motion for all layers, scaled with the disparity
+        const vector<Point2f> trajectory = options.shake ? shakeTrajectory(options.seed)
+                                                         : linearTrajectory(options.angle);
+
+        result.psfs.clear();
+
+        for (const int d : disparities) {
+            result.psfs.push_back(trajectoryKernel(trajectory, psfWidthOf(d, maxDisparity, options.psfWidth)));
+        }
+
+        // top-level node t covers the t-th part of the disparity range
+        result.topLevelKernels.clear();
+        const double step = double(maxDisparity - disparities.front()) / options.topLevelNodes;
+
+        for (int t = 0; t < options.topLevelNodes; t++) {
+            const int d = cvRound(disparities.front() + (t + 0.5) * step);
+            result.topLevelKernels.push_back(trajectoryKernel(trajectory, psfWidthOf(d, maxDisparity, options.psfWidth)));
+        }
+
+        // left view with its quantized disparities
+        result.sharp[0] = sharpLeft.clone();
+        result.disparity[0] = Mat(disparity.size(), CV_8U);
+
+        for (int l = 0; l < disparities.size(); l++) {
+            Mat mask;
+            compare(result.layerMaps[0], l, mask, CMP_EQ);
+            result.disparity[0].setTo(disparities[l], mask);
+        }
+
+        renderRightView(sharpLeft, result.layerMaps[0], disparities,
+                        result.sharp[1], result.disparity[1], result.layerMaps[1]);
+
+        for (int view = 0; view < 2; view++) {
+            blurView(result.sharp[view], result.layerMaps[view], result.psfs, result.blurred[view]);
+        }
+    }
+
+
+    /**
+     * Kernel scaled to [0, 255] for viewing
+     */
+    static Mat kernelImage(const Mat& kernel) {
+        double high;
+        minMaxLoc(kernel, nullptr, &high);
+
+        Mat image;
+        kernel.convertTo(image, CV_8U, 255 / high);
+
+        return image;
+    }
+
+
+    void saveSyntheticStereo(const string& directory, const syntheticStereo& stereo,
+                             const syntheticOptions& options) {
+        const string names[2] = {"left", "right"};
+
+        for (int view = 0; view < 2; view++) {
+            if (!imwrite(directory + "/" + names[view] + ".png", stereo.blurred[view])) {
+                throw runtime_error("Can not write images to " + directory);
+            }
+
+            imwrite(directory + "/sharp-" + names[view] + ".png", stereo.sharp[view]);
+            imwrite(directory + "/disparity-" + names[view] + ".png", stereo.disparity[view]);
+        }
+
+        vector<psfEntry> layerPSFs;
+
+        for (int l = 0; l < stereo.psfs.size(); l++) {
+            psfEntry entry;
+            entry.id = l;
+            entry.label = "layer";
+            entry.psf = stereo.psfs[l];
+            layerPSFs.push_back(entry);
+
+            imwrite(directory + "/kernel-layer-" + to_string(l) + ".png", kernelImage(stereo.psfs[l]));
+        }
+
+        savePSFBank(directory + "/psfs.psfb", layerPSFs);
+
+        vector<psfEntry> topLevel;
+
+        for (int t = 0; t < stereo.topLevelKernels.size(); t++) {
+            psfEntry entry;
+            entry.id = t;
+            entry.label = "top-level";
+            entry.psf = stereo.topLevelKernels[t];
+            topLevel.push_back(entry);
+        }
+
+        savePSFBank(directory + "/kernels.psfb", topLevel);
+
+        ofstream file(directory + "/ground-truth.json");
+
+        if (!file) {
+            throw runtime_error("Can not write ground truth: " + directory + "/ground-truth.json");
+        }
+
+        file << "{" << endl;
+        file << "  \"width\": " << stereo.sharp[0].cols << "," << endl;
+        file << "  \"height\": " << stereo.sharp[0].rows << "," << endl;
+        file << "  \"channels\": " << stereo.sharp[0].channels() << "," << endl;
+        file << "  \"psf_width\": " << options.psfWidth << "," << endl;
+        file << "  \"camera_motion\": \"" << (options.shake ? "shake" : "linear") << "\"," << endl;
+        file << "  \"angle\": " << options.angle << "," << endl;
+        file << "  \"seed\": " << options.seed << "," << endl;
+        file << "  \"max_disparity\": " << stereo.layerDisparities.back() << "," << endl;
+        file << "  \"layers\": [";
+
+        for (int l = 0; l < stereo.layerDisparities.size(); l++) {
+            Mat mask;
+            compare(stereo.layerMaps[0], l, mask, CMP_EQ);
+
+            file << ((l == 0) ? "" : ",") << endl;
+            file << "    {\"layer\": " << l << ", \"disparity\": " << stereo.layerDisparities[l]
+                 << ", \"psf_width\": " << stereo.psfs[l].cols << ", \"pixels_left\": " << countNonZero(mask) << "}";
+        }
+
+        file << endl << "  ]" << endl;
+        file << "}" << endl;
+    }
+}
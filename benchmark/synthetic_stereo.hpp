@@ -0,0 +1,155 @@
+/***********************************************************************
+ * Author:       Franziska Krüger
+ * Requirements: OpenCV 3
+ *
+ * Description:
+ * ------------
+ * Generator of blurred stereo pairs with ground truth for benchmarks.
+ *
+ * A sharp left view (an image or a procedural texture) and a disparity
+ * map (given or procedural) are split into depth layers. The right view
+ * is rendered by shifting the layers from far to near by their disparity.
+ * Both views are blurred layer by layer with the same camera trajectory,
+ * whose length scales with the disparity of the layer (a translating
+ * camera blurs near objects more than far ones), and the layers are
+ * composited from far to near.
+ *
+ * Besides the blurred pair the ground truth consists of the sharp views,
+ * the disparity maps of both views and the PSF of each layer.
+ *
+ ************************************************************************
+*/
+
+#ifndef SYNTHETIC_STEREO_H
+#define SYNTHETIC_STEREO_H
+
+#include <array>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+
+namespace deblur {
+
+    /**
+     * Parameters of a synthetic stereo pair
+     */
+    struct syntheticOptions {
+        cv::Size size = cv::Size(1024, 768);    // resolution of the views
+        int layers = 4;                         // depth layers
+        int minDisparity = 8;                   // disparity of the farthest layer (procedural map)
+        int maxDisparity = 64;                  // disparity of the nearest layer (procedural map)
+        int psfWidth = 35;                      // PSF width of the nearest layer
+        bool shake = true;                      // random camera shake instead of a linear motion
+        float angle = 30;                       // direction of the linear motion in degree
+        int topLevelNodes = 3;                  // number of approximate top-level kernels
+        unsigned seed = 42;                     // texture, disparity map and camera shake
+    };
+
+    /**
+     * Blurred stereo pair with its ground truth
+     */
+    struct syntheticStereo {
+        std::array<cv::Mat, 2> sharp;           // sharp views
+        std::array<cv::Mat, 2> blurred;         // blurred views (same type as the sharp ones)
+        std::array<cv::Mat, 2> disparity;       // CV_8U disparities in pixel (left-right, right-left)
+        std::array<cv::Mat, 2> layerMaps;       // CV_8U depth layer of each pixel
+        std::vector<int> layerDisparities;      // disparity of each layer (ascending)
+        std::vector<cv::Mat> psfs;              // energy preserving PSF of each layer
+        std::vector<cv::Mat> topLevelKernels;   // PSFs in the middle of the disparity range of
+                                                // each top-level node (see loadToplevelKernels)
+    };
+
+    /**
+     * Reproducible sharp image: smoothed noise with overlapping colored rectangles
+     * and ellipses, so there are edges of all orientations.
+     *
+     * @param size     resolution
+     * @param channels 1 (gray) or 3 (BGR)
+     * @param seed     seed of the random generator
+     * @return         CV_8U or CV_8UC3 image
+     */
+    cv::Mat proceduralTexture(const cv::Size size, const int channels = 3, const unsigned seed = 42);
+
+    /**
+     * Procedural disparity map: a background at minDisparity and objects of
+     * the other layers in front of it (the nearer, the smaller).
+     *
+     * @param options size, layers and disparity range
+     * @return        CV_8U disparities in pixel
+     */
+    cv::Mat proceduralDisparity(const syntheticOptions& options);
+
+    /**
+     * Path of a linear camera motion in the given direction
+     *
+     * @param angle direction in degree
+     * @return      normalized trajectory (see normalizeTrajectory)
+     */
+    std::vector<cv::Point2f> linearTrajectory(const float angle);
+
+    /**
+     * Path of a random camera shake (random walk with momentum)
+     *
+     * @param seed seed of the random generator
+     * @return     normalized trajectory (see normalizeTrajectory)
+     */
+    std::vector<cv::Point2f> shakeTrajectory(const unsigned seed);
+
+    /**
+     * Centers a trajectory and scales it to an extent of 1 (largest side of its
+     * bounding box), so it lies within [-0.5, 0.5].
+     */
+    void normalizeTrajectory(std::vector<cv::Point2f>& trajectory);
+
+    /**
+     * Rasterizes a normalized trajectory into an energy preserving kernel of
+     * the given width. The camera spends the same time on each part of the path.
+     *
+     * @param trajectory normalized trajectory
+     * @param width      kernel width (odd, even widths are increased by one)
+     * @return           CV_32F kernel
+     */
+    cv::Mat trajectoryKernel(const std::vector<cv::Point2f>& trajectory, const int width);
+
+    /**
+     * Splits a disparity map into layers of equal disparity range. Each layer
+     * gets the mean disparity of its pixels, empty layers are dropped.
+     *
+     * @param disparity        CV_8U disparity map
+     * @param layers           maximum number of layers
+     * @param layerMap         CV_8U layer of each pixel
+     * @param layerDisparities disparity of each layer (ascending)
+     */
+    void quantizeDisparity(const cv::Mat& disparity, const int layers, cv::Mat& layerMap,
+                           std::vector<int>& layerDisparities);
+
+    /**
+     * Renders the right view and blurs both views.
+     *
+     * @param sharpLeft sharp left view (CV_8U or CV_8UC3)
+     * @param disparity left-right disparities in pixel of the same size (CV_8U)
+     * @param options   layers, PSF width and camera motion
+     * @param result    blurred pair and ground truth
+     */
+    void synthesizeStereo(const cv::Mat& sharpLeft, const cv::Mat& disparity,
+                          const syntheticOptions& options, syntheticStereo& result);
+
+    /**
+     * Saves a synthetic pair into a directory:
+     *     left.png, right.png                   blurred views
+     *     sharp-left.png, sharp-right.png       sharp views
+     *     disparity-left.png, disparity-right.png
+     *     psfs.psfb                             PSF of each layer (label "layer")
+     *     kernels.psfb                          top-level kernels for runDepthDeblur
+     *     ground-truth.json                     layers, disparities and PSF widths
+     *
+     * @param directory existing output directory
+     * @param stereo    pair with ground truth
+     * @param options   parameters of the pair (written to ground-truth.json)
+     */
+    void saveSyntheticStereo(const std::string& directory, const syntheticStereo& stereo,
+                             const syntheticOptions& options);
+}
+
+#endif
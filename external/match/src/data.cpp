@@ -22,8 +22,6 @@
 /********************* data penalty *************************/
 /************************************************************/
 
-#define CUTOFF 1000
-
 int Match::data_penalty_GRAY(Coord l, Coord r)
 {
 	int d;
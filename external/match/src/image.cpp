@@ -48,6 +48,45 @@ void * imNew(ImageType type, int xsize, int ysize)
 	return im;
 }
 
+void * imView(ImageType type, int xsize, int ysize, void *data, int step)
+{
+	void *ptr;
+	GeneralImage im;
+	int data_size;
+	int y;
+
+	if (xsize<=0 || ysize<=0 || !data) return NULL;
+
+	switch (type)
+	{
+		case IMAGE_BINARY: data_size = sizeof(unsigned char);    break;
+		case IMAGE_GRAY:   data_size = sizeof(unsigned char);    break;
+		case IMAGE_SHORT:  data_size = sizeof(short);            break;
+		case IMAGE_RGB:    data_size = sizeof(unsigned char[3]); break;
+		case IMAGE_LONG:   data_size = sizeof(long);             break;
+		case IMAGE_PTR:    data_size = sizeof(void *);           break;
+		case IMAGE_FLOAT:  data_size = sizeof(float);            break;
+		case IMAGE_DOUBLE: data_size = sizeof(double);           break;
+		default: return NULL;
+	}
+
+	if (step < xsize*data_size) return NULL;
+
+	ptr = malloc(sizeof(ImageHeader) + ysize*sizeof(void*));
+	if (!ptr) return NULL;
+	im = (GeneralImage) ((char*)ptr + sizeof(ImageHeader));
+
+	imHeader(im) -> type      = type;
+	imHeader(im) -> data_size = data_size;
+	imHeader(im) -> xsize     = xsize;
+	imHeader(im) -> ysize     = ysize;
+
+	/* only the row pointers are allocated */
+	for (y=0; y<ysize; y++) (im+y)->data = ((char*)data) + (size_t)step*y;
+
+	return im;
+}
+
 /************************************************************/
 /************************************************************/
 /************************************************************/
@@ -84,6 +84,9 @@ typedef struct DoubleImage_st  { double                            *data; } *Dou
 
 void * imNew(ImageType type, int xsize, int ysize);
 inline void imFree(void *im) { free(GeneralImage(im)->data); free(imHeader(im)); }
+/* image on external data with rows which are 'step' bytes apart (data is not copied) */
+void * imView(ImageType type, int xsize, int ysize, void *data, int step);
+inline void imFreeView(void *im) { free(imHeader(im)); }
 void * imLoad(ImageType type, char *filename);
 int imSave(void *im, char *filename);
 
@@ -20,16 +20,212 @@ inline int Match::KZ2_smoothness_penalty2(Coord p, Coord np, Coord d)
 	return (this->*smoothness_penalty2_func)(p, np, d);
 }
 
+/************************************************************/
+/********* rectified images (horizontal disparities) ********/
+/************************************************************/
+
+/* true if the disparities are horizontal and the data and smoothness
+   terms use the same kind of images (both gray or both color) */
+bool Match::KZ2_is_1D()
+{
+	return disp_base.y == 0 && disp_max.y == 0 && (im_left != NULL) == (segm_left != NULL);
+}
+
+/* true if a is inside the band of SetPrior at pixel p */
+inline bool Match::KZ2_in_band(Coord p, Coord a)
+{
+	if (!prior_band) return true;
+
+	int c = IMREF(x_prior, p);
+	return c == OCCLUDED || (a.x >= c - prior_band && a.x <= c + prior_band);
+}
+
+/* true if a is inside the band of SetPrior of any pixel */
+bool Match::KZ2_label_in_band(Coord a)
+{
+	if (!prior_band) return true;
+
+	return a.x >= prior_min - prior_band && a.x <= prior_max + prior_band;
+}
+
+/* penalty of one channel, same as data_penalty_X in data.cpp */
+template <bool SUBPIXEL, bool L2>
+static inline int KZ2_channel_penalty(int Il, int Il_min, int Il_max, int Ir, int Ir_min, int Ir_max)
+{
+	int d;
+
+	if (SUBPIXEL)
+	{
+		int dl, dr;
+
+		if      (Il < Ir_min) dl = Ir_min - Il;
+		else if (Il > Ir_max) dl = Il - Ir_max;
+		else return 0;
+
+		if      (Ir < Il_min) dr = Il_min - Ir;
+		else if (Ir > Il_max) dr = Ir - Il_max;
+		else return 0;
+
+		d = (dl < dr) ? dl : dr;
+		if (L2) d = d*d;
+	}
+	else
+	{
+		d = Il - Ir;
+		if (L2) d = d*d; else if (d<0) d = -d;
+	}
+
+	if (d>CUTOFF) d = CUTOFF;
+
+	return d;
+}
+
+template <bool COLOR, bool SUBPIXEL, bool L2>
+inline int Match::KZ2_data_penalty_1D(int y, int xl, int xr)
+{
+	int d;
+
+	if (!COLOR)
+	{
+		if (SUBPIXEL) d = KZ2_channel_penalty<SUBPIXEL, L2>(
+			imRef(im_left, xl, y),  imRef(im_left_min, xl, y),  imRef(im_left_max, xl, y),
+			imRef(im_right, xr, y), imRef(im_right_min, xr, y), imRef(im_right_max, xr, y));
+		else d = KZ2_channel_penalty<SUBPIXEL, L2>(imRef(im_left, xl, y), 0, 0, imRef(im_right, xr, y), 0, 0);
+	}
+	else
+	{
+		if (SUBPIXEL)
+		{
+			d  = KZ2_channel_penalty<SUBPIXEL, L2>(
+				imRef(im_color_left, xl, y).r,  imRef(im_color_left_min, xl, y).r,  imRef(im_color_left_max, xl, y).r,
+				imRef(im_color_right, xr, y).r, imRef(im_color_right_min, xr, y).r, imRef(im_color_right_max, xr, y).r);
+			d += KZ2_channel_penalty<SUBPIXEL, L2>(
+				imRef(im_color_left, xl, y).g,  imRef(im_color_left_min, xl, y).g,  imRef(im_color_left_max, xl, y).g,
+				imRef(im_color_right, xr, y).g, imRef(im_color_right_min, xr, y).g, imRef(im_color_right_max, xr, y).g);
+			d += KZ2_channel_penalty<SUBPIXEL, L2>(
+				imRef(im_color_left, xl, y).b,  imRef(im_color_left_min, xl, y).b,  imRef(im_color_left_max, xl, y).b,
+				imRef(im_color_right, xr, y).b, imRef(im_color_right_min, xr, y).b, imRef(im_color_right_max, xr, y).b);
+		}
+		else
+		{
+			d  = KZ2_channel_penalty<SUBPIXEL, L2>(imRef(im_color_left, xl, y).r, 0, 0, imRef(im_color_right, xr, y).r, 0, 0);
+			d += KZ2_channel_penalty<SUBPIXEL, L2>(imRef(im_color_left, xl, y).g, 0, 0, imRef(im_color_right, xr, y).g, 0, 0);
+			d += KZ2_channel_penalty<SUBPIXEL, L2>(imRef(im_color_left, xl, y).b, 0, 0, imRef(im_color_right, xr, y).b, 0, 0);
+		}
+		d /= 3;
+	}
+
+	return params.denominator*d - params.K;
+}
+
+/* same as smoothness_penalty2_X in data.cpp with disp = Coord(dx, 0) */
+template <bool COLOR>
+inline int Match::KZ2_smoothness_penalty2_1D(Coord p, Coord np, int dx)
+{
+	int d, d_max = 0;
+
+	if (!COLOR)
+	{
+		d = imRef(segm_left, p.x, p.y) - imRef(segm_left, np.x, np.y);
+		if (d<0) d = -d;
+		if (d_max<d) d_max = d;
+		d = imRef(segm_right, p.x+dx, p.y) - imRef(segm_right, np.x+dx, np.y);
+		if (d<0) d = -d;
+		if (d_max<d) d_max = d;
+	}
+	else
+	{
+		d = imRef(segm_color_left, p.x, p.y).r - imRef(segm_color_left, np.x, np.y).r;
+		if (d<0) d = -d;
+		if (d_max<d) d_max = d;
+		d = imRef(segm_color_right, p.x+dx, p.y).r - imRef(segm_color_right, np.x+dx, np.y).r;
+		if (d<0) d = -d;
+		if (d_max<d) d_max = d;
+
+		d = imRef(segm_color_left, p.x, p.y).g - imRef(segm_color_left, np.x, np.y).g;
+		if (d<0) d = -d;
+		if (d_max<d) d_max = d;
+		d = imRef(segm_color_right, p.x+dx, p.y).g - imRef(segm_color_right, np.x+dx, np.y).g;
+		if (d<0) d = -d;
+		if (d_max<d) d_max = d;
+
+		d = imRef(segm_color_left, p.x, p.y).b - imRef(segm_color_left, np.x, np.y).b;
+		if (d<0) d = -d;
+		if (d_max<d) d_max = d;
+		d = imRef(segm_color_right, p.x+dx, p.y).b - imRef(segm_color_right, np.x+dx, np.y).b;
+		if (d<0) d = -d;
+		if (d_max<d) d_max = d;
+	}
+
+	if (d_max<params.I_threshold2) return params.lambda1;
+	else                           return params.lambda2;
+}
+
+/* calls func<COLOR, SUBPIXEL, L2> args for the current images and parameters */
+#define KZ2_DISPATCH_1D(func, args) \
+	switch ((im_left ? 0 : 4) + (params.sub_pixel ? 2 : 0) + (params.data_cost==Parameters::L2 ? 1 : 0)) \
+	{ \
+		case 0: func<false, false, false> args; break; \
+		case 1: func<false, false, true>  args; break; \
+		case 2: func<false, true,  false> args; break; \
+		case 3: func<false, true,  true>  args; break; \
+		case 4: func<true,  false, false> args; break; \
+		case 5: func<true,  false, true>  args; break; \
+		case 6: func<true,  true,  false> args; break; \
+		case 7: func<true,  true,  true>  args; break; \
+	}
+
 /************************************************************/
 /************************************************************/
 /************************************************************/
 
+/* computes current energy for horizontal disparities */
+template <bool COLOR, bool SUBPIXEL, bool L2>
+int Match::KZ2_ComputeEnergy_1D()
+{
+	int k, dx, ndx;
+	Coord p, np;
+
+	E = 0;
+
+	for (p.y=0; p.y<im_size.y; p.y++)
+	for (p.x=0; p.x<im_size.x; p.x++)
+	{
+		dx = imRef(x_left, p.x, p.y);
+
+		if (dx != OCCLUDED) E += KZ2_data_penalty_1D<COLOR, SUBPIXEL, L2>(p.y, p.x, p.x+dx);
+
+		for (k=0; k<(int)NEIGHBOR_NUM; k++)
+		{
+			np = p + NEIGHBORS[k];
+
+			if (np>=Coord(0,0) && np<im_size)
+			{
+				ndx = imRef(x_left, np.x, np.y);
+				if (dx == ndx) continue;
+				if (dx!=OCCLUDED && np.x+dx>=0 && np.x+dx<im_size.x)
+					E += KZ2_smoothness_penalty2_1D<COLOR>(p, np, dx);
+				if (ndx!=OCCLUDED && p.x+ndx>=0 && p.x+ndx<im_size.x)
+					E += KZ2_smoothness_penalty2_1D<COLOR>(p, np, ndx);
+			}
+		}
+	}
+
+	return E;
+}
+
 /* computes current energy */
 int Match::KZ2_ComputeEnergy()
 {
 	int k;
 	Coord p, d, np, nd;
 
+	if (KZ2_is_1D())
+	{
+		KZ2_DISPATCH_1D(KZ2_ComputeEnergy_1D, ());
+		return E;
+	}
+
 	E = 0;
 
 	for (p.y=0; p.y<im_size.y; p.y++)
@@ -39,7 +235,7 @@ int Match::KZ2_ComputeEnergy()
 
 		if (d.x != OCCLUDED) E += KZ2_data_penalty(p, p+d);
 
-		for (k=0; k<NEIGHBOR_NUM; k++)
+		for (k=0; k<(int)NEIGHBOR_NUM; k++)
 		{
 			np = p + NEIGHBORS[k];
 
@@ -98,6 +294,156 @@ void KZ2_error_function(const char *msg)
 	exit(1);
 }
 
+/* computes the minimum a-expansion configuration for horizontal disparities */
+template <bool COLOR, bool SUBPIXEL, bool L2>
+void Match::KZ2_Expand_1D(Coord a)
+{
+	Coord p, np;
+	int dx, ndx, pdx;
+	int E_old, delta;
+	Energy::Var var_0, var_a, nvar_0, nvar_a;
+	int k;
+	
+	Energy *e = new Energy(KZ2_error_function);
+
+	/* initializing */
+	for (p.y=0; p.y<im_size.y; p.y++)
+	for (p.x=0; p.x<im_size.x; p.x++)
+	{
+		dx = imRef(x_left, p.x, p.y);
+		if (a.x == dx)
+		{
+			imRef(node_vars_0, p.x, p.y) = VAR_ACTIVE;
+			imRef(node_vars_a, p.x, p.y) = VAR_ACTIVE;
+			e -> add_constant(KZ2_data_penalty_1D<COLOR, SUBPIXEL, L2>(p.y, p.x, p.x+dx));
+			continue;
+		}
+
+		if (dx != OCCLUDED)
+		{
+			imRef(node_vars_0, p.x, p.y) = var_0 = e -> add_variable();
+			delta = KZ2_data_penalty_1D<COLOR, SUBPIXEL, L2>(p.y, p.x, p.x+dx);
+			e -> ADD_TERM1(var_0, delta, 0);
+		}
+		else imRef(node_vars_0, p.x, p.y) = VAR_NONPRESENT;
+
+		if (p.x+a.x>=0 && p.x+a.x<im_size.x)
+		{
+			imRef(node_vars_a, p.x, p.y) = var_a = e -> add_variable();
+			if (KZ2_in_band(p, a)) delta = KZ2_data_penalty_1D<COLOR, SUBPIXEL, L2>(p.y, p.x, p.x+a.x);
+			else                   delta = MATCH_INFINITY;
+			e -> ADD_TERM1(var_a, 0, delta);
+		}
+		else imRef(node_vars_a, p.x, p.y) = VAR_NONPRESENT;
+	}
+
+	for (p.y=0; p.y<im_size.y; p.y++)
+	for (p.x=0; p.x<im_size.x; p.x++)
+	{
+		dx = imRef(x_left, p.x, p.y);
+		var_0 = (Energy::Var) imRef(node_vars_0, p.x, p.y);
+		var_a = (Energy::Var) imRef(node_vars_a, p.x, p.y);
+
+		/* adding smoothness */
+		for (k=0; k<(int)NEIGHBOR_NUM; k++)
+		{
+			np = p + NEIGHBORS[k];
+			if ( ! ( np>=Coord(0,0) && np<im_size ) ) continue;
+			ndx = imRef(x_left, np.x, np.y);
+			nvar_0 = (Energy::Var) imRef(node_vars_0, np.x, np.y);
+			nvar_a = (Energy::Var) imRef(node_vars_a, np.x, np.y);
+
+			/* disparity a */
+			if (var_a!=VAR_NONPRESENT && nvar_a!=VAR_NONPRESENT)
+			/* p+a and np+a are inside the right image */
+			{
+				delta = KZ2_smoothness_penalty2_1D<COLOR>(p, np, a.x);
+
+				if (var_a != VAR_ACTIVE)
+				{
+					if (nvar_a != VAR_ACTIVE) e -> ADD_TERM2(var_a, nvar_a, 0, delta, delta, 0);
+					else                      e -> ADD_TERM1(var_a, delta, 0);
+				}
+				else
+				{
+					if (nvar_a != VAR_ACTIVE) e -> ADD_TERM1(nvar_a, delta, 0);
+					else                      {}
+				}
+			}
+
+			/* disparity d (unless it was checked before) */
+			if (IS_VAR(var_0) && np.x+dx>=0 && np.x+dx<im_size.x)
+			{
+				delta = KZ2_smoothness_penalty2_1D<COLOR>(p, np, dx);
+				if (dx == ndx) e -> ADD_TERM2(var_0, nvar_0, 0, delta, delta, 0);
+				else e -> ADD_TERM1(var_0, delta, 0);
+			}
+
+			/* direction nd (unless it was checked before) */
+			if (IS_VAR(nvar_0) && dx!=ndx && p.x+ndx>=0 && p.x+ndx<im_size.x)
+			{
+				delta = KZ2_smoothness_penalty2_1D<COLOR>(p, np, ndx);
+				e -> ADD_TERM1(nvar_0, delta, 0);
+			}
+		}
+
+		/* adding hard constraints in the left image */
+		if (IS_VAR(var_0) && var_a!=VAR_NONPRESENT)
+			e -> ADD_TERM2(var_0, var_a, 0, MATCH_INFINITY, 0, 0);
+
+		/* adding hard constraints in the right image */
+		dx = imRef(x_right, p.x, p.y);
+		if (dx != OCCLUDED)
+		{
+			var_0 = (Energy::Var) imRef(node_vars_0, p.x+dx, p.y);
+			if (var_0 != VAR_ACTIVE)
+			{
+				if (p.x-a.x>=0 && p.x-a.x<im_size.x)
+				{
+					var_a = (Energy::Var) imRef(node_vars_a, p.x-a.x, p.y);
+					e -> ADD_TERM2(var_0, var_a, 0, MATCH_INFINITY, 0, 0);
+				}
+			}
+		}
+	}
+
+	E_old = E;
+	E = e -> minimize();
+
+	if (E < E_old)
+	{
+		for (p.y=0; p.y<im_size.y; p.y++)
+		for (p.x=0; p.x<im_size.x; p.x++)
+		{
+			imRef(x_right, p.x, p.y) = OCCLUDED;
+		}
+
+		/* the vertical disparities stay 0 */
+		for (p.y=0; p.y<im_size.y; p.y++)
+		for (p.x=0; p.x<im_size.x; p.x++)
+		{
+			var_0 = (Energy::Var) imRef(node_vars_0, p.x, p.y);
+			var_a = (Energy::Var) imRef(node_vars_a, p.x, p.y);
+			if ( (IS_VAR(var_0) && e->get_var(var_0)==VALUE0) ||
+			     (var_0==VAR_ACTIVE) )
+			{
+				dx = imRef(x_left, p.x, p.y);
+				pdx = p.x + dx;
+				imRef(x_right, pdx, p.y) = -dx; imRef(y_right, pdx, p.y) = 0;
+			}
+			else if (IS_VAR(var_a) && e->get_var(var_a)==VALUE1)
+			{
+				pdx = p.x + a.x;
+				imRef(x_left, p.x, p.y) = a.x;  imRef(y_left, p.x, p.y) = 0;
+				imRef(x_right, pdx, p.y) = -a.x; imRef(y_right, pdx, p.y) = 0;
+			}
+			else imRef(x_left, p.x, p.y) = OCCLUDED;
+		}
+	}
+
+	delete e;
+}
+
 /* computes the minimum a-expansion configuration */
 void Match::KZ2_Expand(Coord a)
 {
@@ -105,6 +451,12 @@ void Match::KZ2_Expand(Coord a)
 	int E_old, delta;
 	Energy::Var var_0, var_a, nvar_0, nvar_a;
 	int k;
+
+	if (KZ2_is_1D())
+	{
+		KZ2_DISPATCH_1D(KZ2_Expand_1D, (a));
+		return;
+	}
 	
 	Energy *e = new Energy(KZ2_error_function);
 
@@ -133,7 +485,9 @@ void Match::KZ2_Expand(Coord a)
 		if (pa>=Coord(0,0) && pa<im_size)
 		{
 			IMREF(node_vars_a, p) = var_a = e -> add_variable();
-			e -> ADD_TERM1(var_a, 0, KZ2_data_penalty(p, pa));
+			/* disparities outside of the band of SetPrior are forbidden */
+			if (KZ2_in_band(p, a)) e -> ADD_TERM1(var_a, 0, KZ2_data_penalty(p, pa));
+			else                   e -> ADD_TERM1(var_a, 0, MATCH_INFINITY);
 		}
 		else IMREF(node_vars_a, p) = VAR_NONPRESENT;
 	}
@@ -146,7 +500,7 @@ void Match::KZ2_Expand(Coord a)
 		var_a = (Energy::Var) IMREF(node_vars_a, p);
 
 		/* adding smoothness */
-		for (k=0; k<NEIGHBOR_NUM; k++)
+		for (k=0; k<(int)NEIGHBOR_NUM; k++)
 		{
 			np = p + NEIGHBORS[k];
 			if ( ! ( np>=Coord(0,0) && np<im_size ) ) continue;
@@ -5,6 +5,8 @@
 #include <time.h>
 #include <cstring>  // std::memcpy
 #include <cassert>  // assert
+#include <thread>   // std::thread
+#include <vector>   // std::vector
 #include "match.h"
 
 /************************************************************/
@@ -13,18 +15,29 @@
 
 Match::Match(const unsigned char *left, const char unsigned *right, const Coord size, bool color) :
 	im_size(size),
-	disp_base(0, 0),
-	disp_max (0, 0),
-	disp_size(1, 1),
-	unique_flag(true),
 	im_left_min(nullptr),
 	im_left_max(nullptr),
 	im_right_min(nullptr),
 	im_right_max(nullptr),
 	im_color_left_min(nullptr),
-	im_color_right_min(nullptr),
 	im_color_left_max(nullptr),
-	im_color_right_max(nullptr)
+	im_color_right_min(nullptr),
+	im_color_right_max(nullptr),
+	disp_base(0, 0),
+	disp_max (0, 0),
+	disp_size(1, 1),
+	external_images(false),
+	unique_flag(true),
+	expansion_callback(nullptr),
+	expansion_data(nullptr),
+	stat_E_initial(0),
+	stat_steps(0),
+	stat_iterations(0),
+	threads(1),
+	x_prior(nullptr),
+	prior_band(0),
+	prior_min(0),
+	prior_max(0)
 {
 	size_t channel_size = size.x * size.y * sizeof(unsigned char);
 
@@ -46,6 +59,64 @@ Match::Match(const unsigned char *left, const char unsigned *right, const Coord
 		std::memcpy(im_color_right->data, right, 3 * channel_size);
 	}
 
+	InitDisparityMaps();
+}
+
+Match::Match(const unsigned char *left, int left_step, const unsigned char *right, int right_step,
+             const Coord size, bool color) :
+	im_size(size),
+	im_left_min(nullptr),
+	im_left_max(nullptr),
+	im_right_min(nullptr),
+	im_right_max(nullptr),
+	im_color_left_min(nullptr),
+	im_color_left_max(nullptr),
+	im_color_right_min(nullptr),
+	im_color_right_max(nullptr),
+	disp_base(0, 0),
+	disp_max (0, 0),
+	disp_size(1, 1),
+	external_images(true),
+	unique_flag(true),
+	expansion_callback(nullptr),
+	expansion_data(nullptr),
+	stat_E_initial(0),
+	stat_steps(0),
+	stat_iterations(0),
+	threads(1),
+	x_prior(nullptr),
+	prior_band(0),
+	prior_min(0),
+	prior_max(0)
+{
+	/* the images are only read */
+	if (!color) {
+		im_color_left = im_color_right = nullptr;
+
+		im_left  = (GrayImage) imView(IMAGE_GRAY, size.x, size.y, (void *) left, left_step);
+		im_right = (GrayImage) imView(IMAGE_GRAY, size.x, size.y, (void *) right, right_step);
+
+		if (!im_left || !im_right) {
+			fprintf(stderr, "Invalid image views!\n");
+			exit(1);
+		}
+	} else {
+		im_left = im_right = nullptr;
+
+		im_color_left  = (RGBImage) imView(IMAGE_RGB, size.x, size.y, (void *) left, left_step);
+		im_color_right = (RGBImage) imView(IMAGE_RGB, size.x, size.y, (void *) right, right_step);
+
+		if (!im_color_left || !im_color_right) {
+			fprintf(stderr, "Invalid image views!\n");
+			exit(1);
+		}
+	}
+
+	InitDisparityMaps();
+}
+
+void Match::InitDisparityMaps()
+{
 	x_left  = (LongImage) imNew(IMAGE_LONG, im_size.x, im_size.y);
 	y_left  = (LongImage) imNew(IMAGE_LONG, im_size.x, im_size.y);
 	x_right = (LongImage) imNew(IMAGE_LONG, im_size.x, im_size.y);
@@ -81,6 +152,15 @@ Match::Match(char *name_left, char *name_right, bool color)
 {
 	Coord p;
 
+	external_images = false;
+	threads = 1;
+	x_prior = NULL;
+	prior_band = prior_min = prior_max = 0;
+	expansion_callback = NULL;
+	expansion_data = NULL;
+	stat_E_initial = stat_steps = 0;
+	stat_iterations = 0;
+
 	if (!color)
 	{
 		im_color_left = im_color_right = NULL;
@@ -162,10 +242,20 @@ Match::~Match()
 	if (segm_color_left && segm_color_left != im_color_left) imFree(segm_color_left);
 	if (segm_color_right && segm_color_right != im_color_right) imFree(segm_color_right);
 
-	if (im_left) imFree(im_left);
-	if (im_right) imFree(im_right);
-	 if (im_color_left) imFree(im_color_left);
-	 if (im_color_right) imFree(im_color_right);
+	if (external_images)
+	{
+		if (im_left) imFreeView(im_left);
+		if (im_right) imFreeView(im_right);
+		if (im_color_left) imFreeView(im_color_left);
+		if (im_color_right) imFreeView(im_color_right);
+	}
+	else
+	{
+		if (im_left) imFree(im_left);
+		if (im_right) imFree(im_right);
+		if (im_color_left) imFree(im_color_left);
+		if (im_color_right) imFree(im_color_right);
+	}
 
 	if (im_left_min) imFree(im_left_min);
 	if (im_left_max) imFree(im_left_max);
@@ -176,6 +266,8 @@ Match::~Match()
 	if (im_color_right_min) imFree(im_color_right_min);
 	if (im_color_right_max) imFree(im_color_right_max);
 
+	if (x_prior) imFree(x_prior);
+
 	imFree(x_left);
 	imFree(y_left);
 	imFree(x_right);
@@ -254,6 +346,11 @@ void Match::SaveXLeft(char *file_name, bool flag)
 }
 
 void Match::SaveXLeft(unsigned char *dst, bool inverse)
+{
+	SaveXLeft(dst, im_size.x, inverse);
+}
+
+void Match::SaveXLeft(unsigned char *dst, int step, bool inverse)
 {
 	assert(dst != nullptr && "Destination must not be a nullptr");
 
@@ -261,19 +358,85 @@ void Match::SaveXLeft(unsigned char *dst, bool inverse)
 
 	for (p.y=0; p.y<im_size.y; p.y++)
 	{
+		unsigned char *row = dst + (size_t) step * p.y;
+
 		for (p.x = 0; p.x < im_size.x; p.x++)
 		{
 			long d = IMREF(x_left, p), c;
-			if (d == OCCLUDED) dst[p.y * im_size.x + p.x] = (unsigned char) 255;
+			if (d == OCCLUDED) row[p.x] = (unsigned char) 255;
 			else {
 				if (inverse) c = d - disp_base.x;
 				else c = disp_max.x - d;
-				dst[p.y * im_size.x + p.x] = (unsigned char) c;
+				row[p.x] = (unsigned char) c;
+			}
+		}
+	}
+}
+
+void Match::SaveXLeft(short *dst, int step, bool inverse)
+{
+	assert(dst != nullptr && "Destination must not be a nullptr");
+
+	Coord p;
+
+	for (p.y=0; p.y<im_size.y; p.y++)
+	{
+		short *row = (short *) ((char *) dst + (size_t) step * p.y);
+
+		for (p.x = 0; p.x < im_size.x; p.x++)
+		{
+			long d = IMREF(x_left, p), c;
+			if (d == OCCLUDED) row[p.x] = (short) -1;
+			else {
+				if (inverse) c = d - disp_base.x;
+				else c = disp_max.x - d;
+				row[p.x] = (short) c;
 			}
 		}
 	}
 }
 
+void Match::SetPrior(const unsigned char *src, int step, bool inverse, int band)
+{
+	Coord p;
+
+	assert(src != nullptr && "Source must not be a nullptr");
+
+	if (!x_prior) x_prior = (LongImage) imNew(IMAGE_LONG, im_size.x, im_size.y);
+	if (!x_prior) { fprintf(stderr, "Not enough memory!\n"); exit(1); }
+
+	prior_band = (band < 0) ? 0 : band;
+	prior_min = disp_max.x;
+	prior_max = disp_base.x;
+
+	for (p.y=0; p.y<im_size.y; p.y++)
+	{
+		const unsigned char *row = src + (size_t) step * p.y;
+
+		for (p.x=0; p.x<im_size.x; p.x++)
+		{
+			int d, c = row[p.x];
+
+			if (c>=0 && c<disp_size.x)
+			{
+				if (inverse) d = c + disp_base.x;
+				else         d = disp_max.x - c;
+				IMREF(x_left, p) = IMREF(x_prior, p) = d;
+				IMREF(y_left, p) = 0;
+
+				if (d < prior_min) prior_min = d;
+				if (d > prior_max) prior_max = d;
+			}
+			else IMREF(x_left, p) = IMREF(x_prior, p) = OCCLUDED;
+		}
+	}
+
+	/* no disparity at all: search everything */
+	if (prior_min > prior_max) prior_band = 0;
+
+	unique_flag = false;
+}
+
 void Match::SaveYLeft(char *file_name, bool flag)
 {
 	Coord p;
@@ -446,6 +609,25 @@ void Match::SetDispRange(Coord _disp_base, Coord _disp_max)
 	if (! (disp_base <= disp_max) ) { fprintf(stderr, "Error: wrong disparity range!\n"); exit(1); }
 }
 
+void Match::SetExpansionCallback(ExpansionCallback callback, void *data)
+{
+	expansion_callback = callback;
+	expansion_data = data;
+}
+
+void Match::SetThreads(int _threads)
+{
+	threads = (_threads < 1) ? 1 : _threads;
+}
+
+void Match::GetStatistics(int *E_initial, int *E_final, int *steps, float *iterations)
+{
+	if (E_initial) *E_initial = stat_E_initial;
+	if (E_final) *E_final = E;
+	if (steps) *steps = stat_steps;
+	if (iterations) *iterations = stat_iterations;
+}
+
 /************************************************************/
 /************************************************************/
 /************************************************************/
@@ -473,6 +655,9 @@ void Match::SWAP_IMAGES()
 
 	printf("SWAP_IMAGES\n\n");
 
+	/* the band of SetPrior belongs to the left image */
+	prior_band = 0;
+
 	c_tmp = disp_base;
 	disp_base = -disp_max;
 	disp_max = -c_tmp;
@@ -525,19 +710,56 @@ void Match::SWAP_IMAGES()
 	y_right = l_tmp;
 }
 
-void Match::MAKE_UNIQUE()
+void Match::ForEachRows(RowFunction func, bool parallel)
 {
-	Coord p, d, pd, d2;
+	int bands = (parallel) ? threads : 1;
+	if (bands > im_size.y) bands = im_size.y;
+
+	if (bands <= 1)
+	{
+		(this->*func)(0, im_size.y);
+		return;
+	}
+
+	/* the first band is processed by the calling thread */
+	std::vector<std::thread> workers;
+	for (int i=1; i<bands; i++)
+	{
+		workers.push_back(std::thread(func, this, im_size.y*i/bands, im_size.y*(i+1)/bands));
+	}
+	(this->*func)(0, im_size.y/bands);
+
+	for (auto& worker : workers) worker.join();
+}
 
+void Match::MAKE_UNIQUE()
+{
 	printf("MAKE_UNIQUE\n\n");
 
-	for (p.y=0; p.y<im_size.y; p.y++)
+	ForEachRows(&Match::MAKE_UNIQUE_clear);
+
+	/* with vertical disparities the rows depend on each other */
+	ForEachRows(&Match::MAKE_UNIQUE_rows, disp_base.y == 0 && disp_max.y == 0);
+
+	unique_flag = true;
+}
+
+void Match::MAKE_UNIQUE_clear(int y_begin, int y_end)
+{
+	Coord p;
+
+	for (p.y=y_begin; p.y<y_end; p.y++)
 	for (p.x=0; p.x<im_size.x; p.x++)
 	{
 		IMREF(x_right, p) = OCCLUDED;
 	}
+}
 
-	for (p.y=0; p.y<im_size.y; p.y++)
+void Match::MAKE_UNIQUE_rows(int y_begin, int y_end)
+{
+	Coord p, d, pd, d2;
+
+	for (p.y=y_begin; p.y<y_end; p.y++)
 	for (p.x=0; p.x<im_size.x; p.x++)
 	{
 		d.x = IMREF(x_left, p); if (d.x == OCCLUDED) continue;
@@ -558,17 +780,24 @@ void Match::MAKE_UNIQUE()
 		}
 		else IMREF(x_left, p) = OCCLUDED;
 	}
+}
+
+void Match::CROSS_CHECK()
+{
+	printf("CROSS_CHECK\n\n");
+
+	/* each pass only changes the pixel itself, so the rows are independent */
+	ForEachRows(&Match::CROSS_CHECK_left);
+	ForEachRows(&Match::CROSS_CHECK_right);
 
 	unique_flag = true;
 }
 
-void Match::CROSS_CHECK()
+void Match::CROSS_CHECK_left(int y_begin, int y_end)
 {
 	Coord p, d, pd, d2;
 
-	printf("CROSS_CHECK\n\n");
-
-	for (p.y=0; p.y<im_size.y; p.y++)
+	for (p.y=y_begin; p.y<y_end; p.y++)
 	for (p.x=0; p.x<im_size.x; p.x++)
 	{
 		d.x = IMREF(x_left, p); if (d.x == OCCLUDED) continue;
@@ -582,8 +811,13 @@ void Match::CROSS_CHECK()
 		}
 		IMREF(x_left, p) = OCCLUDED;
 	}
+}
 
-	for (p.y=0; p.y<im_size.y; p.y++)
+void Match::CROSS_CHECK_right(int y_begin, int y_end)
+{
+	Coord p, d, pd, d2;
+
+	for (p.y=y_begin; p.y<y_end; p.y++)
 	for (p.x=0; p.x<im_size.x; p.x++)
 	{
 		d.x = IMREF(x_right, p); if (d.x == OCCLUDED) continue;
@@ -597,55 +831,60 @@ void Match::CROSS_CHECK()
 		}
 		IMREF(x_right, p) = OCCLUDED;
 	}
-
-	unique_flag = true;
 }
 
 void Match::FILL_OCCLUSIONS()
 {
-	Coord p, q, d;
-
 	printf("FILL_OCCLUSIONS\n\n");
 
-	// Left image
-	for (p.y=0; p.y<im_size.y; p.y++)
+	ForEachRows(&Match::FILL_OCCLUSIONS_rows);
+
+	unique_flag = false;
+}
+
+void Match::FILL_OCCLUSIONS_rows(int y_begin, int y_end)
+{
+	Coord p, q, d;
+
+	/* both images in one pass so each row stays in the cache */
+	for (p.y=y_begin; p.y<y_end; p.y++)
 	{
+		// Left image
 		for (p.x=0; p.x<im_size.x; p.x++)
 		{
 			d.x = IMREF(x_left, p);
 			if (d.x != OCCLUDED) { d.y = IMREF(y_left, p); break; }
 		}
-		if (p.x == im_size.x) continue;
-		for (q.x=0, q.y=p.y; q.x<p.x; q.x++)
-		{
-			IMREF(x_left, q) = d.x;
-			IMREF(y_left, q) = d.y;
-		}
-
-		for (; p.x<im_size.x; p.x++)
+		if (p.x < im_size.x)
 		{
-			if (IMREF(x_left, p) == OCCLUDED)
+			for (q.x=0, q.y=p.y; q.x<p.x; q.x++)
 			{
-				IMREF(x_left, p) = d.x;
-				IMREF(y_left, p) = d.y;
+				IMREF(x_left, q) = d.x;
+				IMREF(y_left, q) = d.y;
 			}
-			else
+
+			for (; p.x<im_size.x; p.x++)
 			{
-				d.x = IMREF(x_left, p);
-				d.y = IMREF(y_left, p);
+				if (IMREF(x_left, p) == OCCLUDED)
+				{
+					IMREF(x_left, p) = d.x;
+					IMREF(y_left, p) = d.y;
+				}
+				else
+				{
+					d.x = IMREF(x_left, p);
+					d.y = IMREF(y_left, p);
+				}
 			}
 		}
-	}
 
-	// Right image
-	for (p.y=im_size.y-1; p.y>=0; p.y--)
-	{
+		// Right image
 		for (p.x=im_size.x-1; p.x>=0; p.x--)
 		{
 			d.x = IMREF(x_right, p);
 			if (d.x != OCCLUDED) { d.y = IMREF(y_right, p); break; }
 		}
-		if (p.x == im_size.x) continue;
+		if (p.x < 0) continue;
 		for (q.x=im_size.x-1, q.y=p.y; q.x>p.x; q.x--)
 		{
 			IMREF(x_right, q) = d.x;
@@ -666,8 +905,6 @@ void Match::FILL_OCCLUSIONS()
 			}
 		}
 	}
-
-	unique_flag = false;
 }
 
 /************************************************************/
@@ -815,6 +1052,25 @@ void generate_permutation(int *buf, int n)
 	}
 }
 
+/* marks all labels as not yet tested (except labels outside of the band
+   of SetPrior for KZ2), returns the number of labels to test */
+int Match::ResetLabels(bool *buf, int label_num, Method method)
+{
+	Coord a;
+	int label, buf_num = 0;
+
+	for (label=0; label<label_num; label++)
+	{
+		a.x = disp_base.x + label / disp_size.y;
+		a.y = disp_base.y + label % disp_size.y;
+
+		buf[label] = (method==METHOD_KZ2 && a.x<=disp_max.x && !KZ2_label_in_band(a));
+		if (!buf[label]) buf_num ++;
+	}
+
+	return buf_num;
+}
+
 void Match::Run_KZ_BVZ(Method method)
 {
 	Coord a;
@@ -823,7 +1079,7 @@ void Match::Run_KZ_BVZ(Method method)
 	bool *buf;  /* if buf[l] is true then expansion of label corresponding to l
 	               cannot decrease the energy */
 	int buf_num; /* number of 'false' entries in buf */
-	int i, index, label;
+	int index, label;
 	int step, iter;
 	int E_old;
 
@@ -844,10 +1100,10 @@ void Match::Run_KZ_BVZ(Method method)
 		case METHOD_BVZ: BVZ_ComputeEnergy(); break;
 	}
 	printf("E = %d\n", E);
+	stat_E_initial = E;
 
 	/* starting the algorithm */
-	for (i=0; i<label_num; i++) buf[i] = false;
-	buf_num = label_num;
+	buf_num = ResetLabels(buf, label_num, method);
 	step = 0;
 	for (iter=0; iter<params.iter_max && buf_num>0; iter++)
 	{
@@ -865,6 +1121,8 @@ void Match::Run_KZ_BVZ(Method method)
 
 			E_old = E;
 
+			if (expansion_callback) expansion_callback(expansion_data, a, true);
+
 			switch (method)
 			{
 				case METHOD_KZ1: KZ1_Expand(a); break;
@@ -872,6 +1130,8 @@ void Match::Run_KZ_BVZ(Method method)
 				case METHOD_BVZ: BVZ_Expand(a); break;
 			}
 
+			if (expansion_callback) expansion_callback(expansion_data, a, false);
+
 #ifndef NDEBUG
 			{
 				int E_tmp = E;
@@ -900,16 +1160,16 @@ void Match::Run_KZ_BVZ(Method method)
 			}
 			else
 			{
-				int i;
-				for (i=0; i<label_num; i++) buf[i] = false;
-				buf[label] = true;
-				buf_num = label_num - 1;
+				buf_num = ResetLabels(buf, label_num, method);
+				if (!buf[label]) { buf[label] = true; buf_num --; }
 			}
 		}
 		printf(" E = %d\n", E); fflush(stdout);
 	}
 
 	printf("%.1f iterations\n", ((float)step)/label_num);
+	stat_steps = step;
+	stat_iterations = ((float)step)/label_num;
 
 	delete permutation;
 	delete buf;
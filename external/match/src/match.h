@@ -41,6 +41,13 @@ class Match
 {
 public:
 	Match(const unsigned char *left, const char unsigned *right, const Coord size, bool color = false);
+	/*
+		uses the given images without copying them (they have to exist as long as
+		the Match object), rows are 'step' bytes apart. The order of the color
+		channels doesn't matter (e.g. BGR), all costs treat them the same way.
+	*/
+	Match(const unsigned char *left, int left_step, const unsigned char *right, int right_step,
+	      const Coord size, bool color = false);
 	Match(char *name_left, char *name_right, bool color = false);
 	~Match();
 
@@ -48,6 +55,9 @@ public:
 	void LoadSegm(char *name_left, char *name_right, bool color);
 	/* Low-level copy of the underlaying disparity map as unsigned char array */
 	void SaveXLeft(unsigned char *dst, bool inverse); /* if flag is TRUE then larger */
+	/* same with rows which are 'step' bytes apart, occluded pixels are 255 or -1 */
+	void SaveXLeft(unsigned char *dst, int step, bool inverse);
+	void SaveXLeft(short *dst, int step, bool inverse);
 	/*
 	 * Save scaled disparity map as grayscaled image. If inverse is set to true, the
 	 * disparity values will be inverted
@@ -65,6 +75,28 @@ public:
 	
 	void SetDispRange(Coord disp_base, Coord disp_max);
 
+	/*
+		initial left x-disparity map (warm start, e.g. the map of the previous
+		frame of a video) in the format of SaveXLeft. If band > 0, KZ2 only
+		assigns disparities within +-band of the initial disparity of a pixel
+		and skips labels which are outside of the band of all pixels.
+		The disparity range has to be set before.
+	*/
+	void SetPrior(const unsigned char *src, int step, bool inverse, int band);
+
+	/*
+		optional function which is called before (start == true) and after
+		(start == false) each alpha-expansion of KZ1, KZ2 and BVZ, e.g. for tracing
+	*/
+	typedef void (*ExpansionCallback)(void *data, Coord a, bool start);
+	void SetExpansionCallback(ExpansionCallback callback, void *data);
+
+	/* number of threads for MAKE_UNIQUE, CROSS_CHECK and FILL_OCCLUSIONS (default 1) */
+	void SetThreads(int threads);
+
+	/* statistics of the last run of KZ1, KZ2 or BVZ */
+	void GetStatistics(int *E_initial, int *E_final, int *steps, float *iterations);
+
 	float GetK(); /* compute statistics of data_penalty */
 
 	/* Parameters of KZ1, KZ2, BVZ and CORR algorithms. */
@@ -150,13 +182,21 @@ private:
 		r == l + Coord(IMREF(x_left, l), IMREF(y_left, l))
 		l == r + Coord(IMREF(x_right, r), IMREF(y_right, r))
 	*/
+	bool			external_images;	/* true if im_... are views of the caller's data */
 	bool			unique_flag;	/* true if current configuration is unique */
 									/* (each pixel corresponds to at most one pixel in the other image */
 	Parameters		params;
 
 	/********* INTERNAL VARIABLES **************/
 	int				E;					/* current energy */
+	ExpansionCallback	expansion_callback;	/* NULL if not used */
+	void			*expansion_data;
+	int				stat_E_initial, stat_steps;	/* statistics of the last run */
+	float			stat_iterations;
 	PtrImage		ptr_im1, ptr_im2;	/* used for storing variables corresponding to nodes */
+	int				threads;			/* threads of the post-processing */
+	LongImage		x_prior;			/* initial disparities of SetPrior (NULL if not used) */
+	int				prior_band, prior_min, prior_max;	/* band around x_prior, range of x_prior */
 
 	/********* INTERNAL FUNCTIONS **************/
 	typedef enum
@@ -166,6 +206,18 @@ private:
 		METHOD_BVZ
 	} Method;
 	void		Run_KZ_BVZ(Method method);
+	void		InitDisparityMaps();
+	int			ResetLabels(bool *buf, int label_num, Method method);
+
+	/* post-processing of the rows y_begin <= y < y_end, the rows are split into
+	   bands which are processed concurrently */
+	typedef void (Match::*RowFunction)(int y_begin, int y_end);
+	void		ForEachRows(RowFunction func, bool parallel = true);
+	void		MAKE_UNIQUE_clear(int y_begin, int y_end);
+	void		MAKE_UNIQUE_rows(int y_begin, int y_end);
+	void		CROSS_CHECK_left(int y_begin, int y_end);
+	void		CROSS_CHECK_right(int y_begin, int y_end);
+	void		FILL_OCCLUSIONS_rows(int y_begin, int y_end);
 	void		InitSubPixel();
 	void		SubPixel(GrayImage Im, GrayImage ImMin, GrayImage ImMax);
 	void		SubPixelColor(RGBImage Im, RGBImage ImMin, RGBImage ImMax);
@@ -222,6 +274,23 @@ private:
 	int			KZ2_ComputeEnergy();			/* computes current energy */
 	void		KZ2_Expand(Coord a);			/* computes the minimum a-expansion configuration */
 
+	/*
+		KZ2 for rectified images (only horizontal disparities). The data and
+		smoothness terms (GRAY/COLOR, SUBPIXEL, L1/L2) are template parameters,
+		so they are inlined into the construction of the graph.
+	*/
+	bool		KZ2_is_1D();
+	bool		KZ2_in_band(Coord p, Coord a);
+	bool		KZ2_label_in_band(Coord a);
+	template <bool COLOR, bool SUBPIXEL, bool L2>
+	int			KZ2_data_penalty_1D(int y, int xl, int xr);
+	template <bool COLOR>
+	int			KZ2_smoothness_penalty2_1D(Coord p, Coord np, int dx);
+	template <bool COLOR, bool SUBPIXEL, bool L2>
+	int			KZ2_ComputeEnergy_1D();
+	template <bool COLOR, bool SUBPIXEL, bool L2>
+	void		KZ2_Expand_1D(Coord a);
+
 
 
 
@@ -234,5 +303,6 @@ private:
 };
 
 #define MATCH_INFINITY 10000		/* infinite capacity */
+#define CUTOFF 1000					/* maximal data penalty of a color channel */
 
 #endif
@@ -0,0 +1,155 @@
+/***********************************************************************
+ * Author:       Franziska Krüger
+ * Requirements: POSIX (rename, utimensat)
+ *
+ * Description:
+ * ------------
+ * Work queue for batch processing on a shared filesystem. Several
+ * processes (on one or more machines) take image pairs from the same
+ * queue directory:
+ *
+ *     <queue>/pending/<pair>@<attempt>.job   waiting pairs
+ *     <queue>/leases/<pair>@<attempt>.job    pairs in progress
+ *     <queue>/done/<pair>@<attempt>.job      finished pairs
+ *     <queue>/failed/<pair>@<attempt>.job    pairs without retries left
+ *
+ * A job file holds one daemon request line (see deblur_daemon.hpp).
+ * A pair is claimed by renaming it from pending to leases which is
+ * atomic, so exactly one worker gets it. While the pair is processed the
+ * worker touches the lease (heartbeat). Leases that weren't touched for
+ * the lease timeout are moved back to pending with an increased attempt
+ * counter, or to failed if there are no retries left.
+ *
+ ************************************************************************
+*/
+
+#ifndef BATCH_QUEUE_H
+#define BATCH_QUEUE_H
+
+#include <string>
+#include <ctime>      // time_t
+
+
+namespace deblur {
+
+    /**
+     * A claimed pair
+     */
+    struct batchLease {
+        std::string pair;       // name of the pair
+        int attempt;            // 1 for the first try
+        std::string request;    // request line of the job file
+        std::string file;       // current path of the job file
+    };
+
+    /**
+     * Number of job files in each queue folder
+     */
+    struct batchQueueStatus {
+        int pending = 0;
+        int leased = 0;
+        int done = 0;
+        int failed = 0;
+    };
+
+
+    class BatchQueue {
+
+      public:
+
+        /**
+         * @param directory    queue folder on a shared filesystem
+         * @param leaseTimeout seconds without heartbeat until a lease expires
+         * @param maxAttempts  maximal number of tries for each pair
+         */
+        BatchQueue(const std::string& directory, const int leaseTimeout = 60, const int maxAttempts = 3);
+
+        /**
+         * Creates the queue folders if they don't exist.
+         */
+        void create();
+
+        /**
+         * Adds a pair to the pending jobs.
+         *
+         * @param pair    unique name of the pair (without '@' and '/')
+         * @param request request line for the pair
+         */
+        void enqueue(const std::string& pair, const std::string& request);
+
+        /**
+         * Checks if the pair is in any of the queue folders.
+         */
+        bool contains(const std::string& pair);
+
+        /**
+         * Claims a pending pair.
+         *
+         * @param  lease claimed pair
+         * @return       false if there is no pending pair
+         */
+        bool claim(batchLease& lease);
+
+        /**
+         * Renews the lease. Returns false if the lease was lost
+         * (expired and requeued by another process).
+         */
+        bool heartbeat(const batchLease& lease);
+
+        /**
+         * Marks the pair as finished. Returns false if the lease was lost.
+         */
+        bool complete(const batchLease& lease);
+
+        /**
+         * Gives the pair back after an error. It is retried if there
+         * are attempts left, otherwise it is moved to failed and the
+         * error is saved next to the job file.
+         *
+         * @param lease claimed pair
+         * @param error description of the error
+         */
+        void release(const batchLease& lease, const std::string& error);
+
+        /**
+         * Requeues all expired leases.
+         *
+         * @return number of requeued or failed pairs
+         */
+        int requeueExpired();
+
+        /**
+         * Counts the job files in the queue folders.
+         */
+        batchQueueStatus status();
+
+        const std::string& path() const;
+
+
+      private:
+
+        const std::string directory;
+        const int leaseTimeout;
+        const int maxAttempts;
+
+        /**
+         * Current time of the shared filesystem. Using the modification time
+         * of a file avoids problems with different clocks of the machines.
+         */
+        time_t filesystemTime();
+
+        /**
+         * Moves a lease to pending or to failed if there are no attempts left.
+         */
+        bool retry(const std::string& leaseFile, const std::string& pair, const int attempt,
+                   const std::string& error);
+    };
+
+
+    /**
+     * Creates a folder and all missing parent folders.
+     */
+    void makeDirectories(const std::string& path);
+}
+
+#endif
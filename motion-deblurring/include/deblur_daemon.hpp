@@ -0,0 +1,233 @@
+/***********************************************************************
+ * Author:       Franziska Krüger
+ * Requirements: OpenCV 3, POSIX (Unix domain sockets, shared memory)
+ *
+ * Description:
+ * ------------
+ * Long-running deblurring service. Jobs are received over a local Unix
+ * socket or from a spool directory and run on a persistent pool of
+ * workers which share the preloaded top-level kernels.
+ *
+ * Request (one line):
+ *     left=<in> right=<in> out-left=<out> out-right=<out> [id=<name>]
+ *     [threads=<n>] [psf-width=<n>] [layers=<n>] [max-top-nodes=<n>]
+ *     [max-disparity=<n>] [deconv=fft|irls]
+ *
+ * The fields are separated by tabs if the line contains one (paths with
+ * spaces), otherwise by spaces.
+ *
+ * Paths are filenames or shared-memory segments written as shm:<name>.
+ * A segment contains a shmImageHeader followed by the continuous pixel data.
+ *
+ * Reply (one line):
+ *     ok id=<name> total=<ms> disparity=<ms> region-tree=<ms> ...
+ *     error id=<name> <message>
+ *
+ * Additional requests: ping, status, shutdown
+ *
+ ************************************************************************
+*/
+
+#ifndef DEBLUR_DAEMON_H
+#define DEBLUR_DAEMON_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <opencv2/opencv.hpp>
+
+#include "depth_aware_deblurring.hpp"
+
+
+namespace deblur {
+
+    /**
+     * Header in front of the pixel data of a shared-memory image
+     */
+    struct shmImageHeader {
+        char magic[4];      // "DBSM"
+        int rows;
+        int cols;
+        int type;           // OpenCV type like CV_8UC3
+    };
+
+    /**
+     * One deblurring request of a client
+     */
+    struct deblurJob {
+        std::string id;
+        std::string left;
+        std::string right;
+        std::string resultLeft;
+        std::string resultRight;
+        deblurOptions options;
+
+        /**
+         * called with the reply line after the job is finished
+         */
+        std::function<void(const std::string&)> reply;
+    };
+
+    /**
+     * Splits a line into fields at tabs if it contains one, otherwise at
+     * whitespace. Empty fields are skipped.
+     *
+     * @param  line request or list line
+     * @return      fields
+     */
+    std::vector<std::string> splitRequestFields(const std::string& line);
+
+    /**
+     * Parses a request line. Options that aren't given are taken
+     * from the defaults.
+     *
+     * @param  request  request line
+     * @param  defaults default parameters of the daemon
+     * @return          job without id (if not given) and reply callback
+     */
+    deblurJob parseJobRequest(const std::string& request, const deblurOptions& defaults);
+
+    /**
+     * Loads an image from a file or a shared-memory segment (shm:<name>)
+     *
+     * @param  path filename or shm:<name>
+     * @return      copy of the image
+     */
+    cv::Mat readJobImage(const std::string& path);
+
+    /**
+     * Saves an image to a file or a shared-memory segment (shm:<name>).
+     * The segment is created or resized if necessary.
+     *
+     * @param path  filename or shm:<name>
+     * @param image image to save
+     */
+    void writeJobImage(const std::string& path, const cv::Mat& image);
+
+
+    /**
+     * FIFO queue of jobs with a fixed capacity
+     */
+    class JobQueue {
+
+      public:
+
+        JobQueue(const int capacity);
+
+        /**
+         * Appends a job. Returns false if the queue is full or closed.
+         */
+        bool tryPush(deblurJob& job);
+
+        /**
+         * Waits for the next job. Returns false if the queue is closed
+         * and there are no remaining jobs.
+         */
+        bool pop(deblurJob& job);
+
+        /**
+         * Wakes up all waiting workers. Remaining jobs are still delivered.
+         */
+        void close();
+
+        int size();
+
+        int capacity() const;
+
+      private:
+
+        const int maxJobs;
+        bool closed;
+        std::deque<deblurJob> jobs;
+        std::mutex m;
+        std::condition_variable available;
+    };
+
+
+    class DeblurDaemon {
+
+      public:
+
+        /**
+         * Starts the worker pool.
+         *
+         * @param defaults  parameters for requests that don't specify them (incl. cached kernels)
+         * @param workers   number of jobs running at the same time
+         * @param queueSize maximal number of waiting jobs
+         */
+        DeblurDaemon(const deblurOptions& defaults, const int workers = 1, const int queueSize = 8);
+
+        /**
+         * Stops serving and waits until the queued jobs are finished.
+         */
+        ~DeblurDaemon();
+
+        /**
+         * Handles one request line. Jobs are queued and replied asynchronously,
+         * all other requests are replied immediately.
+         *
+         * @param request request line
+         * @param reply   callback for the reply line
+         */
+        void handleRequest(const std::string& request, std::function<void(const std::string&)> reply);
+
+        /**
+         * Accepts clients on a Unix domain socket until stop() is called.
+         * Each connection sends one request and receives one reply.
+         *
+         * @param socketPath path of the socket (an existing file is replaced)
+         */
+        void serveSocket(const std::string& socketPath);
+
+        /**
+         * Polls a spool directory until stop() is called. Each <name>.job file
+         * holds one request. It is renamed to <name>.running while processed
+         * and the reply is written to <name>.done or <name>.failed.
+         *
+         * @param directory    spool directory
+         * @param pollInterval milliseconds between two directory scans
+         */
+        void serveSpool(const std::string& directory, const int pollInterval = 200);
+
+        /**
+         * Lets serveSocket and serveSpool return. Safe to call from a signal handler.
+         */
+        void stop();
+
+        bool isRunning() const;
+
+
+      private:
+
+        deblurOptions defaults;
+        JobQueue queue;
+        std::vector<std::thread> workers;
+        std::atomic<bool> running;
+        std::atomic<int> jobCounter;
+
+        /**
+         * Handles one request line like handleRequest. If the queue is full,
+         * the job is replied with an error only if replyIfFull is set.
+         * Returns false if the job wasn't queued because the queue is full.
+         */
+        bool dispatch(const std::string& request, std::function<void(const std::string&)> reply,
+                      const bool replyIfFull);
+
+        /**
+         * Worker loop: runs jobs until the queue is closed.
+         */
+        void work();
+
+        /**
+         * Runs the algorithm for a job and returns the reply line.
+         */
+        std::string runJob(const deblurJob& job);
+    };
+}
+
+#endif
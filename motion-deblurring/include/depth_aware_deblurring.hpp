@@ -29,12 +29,104 @@
 #define DEPTH_AWARE_DEBLURRING_H
 
 #include <string>
+#include <vector>
 #include <opencv2/opencv.hpp> // cv::Mat
 #include "depth_deblur.hpp"
+#include "run_metrics.hpp"
+#include "psf_bank.hpp"
+#include "stage_cache.hpp"
+#include "disparity_sequence.hpp"
+#include "psf_sequence.hpp"
+#include "preview_deblur.hpp"
 
 
 namespace deblur {
 
+    /**
+     * Parameters of one run of the depth-aware motion deblurring
+     */
+    struct deblurOptions {
+        int threads = 1;                                   // threads for PSF estimation and deconvolution
+        int psfWidth = 35;                                 // approximate PSF width
+        int layers = 12;                                   // number of regions / disparity layers
+        int maxTopLevelNodes = 3;                          // max top level nodes in region tree
+        DepthDeblur::deconvAlgo deconvAlgo = DepthDeblur::IRLS;
+        int maxDisparity = 160;                            // maximum disparity between the views
+        int passes = 1;                                    // 2: second pass with the disparities of the deblurred views
+        bool pooledAllocator = true;                       // recycle matrix buffers during the run
+        size_t memoryBudget = 0;                           // bytes for concurrent solves (0: unlimited)
+        double timeBudgetMs = 0;                           // wall time of the run (0: no budget, see time_budget.hpp)
+        cv::Rect roi;                                      // region of interest, the result has its size (empty: whole image)
+        bool color = false;                                // color result of color views (otherwise gray)
+        DepthDeblur::colorMode colorMode = DepthDeblur::PER_CHANNEL;    // LUMINANCE: one solve per region (--color)
+
+        /**
+         * budget shared by concurrent runs (e.g. the workers of the daemon).
+         * If set memoryBudget is ignored.
+         */
+        MemoryBudget* sharedMemoryBudget = nullptr;
+
+        /**
+         * preloaded top-level kernels. If empty they are loaded from
+         * kernels.psfb or kernel<i>.png inside the current working directory.
+         */
+        std::vector<cv::Mat> toplevelKernels;
+
+        /**
+         * If set the PSFs of all region tree nodes are stored there
+         * (e.g. for a PSF bank).
+         */
+        std::vector<psfEntry>* psfs = nullptr;
+
+        /**
+         * cache for disparity maps, PSFs and deconvolved regions on disk.
+         * Steps with unchanged inputs are skipped (nullptr: no cache).
+         */
+        StageCache* cache = nullptr;
+
+        /**
+         * frames of a stereo video: the disparity estimation starts with the
+         * map of the previous frame (nullptr: single image pair)
+         */
+        DisparitySequence* sequence = nullptr;
+
+        /**
+         * frames of a stereo video: the PSFs of the previous frame are kept
+         * if they still fit (nullptr: estimate all PSFs)
+         */
+        PSFSequence* psfSequence = nullptr;
+
+        /**
+         * disparities and PSFs of a preview of the same views as warm start
+         * (nullptr: no preview, see preview_deblur.hpp)
+         */
+        const previewResult* preview = nullptr;
+    };
+
+    /**
+     * Starts depth-aware motion deblurring algorithm with given blurred images (matrices)
+     * 
+     * @param blurredLeft       OpenCV matrix of blurred left image
+     * @param blurredRight      OpenCV matrix of blurred right image
+     * @param deblurredLeft     result left
+     * @param deblurredRight    result right
+     * @param options           parameters of the algorithm
+     * @return                  time, resources and statistics of the run
+     */
+    RunMetrics runDepthDeblur(const cv::Mat &blurredLeft, const cv::Mat &blurredRight,
+                              cv::Mat& deblurredLeft, cv::Mat& deblurredRight,
+                              const deblurOptions& options);
+
+    /**
+     * Loads the top-level kernels from the PSF bank kernels.psfb inside the
+     * given directory or, if it doesn't exist, the kernel images kernel0.png,
+     * kernel1.png, ... until a file is missing. The kernels are energy preserving.
+     * 
+     * @param  directory folder with the kernels or path of a PSF bank
+     * @return           kernels in order of the top-level nodes
+     */
+    std::vector<cv::Mat> loadToplevelKernels(const std::string& directory = ".");
+
     /**
      * Starts depth-aware motion deblurring algorithm with given blurred images (matrices)
      * 
@@ -47,12 +139,13 @@ namespace deblur {
      * @param maxTopLevelNodes  maximum of top level nodes in region tree construction
      * @param deconvAlgo        algorithm used for deconvolution (FFT or IRLS)
      * @param maxDisparity      maximum disparity between left and right view
+     * @return                  time, resources and statistics of the run
      */
-    void runDepthDeblur(const cv::Mat &blurredLeft, const cv::Mat &blurredRight,
-                        cv::Mat& deblurredLeft, cv::Mat& deblurredRight, const int threads = 1,
-                        int psfWidth = 35, const int layers = 12, const int maxTopLevelNodes = 3,
-                        const DepthDeblur::deconvAlgo deconvAlgo = DepthDeblur::IRLS,
-                        const int maxDisparity = 160);
+    RunMetrics runDepthDeblur(const cv::Mat &blurredLeft, const cv::Mat &blurredRight,
+                              cv::Mat& deblurredLeft, cv::Mat& deblurredRight, const int threads = 1,
+                              int psfWidth = 35, const int layers = 12, const int maxTopLevelNodes = 3,
+                              const DepthDeblur::deconvAlgo deconvAlgo = DepthDeblur::IRLS,
+                              const int maxDisparity = 160);
 
     /**
      * Loads images from given filenames and then starts the depth-aware motion 
@@ -67,14 +160,31 @@ namespace deblur {
      * @param maxDisparity        maximum disparity between left and right view
      * @param filenameDeblurLeft  filename for result left
      * @param filenameDeblurRight filename for result right
+     * @return                    time, resources and statistics of the run
+     */
+    RunMetrics runDepthDeblur(const std::string filenameLeft, const std::string filenameRight,
+                              const int threads = 1, int psfWidth = 35, const int layers = 12,
+                              const int maxTopLevelNodes = 3,
+                              const DepthDeblur::deconvAlgo deconvAlgo = DepthDeblur::IRLS,
+                              const int maxDisparity = 160, 
+                              const std::string filenameDeblurLeft = "deblur-left.png",
+                              const std::string filenameDeblurRight = "deblur-right.png");
+
+    /**
+     * Loads images from given filenames and then starts the depth-aware motion 
+     * deblurring algorithm
+     * 
+     * @param filenameLeft        relative or absolute path to blurred left image
+     * @param filenameRight       relative or absolute path to blurred right image
+     * @param options             parameters of the algorithm
+     * @param filenameDeblurLeft  filename for result left
+     * @param filenameDeblurRight filename for result right
+     * @return                    time, resources and statistics of the run
      */
-    void runDepthDeblur(const std::string filenameLeft, const std::string filenameRight,
-                        const int threads = 1, int psfWidth = 35, const int layers = 12,
-                        const int maxTopLevelNodes = 3,
-                        const DepthDeblur::deconvAlgo deconvAlgo = DepthDeblur::IRLS,
-                        const int maxDisparity = 160, 
-                        const std::string filenameDeblurLeft = "deblur-left.png",
-                        const std::string filenameDeblurRight = "deblur-right.png");
+    RunMetrics runDepthDeblur(const std::string filenameLeft, const std::string filenameRight,
+                              const deblurOptions& options,
+                              const std::string filenameDeblurLeft = "deblur-left.png",
+                              const std::string filenameDeblurRight = "deblur-right.png");
 
 }
 
@@ -20,10 +20,16 @@
 #include <stack>
 #include <queue>                        // FIFO queue
 #include <mutex>
+#include <chrono>
 #include <opencv2/opencv.hpp>
 
 #include "region_tree.hpp"
 #include "disparity_estimation.hpp"
+#include "run_metrics.hpp"
+#include "memory_budget.hpp"
+#include "psf_bank.hpp"
+#include "psf_sequence.hpp"
+#include "stage_cache.hpp"
 
 
 namespace deblur {
@@ -34,6 +40,12 @@ namespace deblur {
 
         enum deconvAlgo { FFT, IRLS };
 
+        /**
+         * Deconvolution of color images: each channel with IRLS or just the
+         * luminance with the chroma of the blurred image restored afterwards
+         */
+        enum colorMode { PER_CHANNEL, LUMINANCE };
+
         /**
          * Constructor for depth-deblurring of stereo images
          * 
@@ -54,10 +66,108 @@ namespace deblur {
          * @param views         left and right image
          * @param disparityAlgo algorithm: SGBM, MATCH
          * @param maxDisparity  estimated maximum disparity
+         * @param centers       disparities of the layers (of the down sampled disparity map)
+         *                      for the quantization. If empty they are found with kmeans.
+         * @param threads       number of threads of the post-processing of the disparity maps
          */
         void disparityEstimation(const std::array<cv::Mat, 2>& views,
                                  const deblur::disparityAlgo disparityAlgo = deblur::MATCH,
-                                 int maxDisparity = 160);
+                                 int maxDisparity = 160,
+                                 const std::vector<float>& centers = std::vector<float>(),
+                                 const int threads = 1);
+
+        /**
+         * Returns the disparities of the layers used by the last disparity estimation
+         * (sorted, of the down sampled disparity map).
+         */
+        const std::vector<float>& getDisparityCenters() const {
+            return disparityCenters;
+        }
+
+        /**
+         * Returns the quantized disparity maps of the left and right view.
+         */
+        const std::array<cv::Mat, 2>& getDisparityMaps() const {
+            return disparityMaps;
+        }
+
+        /**
+         * Returns the disparity maps of the down sampled views before the
+         * quantization (result of the matching).
+         */
+        const std::array<cv::Mat, 2>& getMatchedDisparityMaps() const {
+            return matchedDisparityMaps;
+        }
+
+        /**
+         * Sets an initial disparity map for the graph-cut matching (e.g. of the
+         * previous frame of a video). It has to exist during the disparity estimation.
+         *
+         * @param prior initial map of the down sampled views (nullptr: full search)
+         */
+        void setDisparityPrior(const disparityPrior* prior) {
+            disparityPriorMap = prior;
+        }
+
+        /**
+         * Sets the result of a disparity estimation (e.g. loaded from a cache)
+         * instead of computing it.
+         * 
+         * @param maps    quantized disparity maps of the left and right view
+         * @param centers disparities of the layers
+         */
+        void setDisparityMaps(const std::array<cv::Mat, 2>& maps, const std::vector<float>& centers);
+
+        /**
+         * Returns the PSFs of the leaf regions (one per disparity layer).
+         */
+        std::vector<cv::Mat> getLeafPSFs();
+
+        /**
+         * Sets the PSFs of the leaf regions, e.g. PSFs estimated on another
+         * part of the same image. Call it after the region tree reconstruction.
+         * 
+         * @param psfs one PSF per disparity layer
+         */
+        void setLeafPSFs(const std::vector<cv::Mat>& psfs);
+
+        /**
+         * Returns the PSFs of all region tree nodes with node id, parent and
+         * entropy (e.g. for a PSF bank).
+         * 
+         * @param pass number of the current pass
+         */
+        std::vector<psfEntry> getPSFs(const int pass);
+
+        /**
+         * Sets the PSFs and entropies of the region tree nodes (e.g. loaded from
+         * a cache) instead of estimating them. Call it after the region tree
+         * reconstruction.
+         * 
+         * @param psfs PSFs with the ids of their nodes
+         */
+        void setPSFs(const std::vector<psfEntry>& psfs);
+
+        /**
+         * Sets the PSFs of the previous frame of a video. The mid-level kernel
+         * estimation keeps the previous PSF of a node if its selection energy is
+         * good enough and uses it as additional candidate otherwise. It has to
+         * exist during the mid-level kernel estimation.
+         *
+         * @param prior PSFs of the previous frame (nullptr: estimate all nodes)
+         */
+        void setPSFPrior(const psfPrior* prior) {
+            psfPriorSet = prior;
+        }
+
+        /**
+         * Returns the selection energy of the last full estimation of each node
+         * (0: no selection). Carried PSFs keep the energy of the frame where
+         * they were estimated, so a slow drift is detected too.
+         */
+        const std::vector<float>& getReferenceEnergies() const {
+            return referenceEnergies;
+        }
 
         /**
          * Creates a region tree from disparity maps
@@ -71,9 +181,13 @@ namespace deblur {
          *
          * There is a possibility to load kernel-images because
          * the used algorithm doesn't work very well.
+         *
+         * If kernels are given (e.g. cached by a long-running process) they are
+         * used instead of the kernel-images in the current working directory.
          * 
+         * @param kernels preloaded top-level kernels (kernel i for top-level node i)
          */
-        void toplevelKernelEstimation();
+        void toplevelKernelEstimation(const std::vector<cv::Mat>& kernels = std::vector<cv::Mat>());
 
         /**
          * Estimates the kernel of all middle and leaf level nodes.
@@ -89,7 +203,7 @@ namespace deblur {
          * @param dst     deconvolved image
          * @param view    determine which view is deconvolved
          * @param threads number of threads for parallel deconvolution
-         * @param color   use color image
+         * @param color   use color image (see setColorMode)
          */
         void deconvolve(cv::Mat& dst, view view, int nThreads = 1, bool color = false);
 
@@ -99,10 +213,85 @@ namespace deblur {
          * @param dst     deconvolved image
          * @param view    determine which view is deconvolved
          * @param threads number of threads for parallel deconvolution
-         * @param color   use color image
+         * @param color   use color image (see setColorMode)
          */
         void deconvolveTopLevel(cv::Mat& dst, view view, int nThreads = 1, bool color = false);
 
+        /**
+         * Limits the memory of the concurrent PSF estimations, PSF selections and
+         * deconvolutions. Each task reserves its estimated footprint before it starts.
+         * 
+         * @param budget shared memory budget (nullptr: unlimited)
+         */
+        void setMemoryBudget(MemoryBudget* budget) {
+            memoryBudget = budget;
+        }
+
+        /**
+         * Sets a cache for the deconvolved regions. A region is only deconvolved
+         * if the view, its PSF or its mask changed.
+         * 
+         * @param cache cache on disk (nullptr: no cache)
+         */
+        void setStageCache(StageCache* cache) {
+            stageCache = cache;
+        }
+
+        /**
+         * Sets a deadline (anytime mode). PSF estimations and selections which
+         * would start after it keep the PSF of the parent and regions which would
+         * start after it are deconvolved with the fast FFT deconvolution.
+         * 
+         * @param time deadline (time_point::max(): no deadline)
+         */
+        void setDeadline(const std::chrono::steady_clock::time_point& time) {
+            deadline = time;
+        }
+
+        /**
+         * Restricts the PSF estimation and the deconvolution to a region of interest.
+         * Only nodes whose regions intersect the ROI dilated by the PSF width are
+         * estimated and selected (the others keep the PSF of the parent) and only
+         * the ROI plus twice the PSF width is deconvolved.
+         * 
+         * @param roi region of interest inside of the views
+         */
+        void setRegionOfInterest(const cv::Rect& roi);
+
+        /**
+         * Deconvolves the gray regions with the fast FFT deconvolution instead
+         * of IRLS (e.g. for a preview).
+         */
+        void setFastDeconvolution(const bool fast) {
+            fastDeconvolution = fast;
+        }
+
+        /**
+         * Sets how color images are deconvolved. LUMINANCE deconvolves only the
+         * gray image (the Y channel) and transfers the chroma of the blurred image
+         * with local linear models (see transferChroma), which needs a third of
+         * the IRLS solves of PER_CHANNEL (the default).
+         */
+        void setColorMode(const colorMode mode) {
+            colorDeconvolution = mode;
+        }
+
+        /**
+         * Sets the number of iterations of the IRLS deconvolution of the regions.
+         */
+        void setIRLSIterations(const int iterations) {
+            irlsIterations = iterations;
+        }
+
+        /**
+         * Appends the statistics of this pass (disparity estimation, region tree nodes,
+         * PSF selection, deconvolution and thread utilization) to the run metrics.
+         * 
+         * @param metrics metrics of the whole run
+         * @param pass    number of the current pass
+         */
+        void collectMetrics(RunMetrics& metrics, const int pass);
+
 
       protected:
 
@@ -218,6 +407,7 @@ namespace deblur {
          *      - own psf (also it may be unreliable)
          *      - parent psf
          *      - reliable sibbling psf
+         *      - psf of the previous frame (video)
          *      
          * @param candiates resulting vector of candidates
          * @param id        current node id
@@ -234,6 +424,36 @@ namespace deblur {
          */
         void psfSelection(std::vector<cv::Mat>& candidates, cv::Mat& winnerPSF, int id);
 
+        /**
+         * Energy of a PSF in the PSF selection: the left view is deconvolved and
+         * compared with its shock filtered version.
+         *
+         *     E = 1 - corr(∇latent, ∇shockFiltered)
+         *
+         * @param  psf  candidate PSF
+         * @param  mask mask of the region in the left view
+         * @param  id   node ID
+         * @param  i    index of the candidate
+         * @return      energy in [0, 2] (the smaller the better)
+         */
+        float selectionEnergy(const cv::Mat& psf, cv::Mat& mask, int id, int i);
+
+        /**
+         * PSF of the node in the previous frame if the node has the same parent
+         * and the same layers (nullptr: no previous PSF).
+         */
+        const psfEntry* previousPSF(int id);
+
+        /**
+         * Keeps the PSF of the previous frame for a node if its selection energy
+         * isn't worse than the reference energy plus the threshold.
+         *
+         * @param  id       node ID
+         * @param  previous PSF of the node in the previous frame
+         * @return          if the previous PSF was carried forward
+         */
+        bool carryPreviousPSF(int id, const psfEntry& previous);
+
         /**
          * Computed the correlation of gradient magnitudes inside the same region
          * of two images.
@@ -279,11 +499,6 @@ namespace deblur {
          */
         std::stack<int> regionStack;
 
-        /**
-         * results of region deconvolution
-         */
-        std::vector<cv::Mat> regionDeconv;
-
         /**
          * queue for parallel mid psf estimation
          */
@@ -297,10 +512,23 @@ namespace deblur {
         /*
          * This method is used by threads for parallel deconvolution of the regions. It 
          * uses a thread safe access to the regionStack.
-         * Results are stored in regionDeonv.
+         * Each result is copied into dst (with the region mask) as soon as it is finished.
          * 
          */
-        void deconvolveRegion(const view view, const bool color);
+        void deconvolveRegion(const view view, const bool color, cv::Mat& dst);
+
+        /**
+         * Combines the deconvolved luminance of a view with the chroma of the
+         * blurred color view. Pixels outside of the deconvolved regions (and
+         * outside of the ROI) stay black like in the per-channel result.
+         * 
+         * @param luminance deconvolved gray image
+         * @param view      view of the luminance
+         * @param regions   region tree nodes of the luminance
+         * @param dst       deconvolved color image
+         */
+        void restoreColor(const cv::Mat& luminance, const view view, const std::vector<int>& regions,
+                          cv::Mat& dst);
 
         /**
          * Provides a mutex lock to safely get and pop the top item
@@ -325,9 +553,202 @@ namespace deblur {
         /**
          * Provides a mutex lock to safely get and pop the top item
          * of the shared queue. Returns false if the queue is empty.
-         * 
+         * On success the time since idleSince (the end of the last node of
+         * the thread, so the polling of the empty queue is included) is
+         * counted as spin time.
+         */
+        bool safeQueueAccess(std::queue<int>* sharedQueue, int& item,
+                             const std::chrono::steady_clock::time_point idleSince);
+
+
+    //--------------------------------------------------------------------------------------------
+    //
+    // statistics for the run metrics
+    //
+    // --------------------------------------------------------------------------------------------
+
+        /**
+         * disparities of the layers of the last quantization
+         */
+        std::vector<float> disparityCenters;
+
+        /**
+         * memory budget of the concurrent tasks (nullptr: unlimited)
+         */
+        MemoryBudget* memoryBudget = nullptr;
+
+        /**
+         * cache of the deconvolved regions (nullptr: no cache)
+         */
+        StageCache* stageCache = nullptr;
+
+        /**
+         * hash of the view of the current deconvolution for the region cache keys
+         */
+        CacheKey latentKey = CacheKey("latent");
+
+        /**
+         * mutex for the statistics written by several threads
+         */
+        std::mutex mMetrics;
+
+        /**
+         * energy and iterations of the graph-cut disparity estimation
+         */
+        disparityMetrics matchStatistics;
+
+        /**
+         * unquantized disparity maps of the down sampled views
+         */
+        std::array<cv::Mat, 2> matchedDisparityMaps;
+
+        /**
+         * initial map of the graph-cut matching (nullptr: full search)
+         */
+        const disparityPrior* disparityPriorMap = nullptr;
+
+        /**
+         * number of candidates, winner and its energy of the PSF selection of each node
+         */
+        std::vector<int> selectionCandidates;
+        std::vector<int> selectionWinners;
+        std::vector<float> selectionEnergies;
+
+        /**
+         * PSFs of the previous frame (nullptr: estimate all nodes)
+         */
+        const psfPrior* psfPriorSet = nullptr;
+
+        /**
+         * nodes which kept the PSF of the previous frame (char for concurrent writes)
+         */
+        std::vector<char> carriedPSFs;
+
+        /**
+         * selection energy of the last full estimation of each node
+         */
+        std::vector<float> referenceEnergies;
+
+        /**
+         * ROI dilated by the PSF support and the deconvolved part of the views
+         * (whole views without ROI)
+         */
+        cv::Rect roiSupport;
+        cv::Rect roiDeconvolution;
+
+        /**
+         * true if the region of the node intersects the ROI (in one of the views)
+         */
+        bool inRegionOfInterest(int id);
+
+        /**
+         * deadline of the anytime mode
          */
-        bool safeQueueAccess(std::queue<int>* sharedQueue, int& item);
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+
+        /**
+         * iterations of the IRLS deconvolution of the regions
+         */
+        int irlsIterations = 20;
+
+        /**
+         * FFT instead of IRLS deconvolution of the gray regions
+         */
+        bool fastDeconvolution = false;
+
+        /**
+         * deconvolution of color images
+         */
+        colorMode colorDeconvolution = PER_CHANNEL;
+
+        /**
+         * PSF estimations and selections skipped at the deadline and regions
+         * deconvolved with FFT at the deadline
+         */
+        int skippedNodes = 0;
+        int fastRegions = 0;
+
+        /**
+         * true if the deadline has passed
+         */
+        bool pastDeadline() const {
+            return std::chrono::steady_clock::now() > deadline;
+        }
+
+        /**
+         * IRLS statistics of each deconvolved region
+         */
+        std::vector<deconvolutionMetrics> deconvolutionStatistics;
+
+        /**
+         * wall and working time of each parallel section
+         */
+        std::vector<parallelMetrics> parallelStatistics;
+
+        /**
+         * working time of all threads in the current parallel section (ms)
+         */
+        double busyTime = 0;
+
+        /**
+         * working time of each work item (region tree node) in the current
+         * parallel section (ms). Each item is processed by one thread only.
+         */
+        std::vector<double> workItemTimes;
+
+        /**
+         * accesses of the shared queue/stack in the current parallel section
+         * (guarded by the mutex of the queue/stack, see parallelMetrics)
+         */
+        long accesses = 0;
+        long emptyAccesses = 0;
+        double waitTime = 0;
+        double spinTime = 0;        // idle mid-level workers between their nodes
+
+        /**
+         * working time of the mid-level PSF estimation and selection at each node
+         */
+        std::vector<double> nodeEstimationTimes;
+        std::vector<double> nodeSelectionTimes;
+
+        /**
+         * Adds working time of a thread to the current parallel section.
+         *
+         * @param milliseconds working time
+         * @param item         processed region tree node (-1: none)
+         */
+        void addBusyTime(const double milliseconds, const int item = -1);
+
+        /**
+         * Counts an access of the shared queue/stack. Has to be called
+         * while the mutex of the queue/stack is locked.
+         *
+         * @param request time of the access request (before locking)
+         * @param locked  time the lock was acquired
+         * @param success false if the queue/stack was empty
+         */
+        void countAccess(const std::chrono::steady_clock::time_point request,
+                         const std::chrono::steady_clock::time_point locked, const bool success);
+
+        /**
+         * Starts the parallel section (resets the working time and the access
+         * counters) and returns the start time.
+         */
+        std::chrono::steady_clock::time_point startParallelSection();
+
+        /**
+         * Saves the utilization, the queue accesses and the critical path of
+         * the finished parallel section.
+         *
+         * @param section   name of the section
+         * @param nThreads  number of threads
+         * @param start     start time (see startParallelSection)
+         * @param dependent true if a node is processed after its parent (level-wise
+         *                  PSF estimation), otherwise the work items are independent
+         */
+        void finishParallelSection(const std::string& section, const int nThreads,
+                                   const std::chrono::steady_clock::time_point start,
+                                   const bool dependent = false);
 
     };
 }
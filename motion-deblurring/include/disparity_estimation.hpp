@@ -14,6 +14,8 @@
 
 #include <opencv2/opencv.hpp>
 
+#include "run_metrics.hpp"     // disparityMetrics
+
 
 namespace deblur {
 
@@ -22,25 +24,67 @@ namespace deblur {
      */
     enum disparityAlgo { SGBM, MATCH };
 
+    /**
+     * Initial disparity map of the graph-cut matching (warm start),
+     * e.g. the result of the previous frame of a stereo video
+     */
+    struct disparityPrior {
+        cv::Mat map;        // left-right map of disparityFilledMatch for the same size and max disparity
+        int band = 2;       // only disparities within +-band of the prior are searched (0: all)
+    };
+
+    /**
+     * Parameters of OpenCVs semi global block matching
+     * (found nice parameter values for a good result on many images)
+     */
+    struct sgbmParams {
+        int minDisparity = -64;         // minimum disparity
+        int disparities = 16 * 10;      // range: maximum disparity minus minimum disparity (divisible by 16)
+        int blockSize = 9;              // matched block size (have to be odd: 3-11)
+        int p1 = 600;                   // penalty for disparity changes +/- 1
+        int p2 = 3000;                  // penalty for disparity changes more than 1
+        int disp12MaxDiff = 2;          // maximum allowed difference in the left-right disparity check
+        int preFilterCap = 0;           // truncation value for the prefiltered image pixels
+        int uniquenessRatio = 1;        // margin in percentage by which the best cost should win
+        int speckleWindowSize = 50;     // maximum size of smooth disparity regions (50-200)
+        int speckleRange = 1;           // maximum disparity variation within each connected component
+        int mode = cv::StereoSGBM::MODE_HH;  // full 8-path dynamic programming (MODE_SGBM needs less memory)
+        bool rightFromLeft = false;     // derive the right map from the left one instead of a second match
+    };
+
+
     /**
      * Disparity estimation algorithm using "Computing Visual Correspondence with Occlusions
      * using Graph Cuts" algorithm from Vladimir Kolmogorov and Ramin Zabih
      * 
-     * @param images       left and right image gray value
-     * @param dMaps        resulting maps for left-right and right-left disparity
+     * @param images       left and right image gray value or BGR (used without copy)
+     * @param dMaps        resulting maps for left-right and right-left disparity, maps of
+     *                     the image size and type CV_16S are kept, otherwise CV_8U
      * @param maxDisparity estimated maximum disparity
+     * @param stats        if not null the energy and iterations of KZ2 are saved
+     * @param threads      number of threads of the cross-checking and occlusion filling
+     * @param prior        if not null the matching starts with this map and searches only its band
      */
     void disparityFilledMatch(const std::array<cv::Mat, 2>& images, std::array<cv::Mat, 2>& dMaps,
-                              int maxDisparity);
+                              int maxDisparity, disparityMetrics* stats = nullptr, const int threads = 1,
+                              const disparityPrior* prior = nullptr);
 
     /**
      * Disparity estimation using the SGBM algorithm and filling the occlusions 
      * with the smallest disparity value of the neighborhood (on the line)
      * 
-     * @param images left and right image gray value
-     * @param dMaps  resulting maps for left-right and right-left disparity
+     * The occlusion filling and median filter run in bands of rows of both
+     * views concurrently.
+     *
+     * With more than one thread both directions are matched concurrently.
+     *
+     * @param images  left and right image gray value
+     * @param dMaps   resulting maps for left-right and right-left disparity
+     * @param threads number of threads of the matching and post-processing
+     * @param params  parameters of the matching
      */
-    void disparityFilledSGBM(const std::array<cv::Mat, 2>& images, std::array<cv::Mat, 2>& dMaps);
+    void disparityFilledSGBM(const std::array<cv::Mat, 2>& images, std::array<cv::Mat, 2>& dMaps,
+                             const int threads = 1, const sgbmParams& params = sgbmParams());
 
     /**
      * Fills occlusion regions (where the value is smaller than a given threshold) 
@@ -56,11 +100,15 @@ namespace deblur {
      * Uses OpenCVs semi global block matching algorithm to obtain
      * a disparity map with occlusion as black regions
      * 
+     * The matchers are kept in a pool and reused by later calls.
+     *
      * @param left         left image
      * @param right        right image
-     * @param disparityMap disparity with occlusions
+     * @param disparityMap disparity with occlusions (CV_8U), scaled by 255 / (max - min)
+     * @param params       parameters of the matching
      */
-    void semiGlobalBlockMatching(const cv::Mat& left, const cv::Mat& right, cv::Mat& disparityMap);
+    void semiGlobalBlockMatching(const cv::Mat& left, const cv::Mat& right, cv::Mat& disparityMap,
+                                 const sgbmParams& params = sgbmParams());
 
     /**
      * Quantizes two images with kmeans algorithm and sorts the
@@ -73,8 +121,22 @@ namespace deblur {
      * @param images          input images
      * @param k               cluster number
      * @param quantizedImages clustered images
+     * @param centers         if not null the sorted cluster centers are saved
+     */
+    void quantizeImage(const std::array<cv::Mat,2>& images, const int k, std::array<cv::Mat,2>& quantizedImages,
+                       std::vector<float>* centers = nullptr);
+
+    /**
+     * Quantizes two images with given cluster centers. Each pixel gets the index
+     * of the nearest center. This keeps the labels consistent between
+     * images that are quantized independently (e.g. tiles of a large image).
+     * 
+     * @param images          input images
+     * @param centers         sorted cluster centers
+     * @param quantizedImages clustered images
      */
-    void quantizeImage(const std::array<cv::Mat,2>& images, const int k, std::array<cv::Mat,2>& quantizedImages);
+    void quantizeImage(const std::array<cv::Mat,2>& images, const std::vector<float>& centers,
+                       std::array<cv::Mat,2>& quantizedImages);
 }
 
 #endif
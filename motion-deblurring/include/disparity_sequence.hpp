@@ -0,0 +1,122 @@
+/***********************************************************************
+ * Author:       Franziska Krüger
+ * Requirements: OpenCV 3
+ *
+ * Description:
+ * ------------
+ * Temporal warm start of the disparity estimation for stereo videos.
+ *
+ * Consecutive frames of a video differ only a little, so the graph-cut
+ * matching of a frame starts with the disparity map of the previous frame
+ * and only searches a small band around it. Labels outside of the band of
+ * all pixels are skipped completely.
+ *
+ * A scene cut is detected by comparing a small thumbnail of each frame with
+ * the one of the previous frame. After a cut (and for the first frame) the
+ * full disparity range is searched.
+ *
+ *     DisparitySequence sequence;
+ *     options.sequence = &sequence;
+ *
+ *     for (each frame) {
+ *         runDepthDeblur(left, right, deblurLeft, deblurRight, options);
+ *     }
+ *
+ ************************************************************************
+*/
+
+#ifndef DISPARITY_SEQUENCE_H
+#define DISPARITY_SEQUENCE_H
+
+#include <opencv2/opencv.hpp>
+
+#include "disparity_estimation.hpp"     // disparityPrior
+
+
+namespace deblur {
+
+    class DisparitySequence {
+
+      public:
+
+        /**
+         * @param band         search band around the disparities of the previous frame
+         *                     (of the down sampled disparity map)
+         * @param cutThreshold mean absolute gray value difference of the thumbnails of
+         *                     two frames above which a scene cut is assumed
+         */
+        DisparitySequence(const int band = 2, const double cutThreshold = 25);
+
+        /**
+         * Starts the next frame. It is compared with the previous frame and on
+         * a scene cut the disparity map of the previous frame is dropped.
+         *
+         * @param  left left view of the frame
+         * @return      prior for the disparity estimation (nullptr: full search)
+         */
+        const disparityPrior* nextFrame(const cv::Mat& left);
+
+        /**
+         * Keeps the disparity map of the current frame for the next one.
+         *
+         * @param map          left-right map of the matching (see DepthDeblur::getMatchedDisparityMaps)
+         * @param disparityMs  wall time of the disparity estimation of the current frame
+         */
+        void update(const cv::Mat& map, const double disparityMs);
+
+        /**
+         * index of the current frame (starting with 0)
+         */
+        int frame() const {
+            return frames;
+        }
+
+        /**
+         * true if the current frame was started with the previous map
+         */
+        bool warmStart() const {
+            return warm;
+        }
+
+        /**
+         * true if a scene cut was detected in front of the current frame
+         */
+        bool sceneCut() const {
+            return cut;
+        }
+
+        /**
+         * number of detected scene cuts
+         */
+        int sceneCuts() const {
+            return cuts;
+        }
+
+        /**
+         * Speedup of the disparity estimation of the current frame compared to
+         * the last full search (1 for a full search, 0 if unknown).
+         */
+        double speedup() const;
+
+      private:
+
+        const double cutThreshold;
+
+        /**
+         * down sampled gray version of the previous frame
+         */
+        cv::Mat thumbnail;
+
+        disparityPrior prior;
+
+        int frames = -1;
+        int cuts = 0;
+        bool warm = false;
+        bool cut = false;
+
+        double fullSearchMs = 0;        // disparity estimation of the last full search
+        double currentMs = 0;
+    };
+}
+
+#endif
@@ -0,0 +1,93 @@
+/***********************************************************************
+ * Author:       Franziska Krüger
+ * Requirements: OpenCV 3, POSIX (mmap)
+ *
+ * Description:
+ * ------------
+ * Memory-mapped raw images for inputs and outputs that are too large
+ * for the main memory. The file starts with a rawImageHeader followed by
+ * the continuous pixel data. The operating system loads the pages on
+ * access and can drop them again, so only the parts in use need RAM.
+ *
+ *     MappedImage input("left.raw");
+ *     cv::Mat tile = input.image()(rect).clone();
+ *
+ ************************************************************************
+*/
+
+#ifndef MAPPED_IMAGE_H
+#define MAPPED_IMAGE_H
+
+#include <string>
+#include <opencv2/opencv.hpp>
+
+
+namespace deblur {
+
+    /**
+     * Header of a raw image file
+     */
+    struct rawImageHeader {
+        char magic[4];      // "DBRW"
+        int rows;
+        int cols;
+        int type;           // OpenCV type, e.g. CV_8UC3
+    };
+
+
+    class MappedImage {
+
+      public:
+
+        /**
+         * Maps an existing raw image.
+         *
+         * @param filename path of the raw file
+         * @param writable map it for reading and writing
+         */
+        MappedImage(const std::string& filename, const bool writable = false);
+
+        /**
+         * Creates a raw image of the given size (filled with zeros) and maps it
+         * for reading and writing.
+         */
+        MappedImage(const std::string& filename, const int rows, const int cols, const int type);
+
+        ~MappedImage();
+
+        MappedImage(const MappedImage&) = delete;
+        MappedImage& operator=(const MappedImage&) = delete;
+
+        /**
+         * The pixel data (no copy). Only valid as long as this object exists.
+         */
+        cv::Mat& image() {
+            return mat;
+        }
+
+        /**
+         * Writes the changed pages back to the file.
+         */
+        void flush();
+
+      private:
+
+        /**
+         * Maps the whole file and wraps the pixel data.
+         */
+        void map(const int fd, const bool writable);
+
+        std::string filename;
+        void* data = nullptr;
+        size_t length = 0;
+        cv::Mat mat;
+    };
+
+
+    /**
+     * Saves an image as raw image file.
+     */
+    void saveRawImage(const std::string& filename, const cv::Mat& image);
+}
+
+#endif
@@ -0,0 +1,151 @@
+/***********************************************************************
+ * Author:       Franziska Krüger
+ * Requirements: C++11
+ *
+ * Description:
+ * ------------
+ * Memory budget for the concurrent region solves.
+ *
+ * Each PSF estimation, PSF selection and deconvolution task holds several
+ * padded full-frame float buffers. Before a task starts it reserves its
+ * estimated footprint. If the sum of all running tasks would exceed the
+ * budget the thread waits until other tasks have finished. So a tight
+ * budget results in fewer concurrent solves instead of running out of
+ * memory. A task that is larger than the whole budget runs alone.
+ *
+ *     MemoryReservation reservation(budget, irlsFootprint(size, 1, 35));
+ *
+ ************************************************************************
+*/
+
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+#include <mutex>
+#include <condition_variable>
+#include <opencv2/opencv.hpp>   // cv::Size
+
+
+namespace deblur {
+
+    class MemoryBudget {
+
+      public:
+
+        /**
+         * @param bytes available memory for all tasks (0: unlimited)
+         */
+        MemoryBudget(const size_t bytes = 0) : limit(bytes) {}
+
+        /**
+         * Blocks until the footprint fits into the budget and reserves it.
+         * If no other task is running the footprint is always admitted.
+         */
+        void acquire(const size_t footprint);
+
+        /**
+         * Frees a reserved footprint and wakes waiting tasks.
+         */
+        void release(const size_t footprint);
+
+        /**
+         * available memory (0: unlimited)
+         */
+        size_t budget() const {
+            return limit;
+        }
+
+        /**
+         * currently reserved memory
+         */
+        size_t reserved();
+
+        /**
+         * maximal number of tasks that were running at the same time
+         */
+        int peakTasks();
+
+        /**
+         * number of tasks that had to wait for memory
+         */
+        int throttledTasks();
+
+      private:
+
+        const size_t limit;
+
+        std::mutex m;
+        std::condition_variable released;
+
+        size_t used = 0;
+        int tasks = 0;
+        int maxTasks = 0;
+        int throttled = 0;
+    };
+
+
+    /**
+     * Reserves memory of a budget for the lifetime of the object.
+     * Without budget (nullptr) nothing happens.
+     */
+    class MemoryReservation {
+
+      public:
+
+        MemoryReservation(MemoryBudget* budget, const size_t footprint)
+            : budget(budget)
+            , footprint(footprint)
+        {
+            if (budget != nullptr) budget->acquire(footprint);
+        }
+
+        ~MemoryReservation() {
+            if (budget != nullptr) budget->release(footprint);
+        }
+
+        MemoryReservation(const MemoryReservation&) = delete;
+        MemoryReservation& operator=(const MemoryReservation&) = delete;
+
+      private:
+
+        MemoryBudget* budget;
+        const size_t footprint;
+    };
+
+
+    /**
+     * Estimated peak memory of an IRLS deconvolution (deconvolveIRLS).
+     * The conjugate gradient solver works on images padded by the PSF
+     * with the input, weights, residual, search direction and temporary
+     * convolution results.
+     *
+     * @param size     size of the image
+     * @param channels number of color channels
+     * @param psfWidth width of the PSF
+     */
+    size_t irlsFootprint(const cv::Size& size, const int channels, const int psfWidth);
+
+    /**
+     * Estimated peak memory of a FFT deconvolution (deconvolveFFT).
+     */
+    size_t fftFootprint(const cv::Size& size, const int psfWidth);
+
+    /**
+     * Estimated peak memory of the PSF estimation of one child region
+     * (deconvolution of both views with the parent PSF followed by
+     * the joint PSF estimation on the gradients of both views).
+     *
+     * @param irls IRLS or FFT deconvolution
+     */
+    size_t psfEstimationFootprint(const cv::Size& size, const int psfWidth, const bool irls = true);
+
+    /**
+     * Estimated peak memory of the PSF selection of one region (deconvolution
+     * with each candidate followed by the shock filter and the gradient correlation).
+     *
+     * @param irls IRLS or FFT deconvolution
+     */
+    size_t psfSelectionFootprint(const cv::Size& size, const int psfWidth, const bool irls = true);
+}
+
+#endif
@@ -0,0 +1,87 @@
+/***********************************************************************
+ * Author:       Franziska Krüger
+ * Requirements: OpenCV 3
+ *
+ * Description:
+ * ------------
+ * Low-resolution preview of the depth-aware motion deblurring (e.g. for
+ * a user interface).
+ *
+ * The disparity estimation, the region tree and the PSF estimation run on
+ * the views down sampled by a factor of 2 or 4 with a proportionally
+ * smaller PSF width (the top-level kernels are down sampled too). The PSFs
+ * are scaled back to the full PSF width. The result is either deconvolved
+ * at the low resolution or once at full resolution with the fast FFT
+ * deconvolution.
+ *
+ * The preview can be the warm start of the full-quality run: the matching
+ * starts with the preview disparities and the preview PSFs are the
+ * initialization and an additional candidate of the PSF estimation.
+ *
+ *     previewResult warmStart;
+ *     runPreviewDeblur(left, right, previewLeft, previewRight, options, previewOptions(), &warmStart);
+ *
+ *     options.preview = &warmStart;
+ *     runDepthDeblur(left, right, deblurLeft, deblurRight, options);
+ *
+ ************************************************************************
+*/
+
+#ifndef PREVIEW_DEBLUR_H
+#define PREVIEW_DEBLUR_H
+
+#include <opencv2/opencv.hpp>
+
+#include "disparity_estimation.hpp"     // disparityPrior
+#include "psf_sequence.hpp"             // psfPrior
+#include "run_metrics.hpp"
+
+
+namespace deblur {
+
+    struct deblurOptions;
+
+    /**
+     * Parameters of the preview
+     */
+    struct previewOptions {
+        int factor = 2;                 // down sampling factor of the views (2 or 4)
+        bool fullResolution = false;    // FFT deconvolution at full resolution instead of a small result
+    };
+
+    /**
+     * Warm start of a full-quality run (see deblurOptions::preview)
+     */
+    struct previewResult {
+        int factor = 1;
+        cv::Size size;                  // full resolution of the views
+        disparityPrior disparity;       // left-right map of the matching at full resolution
+        psfPrior psfs;                  // PSFs of all region tree nodes with the full PSF width
+    };
+
+    /**
+     * Scales an energy preserving kernel to another size (negative values
+     * of the interpolation are removed).
+     */
+    cv::Mat scaleKernel(const cv::Mat& kernel, const cv::Size& size);
+
+    /**
+     * Starts the preview of the depth-aware motion deblurring. The results
+     * are gray value images.
+     *
+     * @param blurredLeft   blurred left view
+     * @param blurredRight  blurred right view
+     * @param previewLeft   preview of the left view (small or full resolution)
+     * @param previewRight  preview of the right view
+     * @param options       parameters of the algorithm (of the full resolution)
+     * @param preview       parameters of the preview
+     * @param warmStart     if not null the disparities and PSFs for a full-quality run
+     * @return              time, resources and statistics of the run
+     */
+    RunMetrics runPreviewDeblur(const cv::Mat& blurredLeft, const cv::Mat& blurredRight,
+                                cv::Mat& previewLeft, cv::Mat& previewRight,
+                                const deblurOptions& options, const previewOptions& preview = previewOptions(),
+                                previewResult* warmStart = nullptr);
+}
+
+#endif
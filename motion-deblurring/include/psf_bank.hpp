@@ -0,0 +1,147 @@
+/***********************************************************************
+ * Author:       Franziska Krüger
+ * Requirements: OpenCV 3, POSIX (mmap, fcntl)
+ *
+ * Description:
+ * ------------
+ * Binary PSF bank (.psfb) which stores float kernels together with the
+ * region tree node, the entropy and a label (e.g. the name of a stereo
+ * pair). In contrast to kernel images there is no quantization and no
+ * decoding: the bank is memory-mapped and each PSF is a matrix header
+ * on the mapped data.
+ *
+ * Layout: psfBankHeader followed by the records, each record is a
+ * psfRecordHeader followed by rows * cols floats. Records are only
+ * appended. The header is updated after the record is written, so an
+ * interrupted append leaves the bank unchanged. A save writes a new bank
+ * to <file>.tmp and renames it over the old one.
+ *
+ *     PSFBank bank("kernels.psfb");
+ *     cv::Mat psf = bank.psf(0);
+ *
+ ************************************************************************
+*/
+
+#ifndef PSF_BANK_H
+#define PSF_BANK_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <opencv2/opencv.hpp>
+
+
+namespace deblur {
+
+    /**
+     * Header of a PSF bank file
+     */
+    struct psfBankHeader {
+        char    magic[4];   // "DBPB"
+        int     version;
+        int     records;    // number of complete records
+        int     reserved;
+        int64_t end;        // offset behind the last complete record
+    };
+
+    /**
+     * Header of one PSF inside the bank (followed by the float data)
+     */
+    struct psfRecordHeader {
+        int   id;           // region tree node (-1: unknown)
+        int   parent;       // parent node (-1: top-level node or unknown)
+        int   pass;         // pass of the algorithm (0: unknown)
+        int   rows;
+        int   cols;
+        float entropy;
+        char  label[40];    // zero terminated
+    };
+
+    /**
+     * A PSF with its meta data for writing a bank
+     */
+    struct psfEntry {
+        int         id = -1;
+        int         parent = -1;
+        int         pass = 0;
+        float       entropy = 0;
+        std::string label;
+        cv::Mat     psf;
+    };
+
+
+    class PSFBank {
+
+      public:
+
+        /**
+         * Maps an existing PSF bank for reading.
+         */
+        PSFBank(const std::string& filename);
+
+        ~PSFBank();
+
+        PSFBank(const PSFBank&) = delete;
+        PSFBank& operator=(const PSFBank&) = delete;
+
+        /**
+         * number of PSFs
+         */
+        inline int size() const {
+            return records.size();
+        }
+
+        /**
+         * Meta data of the i-th PSF
+         */
+        inline const psfRecordHeader& record(const int i) const {
+            return *records[i];
+        }
+
+        /**
+         * The i-th PSF as float matrix (no copy). Only valid as long as this
+         * object exists.
+         */
+        cv::Mat psf(const int i) const;
+
+        /**
+         * Copies all PSFs with the given label (empty: all PSFs).
+         */
+        std::vector<psfEntry> entries(const std::string& label = "") const;
+
+      private:
+
+        std::string filename;
+        void* data = nullptr;
+        size_t length = 0;
+        std::vector<const psfRecordHeader*> records;
+    };
+
+
+    /**
+     * Writes a new PSF bank. An existing file is replaced once the new
+     * bank is complete and synced to disk.
+     */
+    void savePSFBank(const std::string& filename, const std::vector<psfEntry>& psfs);
+
+    /**
+     * Appends PSFs to a bank and creates it if necessary. The file is locked
+     * while writing, so several threads and processes (e.g. the workers of
+     * a batch run) can append to the same bank.
+     */
+    void appendPSFBank(const std::string& filename, const std::vector<psfEntry>& psfs);
+
+    /**
+     * Checks the file extension .psfb (with optional index, see loadKernel).
+     */
+    bool isPSFBank(const std::string& filename);
+
+    /**
+     * Loads an energy preserving float kernel from a kernel image or a
+     * PSF bank. "bank.psfb:3" selects the fourth PSF of a bank, "bank.psfb"
+     * the first one.
+     */
+    cv::Mat loadKernel(const std::string& filename);
+}
+
+#endif
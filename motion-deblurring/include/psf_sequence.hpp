@@ -0,0 +1,93 @@
+/***********************************************************************
+ * Author:       Franziska Krüger
+ * Requirements: OpenCV 3
+ *
+ * Description:
+ * ------------
+ * Temporal propagation of the region tree PSFs for stereo videos.
+ *
+ * The blur kernels of the depth layers change only a little from frame to
+ * frame. So the PSFs of the previous frame are carried forward: before the
+ * PSF of a mid-level or leaf node is estimated, the previous PSF of the node
+ * is rated with the selection energy (1 - gradient correlation of the latent
+ * image and its shock filtered version). If the energy isn't worse than the
+ * one of the last full estimation of the node (plus a threshold) the PSF is
+ * kept. Otherwise the node is estimated as usual and the previous PSF is an
+ * additional candidate of the PSF selection.
+ *
+ * So in a steady shot most of the time is spent in the deconvolution.
+ *
+ *     PSFSequence psfSequence;
+ *     options.psfSequence = &psfSequence;
+ *
+ *     for (each frame) {
+ *         runDepthDeblur(left, right, deblurLeft, deblurRight, options);
+ *     }
+ *
+ ************************************************************************
+*/
+
+#ifndef PSF_SEQUENCE_H
+#define PSF_SEQUENCE_H
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include "psf_bank.hpp"     // psfEntry
+
+
+namespace deblur {
+
+    /**
+     * PSFs of the previous frame
+     */
+    struct psfPrior {
+        std::vector<psfEntry> psfs;     // PSFs with the ids of their region tree nodes
+        std::vector<float> energies;    // selection energy of the last full estimation of each node (0: unknown)
+        float threshold = 0.1;          // allowed relative increase of the selection energy
+    };
+
+
+    class PSFSequence {
+
+      public:
+
+        /**
+         * @param threshold allowed relative increase of the selection energy of a
+         *                  carried PSF compared to the last full estimation of its node
+         */
+        PSFSequence(const float threshold = 0.1);
+
+        /**
+         * Starts the next frame. On a scene cut the PSFs of the previous frame
+         * are dropped.
+         *
+         * @param  sceneCut scene cut in front of the frame (see DisparitySequence)
+         * @return          PSFs of the previous frame (nullptr: estimate all nodes)
+         */
+        const psfPrior* nextFrame(const bool sceneCut = false);
+
+        /**
+         * Keeps the PSFs of the current frame for the next one.
+         *
+         * @param psfs     PSFs of all region tree nodes (see DepthDeblur::getPSFs)
+         * @param energies reference energies of the nodes (see DepthDeblur::getReferenceEnergies)
+         */
+        void update(const std::vector<psfEntry>& psfs, const std::vector<float>& energies);
+
+        /**
+         * index of the current frame (starting with 0)
+         */
+        int frame() const {
+            return frames;
+        }
+
+      private:
+
+        psfPrior prior;
+
+        int frames = -1;
+    };
+}
+
+#endif
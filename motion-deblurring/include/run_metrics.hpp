@@ -0,0 +1,245 @@
+/***********************************************************************
+ * Author:       Franziska Krüger
+ * Requirements: POSIX (getrusage, clock_gettime)
+ *
+ * Description:
+ * ------------
+ * Metrics of one run of the depth-aware motion deblurring: time and
+ * resources of the steps, statistics of the disparity estimation, the
+ * region tree, the PSF selection and the deconvolution.
+ *
+ ************************************************************************
+*/
+
+#ifndef RUN_METRICS_H
+#define RUN_METRICS_H
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <chrono>
+
+#include "mat_pool.hpp"     // allocationStatistics
+
+
+namespace deblur {
+
+    /**
+     * Wall and CPU time and matrix allocations of one algorithm step
+     * (summed over all passes)
+     */
+    struct stageMetrics {
+        std::string stage;
+        double wallMs = 0;
+        double cpuMs = 0;               // CPU time of all threads of the process
+        long allocations = 0;           // allocated matrix buffers
+        long poolHits = 0;              // buffers reused from the pool allocator
+        long long allocatedBytes = 0;
+        long long peakBytes = 0;        // high-water mark of the matrix memory
+
+        double poolHitRate() const {
+            return (allocations > 0) ? double(poolHits) / allocations : 0;
+        }
+    };
+
+    /**
+     * Statistics of the graph-cut disparity estimation of one pass
+     */
+    struct disparityMetrics {
+        int pass = 0;
+        int initialEnergy = 0;
+        int finalEnergy = 0;
+        int expansions = 0;     // number of alpha-expansions
+        float iterations = 0;   // expansions / number of labels
+
+        // frames of a stereo video
+        int frame = -1;         // index of the frame (-1: single image pair)
+        bool warmStart = false; // started with the map of the previous frame
+        bool sceneCut = false;  // scene cut in front of the frame (full search)
+        double speedup = 0;     // compared to the last full search
+    };
+
+    /**
+     * Candidates of the PSF selection (the winner of a node is one of them).
+     * Without a reliable sibling the PSF of the previous frame is the third
+     * candidate, but it is reported as PREVIOUS_FRAME_PSF anyway.
+     */
+    enum selectionCandidate { OWN_PSF = 0, PARENT_PSF = 1, SIBLING_PSF = 2, PREVIOUS_FRAME_PSF = 3 };
+
+    /**
+     * Result of the PSF estimation of one region tree node
+     */
+    struct nodeMetrics {
+        int pass = 0;
+        int id = 0;
+        int parent = -1;
+        int layers = 0;             // number of contained disparity layers
+        long pixelsLeft = 0;        // size of the region in the left view
+        long pixelsRight = 0;
+        float entropy = 0;          // entropy of the final PSF
+        int candidates = 0;         // number of candidates of the PSF selection (0: no selection)
+        int winner = -1;            // selectionCandidate of the winner (-1: no selection)
+        float winnerEnergy = 0;     // 1 - gradient correlation of the winner
+        bool carried = false;       // PSF of the previous frame kept without estimation (video)
+        double estimationMs = 0;    // PSF estimation of the children at this node
+        double selectionMs = 0;     // PSF selection of the children at this node
+    };
+
+    /**
+     * IRLS deconvolution of one region
+     */
+    struct deconvolutionMetrics {
+        int pass = 0;
+        int region = 0;
+        int view = 0;               // 0: left, 1: right
+        int iterations = 0;         // conjugate gradient iterations of all IRLS solves
+        float residual = 0;         // relative residual of the last solve
+        double wallMs = 0;
+    };
+
+    /**
+     * Utilization of the threads in a parallel section
+     */
+    struct parallelMetrics {
+        std::string section;
+        int threads = 1;
+        double wallMs = 0;
+        double busyMs = 0;          // summed working time of all threads
+
+        // accesses of the shared queue/stack of the work items
+        long accesses = 0;
+        long emptyAccesses = 0;     // the queue was empty (the mid-level workers poll until all leaves are done)
+        double waitMs = 0;          // waiting for the lock in successful accesses (contention)
+        double spinMs = 0;          // idle workers between their nodes (polling the empty queue)
+
+        // longest chain of work items that depend on each other (parent before
+        // child in the region tree), a lower bound of the wall time
+        double criticalPathMs = 0;
+        std::vector<int> criticalPath;  // node ids from the top-level node down
+
+        double utilization() const {
+            return (wallMs > 0) ? busyMs / (threads * wallMs) : 0;
+        }
+    };
+
+
+    struct RunMetrics {
+        // input and parameters
+        int width = 0;
+        int height = 0;
+        int threads = 1;
+        int psfWidth = 0;
+        int layers = 0;
+        int passes = 0;
+        int tiles = 0;              // processed tiles of the tiled mode
+        std::vector<int> roi;       // x, y, width, height of the region of interest (empty: whole image)
+
+        double totalWallMs = 0;
+        double totalCpuMs = 0;
+        long peakRssKb = 0;         // peak resident set size of the process
+
+        std::vector<stageMetrics> stages;
+
+        /**
+         * pixels per disparity layer in the left and right view (last pass)
+         */
+        std::vector<long> layerPixelsLeft;
+        std::vector<long> layerPixelsRight;
+
+        std::vector<disparityMetrics> disparity;
+        std::vector<nodeMetrics> nodes;
+        std::vector<deconvolutionMetrics> deconvolution;
+        std::vector<parallelMetrics> parallel;
+
+        // memory budget of the concurrent solves (0: unlimited)
+        long long memoryBudgetBytes = 0;
+        int peakConcurrentSolves = 0;
+        int throttledSolves = 0;            // solves that had to wait for memory
+
+        // anytime mode (time budget 0: no budget)
+        double timeBudgetMs = 0;
+        double predictedMs = 0;             // predicted time with the lowered knobs
+        bool deadlineHit = false;
+        int skippedNodes = 0;               // PSF estimations and selections skipped at the deadline
+        int fastRegions = 0;                // regions deconvolved with FFT (deadline or preview)
+        std::vector<std::string> loweredKnobs;
+
+        // lookups in caches of intermediate results
+        long cacheHits = 0;
+        long cacheMisses = 0;
+
+        double cacheHitRate() const {
+            return (cacheHits + cacheMisses > 0) ? double(cacheHits) / (cacheHits + cacheMisses) : 0;
+        }
+
+        /**
+         * Returns the stage with the given name and creates it if necessary.
+         */
+        stageMetrics& stage(const std::string& name);
+
+        /**
+         * Writes the metrics as JSON object.
+         *
+         * @param out    output stream
+         * @param indent number of spaces in front of each line
+         */
+        void writeJSON(std::ostream& out, const int indent = 0) const;
+
+        /**
+         * Saves the metrics as JSON file.
+         */
+        void saveJSON(const std::string& filename) const;
+    };
+
+
+    /**
+     * Adds the wall time, CPU time and matrix allocations since the last
+     * tick to a stage of the run metrics.
+     *
+     *     StageClock clock(metrics);
+     *     ... disparity estimation ...
+     *     clock.tick("disparity");
+     */
+    class StageClock {
+
+      public:
+
+        StageClock(RunMetrics& metrics);
+
+        /**
+         * Adds everything since the last tick (or the creation) to the given stage.
+         */
+        void tick(const std::string& stage);
+
+        /**
+         * Sets total wall time, total CPU time and peak memory of the run.
+         */
+        void finish();
+
+      private:
+
+        RunMetrics& metrics;
+
+        std::chrono::steady_clock::time_point begin;
+        std::chrono::steady_clock::time_point clock;
+        double beginCpu;
+        double cpuClock;
+
+        // the allocation counters and the high-water mark are process totals,
+        // so the stages of concurrent runs include each other's allocations
+        allocationStatistics allocations;
+    };
+
+
+    /**
+     * CPU time of the process (all threads) in milliseconds
+     */
+    double processCpuMs();
+
+    /**
+     * Peak resident set size of the process in kilobytes
+     */
+    long peakRssKb();
+}
+
+#endif
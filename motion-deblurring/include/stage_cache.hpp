@@ -0,0 +1,131 @@
+/***********************************************************************
+ * Author:       Franziska Krüger
+ * Requirements: OpenCV 3, POSIX
+ *
+ * Description:
+ * ------------
+ * Content-addressed cache for the results of the algorithm steps on disk.
+ *
+ * The key of a step is a hash (64 bit FNV-1a) of its input images and of
+ * all parameters that change its result. If the key was stored before the
+ * step can be skipped, e.g. when a pair is deblurred again with other
+ * deconvolution settings or when a crashed batch run is restarted.
+ * Entries are written to a temporary file and renamed, so there are no
+ * partial entries. A truncated or corrupted entry is a miss and is removed.
+ * If the cache exceeds its size the least recently used entries (by
+ * modification time, which is updated on every hit) are removed.
+ *
+ *     CacheKey key("disparity");
+ *     key.add(left).add(right).add(maxDisparity);
+ *
+ *     std::vector<cv::Mat> result;
+ *     if (!cache.load(key, result)) {
+ *         ...
+ *         cache.store(key, result);
+ *     }
+ *
+ ************************************************************************
+*/
+
+#ifndef STAGE_CACHE_H
+#define STAGE_CACHE_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <cstdint>
+#include <opencv2/opencv.hpp>
+
+
+namespace deblur {
+
+    /**
+     * Hash of the inputs of a step
+     */
+    class CacheKey {
+
+      public:
+
+        /**
+         * @param stage name of the step (part of the filename)
+         */
+        CacheKey(const std::string& stage);
+
+        CacheKey& add(const void* data, const size_t bytes);
+        CacheKey& add(const cv::Mat& image);
+        CacheKey& add(const std::vector<cv::Mat>& images);
+        CacheKey& add(const std::string& value);
+        CacheKey& add(const char* value);
+        CacheKey& add(const CacheKey& key);
+
+        /**
+         * adds a number (int, float, enum, ...)
+         */
+        template<typename T>
+        CacheKey& add(const T value) {
+            return add(&value, sizeof(value));
+        }
+
+        /**
+         * stage and hash as filename
+         */
+        std::string str() const;
+
+      private:
+
+        std::string stage;
+        uint64_t hash;
+    };
+
+
+    class StageCache {
+
+      public:
+
+        /**
+         * Entries of former runs beyond the size are removed.
+         *
+         * @param directory folder of the cache (created if necessary)
+         * @param maxBytes  size of the cache (0: unlimited)
+         */
+        StageCache(const std::string& directory, const size_t maxBytes = size_t(1) << 30);
+
+        /**
+         * Loads the matrices stored under the key. An invalid entry is
+         * deleted and counted as a miss.
+         *
+         * @return if the key was found
+         */
+        bool load(const CacheKey& key, std::vector<cv::Mat>& mats);
+
+        /**
+         * Stores the matrices under the key and removes the least recently
+         * used entries if the cache is too large.
+         * Errors are ignored because the cache is optional.
+         */
+        void store(const CacheKey& key, const std::vector<cv::Mat>& mats);
+
+        /**
+         * Scans the folder and removes the least recently used entries
+         * until the cache fits into its size.
+         */
+        void evict();
+
+        long hits();
+        long misses();
+
+      private:
+
+        const std::string directory;
+        const size_t maxBytes;
+
+        std::mutex m;
+        long hitCount = 0;
+        long missCount = 0;
+
+        // size of the entries since the last scan (see evict)
+        size_t cachedBytes = 0;
+    };
+}
+
+#endif
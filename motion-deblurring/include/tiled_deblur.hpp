@@ -0,0 +1,70 @@
+/***********************************************************************
+ * Author:       Franziska Krüger
+ * Requirements: OpenCV 3, POSIX (mmap)
+ *
+ * Description:
+ * ------------
+ * Tiled depth-aware motion deblurring for stereo images which are too
+ * large for the main memory (e.g. gigapixel panoramas).
+ *
+ * Input and output are memory-mapped raw images (see mapped_image.hpp),
+ * so only the current tile and a few small images are kept in RAM:
+ *
+ * 1. The disparity layers are found once on a down sampled overview of the
+ *    whole image. Each tile is quantized with these layers, so a region
+ *    label means the same depth in all tiles.
+ * 2. The PSFs of the layers are estimated once on a reference crop in the
+ *    middle of the image and shared by all tiles.
+ * 3. The tiles are processed one after another (overlap-save): each tile is
+ *    extended by an overlap derived from the PSF width (and the disparity
+ *    range horizontally), deconvolved and only its core is written to the
+ *    output.
+ *
+ ************************************************************************
+*/
+
+#ifndef TILED_DEBLUR_H
+#define TILED_DEBLUR_H
+
+#include <string>
+#include <opencv2/opencv.hpp>
+
+#include "depth_aware_deblurring.hpp"   // deblurOptions
+#include "run_metrics.hpp"
+
+
+namespace deblur {
+
+    /**
+     * Parameters of the tiling
+     */
+    struct tileOptions {
+        int tileSize = 1024;        // side length of the core of a tile
+        int overviewSize = 1024;    // max side length of the overview for the disparity layers
+        int referenceSize = 2048;   // max side length of the reference crop for the PSF estimation
+    };
+
+    /**
+     * Overlap of the tiles for a PSF width and a maximal disparity
+     * (horizontal and vertical).
+     */
+    cv::Size tileOverlap(const int psfWidth, const int maxDisparity);
+
+    /**
+     * Starts the tiled depth-aware motion deblurring. The results are gray
+     * value images.
+     *
+     * @param filenameLeft        raw image of the blurred left view
+     * @param filenameRight       raw image of the blurred right view
+     * @param filenameDeblurLeft  raw image for the result left (created)
+     * @param filenameDeblurRight raw image for the result right (created)
+     * @param options             parameters of the algorithm
+     * @param tiles               parameters of the tiling
+     * @return                    time, resources and statistics of the run
+     */
+    RunMetrics runTiledDepthDeblur(const std::string& filenameLeft, const std::string& filenameRight,
+                                   const std::string& filenameDeblurLeft, const std::string& filenameDeblurRight,
+                                   const deblurOptions& options, const tileOptions& tiles = tileOptions());
+}
+
+#endif
@@ -0,0 +1,102 @@
+/***********************************************************************
+ * Author:       Franziska Krüger
+ * Requirements: OpenCV 3
+ *
+ * Description:
+ * ------------
+ * Time budget of the anytime mode.
+ *
+ * The wall time of the stages is predicted from the image size, the number
+ * of layers, the PSF width and the threads. If the prediction exceeds the
+ * budget the quality knobs are lowered one after another until it fits:
+ *
+ *     1. IRLS iterations of the final deconvolution (20 -> 10)
+ *     2. solver of the PSF estimation and selection (IRLS -> FFT)
+ *     3. depth of the region trees (more top-level nodes, as far as
+ *        top-level kernels are available)
+ *     4. number of layers (halved down to 2)
+ *     5. mid-level PSF estimation (leafs use the PSF of their top-level node)
+ *     6. IRLS iterations of the final deconvolution (10 -> 5)
+ *
+ * During the run the budget is a deadline: PSF estimations which would
+ * start after it keep the PSF of their parent and regions use the FFT
+ * deconvolution, so the best result so far is returned.
+ *
+ *     budgetPlan plan = planTimeBudget(size, options, kernels.size());
+ *
+ ************************************************************************
+*/
+
+#ifndef TIME_BUDGET_H
+#define TIME_BUDGET_H
+
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>   // cv::Size
+
+#include "depth_deblur.hpp"     // deconvAlgo
+
+
+namespace deblur {
+
+    struct deblurOptions;
+
+    /**
+     * Settings which trade quality for time
+     */
+    struct qualityKnobs {
+        int layers = 12;
+        int maxTopLevelNodes = 3;
+        DepthDeblur::deconvAlgo psfSolver = DepthDeblur::IRLS;  // PSF estimation and selection
+        int irlsIterations = 20;        // iterations of the final IRLS deconvolution
+        bool midLevelPSFs = true;       // false: leafs use the PSF of their top-level node
+        bool secondPass = false;        // second pass (disabled in this implementation)
+    };
+
+    /**
+     * Predicted wall time of the stages (ms)
+     */
+    struct stageCosts {
+        double disparityMs = 0;
+        double psfMs = 0;               // mid-level PSF estimation and selection
+        double deconvolutionMs = 0;     // both views
+
+        double totalMs() const {
+            return disparityMs + psfMs + deconvolutionMs;
+        }
+    };
+
+    /**
+     * Knobs which fit into a time budget
+     */
+    struct budgetPlan {
+        qualityKnobs knobs;
+        stageCosts costs;                   // prediction with the knobs
+        std::vector<std::string> lowered;   // lowered knobs in order, e.g. "layers 12 -> 6"
+    };
+
+    /**
+     * Predicts the wall time of the stages of one pass. The coefficients are
+     * rough values of a single core, they are only used for the planning.
+     *
+     * @param size         size of the views
+     * @param threads      number of threads
+     * @param psfWidth     width of the PSF
+     * @param maxDisparity maximal disparity of the matching
+     * @param knobs        quality settings
+     */
+    stageCosts estimateStageCosts(const cv::Size& size, const int threads, const int psfWidth,
+                                  const int maxDisparity, const qualityKnobs& knobs);
+
+    /**
+     * Lowers the quality knobs of the options until the predicted time
+     * fits into options.timeBudgetMs (see the order above).
+     *
+     * @param size            size of the views
+     * @param options         parameters of the run
+     * @param toplevelKernels number of available top-level kernels
+     */
+    budgetPlan planTimeBudget(const cv::Size& size, const deblurOptions& options, const int toplevelKernels);
+}
+
+#endif
@@ -0,0 +1,528 @@
+/***********************************************************************
+ * Author:       Franziska Krüger
+ * Using:        argtable3 - http://www.argtable.org/
+ *
+ * Description:
+ * ------------
+ * Batch processing of many stereo pairs with several processes or
+ * machines that share a queue folder.
+ *
+ * The coordinator enqueues the pairs of a list file, requeues expired
+ * leases and waits until all pairs are finished. Workers claim pairs,
+ * deblur them and save the results and metrics to <out>/<pair>/ once
+ * the pair is completed.
+ *
+ ************************************************************************
+*/
+
+#include <iostream>     // cout, cerr, endl
+#include <fstream>      // list file, metrics
+#include <sstream>
+#include <string>
+#include <set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <stdexcept>
+#include <cstdio>       // rename, remove
+#include <memory>       // unique_ptr
+
+#include <unistd.h>     // gethostname, getpid, rmdir
+
+#include "argtable3.h"  // cross platform command line parsing
+#include "depth_aware_deblurring.hpp"
+#include "deblur_daemon.hpp"
+#include "batch_queue.hpp"
+#include "stage_cache.hpp"
+
+using namespace std;
+
+// global structs for command line parsing
+struct arg_lit *help, *worker, *fft, *irls, *no_cache;
+struct arg_file *coordinator, *queue_dir, *out_dir, *kernel_dir, *psf_bank, *cache_dir;
+struct arg_end *end_args;
+struct arg_int *lease_timeout, *max_attempts, *poll_interval, *cache_size;
+struct arg_int *psf_width, *max_toplevel_nodes, *mythreads, *max_disparity, *d_layers, *memory_budget;
+
+
+/**
+ * Command line settings of the batch processing
+ */
+struct batchSettings {
+    string listFile;        // coordinator: list of pairs
+    bool isWorker;
+    string queueDir;
+    string outDir;
+    string kernelDir;
+    string psfBank;         // worker: bank for the PSFs of all pairs
+    string cacheDir;        // worker: cache of the steps (empty: no cache)
+    int cacheSize;          // worker: MB
+    int leaseTimeout;
+    int maxAttempts;
+    int pollInterval;
+    deblur::deblurOptions options;
+};
+
+
+/**
+ * Saves the user input in given variables.
+ * On error while parsing or used help option this function returns false.
+ */
+static bool parse_commandline_args(int argc, char** argv, batchSettings& settings, int &exitcode) {
+
+    // command line options
+    // the global arg_xxx structs are initialized within the argtable
+    void *argtable[] = {
+        help          = arg_litn("h", "help",                           0, 1, "display this help and exit"),
+        coordinator   = arg_filen("c", "coordinator", "<list>",         0, 1, "enqueue the pairs of the list (<left> <right> [<name>] per line, tab-separated if a path contains spaces) and wait for them"),
+        worker        = arg_litn("W", "worker",                         0, 1, "process pairs of the queue"),
+        queue_dir     = arg_filen("Q", "queue", "<dir>",                1, 1, "queue folder on a shared filesystem"),
+        out_dir       = arg_filen("o", "out", "<dir>",                  0, 1, "coordinator: output folder. Default: out"),
+        lease_timeout = arg_intn ("L", "lease-timeout", "<s>",          0, 1, "seconds without heartbeat until a lease expires. Default: 60"),
+        max_attempts  = arg_intn ("r", "max-attempts", "<n>",           0, 1, "tries for each pair. Default: 3"),
+        poll_interval = arg_intn ("p", "poll", "<ms>",                  0, 1, "milliseconds between queue scans. Default: 1000"),
+        kernel_dir    = arg_filen("k", "kernels", "<dir>",              0, 1, "worker: folder of the top-level kernels or PSF bank. Default: ."),
+        psf_bank      = arg_filen(nullptr, "psf-bank", "<file>",        0, 1, "worker: append the PSFs of each pair to a PSF bank (.psfb)"),
+        cache_dir     = arg_filen(nullptr, "cache-dir", "<dir>",        0, 1, "worker: cache of the results of the steps. Default: <queue>/cache"),
+        cache_size    = arg_intn (nullptr, "cache-size", "<MB>",        0, 1, "worker: size of the cache. Default: 4096"),
+        no_cache      = arg_litn(nullptr, "no-cache",                   0, 1, "worker: compute all steps without cache"),
+        fft           = arg_litn("f", "fft",                            0, 1, "worker: deconvolution with FFT"),
+        irls          = arg_litn("i", "irls",                           0, 1, "worker: deconvolution with IRLS"),
+        psf_width     = arg_intn ("w", "psf-width", "<n>",              0, 1, "worker: approximate PSF width. Default: 35"),
+        d_layers      = arg_intn ("l", "layers", "<n>",                 0, 1, "worker: number of region/disparity layers. Default: 12"),
+        mythreads     = arg_intn ("t", "threads", "<n>",                0, 1, "worker: number of threads. Default: 1"),
+        max_disparity        = arg_intn ("d", "max-disparity", "<n>",   0, 1, "worker: estimated maximum disparity. Default: 160"),
+        max_toplevel_nodes   = arg_intn ("m", "max-top-nodes", "<n>",   0, 1, "worker: max top level nodes in region tree. Default: 3"),
+        memory_budget        = arg_intn (nullptr, "memory-budget", "<MB>", 0, 1, "worker: memory for concurrent region solves. Default: 0 (unlimited)"),
+        end_args      = arg_end(20),
+    };
+
+    // default values (they weren't set if there is a value given)
+    out_dir->filename[0] = "out";
+    kernel_dir->filename[0] = ".";
+    lease_timeout->ival[0] = 60;
+    max_attempts->ival[0] = 3;
+    poll_interval->ival[0] = 1000;
+    cache_size->ival[0] = 4096;
+    psf_width->ival[0] = 35;
+    mythreads->ival[0] = 1;
+    max_toplevel_nodes->ival[0] = 3;
+    max_disparity->ival[0] = 160;
+    d_layers->ival[0] = 12;
+    memory_budget->ival[0] = 0;
+
+    // parsing arguments
+    int nerrors = arg_parse(argc,argv,argtable);
+
+    // special case: '--help' takes precedence over error reporting
+    if (help->count > 0)
+    {
+        cout << "Usage: " << argv[0];
+        arg_print_syntax(stdout, argtable, "\n");
+        cout << "Depth-Aware Motion Deblurring of many pairs with a shared queue." << endl << endl;
+        arg_print_glossary(stdout, argtable, "  %-25s %s\n");
+
+        // deallocate each non-null entry in argtable[]
+        arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+        exitcode = 0;
+        return false;
+    }
+
+    // If the parser returned any errors then display them and exit
+    if (nerrors > 0 || (coordinator->count > 0) == (worker->count > 0))
+    {
+        if (nerrors > 0) {
+            arg_print_errors(stdout, end_args, argv[0]);
+        } else {
+            cout << argv[0] << ": use either --coordinator or --worker" << endl;
+        }
+
+        cout << "Try '" << argv[0] << " --help' for more information." << endl;
+
+        // deallocate each non-null entry in argtable[]
+        arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+        exitcode = 1;
+        return false;
+    }
+
+    if (fft->count > 0) {
+        settings.options.deconvAlgo = deblur::DepthDeblur::FFT;
+    }
+
+    if (irls->count > 0) {
+        settings.options.deconvAlgo = deblur::DepthDeblur::IRLS;
+    }
+
+    // saving arguments in variables
+    settings.isWorker = worker->count > 0;
+    settings.listFile = (coordinator->count > 0) ? coordinator->filename[0] : "";
+    settings.queueDir = queue_dir->filename[0];
+    settings.outDir = out_dir->filename[0];
+    settings.kernelDir = kernel_dir->filename[0];
+    settings.psfBank = (psf_bank->count > 0) ? psf_bank->filename[0] : "";
+    settings.cacheSize = cache_size->ival[0];
+
+    // on the shared filesystem a retried pair continues with the finished steps
+    if (no_cache->count > 0) {
+        settings.cacheDir = "";
+    } else {
+        settings.cacheDir = (cache_dir->count > 0) ? cache_dir->filename[0] : settings.queueDir + "/cache";
+    }
+    settings.leaseTimeout = lease_timeout->ival[0];
+    settings.maxAttempts = max_attempts->ival[0];
+    settings.pollInterval = poll_interval->ival[0];
+    settings.options.psfWidth = psf_width->ival[0];
+    settings.options.threads = mythreads->ival[0];
+    settings.options.maxDisparity = max_disparity->ival[0];
+    settings.options.maxTopLevelNodes = max_toplevel_nodes->ival[0];
+    settings.options.layers = d_layers->ival[0];
+    settings.options.memoryBudget = size_t(memory_budget->ival[0]) << 20;
+
+    // deallocate each non-null entry in argtable[]
+    arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+
+    return true;
+}
+
+
+/**
+ * Name of a pair from the filename of the left view without folder and extension
+ */
+static string pairName(const string& left) {
+    size_t start = left.find_last_of('/');
+    start = (start == string::npos) ? 0 : start + 1;
+
+    size_t end = left.find_last_of('.');
+    end = (end == string::npos || end < start) ? left.size() : end;
+
+    string name = left.substr(start, end - start);
+
+    // '@' separates the attempt in the queue
+    for (char& c : name) {
+        if (c == '@' || c == ' ') c = '_';
+    }
+
+    return name;
+}
+
+
+static void printStatus(const deblur::batchQueueStatus& status) {
+    cout << "pending: " << status.pending << "  leased: " << status.leased
+         << "  done: " << status.done << "  failed: " << status.failed << endl;
+}
+
+
+static int runCoordinator(const batchSettings& settings) {
+    deblur::BatchQueue queue(settings.queueDir, settings.leaseTimeout, settings.maxAttempts);
+    queue.create();
+
+    ifstream list(settings.listFile);
+
+    if (!list) {
+        throw runtime_error("Can not open list: " + settings.listFile);
+    }
+
+    // enqueue all pairs which aren't already in the queue (restart of the coordinator)
+    set<string> names;
+    string line;
+    int added = 0;
+
+    while (getline(list, line)) {
+        vector<string> fields = deblur::splitRequestFields(line);
+
+        if (fields.size() < 2 || fields[0][0] == '#') {
+            continue;
+        }
+
+        const string& left = fields[0];
+        const string& right = fields[1];
+        string name = (fields.size() > 2) ? fields[2] : pairName(left);
+
+        // the same name for different pairs
+        string unique = name;
+
+        for (int i = 2; names.count(unique) > 0; i++) {
+            unique = name + "-" + to_string(i);
+        }
+
+        names.insert(unique);
+
+        if (queue.contains(unique)) {
+            continue;
+        }
+
+        string result = settings.outDir + "/" + unique + "/";
+
+        // tabs keep paths with spaces together
+        queue.enqueue(unique, "id=" + unique + "\tleft=" + left + "\tright=" + right +
+                              "\tout-left=" + result + "deblur-left.png" +
+                              "\tout-right=" + result + "deblur-right.png");
+        added++;
+    }
+
+    cout << "enqueued " << added << " of " << names.size() << " pairs" << endl;
+
+    // wait for the workers
+    while (true) {
+        int requeued = queue.requeueExpired();
+
+        if (requeued > 0) {
+            cout << "requeued " << requeued << " expired leases" << endl;
+        }
+
+        deblur::batchQueueStatus status = queue.status();
+        printStatus(status);
+
+        if (status.pending == 0 && status.leased == 0) {
+            return (status.failed > 0) ? 1 : 0;
+        }
+
+        this_thread::sleep_for(chrono::milliseconds(settings.pollInterval));
+    }
+}
+
+
+/**
+ * Writes the metrics of a pair as JSON
+ */
+static void writeMetrics(const string& filename, const deblur::batchLease& lease, const string& workerName,
+                         const double total, const deblur::RunMetrics& metrics) {
+    ofstream file(filename);
+
+    file << "{" << endl;
+    file << "  \"pair\": \"" << lease.pair << "\"," << endl;
+    file << "  \"worker\": \"" << workerName << "\"," << endl;
+    file << "  \"attempt\": " << lease.attempt << "," << endl;
+    file << "  \"total_ms\": " << total << "," << endl;
+    file << "  \"run\": ";
+    metrics.writeJSON(file, 2);
+    file << endl << "}" << endl;
+}
+
+
+/**
+ * Results of one attempt. They are written to an attempt-specific folder
+ * next to their destination and moved into place only after the pair is
+ * completed, so a worker which lost its lease never overwrites the results
+ * of the worker which took over the pair.
+ */
+class StagedResults {
+
+  public:
+
+    StagedResults(const string& attempt) : attempt(attempt) {}
+
+    /**
+     * Returns the temporary filename of a result
+     */
+    string stage(const string& filename) {
+        size_t name = filename.find_last_of('/') + 1;      // 0 without folder
+        string folder = filename.substr(0, name) + ".attempt-" + attempt;
+
+        deblur::makeDirectories(folder);
+        folders.insert(folder);
+
+        string staged = folder + "/" + filename.substr(name);
+        files.push_back(make_pair(staged, filename));
+
+        return staged;
+    }
+
+    /**
+     * Moves the results to their destination
+     */
+    void commit() {
+        for (const auto& file : files) {
+            if (rename(file.first.c_str(), file.second.c_str()) != 0) {
+                throw runtime_error("Can not save result: " + file.second);
+            }
+        }
+
+        files.clear();
+        removeFolders();
+    }
+
+    /**
+     * Deletes the results of a failed attempt or lost lease
+     */
+    void discard() {
+        for (const auto& file : files) {
+            remove(file.first.c_str());
+        }
+
+        files.clear();
+        removeFolders();
+    }
+
+  private:
+
+    void removeFolders() {
+        for (const string& folder : folders) {
+            rmdir(folder.c_str());
+        }
+
+        folders.clear();
+    }
+
+    const string attempt;                       // <worker>-<attempt>
+    vector<pair<string, string>> files;         // staged file, destination
+    set<string> folders;
+};
+
+
+static int runWorker(batchSettings settings) {
+    deblur::BatchQueue queue(settings.queueDir, settings.leaseTimeout, settings.maxAttempts);
+
+    // worker name for the metrics: <host>-<pid>
+    char host[256] = "localhost";
+    gethostname(host, sizeof(host) - 1);
+    const string workerName = string(host) + "-" + to_string(getpid());
+
+    // the top-level kernels are loaded only once for all pairs
+    settings.options.toplevelKernels = deblur::loadToplevelKernels(settings.kernelDir);
+
+    unique_ptr<deblur::StageCache> cache;
+
+    if (!settings.cacheDir.empty()) {
+        cache.reset(new deblur::StageCache(settings.cacheDir, size_t(settings.cacheSize) << 20));
+        settings.options.cache = cache.get();
+    }
+
+    int processed = 0;
+
+    while (true) {
+        // workers requeue expired leases too, so a missing coordinator
+        // doesn't block the queue
+        queue.requeueExpired();
+
+        deblur::batchLease lease;
+
+        if (!queue.claim(lease)) {
+            deblur::batchQueueStatus status = queue.status();
+
+            // leased pairs may come back if their worker died
+            if (status.pending == 0 && status.leased == 0) {
+                break;
+            }
+
+            this_thread::sleep_for(chrono::milliseconds(settings.pollInterval));
+            continue;
+        }
+
+        cout << "[" << workerName << "] " << lease.pair << " (attempt " << lease.attempt << ")" << endl;
+
+        // heartbeat until the pair is finished
+        mutex m;
+        condition_variable finished;
+        bool isFinished = false;
+
+        thread heartbeat([&]() {
+            unique_lock<mutex> lock(m);
+            chrono::seconds interval(max(1, settings.leaseTimeout / 3));
+
+            while (!finished.wait_for(lock, interval, [&]{ return isFinished; })) {
+                queue.heartbeat(lease);
+            }
+        });
+
+        string error;
+        vector<deblur::psfEntry> psfs;
+        StagedResults results(workerName + "-" + to_string(lease.attempt));
+
+        try {
+            auto start = chrono::steady_clock::now();
+
+            deblur::deblurJob job = deblur::parseJobRequest(lease.request, settings.options);
+            job.options.psfs = &psfs;
+
+            cv::Mat left = deblur::readJobImage(job.left);
+            cv::Mat right = deblur::readJobImage(job.right);
+
+            cv::Mat deblurredLeft, deblurredRight;
+            deblur::RunMetrics metrics = deblur::runDepthDeblur(left, right, deblurredLeft, deblurredRight,
+                                                                job.options);
+
+            string resultFolder = job.resultLeft.substr(0, job.resultLeft.find_last_of('/') + 1);
+
+            deblur::writeJobImage(results.stage(job.resultLeft), deblurredLeft);
+            deblur::writeJobImage(results.stage(job.resultRight), deblurredRight);
+
+            double total = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+            writeMetrics(results.stage(resultFolder + "metrics.json"), lease, workerName, total, metrics);
+        }
+        catch (const exception& e) {
+            error = e.what();
+        }
+
+        {
+            lock_guard<mutex> lock(m);
+            isFinished = true;
+        }
+
+        finished.notify_one();
+        heartbeat.join();
+
+        if (!error.empty()) {
+            cerr << "[" << workerName << "] " << lease.pair << " failed: " << error << endl;
+            results.discard();
+            queue.release(lease, error);
+        } else if (!queue.complete(lease)) {
+            // the lease expired and another worker processes the pair
+            cerr << "[" << workerName << "] " << lease.pair << " lease lost, result is discarded" << endl;
+            results.discard();
+        } else {
+            try {
+                results.commit();
+            }
+            catch (const exception& e) {
+                cerr << "[" << workerName << "] " << lease.pair << " results not saved: " << e.what() << endl;
+            }
+
+            // only PSFs of completed pairs are added (once)
+            if (!settings.psfBank.empty()) {
+                for (auto& psf : psfs) {
+                    psf.label = lease.pair;
+                }
+
+                try {
+                    deblur::appendPSFBank(settings.psfBank, psfs);
+                }
+                catch (const exception& e) {
+                    cerr << "[" << workerName << "] " << lease.pair << " PSFs not saved: " << e.what() << endl;
+                }
+            }
+
+            processed++;
+        }
+    }
+
+    cout << "[" << workerName << "] queue is empty, processed " << processed << " pairs" << endl;
+
+    return 0;
+}
+
+
+int main(int argc, char** argv) {
+    batchSettings settings;
+
+    // parse command line arguments
+    int exitcode = 0;
+    bool success = parse_commandline_args(argc, argv, settings, exitcode);
+
+    if (success == false) {
+        return exitcode;
+    }
+
+    try {
+        if (settings.isWorker) {
+            return runWorker(settings);
+        } else {
+            return runCoordinator(settings);
+        }
+    }
+    catch(const exception& e) {
+        cerr << "ERROR: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+}
@@ -0,0 +1,273 @@
+#include <fstream>                      // job files
+#include <vector>
+#include <algorithm>                    // sort
+#include <stdexcept>                    // throw exception
+#include <cstring>                      // strerror
+#include <cerrno>
+
+#include <unistd.h>                     // getpid, close
+#include <fcntl.h>                      // open, AT_FDCWD
+#include <dirent.h>                     // list queue folders
+#include <sys/stat.h>                   // mkdir, stat, utimensat
+
+#include "batch_queue.hpp"
+
+
+using namespace std;
+
+
+namespace deblur {
+
+    static const string jobSuffix = ".job";
+
+
+    /**
+     * Lists the job files of a folder sorted by name
+     */
+    static vector<string> listJobs(const string& folder) {
+        vector<string> jobs;
+        DIR* dir = opendir(folder.c_str());
+
+        if (dir == nullptr) {
+            return jobs;
+        }
+
+        for (dirent* entry = readdir(dir); entry != nullptr; entry = readdir(dir)) {
+            string name = entry->d_name;
+
+            if (name.size() > jobSuffix.size() && name[0] != '.' &&
+                name.compare(name.size() - jobSuffix.size(), jobSuffix.size(), jobSuffix) == 0) {
+                jobs.push_back(name);
+            }
+        }
+
+        closedir(dir);
+        sort(jobs.begin(), jobs.end());
+
+        return jobs;
+    }
+
+
+    /**
+     * Splits <pair>@<attempt>.job into pair and attempt
+     */
+    static bool parseJobName(const string& name, string& pair, int& attempt) {
+        size_t separator = name.rfind('@');
+
+        if (separator == string::npos) {
+            return false;
+        }
+
+        pair = name.substr(0, separator);
+
+        try {
+            attempt = stoi(name.substr(separator + 1, name.size() - separator - 1 - jobSuffix.size()));
+        } catch (const exception&) {
+            return false;
+        }
+
+        return true;
+    }
+
+
+    static string jobName(const string& pair, const int attempt) {
+        return pair + "@" + to_string(attempt) + jobSuffix;
+    }
+
+
+    /**
+     * Sets the modification time of a file to the current time
+     */
+    static bool touch(const string& file) {
+        return utimensat(AT_FDCWD, file.c_str(), nullptr, 0) == 0;
+    }
+
+
+    void makeDirectories(const string& path) {
+        for (size_t i = 1; i <= path.size(); i++) {
+            if (i == path.size() || path[i] == '/') {
+                string folder = path.substr(0, i);
+
+                if (mkdir(folder.c_str(), 0775) != 0 && errno != EEXIST) {
+                    throw runtime_error("Can not create folder " + folder + ": " + strerror(errno));
+                }
+            }
+        }
+    }
+
+
+    BatchQueue::BatchQueue(const string& directory, const int leaseTimeout, const int maxAttempts)
+        : directory(directory)
+        , leaseTimeout(leaseTimeout)
+        , maxAttempts(maxAttempts)
+    {
+        if (leaseTimeout < 1 || maxAttempts < 1) {
+            throw runtime_error("Lease timeout and attempts have to be greater zero!");
+        }
+    }
+
+
+    const string& BatchQueue::path() const {
+        return directory;
+    }
+
+
+    void BatchQueue::create() {
+        makeDirectories(directory + "/pending");
+        makeDirectories(directory + "/leases");
+        makeDirectories(directory + "/done");
+        makeDirectories(directory + "/failed");
+    }
+
+
+    void BatchQueue::enqueue(const string& pair, const string& request) {
+        if (pair.empty() || pair.find_first_of("@/") != string::npos) {
+            throw runtime_error("Invalid pair name: " + pair);
+        }
+
+        // write a hidden file first so workers never see half a request
+        string tmp = directory + "/pending/." + pair + "-" + to_string(getpid());
+        ofstream file(tmp);
+        file << request << endl;
+        file.close();
+
+        if (!file || rename(tmp.c_str(), (directory + "/pending/" + jobName(pair, 1)).c_str()) != 0) {
+            unlink(tmp.c_str());
+            throw runtime_error("Can not enqueue pair " + pair);
+        }
+    }
+
+
+    bool BatchQueue::contains(const string& pair) {
+        for (const string folder : {"pending", "leases", "done", "failed"}) {
+            for (const string& name : listJobs(directory + "/" + folder)) {
+                string other;
+                int attempt;
+
+                if (parseJobName(name, other, attempt) && other == pair) {
+                    return true;
+                }
+            }
+        }
+
+        return false;
+    }
+
+
+    bool BatchQueue::claim(batchLease& lease) {
+        for (const string& name : listJobs(directory + "/pending")) {
+            string pending = directory + "/pending/" + name;
+            string leased = directory + "/leases/" + name;
+
+            if (!parseJobName(name, lease.pair, lease.attempt)) {
+                continue;
+            }
+
+            // rename keeps the modification time, so touch the job first
+            // to prevent that the new lease looks expired
+            touch(pending);
+
+            // only one process succeeds, the others try the next pair
+            if (rename(pending.c_str(), leased.c_str()) != 0) {
+                continue;
+            }
+
+            ifstream file(leased);
+            getline(file, lease.request);
+            lease.file = leased;
+
+            return true;
+        }
+
+        return false;
+    }
+
+
+    bool BatchQueue::heartbeat(const batchLease& lease) {
+        return touch(lease.file);
+    }
+
+
+    bool BatchQueue::complete(const batchLease& lease) {
+        string done = directory + "/done/" + jobName(lease.pair, lease.attempt);
+        return rename(lease.file.c_str(), done.c_str()) == 0;
+    }
+
+
+    void BatchQueue::release(const batchLease& lease, const string& error) {
+        retry(lease.file, lease.pair, lease.attempt, error);
+    }
+
+
+    bool BatchQueue::retry(const string& leaseFile, const string& pair, const int attempt,
+                           const string& error) {
+        if (attempt < maxAttempts) {
+            string pending = directory + "/pending/" + jobName(pair, attempt + 1);
+            return rename(leaseFile.c_str(), pending.c_str()) == 0;
+        }
+
+        string failed = directory + "/failed/" + jobName(pair, attempt);
+
+        if (rename(leaseFile.c_str(), failed.c_str()) != 0) {
+            return false;
+        }
+
+        ofstream file(directory + "/failed/" + pair + "@" + to_string(attempt) + ".error");
+        file << error << endl;
+
+        return true;
+    }
+
+
+    int BatchQueue::requeueExpired() {
+        time_t now = filesystemTime();
+        int requeued = 0;
+
+        for (const string& name : listJobs(directory + "/leases")) {
+            string leased = directory + "/leases/" + name;
+            struct stat info;
+
+            // the lease may be finished in the meantime
+            if (stat(leased.c_str(), &info) != 0 || now - info.st_mtime <= leaseTimeout) {
+                continue;
+            }
+
+            string pair;
+            int attempt;
+
+            if (parseJobName(name, pair, attempt) &&
+                retry(leased, pair, attempt, "lease expired after " + to_string(leaseTimeout) + "s")) {
+                requeued++;
+            }
+        }
+
+        return requeued;
+    }
+
+
+    batchQueueStatus BatchQueue::status() {
+        batchQueueStatus counts;
+        counts.pending = listJobs(directory + "/pending").size();
+        counts.leased = listJobs(directory + "/leases").size();
+        counts.done = listJobs(directory + "/done").size();
+        counts.failed = listJobs(directory + "/failed").size();
+
+        return counts;
+    }
+
+
+    time_t BatchQueue::filesystemTime() {
+        string clock = directory + "/.clock";
+        int fd = open(clock.c_str(), O_CREAT | O_WRONLY, 0664);
+
+        struct stat info;
+
+        if (fd < 0 || futimens(fd, nullptr) != 0 || fstat(fd, &info) != 0) {
+            if (fd >= 0) close(fd);
+            return time(nullptr);
+        }
+
+        close(fd);
+        return info.st_mtime;
+    }
+}
@@ -0,0 +1,228 @@
+/***********************************************************************
+ * Author:       Franziska Krüger
+ * Using:        argtable3 - http://www.argtable.org/
+ *
+ * Description:
+ * ------------
+ * Depth-Aware Motion Deblurring as long-running process. Jobs are
+ * accepted on a Unix socket and/or from a spool directory.
+ *
+ ************************************************************************
+*/
+
+#include <iostream>     // cout, cerr, endl
+#include <string>
+#include <thread>
+#include <stdexcept>
+#include <csignal>      // SIGINT, SIGTERM
+
+#include "argtable3.h"  // cross platform command line parsing
+#include "depth_aware_deblurring.hpp"
+#include "deblur_daemon.hpp"
+
+using namespace std;
+
+// global structs for command line parsing
+struct arg_lit *help, *fft, *irls;
+struct arg_file *socket_path, *spool_dir, *kernel_dir;
+struct arg_end *end_args;
+struct arg_int *workers, *queue_size, *psf_width, *max_toplevel_nodes, *mythreads, *max_disparity, *d_layers, *memory_budget;
+
+// daemon that is stopped on SIGINT and SIGTERM
+static deblur::DeblurDaemon* runningDaemon = nullptr;
+
+
+static void stopDaemon(int) {
+    if (runningDaemon != nullptr) {
+        runningDaemon->stop();
+    }
+}
+
+
+/**
+ * Saves the user input in given variables.
+ * On error while parsing or used help option this function returns false.
+ */
+static bool parse_commandline_args(int argc, char** argv,
+                                   string &socketPath, string &spoolDir, string &kernelDir,
+                                   int &nWorkers, int &queueSize, deblur::deblurOptions &options,
+                                   int &exitcode) {
+
+    // command line options
+    // the global arg_xxx structs are initialized within the argtable
+    void *argtable[] = {
+        help        = arg_litn("h", "help",                        0, 1, "display this help and exit"),
+        socket_path = arg_filen("s", "socket", "<path>",           0, 1, "listen on this Unix socket"),
+        spool_dir   = arg_filen("p", "spool", "<dir>",             0, 1, "process <name>.job files of this directory"),
+        kernel_dir  = arg_filen("k", "kernels", "<dir>",           0, 1, "folder of the top-level kernels or PSF bank. Default: ."),
+        workers     = arg_intn ("W", "workers", "<n>",             0, 1, "number of jobs running at the same time. Default: 1"),
+        queue_size  = arg_intn ("q", "queue-size", "<n>",          0, 1, "max number of waiting jobs. Default: 8"),
+        fft         = arg_litn("f", "fft",                         0, 1, "default: deconvolution with FFT"),
+        irls        = arg_litn("i", "irls",                        0, 1, "default: deconvolution with IRLS"),
+        psf_width   = arg_intn ("w", "psf-width", "<n>",           0, 1, "default approximate PSF width. Default: 35"),
+        d_layers    = arg_intn ("l", "layers", "<n>",              0, 1, "default number of region/disparity layers. Default: 12"),
+        mythreads   = arg_intn ("t", "threads", "<n>",             0, 1, "default number of threads per job. Default: 1"),
+        max_disparity        = arg_intn ("d", "max-disparity", "<n>", 0, 1, "default estimated maximum disparity. Default: 160"),
+        max_toplevel_nodes   = arg_intn ("m", "max-top-nodes", "<n>", 0, 1, "default max top level nodes in region tree. Default: 3"),
+        memory_budget        = arg_intn (nullptr, "memory-budget", "<MB>", 0, 1, "memory for the region solves of all jobs. Default: 0 (unlimited)"),
+        end_args    = arg_end(20),
+    };
+
+    // default values (they weren't set if there is a value given)
+    kernel_dir->filename[0] = ".";
+    workers->ival[0] = 1;
+    queue_size->ival[0] = 8;
+    psf_width->ival[0] = 35;
+    mythreads->ival[0] = 1;
+    max_toplevel_nodes->ival[0] = 3;
+    max_disparity->ival[0] = 160;
+    d_layers->ival[0] = 12;
+    memory_budget->ival[0] = 0;
+
+    // parsing arguments
+    int nerrors = arg_parse(argc,argv,argtable);
+
+    // special case: '--help' takes precedence over error reporting
+    if (help->count > 0)
+    {
+        cout << "Usage: " << argv[0];
+        arg_print_syntax(stdout, argtable, "\n");
+        cout << "Depth-Aware Motion Deblurring daemon." << endl << endl;
+        arg_print_glossary(stdout, argtable, "  %-25s %s\n");
+
+        // deallocate each non-null entry in argtable[]
+        arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+        exitcode = 0;
+        return false;
+    }
+
+    // If the parser returned any errors then display them and exit
+    if (nerrors > 0 || (socket_path->count == 0 && spool_dir->count == 0))
+    {
+        if (nerrors > 0) {
+            arg_print_errors(stdout, end_args, argv[0]);
+        } else {
+            cout << argv[0] << ": a socket or a spool directory is needed" << endl;
+        }
+
+        cout << "Try '" << argv[0] << " --help' for more information." << endl;
+
+        // deallocate each non-null entry in argtable[]
+        arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+        exitcode = 1;
+        return false;
+    }
+
+    if (fft->count > 0) {
+        options.deconvAlgo = deblur::DepthDeblur::FFT;
+    }
+
+    if (irls->count > 0) {
+        options.deconvAlgo = deblur::DepthDeblur::IRLS;
+    }
+
+    // saving arguments in variables
+    socketPath = (socket_path->count > 0) ? socket_path->filename[0] : "";
+    spoolDir = (spool_dir->count > 0) ? spool_dir->filename[0] : "";
+    kernelDir = kernel_dir->filename[0];
+    nWorkers = workers->ival[0];
+    queueSize = queue_size->ival[0];
+    options.psfWidth = psf_width->ival[0];
+    options.threads = mythreads->ival[0];
+    options.maxDisparity = max_disparity->ival[0];
+    options.maxTopLevelNodes = max_toplevel_nodes->ival[0];
+    options.layers = d_layers->ival[0];
+    options.memoryBudget = size_t(memory_budget->ival[0]) << 20;
+
+    // deallocate each non-null entry in argtable[]
+    arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+
+    return true;
+}
+
+
+int main(int argc, char** argv) {
+    string socketPath;
+    string spoolDir;
+    string kernelDir;
+    int nWorkers;
+    int queueSize;
+    deblur::deblurOptions options;
+
+    // parse command line arguments
+    int exitcode = 0;
+    bool success = parse_commandline_args(argc, argv, socketPath, spoolDir, kernelDir,
+                                          nWorkers, queueSize, options, exitcode);
+
+    if (success == false) {
+        return exitcode;
+    }
+
+    // the top-level kernels are shared by all jobs
+    options.toplevelKernels = deblur::loadToplevelKernels(kernelDir);
+
+    // the memory budget too, so concurrent jobs don't exceed it together
+    deblur::MemoryBudget memoryBudget(options.memoryBudget);
+
+    if (options.memoryBudget > 0) {
+        options.sharedMemoryBudget = &memoryBudget;
+    }
+
+    cout << "Start Depth-Aware Motion Deblurring daemon with" << endl;
+    cout << "   socket:              " << (socketPath.empty() ? "-" : socketPath) << endl;
+    cout << "   spool directory:     " << (spoolDir.empty() ? "-" : spoolDir) << endl;
+    cout << "   workers:             " << nWorkers << endl;
+    cout << "   queue size:          " << queueSize << endl;
+    cout << "   top-level kernels:   " << options.toplevelKernels.size() << " from " << kernelDir << endl;
+    cout << "   memory budget:       " << ((options.memoryBudget > 0) ? to_string(options.memoryBudget >> 20) + " MB" : "unlimited") << endl;
+    cout << endl;
+
+    // clients that disconnect before their reply mustn't kill the daemon
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, stopDaemon);
+    signal(SIGTERM, stopDaemon);
+
+    try {
+        deblur::DeblurDaemon daemon(options, nWorkers, queueSize);
+        runningDaemon = &daemon;
+
+        if (!socketPath.empty() && !spoolDir.empty()) {
+            // the spool directory is watched in the background
+            thread spool([&daemon, &spoolDir]() {
+                try {
+                    daemon.serveSpool(spoolDir);
+                }
+                catch(const exception& e) {
+                    cerr << "ERROR: " << e.what() << endl;
+                    daemon.stop();
+                }
+            });
+
+            try {
+                daemon.serveSocket(socketPath);
+            }
+            catch(...) {
+                daemon.stop();
+                spool.join();
+                throw;
+            }
+
+            daemon.stop();
+            spool.join();
+        } else if (!socketPath.empty()) {
+            daemon.serveSocket(socketPath);
+        } else {
+            daemon.serveSpool(spoolDir);
+        }
+
+        cout << "finishing queued jobs" << endl;
+        runningDaemon = nullptr;
+    }
+    catch(const exception& e) {
+        runningDaemon = nullptr;
+        cerr << "ERROR: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return 0;
+}
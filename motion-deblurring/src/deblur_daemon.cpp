@@ -0,0 +1,674 @@
+#include <iostream>                     // cout, cerr, endl
+#include <sstream>                      // parse requests
+#include <fstream>                      // spool files
+#include <iomanip>                      // setprecision
+#include <algorithm>                    // sort
+#include <stdexcept>                    // throw exception
+#include <chrono>
+#include <cstring>                      // memcpy, strerror
+#include <cerrno>
+
+#include <unistd.h>                     // close, read, write, unlink
+#include <fcntl.h>                      // O_* constants
+#include <dirent.h>                     // spool directory
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>                     // Unix domain sockets
+#include <sys/mman.h>                   // shared memory
+#include <sys/stat.h>
+
+#include <opencv2/highgui/highgui.hpp>  // imread, imwrite
+
+#include "deblur_daemon.hpp"
+
+
+using namespace std;
+using namespace cv;
+
+
+namespace deblur {
+
+    /**
+     * prefix of shared-memory image paths
+     */
+    static const string shmPrefix = "shm:";
+
+
+    static bool isSharedMemory(const string& path) {
+        return path.compare(0, shmPrefix.size(), shmPrefix) == 0;
+    }
+
+
+    /**
+     * POSIX shared-memory names start with a slash
+     */
+    static string sharedMemoryName(const string& path) {
+        string name = path.substr(shmPrefix.size());
+
+        if (name.empty() || name[0] != '/') {
+            name = "/" + name;
+        }
+
+        return name;
+    }
+
+
+    static int parseInt(const string& key, const string& value) {
+        try {
+            return stoi(value);
+        } catch (const exception&) {
+            throw runtime_error("Invalid value for " + key + ": " + value);
+        }
+    }
+
+
+    vector<string> splitRequestFields(const string& line) {
+        vector<string> fields;
+
+        if (line.find('\t') == string::npos) {
+            istringstream tokens(line);
+            string token;
+
+            while (tokens >> token) {
+                fields.push_back(token);
+            }
+
+            return fields;
+        }
+
+        istringstream tokens(line);
+        string token;
+
+        while (getline(tokens, token, '\t')) {
+            // a trailing carriage return of a list edited on Windows
+            if (!token.empty() && token.back() == '\r') {
+                token.pop_back();
+            }
+
+            if (!token.empty()) {
+                fields.push_back(token);
+            }
+        }
+
+        return fields;
+    }
+
+
+    deblurJob parseJobRequest(const string& request, const deblurOptions& defaults) {
+        deblurJob job;
+        job.options = defaults;
+
+        for (const string& token : splitRequestFields(request)) {
+            size_t separator = token.find('=');
+
+            if (separator == string::npos) {
+                throw runtime_error("Invalid request token: " + token);
+            }
+
+            string key = token.substr(0, separator);
+            string value = token.substr(separator + 1);
+
+            if (key == "id") {
+                job.id = value;
+            } else if (key == "left") {
+                job.left = value;
+            } else if (key == "right") {
+                job.right = value;
+            } else if (key == "out-left") {
+                job.resultLeft = value;
+            } else if (key == "out-right") {
+                job.resultRight = value;
+            } else if (key == "threads") {
+                job.options.threads = parseInt(key, value);
+            } else if (key == "psf-width") {
+                job.options.psfWidth = parseInt(key, value);
+            } else if (key == "layers") {
+                job.options.layers = parseInt(key, value);
+            } else if (key == "max-top-nodes") {
+                job.options.maxTopLevelNodes = parseInt(key, value);
+            } else if (key == "max-disparity") {
+                job.options.maxDisparity = parseInt(key, value);
+            } else if (key == "deconv") {
+                if (value == "fft") {
+                    job.options.deconvAlgo = DepthDeblur::FFT;
+                } else if (value == "irls") {
+                    job.options.deconvAlgo = DepthDeblur::IRLS;
+                } else {
+                    throw runtime_error("Unknown deconvolution algorithm: " + value);
+                }
+            } else {
+                throw runtime_error("Unknown request option: " + key);
+            }
+        }
+
+        if (job.left.empty() || job.right.empty() || job.resultLeft.empty() || job.resultRight.empty()) {
+            throw runtime_error("Request needs left, right, out-left and out-right!");
+        }
+
+        if (job.options.threads < 1) {
+            throw runtime_error("Number of threads has to be greater zero!");
+        }
+
+        return job;
+    }
+
+
+    Mat readJobImage(const string& path) {
+        if (!isSharedMemory(path)) {
+            Mat image = imread(path, 1);
+
+            if (!image.data) {
+                throw runtime_error("Can not load image: " + path);
+            }
+
+            return image;
+        }
+
+        string name = sharedMemoryName(path);
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+
+        if (fd < 0) {
+            throw runtime_error("Can not open shared memory " + name + ": " + strerror(errno));
+        }
+
+        struct stat info;
+
+        if (fstat(fd, &info) != 0) {
+            close(fd);
+            throw runtime_error("Can not read size of shared memory " + name + ": " + strerror(errno));
+        }
+
+        if (info.st_size < (off_t)sizeof(shmImageHeader)) {
+            close(fd);
+            throw runtime_error("Shared memory " + name + " has no image header!");
+        }
+
+        void* segment = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+
+        if (segment == MAP_FAILED) {
+            throw runtime_error("Can not map shared memory " + name + ": " + strerror(errno));
+        }
+
+        const shmImageHeader* header = (const shmImageHeader*)segment;
+        Mat image;
+
+        if (memcmp(header->magic, "DBSM", 4) == 0 && header->rows > 0 && header->cols > 0) {
+            // wrap the pixel data and copy it before the segment is unmapped
+            Mat view(header->rows, header->cols, header->type, (char*)segment + sizeof(shmImageHeader));
+
+            if (sizeof(shmImageHeader) + view.total() * view.elemSize() <= (size_t)info.st_size) {
+                view.copyTo(image);
+            }
+        }
+
+        munmap(segment, info.st_size);
+
+        if (!image.data) {
+            throw runtime_error("Shared memory " + name + " doesn't contain a valid image!");
+        }
+
+        return image;
+    }
+
+
+    void writeJobImage(const string& path, const Mat& image) {
+        if (!isSharedMemory(path)) {
+            if (!imwrite(path, image)) {
+                throw runtime_error("Can not save image: " + path);
+            }
+
+            return;
+        }
+
+        string name = sharedMemoryName(path);
+        size_t size = sizeof(shmImageHeader) + image.total() * image.elemSize();
+        int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0600);
+
+        if (fd < 0 || ftruncate(fd, size) != 0) {
+            if (fd >= 0) close(fd);
+            throw runtime_error("Can not create shared memory " + name + ": " + strerror(errno));
+        }
+
+        void* segment = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+
+        if (segment == MAP_FAILED) {
+            throw runtime_error("Can not map shared memory " + name + ": " + strerror(errno));
+        }
+
+        shmImageHeader* header = (shmImageHeader*)segment;
+        memcpy(header->magic, "DBSM", 4);
+        header->rows = image.rows;
+        header->cols = image.cols;
+        header->type = image.type();
+
+        // copy row by row because the image may not be continuous
+        Mat view(image.rows, image.cols, image.type(), (char*)segment + sizeof(shmImageHeader));
+        image.copyTo(view);
+
+        munmap(segment, size);
+    }
+
+
+    // ----------------------------------------------------------------------
+    // job queue
+    // ----------------------------------------------------------------------
+
+    JobQueue::JobQueue(const int capacity)
+        : maxJobs(capacity)
+        , closed(false)
+    {}
+
+
+    bool JobQueue::tryPush(deblurJob& job) {
+        {
+            lock_guard<mutex> lock(m);
+
+            if (closed || jobs.size() >= maxJobs) {
+                return false;
+            }
+
+            jobs.push_back(job);
+        }
+
+        available.notify_one();
+        return true;
+    }
+
+
+    bool JobQueue::pop(deblurJob& job) {
+        unique_lock<mutex> lock(m);
+
+        available.wait(lock, [this]{ return closed || !jobs.empty(); });
+
+        if (jobs.empty()) {
+            return false;
+        }
+
+        job = jobs.front();
+        jobs.pop_front();
+        return true;
+    }
+
+
+    void JobQueue::close() {
+        {
+            lock_guard<mutex> lock(m);
+            closed = true;
+        }
+
+        available.notify_all();
+    }
+
+
+    int JobQueue::size() {
+        lock_guard<mutex> lock(m);
+        return jobs.size();
+    }
+
+
+    int JobQueue::capacity() const {
+        return maxJobs;
+    }
+
+
+    // ----------------------------------------------------------------------
+    // daemon
+    // ----------------------------------------------------------------------
+
+    DeblurDaemon::DeblurDaemon(const deblurOptions& defaults, const int workers, const int queueSize)
+        : defaults(defaults)
+        , queue(queueSize)
+        , running(true)
+        , jobCounter(0)
+    {
+        if (workers < 1 || queueSize < 1) {
+            throw runtime_error("Daemon needs at least one worker and one queue slot!");
+        }
+
+        // the workers live as long as the daemon so each job saves
+        // the process and thread creation
+        for (int i = 0; i < workers; i++) {
+            this->workers.push_back(thread(&DeblurDaemon::work, this));
+        }
+    }
+
+
+    DeblurDaemon::~DeblurDaemon() {
+        stop();
+        queue.close();
+
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+
+    void DeblurDaemon::stop() {
+        running = false;
+    }
+
+
+    bool DeblurDaemon::isRunning() const {
+        return running;
+    }
+
+
+    void DeblurDaemon::work() {
+        deblurJob job;
+
+        while (queue.pop(job)) {
+            string reply = runJob(job);
+
+            cout << "[daemon] " << reply << endl;
+
+            if (job.reply) {
+                job.reply(reply);
+            }
+        }
+    }
+
+
+    string DeblurDaemon::runJob(const deblurJob& job) {
+        auto start = chrono::steady_clock::now();
+
+        try {
+            Mat left = readJobImage(job.left);
+            Mat right = readJobImage(job.right);
+
+            Mat deblurredLeft, deblurredRight;
+            RunMetrics metrics = runDepthDeblur(left, right, deblurredLeft, deblurredRight, job.options);
+
+            writeJobImage(job.resultLeft, deblurredLeft);
+            writeJobImage(job.resultRight, deblurredRight);
+
+            double total = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+            ostringstream reply;
+            reply << fixed << setprecision(1);
+            reply << "ok id=" << job.id << " total=" << total;
+
+            for (const auto& stage : metrics.stages) {
+                reply << " " << stage.stage << "=" << stage.wallMs;
+            }
+
+            reply << " peak-rss-kb=" << metrics.peakRssKb;
+
+            return reply.str();
+        }
+        catch (const exception& e) {
+            return "error id=" + job.id + " " + e.what();
+        }
+    }
+
+
+    void DeblurDaemon::handleRequest(const string& request, function<void(const string&)> reply) {
+        dispatch(request, reply, true);
+    }
+
+
+    bool DeblurDaemon::dispatch(const string& request, function<void(const string&)> reply,
+                                const bool replyIfFull) {
+        // ignore surrounding white space and line endings
+        size_t first = request.find_first_not_of(" \t\r\n");
+        size_t last = request.find_last_not_of(" \t\r\n");
+        string line = (first == string::npos) ? "" : request.substr(first, last - first + 1);
+
+        if (line == "ping") {
+            reply("ok pong");
+            return true;
+        }
+
+        if (line == "status") {
+            reply("ok workers=" + to_string(workers.size()) +
+                  " queued=" + to_string(queue.size()) +
+                  " capacity=" + to_string(queue.capacity()));
+            return true;
+        }
+
+        if (line == "shutdown") {
+            stop();
+            reply("ok shutdown");
+            return true;
+        }
+
+        deblurJob job;
+
+        try {
+            job = parseJobRequest(line, defaults);
+        }
+        catch (const exception& e) {
+            reply(string("error id=- ") + e.what());
+            return true;
+        }
+
+        if (job.id.empty()) {
+            job.id = "job-" + to_string(++jobCounter);
+        }
+
+        job.reply = reply;
+
+        if (!queue.tryPush(job)) {
+            if (replyIfFull) {
+                reply("error id=" + job.id + " queue is full");
+            }
+
+            return false;
+        }
+
+        return true;
+    }
+
+
+    /**
+     * Reads the request line of a client in chunks. The timeout is a deadline
+     * for the whole line, so a client which sends byte by byte can't hold
+     * the accepting thread. Returns false on timeout, error or a line
+     * longer than 64 KB.
+     */
+    static bool readRequestLine(const int client, const int timeoutMs, string& request) {
+        const size_t maxLength = 64 << 10;
+        const auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeoutMs);
+        char buffer[4096];
+
+        while (true) {
+            const long remaining = chrono::duration_cast<chrono::milliseconds>(
+                                       deadline - chrono::steady_clock::now()).count();
+            pollfd readable = {client, POLLIN, 0};
+
+            if (remaining <= 0 || poll(&readable, 1, remaining) <= 0) {
+                return false;
+            }
+
+            ssize_t bytes = read(client, buffer, sizeof(buffer));
+
+            if (bytes < 0) {
+                return false;
+            }
+
+            // a client may close its side without a line ending
+            if (bytes == 0) {
+                return true;
+            }
+
+            const char* end = (const char*)memchr(buffer, '\n', bytes);
+
+            // the connection carries a single request, the rest is ignored
+            if (end != nullptr) {
+                request.append(buffer, end - buffer);
+                return true;
+            }
+
+            request.append(buffer, bytes);
+
+            if (request.size() > maxLength) {
+                return false;
+            }
+        }
+    }
+
+
+    void DeblurDaemon::serveSocket(const string& socketPath) {
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+
+        if (socketPath.size() >= sizeof(address.sun_path)) {
+            throw runtime_error("Socket path is too long: " + socketPath);
+        }
+
+        strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+        int server = socket(AF_UNIX, SOCK_STREAM, 0);
+
+        if (server < 0) {
+            throw runtime_error(string("Can not create socket: ") + strerror(errno));
+        }
+
+        // replace a socket file of a former run
+        unlink(socketPath.c_str());
+
+        if (bind(server, (sockaddr*)&address, sizeof(address)) != 0 || listen(server, 16) != 0) {
+            close(server);
+            throw runtime_error("Can not listen on " + socketPath + ": " + strerror(errno));
+        }
+
+        cout << "[daemon] listening on " << socketPath << endl;
+
+        while (running) {
+            // wake up regularly to check if the daemon was stopped
+            pollfd pending = {server, POLLIN, 0};
+
+            if (poll(&pending, 1, 200) <= 0) {
+                continue;
+            }
+
+            int client = accept(server, nullptr, nullptr);
+
+            if (client < 0) {
+                continue;
+            }
+
+            // don't let a slow client block the daemon
+            string request;
+
+            if (!readRequestLine(client, 5000, request)) {
+                const string line = "error id=- no complete request within 5 s\n";
+                ssize_t written = write(client, line.c_str(), line.size());
+                (void)written;
+                close(client);
+                continue;
+            }
+
+            // the connection is closed after the reply was sent
+            handleRequest(request, [client](const string& reply) {
+                string line = reply + "\n";
+                ssize_t written = write(client, line.c_str(), line.size());
+                (void)written;
+                close(client);
+            });
+        }
+
+        close(server);
+        unlink(socketPath.c_str());
+    }
+
+
+    void DeblurDaemon::serveSpool(const string& directory, const int pollInterval) {
+        const string jobSuffix = ".job";
+        const string runningSuffix = ".running";
+
+        DIR* spool = opendir(directory.c_str());
+
+        if (spool == nullptr) {
+            throw runtime_error("Can not open spool directory: " + directory);
+        }
+
+        // jobs of a crashed daemon are started again
+        for (dirent* entry = readdir(spool); entry != nullptr; entry = readdir(spool)) {
+            string name = entry->d_name;
+
+            if (name.size() > runningSuffix.size() &&
+                name.compare(name.size() - runningSuffix.size(), runningSuffix.size(), runningSuffix) == 0) {
+                string base = directory + "/" + name.substr(0, name.size() - runningSuffix.size());
+                rename((directory + "/" + name).c_str(), (base + jobSuffix).c_str());
+            }
+        }
+
+        closedir(spool);
+
+        cout << "[daemon] watching spool directory " << directory << endl;
+
+        while (running) {
+            vector<string> pending;
+            spool = opendir(directory.c_str());
+
+            if (spool != nullptr) {
+                for (dirent* entry = readdir(spool); entry != nullptr; entry = readdir(spool)) {
+                    string name = entry->d_name;
+
+                    if (name.size() > jobSuffix.size() &&
+                        name.compare(name.size() - jobSuffix.size(), jobSuffix.size(), jobSuffix) == 0) {
+                        pending.push_back(name.substr(0, name.size() - jobSuffix.size()));
+                    }
+                }
+
+                closedir(spool);
+            }
+
+            // oldest name first, clients can use time stamps as names
+            sort(pending.begin(), pending.end());
+
+            for (const string& name : pending) {
+                // jobs are left in the spool directory while the queue is full
+                // (saves claiming jobs which can't be queued anyway)
+                if (queue.size() >= queue.capacity()) {
+                    break;
+                }
+
+                string base = directory + "/" + name;
+
+                // claim the job, this fails if it was removed in the meantime
+                if (rename((base + jobSuffix).c_str(), (base + runningSuffix).c_str()) != 0) {
+                    continue;
+                }
+
+                ifstream file(base + runningSuffix);
+                string request;
+                getline(file, request);
+                file.close();
+
+                // the job name is used as id if none is given
+                // (with the separator of the request, see splitRequestFields)
+                bool hasId = false;
+
+                for (const string& field : splitRequestFields(request)) {
+                    hasId = hasId || field.compare(0, 3, "id=") == 0;
+                }
+
+                if (!hasId) {
+                    request += ((request.find('\t') != string::npos) ? "\tid=" : " id=") + name;
+                }
+
+                auto reply = [base, runningSuffix](const string& reply) {
+                    bool failed = reply.compare(0, 5, "error") == 0;
+                    ofstream result(base + (failed ? ".failed" : ".done"));
+                    result << reply << endl;
+                    result.close();
+
+                    unlink((base + runningSuffix).c_str());
+                };
+
+                // the socket may have filled the queue since the check above,
+                // then the job goes back to the spool and is retried later
+                if (!dispatch(request, reply, false)) {
+                    rename((base + runningSuffix).c_str(), (base + jobSuffix).c_str());
+                    break;
+                }
+            }
+
+            this_thread::sleep_for(chrono::milliseconds(pollInterval));
+        }
+    }
+}
@@ -1,11 +1,19 @@
 #include <iostream>                     // cout, cerr, endl
 #include <stdexcept>                    // throw exception
+#include <unistd.h>                     // access
+#include <chrono>                       // steady_clock
 #include <opencv2/highgui/highgui.hpp>  // imread, imshow, imwrite
 #include <opencv2/imgproc/imgproc.hpp>  // convert
 
 #include "depth_deblur.hpp"             // for one step of the depth-aware deblurring
 #include "utils.hpp"                    // convertFloatToUchar
 #include "disparity_estimation.hpp"     // SGBM MATCH
+#include "trace.hpp"                    // TRACE_SCOPE
+#include "mat_pool.hpp"                 // ScopedMatPool
+#include "psf_bank.hpp"                 // PSFBank
+#include "stage_cache.hpp"              // CacheKey
+#include "time_budget.hpp"              // planTimeBudget
+#include "tiled_deblur.hpp"             // tileOverlap
 
 #include "depth_aware_deblurring.hpp"
 
@@ -16,24 +24,196 @@ using namespace cv;
 
 namespace deblur {
 
-    void runDepthDeblur(const Mat& blurredLeft, const Mat& blurredRight,
-                        Mat& deblurredLeft, Mat& deblurredRight, const int threads,
-                        int psfWidth, const int layers, const int maxTopLevelNodes,
-                        const DepthDeblur::deconvAlgo deconvAlgo, const int maxDisparity) {
+    /**
+     * Runs the disparity estimation or loads its result from the cache.
+     *
+     * @return left-right map of the matching (empty if it isn't in the cache entry)
+     */
+    static Mat cachedDisparityEstimation(DepthDeblur& depthDeblur, const array<Mat, 2>& views,
+                                         const deblurOptions& options, const CacheKey& key) {
+        vector<Mat> cached;
+
+        if (options.cache != nullptr && options.cache->load(key, cached)) {
+            const float* centers = cached[2].ptr<float>();
+            depthDeblur.setDisparityMaps({cached[0], cached[1]}, vector<float>(centers, centers + cached[2].total()));
+            return (cached.size() > 3) ? cached[3] : Mat();
+        }
+
+        depthDeblur.disparityEstimation(views, MATCH, options.maxDisparity, vector<float>(), options.threads);
+
+        const Mat& matched = depthDeblur.getMatchedDisparityMaps()[LEFT];
+
+        if (options.cache != nullptr) {
+            const array<Mat, 2>& maps = depthDeblur.getDisparityMaps();
+            Mat centers(depthDeblur.getDisparityCenters(), true);
+            options.cache->store(key, {maps[LEFT], maps[RIGHT], centers, matched});
+        }
+
+        return matched;
+    }
+
+
+    /**
+     * PSFs of the region tree nodes as matrices for the cache: one row
+     * (id, parent, entropy) per PSF followed by the PSFs.
+     */
+    static vector<Mat> cachedMats(const vector<psfEntry>& psfs) {
+        vector<Mat> mats;
+        Mat meta(psfs.size(), 3, CV_32F);
+
+        for (int i = 0; i < psfs.size(); i++) {
+            meta.at<float>(i, 0) = psfs[i].id;
+            meta.at<float>(i, 1) = psfs[i].parent;
+            meta.at<float>(i, 2) = psfs[i].entropy;
+        }
+
+        mats.push_back(meta);
+
+        for (const auto& entry : psfs) {
+            mats.push_back(entry.psf);
+        }
+
+        return mats;
+    }
+
+
+    /**
+     * Inverse of cachedMats
+     */
+    static vector<psfEntry> psfEntries(const vector<Mat>& mats) {
+        vector<psfEntry> psfs;
+
+        for (int i = 0; i + 1 < mats.size(); i++) {
+            psfEntry entry;
+            entry.id = mats[0].at<float>(i, 0);
+            entry.parent = mats[0].at<float>(i, 1);
+            entry.entropy = mats[0].at<float>(i, 2);
+            entry.psf = mats[i + 1];
+
+            psfs.push_back(entry);
+        }
+
+        return psfs;
+    }
+
+
+    RunMetrics runDepthDeblur(const Mat& blurredLeft, const Mat& blurredRight,
+                              Mat& deblurredLeft, Mat& deblurredRight, const int threads,
+                              int psfWidth, const int layers, const int maxTopLevelNodes,
+                              const DepthDeblur::deconvAlgo deconvAlgo, const int maxDisparity) {
+        deblurOptions options;
+        options.threads = threads;
+        options.psfWidth = psfWidth;
+        options.layers = layers;
+        options.maxTopLevelNodes = maxTopLevelNodes;
+        options.deconvAlgo = deconvAlgo;
+        options.maxDisparity = maxDisparity;
+
+        return runDepthDeblur(blurredLeft, blurredRight, deblurredLeft, deblurredRight, options);
+    }
+
+
+    RunMetrics runDepthDeblur(const Mat& inputLeft, const Mat& inputRight,
+                              Mat& deblurredLeft, Mat& deblurredRight,
+                              const deblurOptions& options) {
+        TRACE_SCOPE("runDepthDeblur");
+
+        const auto begin = chrono::steady_clock::now();
+
         // check if images have the same size
-        if (blurredLeft.cols != blurredRight.cols || blurredLeft.rows != blurredRight.rows) {
+        if (inputLeft.cols != inputRight.cols || inputLeft.rows != inputRight.rows) {
             throw runtime_error("Images aren't of same size!");
         }
 
         // approximate PSF width has to be greater than 0
-        if (psfWidth < 1) {
+        if (options.psfWidth < 1) {
             throw runtime_error("PSF width has to be greater zero!");
         }
 
+        // region of interest: everything is computed on a context window around it
+        // (the same overlap as the tiles, so the matching pixels of the other view
+        // and the PSF support are inside)
+        const Rect image(0, 0, inputLeft.cols, inputLeft.rows);
+        Rect context = image;
+        Rect roi = image;
+
+        if (options.roi.area() > 0) {
+            if ((options.roi & image) != options.roi) {
+                throw runtime_error("Region of interest is outside of the image!");
+            }
+
+            const Size overlap = tileOverlap(options.psfWidth, options.maxDisparity);
+            context = Rect(options.roi.x - overlap.width, options.roi.y - overlap.height,
+                           options.roi.width + 2 * overlap.width, options.roi.height + 2 * overlap.height) & image;
+
+            // ROI inside of the context window
+            roi = Rect(options.roi.x - context.x, options.roi.y - context.y, options.roi.width, options.roi.height);
+        }
+
+        const Mat blurredLeft = inputLeft(context);
+        const Mat blurredRight = inputRight(context);
+
+        const int threads = options.threads;
+
+        // limit the memory of the concurrent region solves
+        MemoryBudget localBudget(options.memoryBudget);
+        MemoryBudget* budget = (options.sharedMemoryBudget != nullptr) ? options.sharedMemoryBudget : &localBudget;
+
+        // recycle the buffers of the many temporary matrices
+        ScopedMatPool pool(options.pooledAllocator);
+
+        RunMetrics metrics;
+        metrics.width = inputLeft.cols;
+        metrics.height = inputLeft.rows;
+
+        if (options.roi.area() > 0) {
+            metrics.roi = {options.roi.x, options.roi.y, options.roi.width, options.roi.height};
+        }
+        metrics.threads = threads;
+        metrics.psfWidth = options.psfWidth;
+        metrics.layers = options.layers;
+
+        // wall and CPU time of the steps (summed over both passes)
+        StageClock clock(metrics);
+
+        // the cache may be shared by several runs
+        const long cacheHits = (options.cache != nullptr) ? options.cache->hits() : 0;
+        const long cacheMisses = (options.cache != nullptr) ? options.cache->misses() : 0;
+
+        // kernels from the disk are loaded once (they are part of the cache keys)
+        const vector<Mat> toplevelKernels = options.toplevelKernels.empty() ? loadToplevelKernels(".")
+                                                                           : options.toplevelKernels;
+
+        // anytime mode: lower the quality knobs until the predicted time fits into the budget
+        // (without budget the knobs are the options)
+        const budgetPlan plan = planTimeBudget(blurredLeft.size(), options, toplevelKernels.size());
+        const qualityKnobs& knobs = plan.knobs;
+
+        auto deadline = chrono::steady_clock::time_point::max();
+
+        if (options.timeBudgetMs > 0) {
+            deadline = begin + chrono::duration_cast<chrono::steady_clock::duration>(
+                                   chrono::duration<double, milli>(options.timeBudgetMs));
+
+            cout << "Time budget " << options.timeBudgetMs << " ms (predicted " << plan.costs.totalMs() << " ms)" << endl;
+
+            for (const auto& knob : plan.lowered) {
+                cout << "   lowered " << knob << endl;
+            }
+
+            metrics.timeBudgetMs = options.timeBudgetMs;
+            metrics.predictedMs = plan.costs.totalMs();
+            metrics.loweredKnobs = plan.lowered;
+            metrics.layers = knobs.layers;
+        }
+
 
         #ifdef IMWRITE
             imwrite("input-left.png", blurredLeft);
             imwrite("input-right.png", blurredRight);
+
+            // the kernels of the mid-level regions are appended
+            savePSFBank("mid-kernels.psfb", vector<psfEntry>());
         #endif
 
         // views for disparity estimation
@@ -42,73 +222,255 @@ namespace deblur {
         blurredLeft.copyTo(deblurViews[LEFT]);
         blurredRight.copyTo(deblurViews[RIGHT]);
 
-        // two passes through algorithm
-        for (int i = 0; i < 2; i++) {
+        // measured time of the disparity estimation / predicted time
+        double speed = 1;
+
+        // the second pass is off by default because the result of the first one is too bad :(
+        const int passes = std::min(2, std::max(1, options.passes));
+
+        // up to two passes through algorithm
+        for (int i = 0; i < passes; i++) {
             cout << i + 1 << ". Pass Estimation" << endl;
+            TRACE_SCOPE_ID("pass", i + 1);
 
             // this class holds everything needed for one step of the depth-aware deblurring
-            DepthDeblur depthDeblur(blurredLeft, blurredRight, psfWidth, layers, deconvAlgo);
+            DepthDeblur depthDeblur(blurredLeft, blurredRight, options.psfWidth, knobs.layers,
+                                    knobs.psfSolver);
+            depthDeblur.setMemoryBudget(budget);
+            depthDeblur.setStageCache(options.cache);
+            depthDeblur.setIRLSIterations(knobs.irlsIterations);
+            depthDeblur.setColorMode(options.colorMode);
+
+            if (options.roi.area() > 0) {
+                depthDeblur.setRegionOfInterest(roi);
+            }
+
+            // stereo video: start with the disparities of the previous frame
+            const disparityPrior* prior = nullptr;
+
+            if (options.sequence != nullptr && i == 0) {
+                prior = options.sequence->nextFrame(blurredLeft);
+            }
+
+            // otherwise start with the disparities of a preview
+            const bool preview = options.preview != nullptr && options.preview->size == blurredLeft.size();
+
+            if (prior == nullptr && preview && i == 0 && !options.preview->disparity.map.empty()) {
+                prior = &options.preview->disparity;
+            }
+
+            depthDeblur.setDisparityPrior(prior);
 
             // initial disparity estimation of blurred images
             // here: left image is matching image and right image is reference image
             //       I_m(x) = I_r(x + d_m(x))
             cout << " Step 1: disparity estimation" << endl;
-            depthDeblur.disparityEstimation(deblurViews, MATCH, maxDisparity);
+            CacheKey disparityKey("disparity");
+            disparityKey.add(deblurViews[LEFT]).add(deblurViews[RIGHT]).add(MATCH)
+                        .add(options.maxDisparity).add(knobs.layers);
+
+            if (prior != nullptr) {
+                disparityKey.add(prior->map).add(prior->band);
+            }
+
+            {
+                TRACE_SCOPE("disparity estimation");
+                auto start = chrono::steady_clock::now();
+
+                Mat matched = cachedDisparityEstimation(depthDeblur, deblurViews, options, disparityKey);
+
+                chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+
+                if (options.sequence != nullptr && i == 0) {
+                    options.sequence->update(matched, elapsed.count());
+                }
+
+                // the speed of this machine compared to the cost model
+                if (options.timeBudgetMs > 0 && i == 0 && plan.costs.disparityMs > 0) {
+                    speed = std::min(4.0, std::max(0.25, elapsed.count() / plan.costs.disparityMs));
+                }
+            }
+            clock.tick("disparity");
             
 
             cout << " Step 2: region tree reconstruction" << endl;
-            depthDeblur.regionTreeReconstruction(maxTopLevelNodes);
+            {
+                TRACE_SCOPE("region tree reconstruction");
+                depthDeblur.regionTreeReconstruction(knobs.maxTopLevelNodes);
+            }
+            clock.tick("region-tree");
+
+            // the PSF estimation has to stop in time for the deconvolution
+            auto psfDeadline = deadline;
+
+            if (options.timeBudgetMs > 0) {
+                psfDeadline -= chrono::duration_cast<chrono::steady_clock::duration>(
+                                   chrono::duration<double, milli>(plan.costs.deconvolutionMs * speed));
+            }
+
+            if (!knobs.midLevelPSFs) {
+                psfDeadline = chrono::steady_clock::time_point::min();
+            }
 
 
-            cout << " Step 3: PSF estimation for top-level regions in trees" << endl;
-            depthDeblur.toplevelKernelEstimation();
+            // stereo video: start with the PSFs of the previous frame
+            const psfPrior* previousPSFs = nullptr;
 
+            if (options.psfSequence != nullptr && i == 0) {
+                const bool sceneCut = (options.sequence != nullptr) && options.sequence->sceneCut();
+                previousPSFs = options.psfSequence->nextFrame(sceneCut);
+            }
 
-            cout << " Step 3.1: Iterative PSF estimation" << endl;
-            cout << "   ... jointly compute PSF for middle & leaf level-regions of both views" << endl;
-            depthDeblur.midLevelKernelEstimation(threads);
+            if (previousPSFs == nullptr && preview && i == 0 && !options.preview->psfs.psfs.empty()) {
+                previousPSFs = &options.preview->psfs;
+            }
+
+            depthDeblur.setPSFPrior(previousPSFs);
+
+            // the PSFs depend on the regions, the blurred views and the top-level kernels
+            CacheKey psfKey("psfs");
+            psfKey.add(disparityKey).add(blurredLeft).add(blurredRight).add(options.psfWidth)
+                  .add(knobs.maxTopLevelNodes).add(knobs.psfSolver).add(toplevelKernels)
+                  .add(roi.x).add(roi.y).add(roi.width).add(roi.height);
+
+            if (previousPSFs != nullptr) {
+                psfKey.add(cachedMats(previousPSFs->psfs)).add(previousPSFs->threshold);
+
+                if (!previousPSFs->energies.empty()) {
+                    psfKey.add(previousPSFs->energies.data(), previousPSFs->energies.size() * sizeof(float));
+                }
+            }
+
+            vector<Mat> cachedPSFs;
+
+            if (options.cache != nullptr && options.cache->load(psfKey, cachedPSFs)) {
+                cout << " Step 3: PSFs of all regions from the cache" << endl;
+                depthDeblur.setPSFs(psfEntries(cachedPSFs));
+            } else {
+                cout << " Step 3: PSF estimation for top-level regions in trees" << endl;
+                {
+                    TRACE_SCOPE("top-level PSF estimation");
+                    depthDeblur.toplevelKernelEstimation(toplevelKernels);
+                }
+                clock.tick("toplevel-psf");
+
+
+                cout << " Step 3.1: Iterative PSF estimation" << endl;
+                cout << "   ... jointly compute PSF for middle & leaf level-regions of both views" << endl;
+                {
+                    TRACE_SCOPE("mid-level PSF estimation");
+                    depthDeblur.setDeadline(psfDeadline);
+                    depthDeblur.midLevelKernelEstimation(threads);
+                }
+
+                // PSFs which were cut short by the deadline aren't cached
+                const bool complete = chrono::steady_clock::now() <= psfDeadline;
+
+                if (options.cache != nullptr && complete) {
+                    options.cache->store(psfKey, cachedMats(depthDeblur.getPSFs(i + 1)));
+                }
+            }
+            clock.tick("midlevel-psf");
 
 
             cout << " Step 4: Blur removal given PSF estimate" << endl;
-            // set new left and right view for second pass
-            if ((i + 1) < 2) {
-                Mat deconvLeft, deconvRight;
-                // use threads
-                depthDeblur.deconvolve(deconvLeft, LEFT, threads);
-                depthDeblur.deconvolve(deconvRight, RIGHT, threads);
+            {
+                TRACE_SCOPE("deconvolution");
+                depthDeblur.setDeadline(deadline);
+
+                // set new left and right view for second pass
+                if ((i + 1) < passes) {
+                    Mat deconvLeft, deconvRight;
+                    // use threads
+                    depthDeblur.deconvolve(deconvLeft, LEFT, threads);
+                    depthDeblur.deconvolve(deconvRight, RIGHT, threads);
                 
-                // this deconvolved images will be used for a disparity update
-                deconvLeft.copyTo(deblurViews[LEFT]);
-                deconvRight.copyTo(deblurViews[RIGHT]);
-            } else {
-                // deblur final images
-                depthDeblur.deconvolve(deblurViews[LEFT], LEFT, threads);
-                depthDeblur.deconvolve(deblurViews[RIGHT], RIGHT, threads);
+                    // this deconvolved images will be used for a disparity update
+                    deconvLeft.copyTo(deblurViews[LEFT]);
+                    deconvRight.copyTo(deblurViews[RIGHT]);
+                } else {
+                    // deblur final images
+                    depthDeblur.deconvolve(deblurViews[LEFT], LEFT, threads, options.color);
+                    depthDeblur.deconvolve(deblurViews[RIGHT], RIGHT, threads, options.color);
+                }
+            }
 
-                // FIXME: deblur color images
+            clock.tick("deconvolution");
+
+            depthDeblur.collectMetrics(metrics, i + 1);
+            metrics.passes++;
+
+            if (options.sequence != nullptr && i == 0) {
+                disparityMetrics& disparity = metrics.disparity.back();
+                disparity.frame = options.sequence->frame();
+                disparity.warmStart = options.sequence->warmStart();
+                disparity.sceneCut = options.sequence->sceneCut();
+                disparity.speedup = options.sequence->speedup();
+            }
+
+            if (options.psfSequence != nullptr && i == 0) {
+                options.psfSequence->update(depthDeblur.getPSFs(i + 1), depthDeblur.getReferenceEnergies());
+            }
+
+            // PSFs of the last pass
+            if (options.psfs != nullptr) {
+                *options.psfs = depthDeblur.getPSFs(i + 1);
             }
 
             #ifdef IMWRITE
                 imwrite("deconv-" + to_string(i + 1) + "-left.png", deblurViews[LEFT]);
                 imwrite("deconv-" + to_string(i + 1) + "-right.png", deblurViews[RIGHT]);
             #endif
+        }
+
+        // only the ROI is a result
+        deblurViews[LEFT](roi).copyTo(deblurredLeft);
+        deblurViews[RIGHT](roi).copyTo(deblurredRight);
+        
+        clock.finish();
+        metrics.memoryBudgetBytes = budget->budget();
+        metrics.peakConcurrentSolves = budget->peakTasks();
+        metrics.throttledSolves = budget->throttledTasks();
 
-            // FIXME: skip second pass because the result is of the first is too bad :(
-            i++;
+        if (options.timeBudgetMs > 0) {
+            metrics.deadlineHit = metrics.totalWallMs > options.timeBudgetMs || metrics.fastRegions > 0
+                                  || (knobs.midLevelPSFs && metrics.skippedNodes > 0);
+
+            cout << "Time budget " << (metrics.deadlineHit ? "exceeded" : "kept") << ": "
+                 << metrics.totalWallMs << " of " << options.timeBudgetMs << " ms" << endl;
         }
 
-        deblurViews[LEFT].copyTo(deblurredLeft);
-        deblurViews[RIGHT].copyTo(deblurredRight);
+        if (options.cache != nullptr) {
+            metrics.cacheHits = options.cache->hits() - cacheHits;
+            metrics.cacheMisses = options.cache->misses() - cacheMisses;
+        }
         
         cout << "finished Algorithm" << endl;
+
+        return metrics;
+    }
+
+
+    RunMetrics runDepthDeblur(const string filenameLeft, const string filenameRight,
+                              const int threads, const int psfWidth, const int layers,
+                              const int maxTopLevelNodes, const DepthDeblur::deconvAlgo deconvAlgo,
+                              const int maxDisparity,
+                              const string filenameResultLeft, const string filenameResultRight) {
+        deblurOptions options;
+        options.threads = threads;
+        options.psfWidth = psfWidth;
+        options.layers = layers;
+        options.maxTopLevelNodes = maxTopLevelNodes;
+        options.deconvAlgo = deconvAlgo;
+        options.maxDisparity = maxDisparity;
+
+        return runDepthDeblur(filenameLeft, filenameRight, options, filenameResultLeft, filenameResultRight);
     }
 
 
-    void runDepthDeblur(const string filenameLeft, const string filenameRight,
-                        const int threads, const int psfWidth, const int layers,
-                        const int maxTopLevelNodes, const DepthDeblur::deconvAlgo deconvAlgo,
-                        const int maxDisparity,
-                        const string filenameResultLeft, const string filenameResultRight) {
+    RunMetrics runDepthDeblur(const string filenameLeft, const string filenameRight,
+                              const deblurOptions& options,
+                              const string filenameResultLeft, const string filenameResultRight) {
 
         // load images
         Mat blurredLeft, blurredRight;
@@ -120,10 +482,48 @@ namespace deblur {
         }
 
         Mat left, right;
-        runDepthDeblur(blurredLeft, blurredRight, left, right, threads, psfWidth, layers, maxTopLevelNodes,
-                       deconvAlgo, maxDisparity);
+        RunMetrics metrics = runDepthDeblur(blurredLeft, blurredRight, left, right, options);
 
         imwrite(filenameResultLeft, left);
         imwrite(filenameResultRight, right);
+
+        return metrics;
+    }
+
+
+    vector<Mat> loadToplevelKernels(const string& directory) {
+        vector<Mat> kernels;
+
+        // a PSF bank (given directly or inside the folder) is preferred
+        // because it holds the float kernels
+        string bank = isPSFBank(directory) ? directory : directory + "/kernels.psfb";
+
+        if (isPSFBank(directory) || access(bank.c_str(), R_OK) == 0) {
+            PSFBank psfs(bank);
+
+            for (int i = 0; i < psfs.size(); i++) {
+                Mat kernel = psfs.psf(i).clone();
+                kernel /= sum(kernel)[0];
+                kernels.push_back(kernel);
+            }
+
+            return kernels;
+        }
+
+        for (int i = 0; ; i++) {
+            Mat kernelImage = imread(directory + "/kernel" + to_string(i) + ".png", CV_LOAD_IMAGE_GRAYSCALE);
+
+            if (!kernelImage.data) {
+                break;
+            }
+
+            // convert kernel-image to energy preserving float kernel
+            kernelImage.convertTo(kernelImage, CV_32F);
+            kernelImage /= sum(kernelImage)[0];
+
+            kernels.push_back(kernelImage);
+        }
+
+        return kernels;
     }
 }
\ No newline at end of file
@@ -1,7 +1,11 @@
 #include <iostream>                     // cout, cerr, endl
 #include <opencv2/highgui/highgui.hpp>  // imread, imshow, imwrite
 #include <cmath>                        // log
+#include <algorithm>                    // sort
+#include <numeric>                      // iota
+#include <map>
 #include <thread>
+#include <chrono>
 
 #include "utils.hpp"
 #include "disparity_estimation.hpp"     // SGBM, fillOcclusions, quantize
@@ -10,6 +14,9 @@
 #include "two_phase_psf_estimation.hpp"
 #include "deconvolution.hpp"
 #include "coherence_filter.hpp"
+#include "trace.hpp"
+#include "psf_bank.hpp"                 // appendPSFBank
+#include "depth_aware_deblurring.hpp"   // loadToplevelKernels
 
 #include "depth_deblur.hpp"
 
@@ -43,8 +50,17 @@ namespace deblur {
     }
 
 
+    /**
+     * Milliseconds since the given time point
+     */
+    static double elapsedMs(const chrono::steady_clock::time_point start) {
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    }
+
+
     void DepthDeblur::disparityEstimation(const array<Mat, 2>& input, const disparityAlgo algorithm,
-                                          int maxDisparity) {
+                                          int maxDisparity, const vector<float>& centers,
+                                          const int threads) {
         array<Mat, 2> views;
 
         // use gray values for disparity estimation for SGBM
@@ -76,14 +92,14 @@ namespace deblur {
             // disparity map with occlusions as black regions
             // here a different algorithm as the paper approach is used
             // because it is more convenient to use a OpenCV implementation.
-            disparityFilledSGBM(small, smallDMaps);
+            disparityFilledSGBM(small, smallDMaps, threads);
         } else if (algorithm == MATCH) {
             // because the images are down sampled the max disparity from the user
             // has to be downsampled too
             maxDisparity /= sampleRatio;
 
             // disparity estimation algorithm from the paper
-            disparityFilledMatch(small, smallDMaps, maxDisparity);
+            disparityFilledMatch(small, smallDMaps, maxDisparity, &matchStatistics, threads, disparityPriorMap);
         } else {
             throw runtime_error("Invalid disparity algorithm");
         }
@@ -101,9 +117,19 @@ namespace deblur {
             imwrite("dmap-algo-right.png", disparityViewableAlgo);
         #endif
 
+        matchedDisparityMaps = smallDMaps;
+
         // quantize the image
         array<Mat, 2> quantizedDMaps;
-        quantizeImage(smallDMaps, layers, quantizedDMaps);
+
+        if (centers.empty()) {
+            quantizeImage(smallDMaps, layers, quantizedDMaps, &disparityCenters);
+        } else {
+            assert(centers.size() == layers && "one center per layer needed");
+
+            disparityCenters = centers;
+            quantizeImage(smallDMaps, centers, quantizedDMaps);
+        }
 
         #ifdef IMWRITE
             // convert quantized image to be displayable
@@ -126,6 +152,93 @@ namespace deblur {
     }
 
 
+    void DepthDeblur::setDisparityMaps(const array<Mat, 2>& maps, const vector<float>& centers) {
+        assert(centers.size() == layers && "one center per layer needed");
+
+        maps[LEFT].copyTo(disparityMaps[LEFT]);
+        maps[RIGHT].copyTo(disparityMaps[RIGHT]);
+        disparityCenters = centers;
+    }
+
+
+    vector<Mat> DepthDeblur::getLeafPSFs() {
+        vector<Mat> psfs(layers);
+
+        // the leaf nodes have the ids of the layers
+        for (int l = 0; l < layers; l++) {
+            psfs[l] = regionTree[l].psf;
+        }
+
+        return psfs;
+    }
+
+
+    vector<psfEntry> DepthDeblur::getPSFs(const int pass) {
+        vector<psfEntry> psfs;
+
+        for (int id = 0; id < regionTree.size(); id++) {
+            if (regionTree[id].psf.empty()) {
+                continue;
+            }
+
+            psfEntry entry;
+            entry.id = id;
+            entry.parent = regionTree[id].parent;
+            entry.pass = pass;
+            entry.entropy = computeEntropy(regionTree[id].psf);
+            entry.psf = regionTree[id].psf;
+
+            psfs.push_back(entry);
+        }
+
+        return psfs;
+    }
+
+
+    void DepthDeblur::setPSFs(const vector<psfEntry>& psfs) {
+        for (const auto& entry : psfs) {
+            assert(entry.id >= 0 && entry.id < regionTree.size() && "PSF of an unknown node");
+
+            entry.psf.copyTo(regionTree[entry.id].psf);
+            regionTree[entry.id].entropy = entry.entropy;
+        }
+    }
+
+
+    void DepthDeblur::setLeafPSFs(const vector<Mat>& psfs) {
+        assert(psfs.size() == layers && "one PSF per layer needed");
+
+        for (int l = 0; l < layers; l++) {
+            psfs[l].copyTo(regionTree[l].psf);
+        }
+    }
+
+
+    void DepthDeblur::setRegionOfInterest(const Rect& roi) {
+        const Rect views(0, 0, floatImages[LEFT].cols, floatImages[LEFT].rows);
+
+        // pixels within the PSF width influence the ROI
+        roiSupport = Rect(roi.x - psfWidth, roi.y - psfWidth,
+                          roi.width + 2 * psfWidth, roi.height + 2 * psfWidth) & views;
+
+        // twice the PSF width keeps the ringing of the border out of the ROI (see tileOverlap)
+        roiDeconvolution = Rect(roi.x - 2 * psfWidth, roi.y - 2 * psfWidth,
+                                roi.width + 4 * psfWidth, roi.height + 4 * psfWidth) & views;
+    }
+
+
+    bool DepthDeblur::inRegionOfInterest(int id) {
+        if (roiSupport.area() == 0) {
+            return true;
+        }
+
+        array<Mat, 2> masks;
+        regionTree.getMasks(id, masks);
+
+        return countNonZero(masks[LEFT](roiSupport)) > 0 || countNonZero(masks[RIGHT](roiSupport)) > 0;
+    }
+
+
     void DepthDeblur::regionTreeReconstruction(const int maxTopLevelNodes) {
         // create a region tree
         regionTree.create(disparityMaps[LEFT], disparityMaps[RIGHT], layers,
@@ -133,7 +246,11 @@ namespace deblur {
     }
 
 
-    void DepthDeblur::toplevelKernelEstimation() {
+    void DepthDeblur::toplevelKernelEstimation(const vector<Mat>& kernels) {
+        // kernels from the disk are loaded once for all top-level nodes
+        const vector<Mat> loadedKernels = kernels.empty() ? loadToplevelKernels(".") : vector<Mat>();
+        const vector<Mat>& toplevelKernels = kernels.empty() ? loadedKernels : kernels;
+
         // go through each top-level node
         for (int i = 0; i < regionTree.topLevelNodeIds.size(); i++) {
             int id = regionTree.topLevelNodeIds[i];
@@ -193,9 +310,14 @@ namespace deblur {
             // imwrite("tapered" + to_string(i) + ".jpg", taperedRegion);
             
             // 2. load kernel images generated with the exe for toplevels
-            // load the kernel images which should be named left/right-kerneli.png
-            // they should be located in the folder where this algorithm is started
-            Mat kernelImage = imread("kernel" + to_string(i) + ".png", CV_LOAD_IMAGE_GRAYSCALE);
+            // load the kernels which should be stored in kernels.psfb or
+            // kernel<i>.png in the folder where this algorithm is started
+            // (preloaded kernels skip the disk access)
+            Mat kernelImage;
+
+            if (i < toplevelKernels.size() && toplevelKernels[i].data) {
+                toplevelKernels[i].copyTo(kernelImage);
+            }
 
             if (!kernelImage.data) {
                 throw runtime_error("Can not load kernel!");
@@ -220,6 +342,7 @@ namespace deblur {
 
     void DepthDeblur::jointPSFEstimation(const array<Mat, 2>& masks, const array<Mat,2>& salientEdgesLeft,
                                          const array<Mat,2>& salientEdgesRight, Mat& psf) {
+        TRACE_SCOPE("jointPSFEstimation");
 
         // get gradients of current region only
         array<Mat,2> regionGradsLeft, regionGradsRight;
@@ -440,6 +563,7 @@ namespace deblur {
 
     void DepthDeblur::estimateChildPSF(const Mat& parentPSF, Mat& psf, const array<Mat, 2>& masks,
                                        const int id) {
+        TRACE_SCOPE_ID("estimateChildPSF", id);
 
         // compute salient edge map ∇S_i for region
         // 
@@ -491,12 +615,13 @@ namespace deblur {
             imwrite("mid-" + to_string(id) + "-mask-left.png", masks[LEFT] * 255);
             imwrite("mid-" + to_string(id) + "-mask-right.png", masks[RIGHT] * 255);
 
-            // kernels
-            Mat tmp;
-            psf.copyTo(tmp);
-            tmp *= 1000;
-            convertFloatToUchar(tmp, tmp);
-            imwrite("mid-" + to_string(id) + "-kernel-init.png", tmp);
+            // float kernels (see tools/psf-bank for images)
+            psfEntry kernel;
+            kernel.id = id;
+            kernel.parent = regionTree[id].parent;
+            kernel.label = "init";
+            kernel.psf = psf;
+            appendPSFBank("mid-kernels.psfb", {kernel});
         #endif
     }
 
@@ -562,10 +687,19 @@ namespace deblur {
         if (isReliablePSF(sid)) {
             candiates.push_back(regionTree[sid].psf);
         }
+
+        // psf of the previous frame is added as last candidate
+        const psfEntry* previous = previousPSF(id);
+
+        if (previous != nullptr) {
+            candiates.push_back(previous->psf);
+        }
     }
 
 
     void DepthDeblur::psfSelection(vector<Mat>& candidates, Mat& winnerPSF, int id) {
+        TRACE_SCOPE_ID("psfSelection", id);
+
         float minEnergy = 2;
         int winner = 0;
 
@@ -573,72 +707,167 @@ namespace deblur {
             cout << "psf selection for node " << id << " with " << candidates.size() << " candidates" << endl;
         #endif
         
-        for (int i = 0; i < candidates.size(); i++) {
-            // get mask of this region
-            Mat mask;
-            regionTree.getMask(id, mask, LEFT);
-
-            // compute latent image (only of one view - the other doesn't contain more information)
-            Mat latent;
-            if (deconvAlgoPSFSelection == FFT) {
-                // fast, but ringing artifacts
-                deconvolveFFT(floatImages[LEFT], latent, candidates[i]);
-            } else if (deconvAlgoPSFSelection == IRLS) {
-                // very slow, but better result
-                deconvolveIRLS(floatImages[LEFT], latent, candidates[i], mask);
-            }
-
-            // convert like matlab imshow([latent])
-            threshold(latent, latent, 0.0, -1, THRESH_TOZERO);
-            threshold(latent, latent, 1.0, -1, THRESH_TRUNC);
-            latent *= 255;
-
-            // slightly Gaussian smoothed
-            // use the complete image to avoid unwanted effects at the borders
-            Mat smoothed;
-            GaussianBlur(latent, smoothed, Size(5, 5), 0, 0, BORDER_DEFAULT);
-            
-            // shock filtered
-            Mat shockFiltered;
-            coherenceFilter(smoothed, shockFiltered);
+        // get mask of this region
+        Mat mask;
+        regionTree.getMask(id, mask, LEFT);
 
-            // compute correlation of the latent image and the shockfiltered image
-            float energy = 1 - gradientCorrelation(latent, shockFiltered, mask, id, i);
+        for (int i = 0; i < candidates.size(); i++) {
+            float energy = selectionEnergy(candidates[i], mask, id, i);
 
             #ifdef IMWRITE
                 cout << "    corr-energy for candidate " << i << ": " << energy << endl;
-
-                Mat tmp;
-                latent.convertTo(tmp, CV_8U);
-                imwrite("mid-" + to_string(id) + "-deconv-" + to_string(i) + "-e" + to_string(energy) + ".png", tmp);
-
-                // shockFiltered.convertTo(tmp, CV_8U);
-                // imwrite("mid-" + to_string(id) + "-deconv-" + to_string(i) + "-shockf.png", tmp);
             #endif
 
             if (energy < minEnergy) {
                 minEnergy = energy;
                 winner = i;
-
-                // save latent image of leaf nodes to save time for deblurring
-                if (regionTree[id].children.first == -1 && deconvAlgoPSFSelection == IRLS) {
-                    latent.copyTo(regionDeconv[id]);
-                }
             }
         }
 
         candidates[winner].copyTo(winnerPSF);
+
+        // each node is selected by exactly one thread
+        selectionCandidates[id] = candidates.size();
+        selectionWinners[id] = winner;
+        selectionEnergies[id] = minEnergy;
+        referenceEnergies[id] = minEnergy;
             
         #ifdef IMWRITE
-            cout << "    winner: " << winner << " (0: self, 1: parent, 2: sibbling)" << endl;
+            cout << "    winner: " << winner << " (0: self, 1: parent, 2: sibbling, last: previous frame)" << endl;
+
+            // float kernels (see tools/psf-bank for images)
+            psfEntry kernel;
+            kernel.id = id;
+            kernel.parent = regionTree[id].parent;
+            kernel.entropy = computeEntropy(candidates[winner]);
+            kernel.label = "selection-" + to_string(winner);
+            kernel.psf = candidates[winner];
+            appendPSFBank("mid-kernels.psfb", {kernel});
+        #endif
+    }
+
 
-            // kernels
+    float DepthDeblur::selectionEnergy(const Mat& psf, Mat& mask, int id, int i) {
+        TRACE_SCOPE_ID("psfSelection candidate", i);
+
+        // compute latent image (only of one view - the other doesn't contain more information)
+        Mat latent;
+        if (deconvAlgoPSFSelection == FFT) {
+            // fast, but ringing artifacts
+            deconvolveFFT(floatImages[LEFT], latent, psf);
+        } else if (deconvAlgoPSFSelection == IRLS) {
+            // very slow, but better result
+            deconvolveIRLS(floatImages[LEFT], latent, psf, mask);
+        }
+
+        // convert like matlab imshow([latent])
+        threshold(latent, latent, 0.0, -1, THRESH_TOZERO);
+        threshold(latent, latent, 1.0, -1, THRESH_TRUNC);
+        latent *= 255;
+
+        // slightly Gaussian smoothed
+        // use the complete image to avoid unwanted effects at the borders
+        Mat smoothed;
+        GaussianBlur(latent, smoothed, Size(5, 5), 0, 0, BORDER_DEFAULT);
+        
+        // shock filtered
+        Mat shockFiltered;
+        coherenceFilter(smoothed, shockFiltered);
+
+        // compute correlation of the latent image and the shockfiltered image
+        float energy = 1 - gradientCorrelation(latent, shockFiltered, mask, id, i);
+
+        #ifdef IMWRITE
             Mat tmp;
-            candidates[winner].copyTo(tmp);
-            tmp *= 1000;
-            convertFloatToUchar(tmp, tmp);
-            imwrite("mid-" + to_string(id) + "-kernel-selection-" + to_string(winner) + ".png", tmp);
+            latent.convertTo(tmp, CV_8U);
+            imwrite("mid-" + to_string(id) + "-deconv-" + to_string(i) + "-e" + to_string(energy) + ".png", tmp);
+
+            // shockFiltered.convertTo(tmp, CV_8U);
+            // imwrite("mid-" + to_string(id) + "-deconv-" + to_string(i) + "-shockf.png", tmp);
+        #endif
+
+        return energy;
+    }
+
+
+    const psfEntry* DepthDeblur::previousPSF(int id) {
+        if (psfPriorSet == nullptr) {
+            return nullptr;
+        }
+
+        const psfEntry* previous = nullptr;
+        map<int, int> parents;
+
+        for (const auto& entry : psfPriorSet->psfs) {
+            parents[entry.id] = entry.parent;
+
+            if (entry.id == id) {
+                previous = &entry;
+            }
+        }
+
+        // the region tree may change from frame to frame
+        const int pid = regionTree[id].parent;
+
+        if (previous == nullptr || previous->parent != pid || pid < 0
+            || previous->psf.size() != regionTree[pid].psf.size()) {
+            return nullptr;
+        }
+
+        // layers of the node in the previous region tree
+        // (the leaf nodes have the ids of the layers)
+        vector<int> previousLayers;
+
+        for (int l = 0; l < layers; l++) {
+            for (int n = l; n != -1; n = (parents.count(n) > 0) ? parents[n] : -1) {
+                if (n == id) {
+                    previousLayers.push_back(l);
+                    break;
+                }
+            }
+        }
+
+        vector<int> currentLayers = regionTree[id].layers;
+        sort(currentLayers.begin(), currentLayers.end());
+
+        return (previousLayers == currentLayers) ? previous : nullptr;
+    }
+
+
+    bool DepthDeblur::carryPreviousPSF(int id, const psfEntry& previous) {
+        // energy of the last full estimation of this node
+        const vector<float>& energies = psfPriorSet->energies;
+
+        if (id >= energies.size() || energies[id] <= 0) {
+            return false;
+        }
+
+        TRACE_SCOPE_ID("carryPreviousPSF", id);
+
+        Mat mask;
+        regionTree.getMask(id, mask, LEFT);
+
+        const float energy = selectionEnergy(previous.psf, mask, id, 0);
+
+        #ifdef IMWRITE
+            cout << "energy of the previous psf of node " << id << ": " << energy
+                 << " (reference " << energies[id] << ")" << endl;
         #endif
+
+        if (energy > energies[id] * (1 + psfPriorSet->threshold)) {
+            return false;
+        }
+
+        previous.psf.copyTo(regionTree[id].psf);
+
+        // each node is estimated by exactly one thread
+        carriedPSFs[id] = true;
+        selectionCandidates[id] = 1;
+        selectionWinners[id] = PREVIOUS_FRAME_PSF;
+        selectionEnergies[id] = energy;
+        referenceEnergies[id] = energies[id];
+
+        return true;
     }
 
 
@@ -690,13 +919,23 @@ namespace deblur {
     }
 
 
-    bool DepthDeblur::safeQueueAccess(queue<int>* sharedQueue, int& item) {
+    bool DepthDeblur::safeQueueAccess(queue<int>* sharedQueue, int& item,
+                                      const chrono::steady_clock::time_point idleSince) {
+        auto request = chrono::steady_clock::now();
+
         // this lock guard calls lock and if the end of the scope is reached
         // it calls unlock automatically
         lock_guard<mutex> g(m);
 
+        const bool success = (sharedQueue->empty() != true);
+        countAccess(request, chrono::steady_clock::now(), success);
+
         // now we can access the stack without collisions
-        if (sharedQueue->empty() != true) {
+        if (success) {
+            // the worker polled the empty queue (and looped in between)
+            // until another thread pushed the next node
+            spinTime += chrono::duration<double, milli>(request - idleSince).count();
+
             item = sharedQueue->front();
             sharedQueue->pop();
             return true;
@@ -708,16 +947,41 @@ namespace deblur {
 
     void DepthDeblur::midLevelKernelEstimationNode(){
         int id;
+        auto idleSince = chrono::steady_clock::now();
 
         while(visitedLeafs != layers) {
-            if (safeQueueAccess(&remainingNodes, id)) {
+            if (safeQueueAccess(&remainingNodes, id, idleSince)) {
+                TRACE_SCOPE_ID("midlevel node", id);
+                auto start = chrono::steady_clock::now();
+
                 // get IDs of the child nodes
                 int cid1 = regionTree[id].children.first;
                 int cid2 = regionTree[id].children.second;
 
                 // do PSF computation for a middle node with its children
                 // (leaf nodes doesn't have any children)
-                if (cid1 != -1 && cid2 != -1) {
+                if (cid1 != -1 && cid2 != -1 && pastDeadline()) {
+                    // anytime mode: the children keep the psf of their parent
+                    regionTree[cid1].psf = regionTree[id].psf;
+                    regionTree[cid2].psf = regionTree[id].psf;
+                    regionTree[cid1].entropy = computeEntropy(regionTree[cid1].psf);
+                    regionTree[cid2].entropy = computeEntropy(regionTree[cid2].psf);
+
+                    mMetrics.lock();
+                    skippedNodes += 2;
+                    mMetrics.unlock();
+
+                    m.lock();
+                    remainingNodes.push(cid1);
+                    remainingNodes.push(cid2);
+                    m.unlock();
+
+                } else if (cid1 != -1 && cid2 != -1) {
+                    // wait until there is enough memory
+                    // (the children are estimated one after another)
+                    MemoryReservation reservation(memoryBudget,
+                        psfEstimationFootprint(floatImages[LEFT].size(), psfWidth, deconvAlgoPSFSelection == IRLS));
+
                     // PSF estimation for each children
                     // (salient edge map computation and joint psf estimation)
                     
@@ -728,8 +992,16 @@ namespace deblur {
 
                     // check if one of the masks is empty because then the joint estimation is not working
                     // (this could happen when the depth value is appears just in one disparity map)
-                    if (sum(masks[LEFT])[0] != 0 && sum(masks[RIGHT])[0] != 0) {
-                        estimateChildPSF(regionTree[id].psf, regionTree[cid1].psf, masks, cid1);
+                    // regions outside of the ROI aren't estimated either
+                    if (sum(masks[LEFT])[0] != 0 && sum(masks[RIGHT])[0] != 0 && inRegionOfInterest(cid1)) {
+                        // video: keep the psf of the previous frame if it still fits,
+                        // otherwise it is a better initialization than the parent psf
+                        const psfEntry* previous = previousPSF(cid1);
+
+                        if (previous == nullptr || !carryPreviousPSF(cid1, *previous)) {
+                            estimateChildPSF((previous != nullptr) ? previous->psf : regionTree[id].psf,
+                                             regionTree[cid1].psf, masks, cid1);
+                        }
                     } else {
                         // set the child psf to the parents one if one mask is empty
                         regionTree[cid1].psf = regionTree[id].psf;
@@ -742,8 +1014,16 @@ namespace deblur {
 
                     // check if one of the masks is empty because then the joint estimation is not working
                     // (this could happen when the depth value is appears just in one disparity map)
-                    if (sum(masks[LEFT])[0] != 0 && sum(masks[RIGHT])[0] != 0) {
-                        estimateChildPSF(regionTree[id].psf, regionTree[cid2].psf, masks, cid2);
+                    // regions outside of the ROI aren't estimated either
+                    if (sum(masks[LEFT])[0] != 0 && sum(masks[RIGHT])[0] != 0 && inRegionOfInterest(cid2)) {
+                        // video: keep the psf of the previous frame if it still fits,
+                        // otherwise it is a better initialization than the parent psf
+                        const psfEntry* previous = previousPSF(cid2);
+
+                        if (previous == nullptr || !carryPreviousPSF(cid2, *previous)) {
+                            estimateChildPSF((previous != nullptr) ? previous->psf : regionTree[id].psf,
+                                             regionTree[cid2].psf, masks, cid2);
+                        }
                     } else {
                         // set the child psf to the parents one if one mask is empty
                         regionTree[cid2].psf = regionTree[id].psf;
@@ -772,41 +1052,85 @@ namespace deblur {
                     visitedLeafs++;
                     mCounter.unlock();
                 }
+
+                addBusyTime(elapsedMs(start), id);
+                idleSince = chrono::steady_clock::now();
             }
         }
+
+        // polling after the last node until the other threads reached the leafs
+        lock_guard<mutex> g(m);
+        spinTime += elapsedMs(idleSince);
     }
 
 
     void DepthDeblur::midLevelKernelRefinement() {
         int id;
-
-        if (deconvAlgoPSFSelection == IRLS) {
-            // reset storage for deconvolved leaf nodes
-            regionDeconv.resize(layers);
-        }
+        auto idleSince = chrono::steady_clock::now();
 
         while(visitedLeafs != layers) {
-            if (safeQueueAccess(&remainingNodes, id)) {
+            if (safeQueueAccess(&remainingNodes, id, idleSince)) {
+                TRACE_SCOPE_ID("refinement node", id);
+                auto start = chrono::steady_clock::now();
+
                 // get IDs of the child nodes
                 int cid1 = regionTree[id].children.first;
                 int cid2 = regionTree[id].children.second;
 
                 // do PSF computation for a middle node with its children
                 // (leaf nodes doesn't have any children)
-                if (cid1 != -1 && cid2 != -1) {
+                if (cid1 != -1 && cid2 != -1 && pastDeadline()) {
+                    // anytime mode: the children keep their own psf
+                    mMetrics.lock();
+                    skippedNodes += 2;
+                    mMetrics.unlock();
+
+                    m.lock();
+                    remainingNodes.push(cid1);
+                    remainingNodes.push(cid2);
+                    m.unlock();
+
+                } else if (cid1 != -1 && cid2 != -1) {
+                    // wait until there is enough memory
+                    // (the children are selected one after another)
+                    MemoryReservation reservation(memoryBudget,
+                        psfSelectionFootprint(floatImages[LEFT].size(), psfWidth, deconvAlgoPSFSelection == IRLS));
+
+                    // psfs carried from the previous frame are already selected
+                    // and regions outside of the ROI keep their psf
+                    const bool select1 = !carriedPSFs[cid1] && inRegionOfInterest(cid1);
+                    const bool select2 = !carriedPSFs[cid2] && inRegionOfInterest(cid2);
+
                     // candiate selection
                     vector<Mat> candiates1, candiates2;
-                    candidateSelection(candiates1, cid1, cid2);
-                    candidateSelection(candiates2, cid2, cid1);
+                    if (select1) candidateSelection(candiates1, cid1, cid2);
+                    if (select2) candidateSelection(candiates2, cid2, cid1);
 
                     // final psf selection
                     // save the winner of the psf selection not in the current node because
                     // its sibbling would use this kernel (maybe its own twice)
                     array<Mat, 2> winners;
-                    psfSelection(candiates1, winners[0], cid1);
-                    psfSelection(candiates2, winners[1], cid2);
-                    winners[0].copyTo(regionTree[cid1].psf);
-                    winners[1].copyTo(regionTree[cid2].psf);
+
+                    if (select1) {
+                        psfSelection(candiates1, winners[0], cid1);
+                        winners[0].copyTo(regionTree[cid1].psf);
+                    }
+
+                    if (select2) {
+                        psfSelection(candiates2, winners[1], cid2);
+                        winners[1].copyTo(regionTree[cid2].psf);
+                    }
+
+                    // the psf of the previous frame is the last candidate
+                    if (select1 && previousPSF(cid1) != nullptr
+                        && selectionWinners[cid1] == candiates1.size() - 1) {
+                        selectionWinners[cid1] = PREVIOUS_FRAME_PSF;
+                    }
+
+                    if (select2 && previousPSF(cid2) != nullptr
+                        && selectionWinners[cid2] == candiates2.size() - 1) {
+                        selectionWinners[cid2] = PREVIOUS_FRAME_PSF;
+                    }
 
 
                     // add children ids to the back of the queue (this has to be thread save)
@@ -820,8 +1144,15 @@ namespace deblur {
                     visitedLeafs++;
                     mCounter.unlock();
                 }
+
+                addBusyTime(elapsedMs(start), id);
+                idleSince = chrono::steady_clock::now();
             }
         }   
+
+        // polling after the last node until the other threads reached the leafs
+        lock_guard<mutex> g(m);
+        spinTime += elapsedMs(idleSince);
     }
     
 
@@ -845,10 +1176,19 @@ namespace deblur {
             remainingNodes.push(regionTree.topLevelNodeIds[i]);
         }
 
+        // storage for the result of the psf selection of each node
+        selectionCandidates.assign(regionTree.size(), 0);
+        selectionWinners.assign(regionTree.size(), -1);
+        selectionEnergies.assign(regionTree.size(), 0);
+        carriedPSFs.assign(regionTree.size(), false);
+        referenceEnergies.assign(regionTree.size(), 0);
+
         // create worker threads
         int nrOfWorker = nThreads - 1;
         thread threads[nrOfWorker];
 
+        auto start = startParallelSection();
+
         for (int id = 0; id < nrOfWorker; id++) {
             // each worker gets the deconvolveRegion method with the regionStack
             threads[id] = thread(&DepthDeblur::midLevelKernelEstimationNode, this);
@@ -861,6 +1201,9 @@ namespace deblur {
             threads[id].join();
         }
 
+        finishParallelSection("midlevel-psf-estimation", nThreads, start, true);
+        nodeEstimationTimes = workItemTimes;
+
 
         // candidate PSF selection
         // (same process as before)
@@ -871,6 +1214,8 @@ namespace deblur {
             remainingNodes.push(regionTree.topLevelNodeIds[i]);
         }
 
+        start = startParallelSection();
+
         for (int id = 0; id < nrOfWorker; id++) {
             // each worker gets the deconvolveRegion method with the regionStack
             threads[id] = thread(&DepthDeblur::midLevelKernelRefinement, this);
@@ -882,16 +1227,24 @@ namespace deblur {
         for (int id = 0; id < nrOfWorker; id++) {
             threads[id].join();
         }
+
+        finishParallelSection("psf-selection", nThreads, start, true);
+        nodeSelectionTimes = workItemTimes;
     }
 
 
     bool DepthDeblur::safeStackAccess(stack<int>* sharedStack, int& item) {
+        auto request = chrono::steady_clock::now();
+
         // this lock guard calls lock and if the end of the scope is reached
         // it calls unlock automatically
         lock_guard<mutex> g(m);
 
+        const bool success = (sharedStack->empty() != true);
+        countAccess(request, chrono::steady_clock::now(), success);
+
         // now we can access the stack without collisions
-        if (sharedStack->empty() != true) {
+        if (success) {
             item = sharedStack->top();
             sharedStack->pop();
             return true;
@@ -901,41 +1254,144 @@ namespace deblur {
     }
 
 
-    void DepthDeblur::deconvolveRegion(const view view, const bool color) {
+    void DepthDeblur::deconvolveRegion(const view view, const bool color, Mat& dst) {
         // region index
         int i;
 
         // work as long as there is something on the stack
         while (safeStackAccess(&regionStack, i)) {
+            TRACE_SCOPE_ID("deconvolveRegion", i);
+            auto start = chrono::steady_clock::now();
+
             // get mask of the disparity level
-            Mat mask;
-            regionTree.getMask(i, mask, view);
+            Mat fullMask;
+            regionTree.getMask(i, fullMask, view);
+
+            // with a region of interest only the ROI plus margin is deconvolved
+            const Rect area = (roiDeconvolution.area() > 0) ? roiDeconvolution : Rect(0, 0, fullMask.cols, fullMask.rows);
+            Mat mask = fullMask(area);
+            Mat result = dst(area);
+
+            // nothing to do for an empty region
+            // (e.g. a disparity layer that doesn't appear in a tile or the ROI)
+            if (countNonZero(mask) == 0) {
+                continue;
+            }
 
             // using whole image with mask for deconv not just region because of
             // artifacts at the region boundaries
             Mat image;
 
             if (color) {
-                image = images[view];
+                images[view](area).convertTo(image, CV_32FC3, 1 / 255.0);
             } else {
-                image = floatImages[view];
+                image = floatImages[view](area);
             }
 
-            deconvolveIRLS(image, regionDeconv[i], regionTree[i].psf, mask);
+            irlsStatistics stats;
+
+            // fast deconvolution of a preview or after the deadline of the anytime mode
+            // (the color images are always deconvolved with IRLS)
+            const bool fast = !color && (fastDeconvolution || pastDeadline());
+
+            // the same view, PSF, region and iterations give the same latent region
+            CacheKey key = latentKey;
+            key.add(regionTree[i].psf).add(mask).add(irlsIterations)
+               .add(area.x).add(area.y).add(area.width).add(area.height);
+
+            vector<Mat> cached;
+
+            if (!fast && stageCache != nullptr && stageCache->load(key, cached)) {
+                // only the bounding box of the region is cached
+                const int* box = cached[1].ptr<int>();
+                Mat region = result(Rect(box[0], box[1], box[2], box[3]));
+                cached[0].copyTo(region, mask(Rect(box[0], box[1], box[2], box[3])));
+            } else {
+                Mat deconv;
+
+                if (fast) {
+                    MemoryReservation reservation(memoryBudget, fftFootprint(image.size(), psfWidth));
+                    deconvolveFFT(image, deconv, regionTree[i].psf, mask);
+                } else {
+                    // wait until there is enough memory
+                    MemoryReservation reservation(memoryBudget, irlsFootprint(image.size(), image.channels(), psfWidth));
+                    deconvolveIRLS(image, deconv, regionTree[i].psf, mask, 0.001, irlsIterations, &stats);
+                }
+
+                // threshold the result because it has large negative and positive values
+                // which would result in a very grayish image
+                threshold(deconv, deconv, 0.0, -1, THRESH_TOZERO);
+                threshold(deconv, deconv, 1.0, -1, THRESH_TRUNC);
+                deconv.convertTo(deconv, CV_8U, 255);
+
+                // add the region to the result right away, so only the regions in progress
+                // are kept in memory. No lock is needed because the masks of the regions
+                // are disjoint and dst is already allocated.
+                deconv.copyTo(result, mask);
+
+                if (!fast && stageCache != nullptr) {
+                    vector<Point> points;
+                    findNonZero(mask, points);
+                    Rect box = boundingRect(points);
 
-            // threshold the result because it has large negative and positive values
-            // which would result in a very grayish image
-            threshold(regionDeconv[i], regionDeconv[i], 0.0, -1, THRESH_TOZERO);
-            threshold(regionDeconv[i], regionDeconv[i], 1.0, -1, THRESH_TRUNC);
-            regionDeconv[i].convertTo(regionDeconv[i], CV_8U, 255);
+                    Mat latent;
+                    deconv(box).copyTo(latent, mask(box));
+
+                    Mat boxValues = (Mat_<int>(1, 4) << box.x, box.y, box.width, box.height);
+                    stageCache->store(key, {latent, boxValues});
+                }
+            }
+
+            deconvolutionMetrics metrics;
+            metrics.region = i;
+            metrics.view = view;
+            metrics.iterations = stats.iterations;
+            metrics.residual = stats.residual;
+            metrics.wallMs = elapsedMs(start);
+
+            lock_guard<mutex> lock(mMetrics);
+            deconvolutionStatistics.push_back(metrics);
+            busyTime += metrics.wallMs;
+            workItemTimes[i] += metrics.wallMs;
+            fastRegions += fast;
+        }
+    }
+
+
+    /**
+     * Allocates the result of a deconvolution (black where no region is)
+     */
+    static void prepareResult(Mat& dst, const Mat& image, const bool color) {
+        const int type = color ? CV_8UC(image.channels()) : CV_8U;
+
+        if (dst.size() != image.size() || dst.type() != type) {
+            dst = Mat::zeros(image.size(), type);
         }
     }
 
 
     void DepthDeblur::deconvolve(Mat& dst, view view, int nThreads, bool color) {
+        // only the luminance is deconvolved, the chroma comes from the blurred view
+        if (color && colorDeconvolution == LUMINANCE && images[view].channels() == 3) {
+            Mat luminance;
+            deconvolve(luminance, view, nThreads, false);
+
+            // the leaf nodes are the disparity layers
+            vector<int> regions(layers);
+            iota(regions.begin(), regions.end(), 0);
+            restoreColor(luminance, view, regions, dst);
+            return;
+        }
+
         // deconvolve in parallel
-        // reset storage for deconvolved images
-        regionDeconv.resize(layers);
+        // the workers composite their regions into dst
+        prepareResult(dst, images[view], color);
+
+        // the view is hashed once for all regions
+        if (stageCache != nullptr) {
+            latentKey = CacheKey("latent");
+            latentKey.add(color ? images[view] : floatImages[view]);
+        }
 
         // set up stack with regions that have to be calculated
         // store leaf node region index
@@ -947,26 +1403,22 @@ namespace deblur {
         int nrOfWorker = nThreads - 1;
         thread threads[nrOfWorker];
 
+        auto start = startParallelSection();
+
         for (int id = 0; id < nrOfWorker; id++) {
             // each worker gets the deconvolveRegion method with the regionStack
-            threads[id] = thread(&DepthDeblur::deconvolveRegion, this, view, color);
+            threads[id] = thread(&DepthDeblur::deconvolveRegion, this, view, color, ref(dst));
         }
 
         // let the main thread do some work too
-        deconvolveRegion(view, color);
+        deconvolveRegion(view, color, dst);
 
         // wait for all threads to finish
         for (int id = 0; id < nrOfWorker; id++) {
             threads[id].join();
         }
 
-        // add all region deconvs
-        for (int i = 0; i < regionDeconv.size(); i++) {
-            Mat mask;
-            // the index of the region in regionDeconv and regionTree are the same
-            regionTree.getMask(i, mask, view);
-            regionDeconv[i].copyTo(dst, mask);
-        }
+        finishParallelSection((view == LEFT) ? "deconvolution-left" : "deconvolution-right", nThreads, start);
 
         #ifdef IMWRITE
             imwrite("deconv-" + to_string(view) + ".png", dst);
@@ -975,10 +1427,22 @@ namespace deblur {
 
 
     void DepthDeblur::deconvolveTopLevel(Mat& dst, view view, int nThreads, bool color) {
+        // only the luminance is deconvolved, the chroma comes from the blurred view
+        if (color && colorDeconvolution == LUMINANCE && images[view].channels() == 3) {
+            Mat luminance;
+            deconvolveTopLevel(luminance, view, nThreads, false);
+            restoreColor(luminance, view, regionTree.topLevelNodeIds, dst);
+            return;
+        }
+
         // deconvolve in parallel
-        // reset storage for deconvolved images
-        // size of region tree is used because top-level regions have the highest indices
-        regionDeconv.resize(regionTree.size());
+        // the workers composite their regions into dst
+        prepareResult(dst, images[view], color);
+
+        if (stageCache != nullptr) {
+            latentKey = CacheKey("latent");
+            latentKey.add(color ? images[view] : floatImages[view]);
+        }
 
         // set up stack with regions that have to be calculated
         // store leaf node region index
@@ -991,32 +1455,201 @@ namespace deblur {
         int nrOfWorker = nThreads - 1;
         thread threads[nrOfWorker];
 
+        auto start = startParallelSection();
+
         for (int id = 0; id < nrOfWorker; id++) {
             // each worker gets the deconvolveRegion method with the regionStack
-            threads[id] = thread(&DepthDeblur::deconvolveRegion, this, view, color);
+            threads[id] = thread(&DepthDeblur::deconvolveRegion, this, view, color, ref(dst));
         }
 
         // let the main thread do some work too
-        deconvolveRegion(view, color);
+        deconvolveRegion(view, color, dst);
 
         // wait for all threads to finish
         for (int id = 0; id < nrOfWorker; id++) {
             threads[id].join();
         }
 
-        // add all region deconvs
-        for (int i = 0; i < regionTree.topLevelNodeIds.size(); i++) {
-            int id = regionTree.topLevelNodeIds[i];
+        finishParallelSection((view == LEFT) ? "deconvolution-left" : "deconvolution-right", nThreads, start);
 
+        #ifdef IMWRITE
+            imwrite("deconv-" + to_string(view) + ".png", dst);
+        #endif
+    }
+
+
+    void DepthDeblur::restoreColor(const Mat& luminance, const view view, const vector<int>& regions,
+                                   Mat& dst) {
+        TRACE_SCOPE("restoreColor");
+
+        // the windows of the linear models cover the blur of a pixel
+        transferChroma(images[view], luminance, dst, psfWidth / 2);
+
+        // keep the black background of a partial result (e.g. the top-level regions
+        // or a ROI): only the pixels of the deconvolved regions get a color
+        Mat covered = Mat::zeros(luminance.size(), CV_8U);
+
+        for (const int id : regions) {
             Mat mask;
-            // the index of the region in regionDeconv and regionTree are the same
             regionTree.getMask(id, mask, view);
+            bitwise_or(covered, mask, covered);
+        }
 
-            regionDeconv[id].copyTo(dst, mask);
+        if (roiDeconvolution.area() > 0) {
+            Mat inside = Mat::zeros(covered.size(), CV_8U);
+            inside(roiDeconvolution).setTo(255);
+            bitwise_and(covered, inside, covered);
         }
 
+        Mat background;
+        compare(covered, 0, background, CMP_EQ);
+        dst.setTo(0, background);
+
         #ifdef IMWRITE
-            imwrite("deconv-" + to_string(view) + ".png", dst);
+            imwrite("deconv-color-" + to_string(view) + ".png", dst);
         #endif
     }
+
+
+    void DepthDeblur::addBusyTime(const double milliseconds, const int item) {
+        lock_guard<mutex> lock(mMetrics);
+        busyTime += milliseconds;
+
+        if (item >= 0) {
+            workItemTimes[item] += milliseconds;
+        }
+    }
+
+
+    void DepthDeblur::countAccess(const chrono::steady_clock::time_point request,
+                                  const chrono::steady_clock::time_point locked, const bool success) {
+        accesses++;
+
+        if (success) {
+            waitTime += chrono::duration<double, milli>(locked - request).count();
+        } else {
+            // the spin time of the mid-level workers is counted from their
+            // last node to the next one (see safeQueueAccess)
+            emptyAccesses++;
+        }
+    }
+
+
+    chrono::steady_clock::time_point DepthDeblur::startParallelSection() {
+        busyTime = 0;
+        workItemTimes.assign(regionTree.size(), 0);
+        accesses = 0;
+        emptyAccesses = 0;
+        waitTime = 0;
+        spinTime = 0;
+
+        return chrono::steady_clock::now();
+    }
+
+
+    void DepthDeblur::finishParallelSection(const string& section, const int nThreads,
+                                            const chrono::steady_clock::time_point start,
+                                            const bool dependent) {
+        parallelMetrics metrics;
+        metrics.section = section;
+        metrics.threads = nThreads;
+        metrics.wallMs = elapsedMs(start);
+        metrics.busyMs = busyTime;
+        metrics.accesses = accesses;
+        metrics.emptyAccesses = emptyAccesses;
+        metrics.waitMs = waitTime;
+        metrics.spinMs = spinTime;
+
+        // critical path: the most expensive item or, if the nodes depend on their
+        // parents, the most expensive chain from a top-level node to a leaf
+        int last = -1;
+
+        for (int id = 0; id < workItemTimes.size(); id++) {
+            double length = 0;
+
+            for (int n = id; n != -1; n = dependent ? regionTree[n].parent : -1) {
+                length += workItemTimes[n];
+            }
+
+            if (length > metrics.criticalPathMs) {
+                metrics.criticalPathMs = length;
+                last = id;
+            }
+        }
+
+        for (int n = last; n != -1; n = dependent ? regionTree[n].parent : -1) {
+            metrics.criticalPath.insert(metrics.criticalPath.begin(), n);
+        }
+
+        parallelStatistics.push_back(metrics);
+    }
+
+
+    void DepthDeblur::collectMetrics(RunMetrics& metrics, const int pass) {
+        matchStatistics.pass = pass;
+        metrics.disparity.push_back(matchStatistics);
+
+        // nodes of the region tree
+        for (int id = 0; id < regionTree.size(); id++) {
+            nodeMetrics node;
+            node.pass = pass;
+            node.id = id;
+            node.parent = regionTree[id].parent;
+            node.layers = regionTree[id].layers.size();
+
+            // entropy of the final psf (after the selection)
+            if (!regionTree[id].psf.empty()) {
+                node.entropy = computeEntropy(regionTree[id].psf);
+            }
+
+            array<Mat, 2> masks;
+            regionTree.getMasks(id, masks);
+            node.pixelsLeft = countNonZero(masks[LEFT]);
+            node.pixelsRight = countNonZero(masks[RIGHT]);
+
+            if (id < selectionWinners.size()) {
+                node.candidates = selectionCandidates[id];
+                node.winner = selectionWinners[id];
+                node.winnerEnergy = selectionEnergies[id];
+                node.carried = carriedPSFs[id];
+            }
+
+            if (id < nodeEstimationTimes.size()) {
+                node.estimationMs = nodeEstimationTimes[id];
+            }
+
+            if (id < nodeSelectionTimes.size()) {
+                node.selectionMs = nodeSelectionTimes[id];
+            }
+
+            metrics.nodes.push_back(node);
+        }
+
+        // pixels of each disparity layer (the leaf nodes)
+        metrics.layerPixelsLeft.assign(layers, 0);
+        metrics.layerPixelsRight.assign(layers, 0);
+
+        for (int l = 0; l < layers; l++) {
+            array<Mat, 2> masks;
+            regionTree.getMasks(l, masks);
+            metrics.layerPixelsLeft[l] = countNonZero(masks[LEFT]);
+            metrics.layerPixelsRight[l] = countNonZero(masks[RIGHT]);
+        }
+
+        for (auto& d : deconvolutionStatistics) {
+            d.pass = pass;
+            metrics.deconvolution.push_back(d);
+        }
+
+        metrics.parallel.insert(metrics.parallel.end(), parallelStatistics.begin(), parallelStatistics.end());
+        metrics.skippedNodes += skippedNodes;
+        metrics.fastRegions += fastRegions;
+
+        deconvolutionStatistics.clear();
+        parallelStatistics.clear();
+        nodeEstimationTimes.clear();
+        nodeSelectionTimes.clear();
+        skippedNodes = 0;
+        fastRegions = 0;
+    }
 }
@@ -1,4 +1,7 @@
 #include <iostream>                     // cout, cerr, endl
+#include <algorithm>                    // min, max, copy, reverse_copy, fill
+#include <thread>
+#include <mutex>
 #include <opencv2/imgproc/imgproc.hpp>  // convert
 
 #include <opencv2/calib3d/calib3d.hpp>  // sgbm
@@ -6,6 +9,7 @@
 
 #include "disparity_estimation.hpp"
 #include "utils.hpp"                    // LEFT RIGHT fillPixel
+#include "trace.hpp"
 
 using namespace cv;
 using namespace std;
@@ -13,24 +17,47 @@ using namespace std;
 
 namespace deblur {
 
-    void disparityFilledMatch(const array<Mat, 2>& images, array<Mat, 2>& dMaps,
-                              int maxDisparity) {
+    /**
+     * Traces each alpha-expansion of the match algorithm (id is the disparity)
+     */
+    static void traceExpansion(void* data, Coord a, bool start) {
+        if (!trace::enabled()) {
+            return;
+        }
 
-        bool color = (images[LEFT].type() == CV_8UC3);
+        if (start) {
+            trace::begin("KZ2 expansion", -a.x);
+        } else {
+            trace::end();
+        }
+    }
 
-        Mat left, right;
 
-        if (color) {
-            // OpenCV stores colorimages as BGR so we have to convert them
-            cvtColor(images[LEFT], left, COLOR_BGR2RGB);
-            cvtColor(images[RIGHT], right, COLOR_BGR2RGB);
+    /**
+     * Writes the left disparities of the match algorithm into a CV_8U or CV_16S map
+     */
+    static void saveMatchDisparity(Match& match, Mat& dMap, const bool inverse) {
+        if (dMap.type() == CV_16S) {
+            match.SaveXLeft(dMap.ptr<short>(), int(dMap.step), inverse);
         } else {
-            left = images[LEFT];
-            right = images[RIGHT];
+            match.SaveXLeft(dMap.ptr<uchar>(), int(dMap.step), inverse);
         }
+    }
+
+
+    void disparityFilledMatch(const array<Mat, 2>& images, array<Mat, 2>& dMaps,
+                              int maxDisparity, disparityMetrics* stats, const int threads,
+                              const disparityPrior* prior) {
+        TRACE_SCOPE("disparityFilledMatch");
+
+        const Mat& left = images[LEFT];
+        const Mat& right = images[RIGHT];
 
-        // create new Match object
-        Match match(left.data, right.data, Coord(left.cols, left.rows), color);
+        bool color = (left.type() == CV_8UC3);
+
+        // Match reads the images in place, the order of the color channels (BGR) doesn't
+        // matter for its costs
+        Match match(left.data, int(left.step), right.data, int(right.step), Coord(left.cols, left.rows), color);
 
         // parameters
         int lambda = 20;
@@ -61,148 +88,333 @@ namespace deblur {
 
         match.SetParameters(&kz2_params);
         match.SetDispRange(disp_base, disp_max);
+        match.SetExpansionCallback(traceExpansion, nullptr);
+        match.SetThreads(threads);
+
+        // warm start with the map of the previous frame (same format as SaveXLeft)
+        if (prior != nullptr && !prior->map.empty()) {
+            assert(prior->map.size() == left.size() && prior->map.type() == CV_8U && "prior of the same size needed");
+            match.SetPrior(prior->map.ptr<uchar>(), int(prior->map.step), false, prior->band);
+        }
 
         // using the "Computing Visual Correspondence with Occlusions using Graph Cuts" algorithm from
         // Vladimir Kolmogorov and Ramin Zabih
-        match.KZ2();
+        {
+            TRACE_SCOPE("KZ2");
+            match.KZ2();
+        }
 
-        // doing cross-checking afterwards
-        match.CROSS_CHECK();
+        if (stats != nullptr) {
+            match.GetStatistics(&stats->initialEnergy, &stats->finalEnergy,
+                                &stats->expansions, &stats->iterations);
+        }
+
+        {
+            TRACE_SCOPE("cross check & fill occlusions");
 
-        // fill occlusions
-        match.FILL_OCCLUSIONS();
+            // doing cross-checking afterwards
+            match.CROSS_CHECK();
 
-        // transfer the results to OpenCV (left-rigth)
-        Mat disparity_left(left.size(), CV_8U);
-        match.SaveXLeft(disparity_left.data, false);
-        disparity_left.copyTo(dMaps[LEFT]);
+            // fill occlusions
+            match.FILL_OCCLUSIONS();
+        }
+
+        // write the results directly into the disparity maps (left-right).
+        // Maps of the right size and type CV_16S are kept, otherwise they are CV_8U
+        for (auto& dMap : dMaps) {
+            if (dMap.size() != left.size() || dMap.type() != CV_16S) {
+                dMap.create(left.size(), CV_8U);
+            }
+        }
+
+        saveMatchDisparity(match, dMaps[LEFT], false);
 
         // to get the results for right-left disparity
         // we have to swap the images
         match.SWAP_IMAGES();
         // save the image with inverted colors
-        Mat disparity_right(right.size(), CV_8U);
-        match.SaveXLeft(disparity_right.data, true);
-        disparity_right.copyTo(dMaps[RIGHT]);
+        saveMatchDisparity(match, dMaps[RIGHT], true);
     }
 
 
-    void disparityFilledSGBM(const array<Mat, 2>& images, array<Mat, 2>& dMaps) {
-        // disparity map for left-right
-        semiGlobalBlockMatching(images[LEFT], images[RIGHT], dMaps[LEFT]);
+    /**
+     * Fills the occlusions of one row of a disparity map (see fillOcclusionRegions)
+     */
+    static void fillOcclusionRow(uchar* row, const int cols, const uchar threshold) {
+        uchar minDisparity = 255;
+        int start = -1;
+
+        for (int col = 0; col < cols; col++) {
+            uchar value = row[col];
+
+            // check if in occluded region
+            if (start != -1) {
+                // found next disparity or reached end of the row
+                if (value > threshold || col == cols - 1) {
+                    // compare current disparity - find smallest
+                    minDisparity = (minDisparity < value || col == cols - 1)
+                                   ? minDisparity
+                                   : value;
+
+                    // fill whole region and reset the start of the region
+                    std::fill(row + start, row + col + 1, minDisparity);
+                    start = -1;
+                }
+            } else if (value <= threshold) {
+                // found new occluded pixel
+                // there is no left neighbor at column 0 so check it
+                minDisparity = (col > 0) ? row[col - 1] : 255;
+                start = col;
+
+                // an occluded pixel at the end of the row gets its left neighbor
+                if (col == cols - 1) {
+                    row[col] = minDisparity;
+                }
+            }
+        }
+    }
+
+
+    /**
+     * Pool of SGBM matchers. OpenCV keeps the buffers of the cost aggregation
+     * in the matcher, so reusing it avoids allocating them for each pair.
+     */
+    static mutex sgbmMutex;
+    static vector<Ptr<StereoSGBM>> idleMatchers;
+
+
+    /**
+     * Takes a matcher of the pool (or creates one) for the lifetime of the
+     * object and configures it.
+     */
+    class PooledSGBM {
+
+      public:
+
+        PooledSGBM(const sgbmParams& params) {
+            {
+                lock_guard<mutex> lock(sgbmMutex);
+
+                if (!idleMatchers.empty()) {
+                    matcher = idleMatchers.back();
+                    idleMatchers.pop_back();
+                }
+            }
+
+            if (matcher.empty()) {
+                matcher = StereoSGBM::create(params.minDisparity, params.disparities, params.blockSize);
+            }
+
+            matcher->setMinDisparity(params.minDisparity);
+            matcher->setNumDisparities(params.disparities);
+            matcher->setBlockSize(params.blockSize);
+            matcher->setP1(params.p1);
+            matcher->setP2(params.p2);
+            matcher->setDisp12MaxDiff(params.disp12MaxDiff);
+            matcher->setPreFilterCap(params.preFilterCap);
+            matcher->setUniquenessRatio(params.uniquenessRatio);
+            matcher->setSpeckleWindowSize(params.speckleWindowSize);
+            matcher->setSpeckleRange(params.speckleRange);
+            matcher->setMode(params.mode);
+        }
+
+        ~PooledSGBM() {
+            lock_guard<mutex> lock(sgbmMutex);
+            idleMatchers.push_back(matcher);
+        }
+
+        PooledSGBM(const PooledSGBM&) = delete;
+        PooledSGBM& operator=(const PooledSGBM&) = delete;
+
+        StereoSGBM* operator->() {
+            return matcher.get();
+        }
+
+      private:
+
+        Ptr<StereoSGBM> matcher;
+    };
+
+
+    /**
+     * SGBM disparity map with 4 fractional bits (CV_16S)
+     */
+    static void rawSGBM(const Mat& left, const Mat& right, Mat& disparityMap, const sgbmParams& params) {
+        TRACE_SCOPE("SGBM");
+
+        PooledSGBM sgbm(params);
+        sgbm->compute(left, right, disparityMap);
+    }
+
+
+    /**
+     * Right-left disparity map derived from the left-right one: each left pixel
+     * is moved to its match in the right view. If several pixels hit the same
+     * one the larger disparity (nearer object) wins, pixels without a match are
+     * occluded.
+     */
+    static void deriveRightDisparity(const Mat& left, Mat& right, const sgbmParams& params) {
+        TRACE_SCOPE("derive right disparity");
+
+        // SGBM marks invalid pixels with (minDisparity - 1) * 16
+        const short invalid = (params.minDisparity - 1) * 16;
+
+        right.create(left.size(), CV_16S);
+
+        for (int row = 0; row < left.rows; row++) {
+            const short* src = left.ptr<short>(row);
+            short* dst = right.ptr<short>(row);
+
+            std::fill(dst, dst + right.cols, invalid);
+
+            for (int col = 0; col < left.cols; col++) {
+                if (src[col] <= invalid) {
+                    continue;
+                }
+
+                int match = col - cvRound(src[col] / 16.0);
+
+                if (match >= 0 && match < right.cols && src[col] > dst[match]) {
+                    dst[match] = src[col];
+                }
+            }
+        }
+    }
+
+
+    /**
+     * Post-processing of the rows [begin, end) of a SGBM disparity map: scale to
+     * CV_8U, (flip,) fill the occlusions and median filter. The band is extended
+     * by the radius of the median filter so the result is the same as for the
+     * whole map.
+     *
+     * @param raw       disparity map with occlusions (CV_16S)
+     * @param dst       filtered disparity map (of the same size)
+     * @param mirrored  flip the rows horizontally first
+     * @param scale     factor of the conversion to CV_8U
+     */
+    static void filterDisparityRows(const Mat& raw, Mat& dst, const int begin, const int end,
+                                    const bool mirrored, const double scale,
+                                    const uchar threshold, const int medianSize) {
+        const int radius = medianSize / 2;
+        const int top = std::max(0, begin - radius);
+        const int bottom = std::min(raw.rows, end + radius);
+        const int cols = raw.cols;
+
+        Mat band(bottom - top, cols, CV_8U);
+
+        for (int row = top; row < bottom; row++) {
+            const short* src = raw.ptr<short>(row);
+            uchar* bandRow = band.ptr<uchar>(row - top);
+
+            for (int col = 0; col < cols; col++) {
+                bandRow[col] = saturate_cast<uchar>(src[mirrored ? cols - 1 - col : col] * scale);
+            }
+
+            fillOcclusionRow(bandRow, cols, threshold);
+        }
+
+        Mat median;
+        medianBlur(band, median, medianSize);
+
+        Mat core = dst.rowRange(begin, end);
+        median.rowRange(begin - top, end - top).copyTo(core);
+    }
+
+
+    void disparityFilledSGBM(const array<Mat, 2>& images, array<Mat, 2>& dMaps, const int threads,
+                             const sgbmParams& params) {
+        TRACE_SCOPE("disparityFilledSGBM");
+
+        array<Mat, 2> raw;
 
         // disparity map from right to left
         // therfore flip the images because otherwise SGBM will not work
-        Mat smallLeftFlipped, smallRightFlipped;
-        flip(images[LEFT], smallLeftFlipped, 1);
-        flip(images[RIGHT], smallRightFlipped, 1);
+        auto matchRight = [&]() {
+            Mat smallLeftFlipped, smallRightFlipped;
+            flip(images[LEFT], smallLeftFlipped, 1);
+            flip(images[RIGHT], smallRightFlipped, 1);
+
+            rawSGBM(smallRightFlipped, smallLeftFlipped, raw[RIGHT], params);
+        };
+
+        // both directions concurrently
+        thread rightWorker;
+
+        if (!params.rightFromLeft && threads > 1) {
+            rightWorker = thread(matchRight);
+        }
 
         // disparity map for left-right
-        semiGlobalBlockMatching(smallRightFlipped, smallLeftFlipped, dMaps[RIGHT]);
+        rawSGBM(images[LEFT], images[RIGHT], raw[LEFT], params);
 
-        // flip disparity map back
-        Mat disparityFlipped;
-        flip(dMaps[RIGHT], disparityFlipped, 1);
-        disparityFlipped.copyTo(dMaps[RIGHT]);
+        if (params.rightFromLeft) {
+            deriveRightDisparity(raw[LEFT], raw[RIGHT], params);
+        } else if (rightWorker.joinable()) {
+            rightWorker.join();
+        } else {
+            matchRight();
+        }
 
+        TRACE_SCOPE("fill occlusions & median");
 
-        // fill occlusion regions (= value < 10)
-        fillOcclusionRegions(dMaps[LEFT], 10);
-        fillOcclusionRegions(dMaps[RIGHT], 10);
+        // the matched right map is flipped, the derived one isn't
+        const array<bool, 2> mirrored = {false, !params.rightFromLeft};
 
-        // median filter to remove small outliers from disparity map
-        Mat median;
-        medianBlur(dMaps[LEFT], median, 9);
-        median.copyTo(dMaps[LEFT]);
-        medianBlur(dMaps[RIGHT], median, 9);
-        median.copyTo(dMaps[RIGHT]);
-    }
+        // same scale for both views (the range of the SGBM values)
+        const double scale = 255.0 / (16 * params.disparities);
 
+        // scale, flip, fill occlusion regions (= value < 10) and use a median filter
+        // to remove small outliers from the disparity map in bands of rows.
+        // The bands of both views are processed concurrently.
+        const int bands = std::max(1, threads / 2);
+        vector<thread> workers;
 
-    void fillOcclusionRegions(Mat& disparityMap, const uchar threshold) {
-        assert(disparityMap.type() == CV_8U && "gray values needed");
+        for (int view = LEFT; view <= RIGHT; view++) {
+            dMaps[view].create(raw[view].size(), CV_8U);
 
-        uchar minDisparity = 255;
-        Point start(-1,-1);
+            for (int i = 0; i < bands; i++) {
+                const int begin = raw[view].rows * i / bands;
+                const int end = raw[view].rows * (i + 1) / bands;
 
-        // go through each pixel
-        for (int row = 0; row < disparityMap.rows; row++) {
-            for (int col = 0; col < disparityMap.cols; col++) {
-                uchar value = disparityMap.at<uchar>(row, col);
-                    
-                // check if in occluded region
-                if (start != Point(-1, -1)) {
-                    // found next disparity or reached end of the row
-                    if (value > threshold || col == disparityMap.cols - 1) {
-                        // compare current disparity - find smallest
-                        minDisparity = (minDisparity < value || col == disparityMap.cols - 1)
-                                       ? minDisparity
-                                       : value;
-
-                        // fill whole region and reset the start point of the region
-                        fillPixel(disparityMap, start, Point(col, row), minDisparity);
-                        start = Point(-1,-1);
-                    }
+                if (threads > 1) {
+                    workers.push_back(thread(filterDisparityRows, cref(raw[view]), ref(dMaps[view]),
+                                             begin, end, mirrored[view], scale, 10, 9));
                 } else {
-                    // found new occluded pixel
-                    if (value <= threshold) {
-                        // there is no left neighbor at column 0 so check it
-                        minDisparity = (col > 0) ? disparityMap.at<uchar>(row, col - 1) : 255;
-                        start = Point(col, row);
-                    }
+                    filterDisparityRows(raw[view], dMaps[view], begin, end, mirrored[view], scale, 10, 9);
                 }
             }
         }
+
+        for (auto& worker : workers) {
+            worker.join();
+        }
     }
 
 
-    void semiGlobalBlockMatching(const Mat& left, const Mat& right, Mat& disparityMap) {
-        // set up stereo block match algorithm
-        // (found nice parameter values for a good result on many images)
-        int minDis = -64;             // minimum disparity
-        int disRange = 16 * 10;       // range: Maximum disparity minus minimum disparity
-        int blockSize = 9;            // Matched block size (have to be odd: 3-11)
-        int p1 = 600;                 // P1 disparity smoothness (default: 0)
-                                      // penalty for disparity changes +/- 1
-        int p2 = 3000;                // P2 disparity smoothness (default: 0)
-                                      // penalty for disparity changes more than 1
-        int disp12MaxDiff = 2;        // Maximum allowed difference in the left-right disparity check
-        int preFilterCap = 0;        // Truncation value for the prefiltered image pixels
-        int uniquenessRatio = 1;      // Margin in percentage by which the best (minimum) computed cost
-                                      // function value should “win” the second best value to consider 
-                                      // the found match correct (5-15)
-        int speckleWindowSize = 50;    // Maximum size of smooth disparity regions (50-200)
-        int speckleRange = 1;         // Maximum disparity variation within each connected component (1-2)
-        bool fullDP = true;           // Set it to true to run the full-scale two-pass dynamic programming algorithm
-
-        // #ifndef NDEBUG
-        //     cout << "  parameter of SGBM" << endl;
-        //     cout << "    min disparity     " << minDis << endl;
-        //     cout << "    disparity range   " << disRange << endl;
-        //     cout << "    block size        " << blockSize << endl;
-        //     cout << "    P1                " << p1 << endl;
-        //     cout << "    P2                " << p2 << endl;
-        //     cout << "    disp12MaxDiff     " << disp12MaxDiff << endl;
-        //     cout << "    preFilterCap      " << preFilterCap << endl;
-        //     cout << "    uniquenessRatio   " << uniquenessRatio << endl;
-        //     cout << "    speckleWindowSize " << speckleWindowSize << endl;
-        //     cout << "    speckleRange      " << speckleRange << endl;
-        //     cout << "    fullDP            " << fullDP << endl;
-        // #endif
-
-        Ptr<StereoSGBM> sgbm = StereoSGBM::create(minDis, disRange, blockSize,
-                                                  p1, p2, disp12MaxDiff, preFilterCap, uniquenessRatio,
-                                                  speckleWindowSize, speckleRange, fullDP);
-                                                  
-        sgbm->compute(left, right, disparityMap);
+    void fillOcclusionRegions(Mat& disparityMap, const uchar threshold) {
+        assert(disparityMap.type() == CV_8U && "gray values needed");
+
+        for (int row = 0; row < disparityMap.rows; row++) {
+            fillOcclusionRow(disparityMap.ptr<uchar>(row), disparityMap.cols, threshold);
+        }
+    }
+
+
+    void semiGlobalBlockMatching(const Mat& left, const Mat& right, Mat& disparityMap,
+                                 const sgbmParams& params) {
+        Mat raw;
+        rawSGBM(left, right, raw, params);
 
         // get its extreme values
         double minVal; double maxVal;
-        minMaxLoc(disparityMap, &minVal, &maxVal);
+        minMaxLoc(raw, &minVal, &maxVal);
 
         // convert disparity map to values between 0 and 255
         // scale factor for conversion is: 255 / (max - min)
-        disparityMap.convertTo(disparityMap, CV_8UC1, 255/(maxVal - minVal));
+        // (the disparity estimation uses the fixed range of the SGBM values
+        // instead, so both views have the same scale)
+        raw.convertTo(disparityMap, CV_8UC1, 255 / (maxVal - minVal));
     }
 
 
@@ -214,7 +426,10 @@ namespace deblur {
     }
 
 
-    void quantizeImage(const array<Mat,2>& images, const int k, array<Mat,2>& quantizedImages) {
+    void quantizeImage(const array<Mat,2>& images, const int k, array<Mat,2>& quantizedImages,
+                       vector<float>* centers) {
+        TRACE_SCOPE("quantizeImage");
+
         assert(images[0].size() == images[1].size() && "Both images have to be of the same size");
 
         int totalPixels = images[0].total() + images[1].total();
@@ -234,7 +449,7 @@ namespace deblur {
 
         // kmeans clustering
         Mat labels;
-        Mat centers;
+        Mat clusterCenters;
 
         kmeans(samples,                // input
                k,                      // number of cluster
@@ -243,7 +458,7 @@ namespace deblur {
                                        // termination criterion: here number of iterations
                5,                      // attempts - execution with different inital labelings
                KMEANS_RANDOM_CENTERS,  // flags: random initial centers
-               centers);               // output of cluster center
+               clusterCenters);        // output of cluster center
 
         // sort clusters such that they represent the ordered disparities
         // store pairs of (cluster, color) in a vector and sort it depending on the color
@@ -251,7 +466,7 @@ namespace deblur {
         clusters.reserve(k);
 
         for (int i = 0; i < k; i++) {
-            pair<int, float> cluster(i, centers.at<float>(i, 0));
+            pair<int, float> cluster(i, clusterCenters.at<float>(i, 0));
             clusters.push_back(cluster);
         }
 
@@ -265,6 +480,14 @@ namespace deblur {
             mapping[clusters[i].first] = i;
         }
 
+        if (centers != nullptr) {
+            centers->resize(k);
+
+            for (int i = 0; i < k; i++) {
+                (*centers)[i] = clusters[i].second;
+            }
+        }
+
         // map the clustering to an image
         Mat newImage1(images[0].size(), CV_8U);
         Mat newImage2(images[1].size(), CV_8U);
@@ -283,4 +506,33 @@ namespace deblur {
         newImage1.copyTo(quantizedImages[0]);
         newImage2.copyTo(quantizedImages[1]);
     }
+
+
+    void quantizeImage(const array<Mat,2>& images, const vector<float>& centers, array<Mat,2>& quantizedImages) {
+        TRACE_SCOPE("quantizeImage");
+
+        assert(images[0].size() == images[1].size() && "Both images have to be of the same size");
+        assert(!centers.empty() && "cluster centers needed");
+
+        // nearest center for each gray value
+        uchar lookup[256];
+
+        for (int value = 0; value < 256; value++) {
+            size_t nearest = 0;
+
+            for (size_t i = 1; i < centers.size(); i++) {
+                if (abs(centers[i] - value) < abs(centers[nearest] - value)) {
+                    nearest = i;
+                }
+            }
+
+            lookup[value] = nearest;
+        }
+
+        Mat table(1, 256, CV_8U, lookup);
+
+        for (int i = 0; i < 2; i++) {
+            LUT(images[i], table, quantizedImages[i]);
+        }
+    }
 }
@@ -0,0 +1,92 @@
+#include <iostream>                     // cout, endl
+#include <algorithm>                    // max
+#include <opencv2/imgproc/imgproc.hpp>  // resize, cvtColor
+
+#include "disparity_sequence.hpp"
+
+
+using namespace std;
+using namespace cv;
+
+
+namespace deblur {
+
+    /**
+     * width of the thumbnails for the scene cut detection
+     */
+    static const int thumbnailWidth = 64;
+
+
+    DisparitySequence::DisparitySequence(const int band, const double cutThreshold)
+        : cutThreshold(cutThreshold)
+    {
+        prior.band = band;
+    }
+
+
+    const disparityPrior* DisparitySequence::nextFrame(const Mat& left) {
+        frames++;
+
+        Mat gray;
+
+        if (left.channels() == 3) {
+            cvtColor(left, gray, COLOR_BGR2GRAY);
+        } else {
+            gray = left;
+        }
+
+        const double scale = double(thumbnailWidth) / std::max(1, gray.cols);
+        Mat current;
+        resize(gray, current, Size(), scale, scale, INTER_AREA);
+
+        cut = false;
+
+        if (!thumbnail.empty() && thumbnail.size() == current.size()) {
+            Mat difference;
+            absdiff(current, thumbnail, difference);
+
+            const double change = mean(difference)[0];
+
+            if (change > cutThreshold) {
+                cout << "   scene cut in front of frame " << frames << " (difference " << change << ")" << endl;
+                cut = true;
+                cuts++;
+            }
+        }
+
+        // new shot or other resolution
+        if (cut || thumbnail.size() != current.size()) {
+            prior.map.release();
+        }
+
+        thumbnail = current;
+        warm = !prior.map.empty();
+
+        return warm ? &prior : nullptr;
+    }
+
+
+    void DisparitySequence::update(const Mat& map, const double disparityMs) {
+        currentMs = disparityMs;
+
+        if (!warm) {
+            fullSearchMs = disparityMs;
+        }
+
+        // without map (e.g. loaded from an old cache entry) the next frame does a full search
+        if (map.empty()) {
+            prior.map.release();
+        } else {
+            map.copyTo(prior.map);
+        }
+    }
+
+
+    double DisparitySequence::speedup() const {
+        if (!warm) {
+            return 1;
+        }
+
+        return (currentMs > 0 && fullSearchMs > 0) ? fullSearchMs / currentMs : 0;
+    }
+}
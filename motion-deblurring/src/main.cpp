@@ -13,18 +13,28 @@
 #include <iostream>     // cout, cerr, endl
 #include <string>       // stoi
 #include <stdexcept>
+#include <memory>       // unique_ptr
+#include <algorithm>    // max
+#include <cstdio>       // sscanf
+#include <opencv2/highgui/highgui.hpp>  // imread, imwrite
 
 #include "argtable3.h"  // cross platform command line parsing
 #include "depth_aware_deblurring.hpp"
 #include "depth_deblur.hpp"
+#include "trace.hpp"
+#include "psf_bank.hpp"
+#include "stage_cache.hpp"
+#include "preview_deblur.hpp"
 
 using namespace std;
 
 // global structs for command line parsing
-struct arg_lit *help, *fft, *irls;
-struct arg_file *left_image, *right_image;
+struct arg_lit *help, *fft, *irls, *no_cache, *preview_full, *refine, *color_result, *per_channel;
+struct arg_file *left_image, *right_image, *trace_file, *metrics_file, *psf_bank, *cache_dir;
 struct arg_end *end_args;
-struct arg_int *psf_width, *max_toplevel_nodes, *mythreads, *max_disparity, *d_layers;
+struct arg_int *psf_width, *max_toplevel_nodes, *mythreads, *max_disparity, *d_layers, *memory_budget, *cache_size;
+struct arg_int *time_budget, *preview, *d_passes;
+struct arg_str *roi_rect;
 
 
 /**
@@ -35,7 +45,11 @@ static bool parse_commandline_args(int argc, char** argv,
                                    string &left, string &right, int &nThreads,
                                    int &psfWidth, int &dLayers, int &maxTopLevelNodes, int &maxDisparity,
                                    deblur::DepthDeblur::deconvAlgo &deconvAlgo,
-                                   int &exitcode) {
+                                   int &memoryBudget, string &traceFile, string &metricsFile, string &psfBank,
+                                   string &cacheDir, int &cacheSize, int &timeBudget,
+                                   deblur::previewOptions &previewOpts, int &previewFactor, bool &refineAfterPreview,
+                                   cv::Rect &roi, int &passes, bool &colorResult,
+                                   deblur::DepthDeblur::colorMode &colorMode, int &exitcode) {
     
     // command line options
     // the global arg_xxx structs are initialized within the argtable
@@ -48,6 +62,21 @@ static bool parse_commandline_args(int argc, char** argv,
         mythreads   = arg_intn ("t", "threads", "<n>",             0, 1, "number of threads. Default: 1"),
         max_disparity        = arg_intn ("d", "max-disparity", "<n>", 0, 1, "estimated maximum disparity. Default: 160"),
         max_toplevel_nodes   = arg_intn ("m", "max-top-nodes", "<n>", 0, 1, "max top level nodes in region tree. Default: 3"),
+        memory_budget        = arg_intn (nullptr, "memory-budget", "<MB>", 0, 1, "memory for concurrent region solves. Default: 0 (unlimited)"),
+        d_passes             = arg_intn (nullptr, "passes", "<n>", 0, 1, "1 or 2 (second pass with the disparities of the deblurred views). Default: 1"),
+        time_budget          = arg_intn (nullptr, "time-budget", "<ms>", 0, 1, "wall time of the run, lowers the quality if necessary. Default: 0 (no budget)"),
+        trace_file  = arg_filen(nullptr, "trace", "<file>",        0, 1, "save a Chrome trace (JSON) and print a summary of the steps"),
+        metrics_file = arg_filen(nullptr, "metrics", "<file>",     0, 1, "save time, resources and statistics of the run (JSON)"),
+        psf_bank    = arg_filen(nullptr, "psf-bank", "<file>",     0, 1, "save the float PSFs of all regions (.psfb)"),
+        cache_dir   = arg_filen(nullptr, "cache-dir", "<dir>",     0, 1, "cache of the results of the steps. Default: no cache"),
+        cache_size  = arg_intn (nullptr, "cache-size", "<MB>",     0, 1, "size of the cache. Default: 1024"),
+        no_cache    = arg_litn(nullptr, "no-cache",                0, 1, "compute all steps without cache (overrides --cache-dir)"),
+        roi_rect    = arg_strn (nullptr, "roi", "<x,y,w,h>",       0, 1, "deblur only this region of interest (the result has its size)"),
+        preview     = arg_intn (nullptr, "preview", "<factor>",    0, 1, "quick preview with 1/factor resolution (2 or 4). Default: 0 (off)"),
+        preview_full = arg_litn(nullptr, "preview-full",           0, 1, "preview with a fast deconvolution at full resolution"),
+        refine      = arg_litn(nullptr, "refine",                  0, 1, "full-quality run after the preview, starting with its disparities and PSFs"),
+        color_result = arg_litn(nullptr, "color",                  0, 1, "color result (luminance deconvolution with chroma transfer)"),
+        per_channel = arg_litn(nullptr, "per-channel",             0, 1, "color result with a deconvolution of each channel (3x slower)"),
         left_image  = arg_filen(nullptr, nullptr, "<left image>",  1, 1, "left image"),
         right_image = arg_filen(nullptr, nullptr, "<right image>", 1, 1, "right image"),
         end_args    = arg_end(20),
@@ -59,6 +88,11 @@ static bool parse_commandline_args(int argc, char** argv,
     max_toplevel_nodes->ival[0] = 3;
     max_disparity->ival[0] = 160;
     d_layers->ival[0] = 12;
+    memory_budget->ival[0] = 0;
+    time_budget->ival[0] = 0;
+    d_passes->ival[0] = 1;
+    preview->ival[0] = 0;
+    cache_size->ival[0] = 1024;
 
     // parsing arguments
     int nerrors = arg_parse(argc,argv,argtable);
@@ -106,6 +140,32 @@ static bool parse_commandline_args(int argc, char** argv,
     maxDisparity = max_disparity->ival[0];
     maxTopLevelNodes = max_toplevel_nodes->ival[0];
     dLayers =d_layers->ival[0];
+    memoryBudget = memory_budget->ival[0];
+    timeBudget = time_budget->ival[0];
+    passes = d_passes->ival[0];
+    previewFactor = preview->ival[0];
+    previewOpts.factor = std::max(1, previewFactor);
+    previewOpts.fullResolution = (preview_full->count > 0);
+    refineAfterPreview = (refine->count > 0);
+    colorResult = (color_result->count > 0 || per_channel->count > 0);
+    colorMode = (per_channel->count > 0) ? deblur::DepthDeblur::PER_CHANNEL : deblur::DepthDeblur::LUMINANCE;
+
+    if (roi_rect->count > 0) {
+        if (sscanf(roi_rect->sval[0], "%d,%d,%d,%d", &roi.x, &roi.y, &roi.width, &roi.height) != 4
+            || roi.width < 1 || roi.height < 1) {
+            cout << "Invalid region of interest: " << roi_rect->sval[0] << " (x,y,w,h expected)" << endl;
+
+            arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+            exitcode = 1;
+            return false;
+        }
+    }
+    traceFile = (trace_file->count > 0) ? trace_file->filename[0] : "";
+    metricsFile = (metrics_file->count > 0) ? metrics_file->filename[0] : "";
+    psfBank = (psf_bank->count > 0) ? psf_bank->filename[0] : "";
+    // the cache is opt-in, a plain run doesn't write into the working directory
+    cacheDir = (cache_dir->count > 0 && no_cache->count == 0) ? cache_dir->filename[0] : "";
+    cacheSize = cache_size->ival[0];
 
     // deallocate each non-null entry in argtable[]
     arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
@@ -123,12 +183,30 @@ int main(int argc, char** argv) {
     int maxTopLevelNodes;
     int maxDisparity;
     int layers;
+    int memoryBudget;
     deblur::DepthDeblur::deconvAlgo deconvAlgo = deblur::DepthDeblur::IRLS;
+    string traceFile;
+    string metricsFile;
+    string psfBank;
+    string cacheDir;
+    int cacheSize;
+    int timeBudget;
+    deblur::previewOptions previewOpts;
+    int previewFactor;
+    bool refineAfterPreview;
+    cv::Rect roi;
+    int passes;
+    bool colorResult;
+    deblur::DepthDeblur::colorMode colorMode;
 
     // parse command line arguments
     int exitcode = 0;
     bool success = parse_commandline_args(argc, argv, imageLeft, imageRight, nThreads,
-                                          psfWidth, layers, maxTopLevelNodes, maxDisparity, deconvAlgo, exitcode);
+                                          psfWidth, layers, maxTopLevelNodes, maxDisparity, deconvAlgo,
+                                          memoryBudget, traceFile, metricsFile, psfBank,
+                                          cacheDir, cacheSize, timeBudget,
+                                          previewOpts, previewFactor, refineAfterPreview, roi,
+                                          passes, colorResult, colorMode, exitcode);
 
     if (success == false) {
         return exitcode;
@@ -144,10 +222,109 @@ int main(int argc, char** argv) {
     cout << "   max top level nodes: " << maxTopLevelNodes << endl;
     cout << "   deconvolution algo:  " << ((deconvAlgo == deblur::DepthDeblur::FFT) ? "FFT" : "IRLS") << endl;
     cout << "   threads:             " << nThreads << endl;
+    cout << "   passes:              " << passes << endl;
+
+    if (memoryBudget > 0) {
+        cout << "   memory budget:       " << memoryBudget << " MB" << endl;
+    }
+
+    if (timeBudget > 0) {
+        cout << "   time budget:         " << timeBudget << " ms" << endl;
+    }
+
+    if (roi.area() > 0) {
+        cout << "   region of interest:  " << roi.x << "," << roi.y << " " << roi.width << "x" << roi.height << endl;
+    }
+
+    if (colorResult) {
+        cout << "   color:               "
+             << ((colorMode == deblur::DepthDeblur::LUMINANCE) ? "luminance + chroma transfer" : "each channel") << endl;
+    }
+
+    if (previewFactor > 0) {
+        cout << "   preview:             1/" << previewOpts.factor
+             << (previewOpts.fullResolution ? " (full resolution result)" : "")
+             << (refineAfterPreview ? " + full-quality run" : "") << endl;
+    }
+
+    if (!cacheDir.empty()) {
+        cout << "   cache:               " << cacheDir << " (" << cacheSize << " MB)" << endl;
+    }
     cout << endl;
 
+    if (!traceFile.empty()) {
+        deblur::trace::enable();
+    }
+
     try {
-        deblur::runDepthDeblur(imageLeft, imageRight, nThreads, psfWidth, layers, maxTopLevelNodes, deconvAlgo, maxDisparity);
+        deblur::deblurOptions options;
+        options.threads = nThreads;
+        options.psfWidth = psfWidth;
+        options.layers = layers;
+        options.maxTopLevelNodes = maxTopLevelNodes;
+        options.deconvAlgo = deconvAlgo;
+        options.maxDisparity = maxDisparity;
+        options.memoryBudget = size_t(memoryBudget) << 20;
+        options.timeBudgetMs = timeBudget;
+        options.roi = roi;
+        options.passes = passes;
+        options.color = colorResult;
+        options.colorMode = colorMode;
+
+        vector<deblur::psfEntry> psfs;
+        options.psfs = psfBank.empty() ? nullptr : &psfs;
+
+        // steps with unchanged inputs are loaded from the cache
+        unique_ptr<deblur::StageCache> cache;
+
+        if (!cacheDir.empty()) {
+            cache.reset(new deblur::StageCache(cacheDir, size_t(cacheSize) << 20));
+            options.cache = cache.get();
+        }
+
+        deblur::RunMetrics metrics;
+
+        if (previewFactor > 0) {
+            cv::Mat left = cv::imread(imageLeft, 1);
+            cv::Mat right = cv::imread(imageRight, 1);
+
+            if (!left.data || !right.data) {
+                throw runtime_error("Can not load images!");
+            }
+
+            cv::Mat previewLeft, previewRight;
+            deblur::previewResult warmStart;
+
+            metrics = deblur::runPreviewDeblur(left, right, previewLeft, previewRight, options,
+                                               previewOpts, &warmStart);
+
+            cv::imwrite("preview-left.png", previewLeft);
+            cv::imwrite("preview-right.png", previewRight);
+
+            // the full-quality run starts with the disparities and PSFs of the preview
+            if (refineAfterPreview) {
+                options.preview = &warmStart;
+                metrics = deblur::runDepthDeblur(imageLeft, imageRight, options);
+            }
+        } else {
+            metrics = deblur::runDepthDeblur(imageLeft, imageRight, options);
+        }
+
+        if (!psfBank.empty()) {
+            deblur::savePSFBank(psfBank, psfs);
+        }
+
+        if (!metricsFile.empty()) {
+            metrics.saveJSON(metricsFile);
+        }
+
+        if (!traceFile.empty()) {
+            deblur::trace::enable(false);
+            deblur::trace::writeChromeTrace(traceFile);
+
+            cout << endl;
+            deblur::trace::printSummary(cout);
+        }
     }
     catch(const exception& e) {
         cerr << "ERROR: " << e.what() << endl;
@@ -0,0 +1,116 @@
+#include <stdexcept>                    // throw exception
+#include <cstring>                      // memcmp, memcpy, strerror
+#include <cerrno>
+
+#include <fcntl.h>                      // open
+#include <unistd.h>                     // close, ftruncate
+#include <sys/mman.h>                   // mmap, msync
+#include <sys/stat.h>                   // fstat
+
+#include "mapped_image.hpp"
+
+
+using namespace std;
+using namespace cv;
+
+
+namespace deblur {
+
+    MappedImage::MappedImage(const string& filename, const bool writable)
+                            : filename(filename)
+    {
+        int fd = open(filename.c_str(), writable ? O_RDWR : O_RDONLY);
+
+        if (fd < 0) {
+            throw runtime_error("Can not open raw image " + filename + ": " + strerror(errno));
+        }
+
+        map(fd, writable);
+    }
+
+
+    MappedImage::MappedImage(const string& filename, const int rows, const int cols, const int type)
+                            : filename(filename)
+    {
+        int fd = open(filename.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0644);
+
+        // the new file is filled with zeros
+        size_t size = sizeof(rawImageHeader) + size_t(rows) * cols * CV_ELEM_SIZE(type);
+
+        if (fd < 0 || ftruncate(fd, size) != 0) {
+            if (fd >= 0) close(fd);
+            throw runtime_error("Can not create raw image " + filename + ": " + strerror(errno));
+        }
+
+        rawImageHeader header;
+        memcpy(header.magic, "DBRW", 4);
+        header.rows = rows;
+        header.cols = cols;
+        header.type = type;
+
+        if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) {
+            close(fd);
+            throw runtime_error("Can not write raw image " + filename + ": " + strerror(errno));
+        }
+
+        map(fd, true);
+    }
+
+
+    MappedImage::~MappedImage() {
+        if (data != nullptr) {
+            munmap(data, length);
+        }
+    }
+
+
+    void MappedImage::map(const int fd, const bool writable) {
+        struct stat info;
+        fstat(fd, &info);
+        length = info.st_size;
+
+        if (length < sizeof(rawImageHeader)) {
+            close(fd);
+            throw runtime_error("Raw image " + filename + " has no header!");
+        }
+
+        data = mmap(nullptr, length, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+
+        // the mapping stays valid without the file descriptor
+        close(fd);
+
+        if (data == MAP_FAILED) {
+            data = nullptr;
+            throw runtime_error("Can not map raw image " + filename + ": " + strerror(errno));
+        }
+
+        const rawImageHeader* header = (const rawImageHeader*)data;
+
+        if (memcmp(header->magic, "DBRW", 4) != 0 || header->rows <= 0 || header->cols <= 0
+            || sizeof(rawImageHeader) + size_t(header->rows) * header->cols * CV_ELEM_SIZE(header->type) > length) {
+            munmap(data, length);
+            data = nullptr;
+            throw runtime_error(filename + " isn't a valid raw image!");
+        }
+
+        // the pages are read on demand and the sequential access of
+        // tiles row by row profits from read-ahead
+        madvise(data, length, MADV_SEQUENTIAL);
+
+        mat = Mat(header->rows, header->cols, header->type, (char*)data + sizeof(rawImageHeader));
+    }
+
+
+    void MappedImage::flush() {
+        if (data != nullptr && msync(data, length, MS_SYNC) != 0) {
+            throw runtime_error("Can not write raw image " + filename + ": " + strerror(errno));
+        }
+    }
+
+
+    void saveRawImage(const string& filename, const Mat& image) {
+        MappedImage raw(filename, image.rows, image.cols, image.type());
+        image.copyTo(raw.image());
+        raw.flush();
+    }
+}
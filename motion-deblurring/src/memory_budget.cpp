@@ -0,0 +1,102 @@
+#include "memory_budget.hpp"
+
+
+using namespace std;
+
+
+namespace deblur {
+
+    void MemoryBudget::acquire(const size_t footprint) {
+        unique_lock<mutex> lock(m);
+
+        auto fits = [&]() {
+            return limit == 0 || tasks == 0 || used + footprint <= limit;
+        };
+
+        if (!fits()) {
+            throttled++;
+            released.wait(lock, fits);
+        }
+
+        used += footprint;
+        tasks++;
+        maxTasks = max(maxTasks, tasks);
+    }
+
+
+    void MemoryBudget::release(const size_t footprint) {
+        {
+            lock_guard<mutex> lock(m);
+            used -= footprint;
+            tasks--;
+        }
+
+        released.notify_all();
+    }
+
+
+    size_t MemoryBudget::reserved() {
+        lock_guard<mutex> lock(m);
+        return used;
+    }
+
+
+    int MemoryBudget::peakTasks() {
+        lock_guard<mutex> lock(m);
+        return maxTasks;
+    }
+
+
+    int MemoryBudget::throttledTasks() {
+        lock_guard<mutex> lock(m);
+        return throttled;
+    }
+
+
+    /**
+     * bytes of a float image padded by the PSF on each side
+     */
+    static size_t paddedBytes(const cv::Size& size, const int psfWidth) {
+        return size_t(size.width + psfWidth) * (size.height + psfWidth) * sizeof(float);
+    }
+
+
+    size_t irlsFootprint(const cv::Size& size, const int channels, const int psfWidth) {
+        // the channels are solved one after another:
+        // padded source, b, x, Ax, r, p, Ap, convolution temporaries, mask,
+        // boundaries and the five weight maps
+        const size_t solver = 20 * paddedBytes(size, psfWidth);
+
+        // split channels and the float result of each channel
+        const size_t image = size_t(size.area()) * sizeof(float) * channels * 2;
+
+        return solver + image;
+    }
+
+
+    size_t fftFootprint(const cv::Size& size, const int psfWidth) {
+        // four complex spectra, the result spectrum, gradients and the
+        // swapped result
+        return 12 * size_t(size.area()) * sizeof(float) + 2 * paddedBytes(size, psfWidth);
+    }
+
+
+    size_t psfEstimationFootprint(const cv::Size& size, const int psfWidth, const bool irls) {
+        // deconvolution of a view (one after another) together with the
+        // deconvolved and gradient images of both views
+        const size_t deconvolution = irls ? irlsFootprint(size, 1, psfWidth) : fftFootprint(size, psfWidth);
+        const size_t gradients = 16 * size_t(size.area()) * sizeof(float);
+
+        return deconvolution + gradients;
+    }
+
+
+    size_t psfSelectionFootprint(const cv::Size& size, const int psfWidth, const bool irls) {
+        // the candidates are tested one after another:
+        // latent, smoothed and shock filtered image with their gradients
+        const size_t deconvolution = irls ? irlsFootprint(size, 1, psfWidth) : fftFootprint(size, psfWidth);
+        const size_t filtered = 8 * size_t(size.area()) * sizeof(float);
+
+        return deconvolution + filtered;
+    }
+}
@@ -0,0 +1,199 @@
+#include <iostream>                     // cout, cerr, endl
+#include <stdexcept>                    // throw exception
+#include <algorithm>                    // min, max
+#include <cmath>                        // ceil
+#include <opencv2/imgproc/imgproc.hpp>  // resize
+
+#include "depth_aware_deblurring.hpp"   // deblurOptions, loadToplevelKernels
+#include "depth_deblur.hpp"
+#include "mat_pool.hpp"                 // ScopedMatPool
+#include "trace.hpp"                    // TRACE_SCOPE
+
+#include "preview_deblur.hpp"
+
+
+using namespace std;
+using namespace cv;
+
+
+namespace deblur {
+
+    Mat scaleKernel(const Mat& kernel, const Size& size) {
+        Mat floatKernel;
+        kernel.convertTo(floatKernel, CV_32F);
+
+        Mat scaled;
+        const int interpolation = (size.area() < kernel.size().area()) ? INTER_AREA : INTER_LINEAR;
+        resize(floatKernel, scaled, size, 0, 0, interpolation);
+
+        threshold(scaled, scaled, 0.0, -1, THRESH_TOZERO);
+
+        const double energy = sum(scaled)[0];
+
+        if (energy > 0) {
+            scaled /= energy;
+        }
+
+        return scaled;
+    }
+
+
+    /**
+     * Odd width of a kernel scaled by the given factor (at least 3)
+     */
+    static int scaledWidth(const int width, const double scale) {
+        const int scaled = std::max(3, int(round(width * scale)));
+        return (scaled % 2 == 0) ? scaled - 1 : scaled;
+    }
+
+
+    RunMetrics runPreviewDeblur(const Mat& blurredLeft, const Mat& blurredRight,
+                                Mat& previewLeft, Mat& previewRight,
+                                const deblurOptions& options, const previewOptions& preview,
+                                previewResult* warmStart) {
+        TRACE_SCOPE("runPreviewDeblur");
+
+        if (blurredLeft.size() != blurredRight.size()) {
+            throw runtime_error("Images aren't of same size!");
+        }
+
+        if (options.psfWidth < 1) {
+            throw runtime_error("PSF width has to be greater zero!");
+        }
+
+        if (preview.factor < 1) {
+            throw runtime_error("Preview factor has to be greater zero!");
+        }
+
+        const int threads = options.threads;
+        const double scale = 1.0 / preview.factor;
+
+        MemoryBudget localBudget(options.memoryBudget);
+        MemoryBudget* budget = (options.sharedMemoryBudget != nullptr) ? options.sharedMemoryBudget : &localBudget;
+
+        ScopedMatPool pool(options.pooledAllocator);
+
+        RunMetrics metrics;
+        metrics.width = blurredLeft.cols;
+        metrics.height = blurredLeft.rows;
+        metrics.threads = threads;
+        metrics.psfWidth = options.psfWidth;
+        metrics.layers = options.layers;
+        metrics.passes = 1;
+
+        StageClock clock(metrics);
+
+        // the blur shrinks with the views
+        array<Mat, 2> small;
+        resize(blurredLeft, small[LEFT], Size(), scale, scale, INTER_AREA);
+        resize(blurredRight, small[RIGHT], Size(), scale, scale, INTER_AREA);
+
+        const int psfWidth = scaledWidth(options.psfWidth, scale);
+        const int maxDisparity = std::max(4, int(ceil(options.maxDisparity * scale)));
+
+        const vector<Mat> kernels = options.toplevelKernels.empty() ? loadToplevelKernels(".")
+                                                                   : options.toplevelKernels;
+        vector<Mat> smallKernels;
+
+        for (const auto& kernel : kernels) {
+            smallKernels.push_back(scaleKernel(kernel, Size(scaledWidth(kernel.cols, scale),
+                                                            scaledWidth(kernel.rows, scale))));
+        }
+
+        cout << "Preview with 1/" << preview.factor << " resolution (PSF width " << psfWidth << ")" << endl;
+
+        DepthDeblur depthDeblur(small[LEFT], small[RIGHT], psfWidth, options.layers, options.deconvAlgo);
+        depthDeblur.setMemoryBudget(budget);
+
+        cout << " Step 1: disparity estimation" << endl;
+        depthDeblur.disparityEstimation(small, MATCH, maxDisparity, vector<float>(), threads);
+        clock.tick("preview-disparity");
+
+        cout << " Step 2: region tree reconstruction" << endl;
+        depthDeblur.regionTreeReconstruction(options.maxTopLevelNodes);
+        clock.tick("preview-region-tree");
+
+        cout << " Step 3: PSF estimation" << endl;
+        depthDeblur.toplevelKernelEstimation(smallKernels);
+        depthDeblur.midLevelKernelEstimation(threads);
+        clock.tick("preview-psf");
+
+        // PSFs of the full resolution (the same odd width as DepthDeblur uses)
+        const int fullWidth = (options.psfWidth % 2 == 0) ? options.psfWidth - 1 : options.psfWidth;
+        vector<psfEntry> psfs = depthDeblur.getPSFs(1);
+
+        for (auto& entry : psfs) {
+            entry.psf = scaleKernel(entry.psf, Size(fullWidth, fullWidth));
+            entry.entropy = 0;      // unknown at full resolution
+        }
+
+        cout << " Step 4: deconvolution" << endl;
+
+        if (preview.fullResolution) {
+            // the regions of the preview at full resolution
+            array<Mat, 2> maps;
+            resize(depthDeblur.getDisparityMaps()[LEFT], maps[LEFT], blurredLeft.size(), 0, 0, INTER_NEAREST);
+            resize(depthDeblur.getDisparityMaps()[RIGHT], maps[RIGHT], blurredRight.size(), 0, 0, INTER_NEAREST);
+
+            vector<float> centers = depthDeblur.getDisparityCenters();
+
+            for (auto& center : centers) {
+                center *= preview.factor;
+            }
+
+            DepthDeblur fullDeblur(blurredLeft, blurredRight, options.psfWidth, options.layers, options.deconvAlgo);
+            fullDeblur.setMemoryBudget(budget);
+            fullDeblur.setDisparityMaps(maps, centers);
+            fullDeblur.regionTreeReconstruction(options.maxTopLevelNodes);
+            fullDeblur.setPSFs(psfs);
+
+            // a single fast deconvolution
+            fullDeblur.setFastDeconvolution(true);
+            fullDeblur.deconvolve(previewLeft, LEFT, threads);
+            fullDeblur.deconvolve(previewRight, RIGHT, threads);
+        } else {
+            depthDeblur.deconvolve(previewLeft, LEFT, threads);
+            depthDeblur.deconvolve(previewRight, RIGHT, threads);
+        }
+
+        clock.tick("deconvolution");
+
+        // the statistics of the region tree of the preview
+        depthDeblur.collectMetrics(metrics, 1);
+
+        if (warmStart != nullptr) {
+            warmStart->factor = preview.factor;
+            warmStart->size = blurredLeft.size();
+
+            // the matching of the full run works on the views down sampled by 2
+            // (see DepthDeblur::disparityEstimation), the disparities grow with the factor
+            const Mat& matched = depthDeblur.getMatchedDisparityMaps()[LEFT];
+            const Size matchSize(blurredLeft.cols / 2, blurredLeft.rows / 2);
+
+            if (!matched.empty()) {
+                Mat map;
+                resize(matched, map, matchSize, 0, 0, INTER_NEAREST);
+                map.convertTo(warmStart->disparity.map, CV_8U, preview.factor);
+            } else {
+                warmStart->disparity.map.release();
+            }
+
+            // the up sampled disparities are only exact up to the factor
+            warmStart->disparity.band = preview.factor + 1;
+
+            // without energies no PSF is kept, they are the initialization
+            // and an additional candidate of the PSF estimation
+            warmStart->psfs.psfs = psfs;
+            warmStart->psfs.energies.clear();
+        }
+
+        clock.finish();
+        metrics.memoryBudgetBytes = budget->budget();
+        metrics.peakConcurrentSolves = budget->peakTasks();
+        metrics.throttledSolves = budget->throttledTasks();
+
+        cout << "finished Preview" << endl;
+
+        return metrics;
+    }
+}
@@ -0,0 +1,360 @@
+#include <stdexcept>                    // throw exception
+#include <mutex>
+#include <cstring>                      // memcmp, memcpy, strncpy, strerror
+#include <cerrno>
+#include <cstdio>                       // rename
+
+#include <fcntl.h>                      // open, fcntl
+#include <unistd.h>                     // close, pread, pwrite, fsync, unlink
+#include <sys/mman.h>                   // mmap
+#include <sys/stat.h>                   // fstat, stat
+
+#include <opencv2/highgui/highgui.hpp>  // imread
+
+#include "psf_bank.hpp"
+
+
+using namespace std;
+using namespace cv;
+
+
+namespace deblur {
+
+    static const int bankVersion = 1;
+
+
+    PSFBank::PSFBank(const string& filename)
+                    : filename(filename)
+    {
+        int fd = open(filename.c_str(), O_RDONLY);
+
+        if (fd < 0) {
+            throw runtime_error("Can not open PSF bank " + filename + ": " + strerror(errno));
+        }
+
+        struct stat info;
+
+        if (fstat(fd, &info) != 0) {
+            close(fd);
+            throw runtime_error("Can not read size of PSF bank " + filename + ": " + strerror(errno));
+        }
+
+        length = info.st_size;
+
+        if (length < sizeof(psfBankHeader)) {
+            close(fd);
+            throw runtime_error(filename + " isn't a valid PSF bank!");
+        }
+
+        data = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+
+        // the mapping stays valid without the file descriptor
+        close(fd);
+
+        if (data == MAP_FAILED) {
+            data = nullptr;
+            throw runtime_error("Can not map PSF bank " + filename + ": " + strerror(errno));
+        }
+
+        const psfBankHeader* header = (const psfBankHeader*)data;
+
+        if (memcmp(header->magic, "DBPB", 4) != 0 || header->version != bankVersion
+            || header->end > int64_t(length)) {
+            munmap(data, length);
+            data = nullptr;
+            throw runtime_error(filename + " isn't a valid PSF bank!");
+        }
+
+        // index the records
+        size_t offset = sizeof(psfBankHeader);
+
+        for (int i = 0; i < header->records; i++) {
+            const psfRecordHeader* record = (const psfRecordHeader*)((const char*)data + offset);
+            offset += sizeof(psfRecordHeader);
+
+            if (offset > size_t(header->end) || record->rows <= 0 || record->cols <= 0) {
+                munmap(data, length);
+                data = nullptr;
+                throw runtime_error("PSF bank " + filename + " is corrupted!");
+            }
+
+            offset += size_t(record->rows) * record->cols * sizeof(float);
+
+            if (offset > size_t(header->end)) {
+                munmap(data, length);
+                data = nullptr;
+                throw runtime_error("PSF bank " + filename + " is corrupted!");
+            }
+
+            records.push_back(record);
+        }
+    }
+
+
+    PSFBank::~PSFBank() {
+        if (data != nullptr) {
+            munmap(data, length);
+        }
+    }
+
+
+    Mat PSFBank::psf(const int i) const {
+        const psfRecordHeader* record = records[i];
+
+        // the float data follows the header
+        return Mat(record->rows, record->cols, CV_32F, (void*)(record + 1));
+    }
+
+
+    vector<psfEntry> PSFBank::entries(const string& label) const {
+        vector<psfEntry> psfs;
+
+        for (int i = 0; i < size(); i++) {
+            const psfRecordHeader& meta = record(i);
+
+            if (!label.empty() && label != meta.label) {
+                continue;
+            }
+
+            psfEntry entry;
+            entry.id = meta.id;
+            entry.parent = meta.parent;
+            entry.pass = meta.pass;
+            entry.entropy = meta.entropy;
+            entry.label = meta.label;
+            entry.psf = psf(i).clone();
+
+            psfs.push_back(entry);
+        }
+
+        return psfs;
+    }
+
+
+    /**
+     * Writes the records behind the last complete one and updates the header
+     * afterwards. The caller has to lock the file.
+     */
+    static void writeRecords(const int fd, const string& filename, const vector<psfEntry>& psfs) {
+        psfBankHeader header;
+
+        struct stat info;
+
+        if (fstat(fd, &info) != 0) {
+            throw runtime_error("Can not read size of PSF bank " + filename + ": " + strerror(errno));
+        }
+
+        if (info.st_size == 0) {
+            // new bank
+            memcpy(header.magic, "DBPB", 4);
+            header.version = bankVersion;
+            header.records = 0;
+            header.reserved = 0;
+            header.end = sizeof(psfBankHeader);
+        } else if (pread(fd, &header, sizeof(header), 0) != sizeof(header)
+                   || memcmp(header.magic, "DBPB", 4) != 0 || header.version != bankVersion) {
+            throw runtime_error(filename + " isn't a valid PSF bank!");
+        }
+
+        int64_t offset = header.end;
+
+        for (const auto& entry : psfs) {
+            Mat psf;
+            entry.psf.convertTo(psf, CV_32F);
+
+            // the data of a record has to be continuous
+            if (!psf.isContinuous()) {
+                psf = psf.clone();
+            }
+
+            psfRecordHeader record;
+            memset(&record, 0, sizeof(record));
+            record.id = entry.id;
+            record.parent = entry.parent;
+            record.pass = entry.pass;
+            record.rows = psf.rows;
+            record.cols = psf.cols;
+            record.entropy = entry.entropy;
+            strncpy(record.label, entry.label.c_str(), sizeof(record.label) - 1);
+
+            const size_t bytes = psf.total() * sizeof(float);
+
+            if (pwrite(fd, &record, sizeof(record), offset) != sizeof(record)
+                || pwrite(fd, psf.data, bytes, offset + sizeof(record)) != ssize_t(bytes)) {
+                throw runtime_error("Can not write PSF bank " + filename + ": " + strerror(errno));
+            }
+
+            offset += sizeof(record) + bytes;
+            header.records++;
+        }
+
+        // the new records become visible with the header
+        header.end = offset;
+
+        if (fdatasync(fd) != 0 || pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) {
+            throw runtime_error("Can not write PSF bank " + filename + ": " + strerror(errno));
+        }
+    }
+
+
+    // record locks don't exclude the threads of a process
+    static mutex bankMutex;
+
+
+    /**
+     * Opens the bank (a new one is created) and locks it for writing.
+     * A save replaces the file while others wait for its lock, so the lock
+     * is only valid if the path still refers to the locked file.
+     */
+    static int openLocked(const string& filename) {
+        while (true) {
+            int fd = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+
+            if (fd < 0) {
+                throw runtime_error("Can not open PSF bank " + filename + ": " + strerror(errno));
+            }
+
+            // lock the whole file (works on NFS too in contrast to flock)
+            struct flock fileLock;
+            memset(&fileLock, 0, sizeof(fileLock));
+            fileLock.l_type = F_WRLCK;
+            fileLock.l_whence = SEEK_SET;
+
+            if (fcntl(fd, F_SETLKW, &fileLock) != 0) {
+                close(fd);
+                throw runtime_error("Can not lock PSF bank " + filename + ": " + strerror(errno));
+            }
+
+            struct stat locked, current;
+
+            if (fstat(fd, &locked) != 0) {
+                close(fd);
+                throw runtime_error("Can not read PSF bank " + filename + ": " + strerror(errno));
+            }
+
+            if (stat(filename.c_str(), &current) == 0
+                && current.st_dev == locked.st_dev && current.st_ino == locked.st_ino) {
+                return fd;
+            }
+
+            // replaced in the meantime, closing the file releases the lock
+            close(fd);
+        }
+    }
+
+
+    void savePSFBank(const string& filename, const vector<psfEntry>& psfs) {
+        lock_guard<mutex> lock(bankMutex);
+
+        // the lock of the old bank keeps appends out until it is replaced
+        int fd = openLocked(filename);
+
+        // the new bank is written completely before it replaces the old one,
+        // so an interrupted save leaves the old bank unchanged
+        const string tmp = filename + ".tmp";
+        int out = open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+        if (out < 0) {
+            close(fd);
+            throw runtime_error("Can not create PSF bank " + tmp + ": " + strerror(errno));
+        }
+
+        try {
+            writeRecords(out, tmp, psfs);
+
+            if (fsync(out) != 0) {
+                throw runtime_error("Can not write PSF bank " + tmp + ": " + strerror(errno));
+            }
+
+            close(out);
+            out = -1;
+
+            if (rename(tmp.c_str(), filename.c_str()) != 0) {
+                throw runtime_error("Can not replace PSF bank " + filename + ": " + strerror(errno));
+            }
+        }
+        catch (...) {
+            if (out >= 0) {
+                close(out);
+            }
+
+            unlink(tmp.c_str());
+            close(fd);
+            throw;
+        }
+
+        close(fd);
+    }
+
+
+    void appendPSFBank(const string& filename, const vector<psfEntry>& psfs) {
+        lock_guard<mutex> lock(bankMutex);
+
+        int fd = openLocked(filename);
+
+        try {
+            writeRecords(fd, filename, psfs);
+        }
+        catch (...) {
+            // closing the file releases the lock
+            close(fd);
+            throw;
+        }
+
+        close(fd);
+    }
+
+
+    bool isPSFBank(const string& filename) {
+        size_t pos = filename.rfind(".psfb");
+
+        return pos != string::npos
+               && (pos + 5 == filename.size() || filename[pos + 5] == ':');
+    }
+
+
+    Mat loadKernel(const string& filename) {
+        Mat kernel;
+
+        if (isPSFBank(filename)) {
+            // bank with optional index
+            size_t pos = filename.rfind(".psfb") + 5;
+            int index = 0;
+
+            if (pos < filename.size()) {
+                try {
+                    size_t end = 0;
+                    index = stoi(filename.substr(pos + 1), &end);
+
+                    if (end != filename.size() - pos - 1) {
+                        throw invalid_argument("trailing characters");
+                    }
+                } catch (const exception&) {
+                    throw runtime_error("Invalid PSF index of bank " + filename.substr(0, pos) + ": "
+                                        + filename.substr(pos + 1));
+                }
+            }
+
+            PSFBank bank(filename.substr(0, pos));
+
+            if (index < 0 || index >= bank.size()) {
+                throw runtime_error("PSF bank " + filename.substr(0, pos) + " has no PSF " + to_string(index) + "!");
+            }
+
+            kernel = bank.psf(index).clone();
+        } else {
+            kernel = imread(filename, CV_LOAD_IMAGE_GRAYSCALE);
+
+            if (!kernel.data) {
+                throw runtime_error("Can not load kernel " + filename + "!");
+            }
+
+            kernel.convertTo(kernel, CV_32F);
+        }
+
+        // energy preserving kernel
+        kernel /= sum(kernel)[0];
+
+        return kernel;
+    }
+}
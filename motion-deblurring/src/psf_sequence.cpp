@@ -0,0 +1,40 @@
+#include "psf_sequence.hpp"
+
+
+using namespace std;
+using namespace cv;
+
+
+namespace deblur {
+
+    PSFSequence::PSFSequence(const float threshold) {
+        prior.threshold = threshold;
+    }
+
+
+    const psfPrior* PSFSequence::nextFrame(const bool sceneCut) {
+        frames++;
+
+        // the kernels of a new shot have nothing in common with the previous ones
+        if (sceneCut) {
+            prior.psfs.clear();
+            prior.energies.clear();
+        }
+
+        return prior.psfs.empty() ? nullptr : &prior;
+    }
+
+
+    void PSFSequence::update(const vector<psfEntry>& psfs, const vector<float>& energies) {
+        prior.psfs.clear();
+
+        // deep copies because the region tree of the frame is released
+        for (const auto& entry : psfs) {
+            prior.psfs.push_back(entry);
+            prior.psfs.back().psf = entry.psf.clone();
+        }
+
+        // without energies (e.g. PSFs from the cache) all nodes of the next frame are estimated
+        prior.energies = energies;
+    }
+}
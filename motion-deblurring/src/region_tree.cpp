@@ -4,6 +4,7 @@
 #include <opencv2/imgproc/imgproc.hpp>  // convert
 
 #include "region_tree.hpp"
+#include "trace.hpp"
 
 
 using namespace cv;
@@ -17,6 +18,7 @@ namespace deblur {
     void RegionTree::create(const Mat& quantizedDisparityMapL, const Mat& quantizedDisparityMapR,
                             const int layers, Mat* imageLeft, Mat* imageRight,
                             const int maxTopLevelNodes){
+        TRACE_SCOPE("RegionTree::create");
 
         // save a pointer to the original image
         images[LEFT] = imageLeft;
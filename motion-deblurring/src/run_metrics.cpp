@@ -0,0 +1,246 @@
+#include <fstream>
+#include <sstream>
+#include <cmath>                        // isfinite
+#include <iomanip>                      // setprecision
+#include <stdexcept>                    // throw exception
+#include <ctime>                        // clock_gettime
+#include <algorithm>                    // max
+
+#include <sys/resource.h>               // getrusage
+
+#include "run_metrics.hpp"
+
+
+using namespace std;
+
+
+namespace deblur {
+
+    double processCpuMs() {
+        timespec time;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+
+        return time.tv_sec * 1000.0 + time.tv_nsec / 1e6;
+    }
+
+
+    long peakRssKb() {
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+
+        // Linux reports kilobytes
+        return usage.ru_maxrss;
+    }
+
+
+    StageClock::StageClock(RunMetrics& metrics)
+                          : metrics(metrics)
+                          , begin(chrono::steady_clock::now())
+                          , clock(begin)
+                          , beginCpu(processCpuMs())
+                          , cpuClock(beginCpu)
+    {
+        PoolAllocator::instance().resetPeak();
+        allocations = PoolAllocator::instance().statistics();
+    }
+
+
+    void StageClock::tick(const string& name) {
+        auto now = chrono::steady_clock::now();
+        double cpuNow = processCpuMs();
+
+        stageMetrics& stage = metrics.stage(name);
+        stage.wallMs += chrono::duration<double, milli>(now - clock).count();
+        stage.cpuMs += cpuNow - cpuClock;
+
+        PoolAllocator& allocator = PoolAllocator::instance();
+        allocationStatistics current = allocator.statistics();
+        stage.allocations += current.allocations - allocations.allocations;
+        stage.poolHits += current.poolHits - allocations.poolHits;
+        stage.allocatedBytes += current.bytes - allocations.bytes;
+        stage.peakBytes = max(stage.peakBytes, current.peakBytes);
+        allocator.resetPeak();
+
+        allocations = current;
+        clock = now;
+        cpuClock = cpuNow;
+    }
+
+
+    void StageClock::finish() {
+        metrics.totalWallMs = chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+        metrics.totalCpuMs = processCpuMs() - beginCpu;
+        metrics.peakRssKb = peakRssKb();
+    }
+
+
+    stageMetrics& RunMetrics::stage(const string& name) {
+        for (auto& s : stages) {
+            if (s.stage == name) {
+                return s;
+            }
+        }
+
+        stages.push_back(stageMetrics());
+        stages.back().stage = name;
+
+        return stages.back();
+    }
+
+
+    /**
+     * Name of the winner of a PSF selection (see selectionCandidate)
+     */
+    static const char* winnerName(const int winner) {
+        switch (winner) {
+            case OWN_PSF:               return "own";
+            case PARENT_PSF:            return "parent";
+            case SIBLING_PSF:           return "sibling";
+            case PREVIOUS_FRAME_PSF:    return "previous-frame";
+        }
+
+        return "none";
+    }
+
+
+    /**
+     * Number of the JSON output. JSON has no NaN or infinity, they are written as null.
+     */
+    struct jsonNumber {
+        double value;
+    };
+
+    static ostream& operator<<(ostream& out, const jsonNumber& number) {
+        if (std::isfinite(number.value)) {
+            out << number.value;
+        } else {
+            out << "null";
+        }
+
+        return out;
+    }
+
+    static jsonNumber num(const double value) {
+        return jsonNumber{value};
+    }
+
+
+    /**
+     * Writes a JSON array where each element is written by the given function
+     */
+    template<typename T, typename F>
+    static void writeArray(ostream& out, const string& pad, const string& name,
+                           const vector<T>& elements, F writeElement, const bool last = false) {
+        out << pad << "  \"" << name << "\": [";
+
+        for (int i = 0; i < elements.size(); i++) {
+            out << ((i > 0) ? ",\n" : "\n") << pad << "    ";
+            writeElement(elements[i]);
+        }
+
+        out << (elements.empty() ? "]" : "\n" + pad + "  ]") << (last ? "" : ",") << endl;
+    }
+
+
+    void RunMetrics::writeJSON(ostream& stream, const int indent) const {
+        const string pad(indent, ' ');
+
+        // own formatting, the stream of the caller keeps its flags
+        ostringstream out;
+        out << fixed << setprecision(3);
+        out << "{" << endl;
+        out << pad << "  \"width\": " << width << "," << endl;
+        out << pad << "  \"height\": " << height << "," << endl;
+        out << pad << "  \"threads\": " << threads << "," << endl;
+        out << pad << "  \"psf_width\": " << psfWidth << "," << endl;
+        out << pad << "  \"layers\": " << layers << "," << endl;
+        out << pad << "  \"passes\": " << passes << "," << endl;
+        out << pad << "  \"tiles\": " << tiles << "," << endl;
+        out << pad << "  \"total_wall_ms\": " << num(totalWallMs) << "," << endl;
+        out << pad << "  \"total_cpu_ms\": " << num(totalCpuMs) << "," << endl;
+        out << pad << "  \"peak_rss_kb\": " << peakRssKb << "," << endl;
+        out << pad << "  \"memory_budget_bytes\": " << memoryBudgetBytes << "," << endl;
+        out << pad << "  \"peak_concurrent_solves\": " << peakConcurrentSolves << "," << endl;
+        out << pad << "  \"throttled_solves\": " << throttledSolves << "," << endl;
+        out << pad << "  \"cache_hits\": " << cacheHits << "," << endl;
+        out << pad << "  \"cache_misses\": " << cacheMisses << "," << endl;
+        out << pad << "  \"cache_hit_rate\": " << num(cacheHitRate()) << "," << endl;
+        out << pad << "  \"time_budget_ms\": " << num(timeBudgetMs) << "," << endl;
+        out << pad << "  \"predicted_ms\": " << num(predictedMs) << "," << endl;
+        out << pad << "  \"deadline_hit\": " << (deadlineHit ? "true" : "false") << "," << endl;
+        out << pad << "  \"skipped_nodes\": " << skippedNodes << "," << endl;
+        out << pad << "  \"fast_regions\": " << fastRegions << "," << endl;
+
+        writeArray(out, pad, "roi", roi, [&](const int& value) { out << value; });
+
+        writeArray(out, pad, "lowered_knobs", loweredKnobs, [&](const string& knob) {
+            out << "\"" << knob << "\"";
+        });
+
+        writeArray(out, pad, "stages", stages, [&](const stageMetrics& s) {
+            out << "{\"stage\": \"" << s.stage << "\", \"wall_ms\": " << num(s.wallMs)
+                << ", \"cpu_ms\": " << num(s.cpuMs) << ", \"allocations\": " << s.allocations
+                << ", \"allocated_bytes\": " << s.allocatedBytes << ", \"pool_hit_rate\": " << num(s.poolHitRate())
+                << ", \"peak_bytes\": " << s.peakBytes << "}";
+        });
+
+        writeArray(out, pad, "layer_pixels_left", layerPixelsLeft, [&](const long& n) { out << n; });
+        writeArray(out, pad, "layer_pixels_right", layerPixelsRight, [&](const long& n) { out << n; });
+
+        writeArray(out, pad, "disparity", disparity, [&](const disparityMetrics& d) {
+            out << "{\"pass\": " << d.pass << ", \"kz2_initial_energy\": " << d.initialEnergy
+                << ", \"kz2_final_energy\": " << d.finalEnergy << ", \"kz2_expansions\": " << d.expansions
+                << ", \"kz2_iterations\": " << num(d.iterations) << ", \"frame\": " << d.frame
+                << ", \"warm_start\": " << (d.warmStart ? "true" : "false")
+                << ", \"scene_cut\": " << (d.sceneCut ? "true" : "false")
+                << ", \"speedup\": " << num(d.speedup) << "}";
+        });
+
+        writeArray(out, pad, "nodes", nodes, [&](const nodeMetrics& n) {
+            out << "{\"pass\": " << n.pass << ", \"id\": " << n.id << ", \"parent\": " << n.parent
+                << ", \"layers\": " << n.layers << ", \"pixels_left\": " << n.pixelsLeft
+                << ", \"pixels_right\": " << n.pixelsRight << ", \"entropy\": " << num(n.entropy)
+                << ", \"candidates\": " << n.candidates << ", \"winner\": " << n.winner
+                << ", \"winner_psf\": \"" << winnerName(n.winner) << "\""
+                << ", \"winner_energy\": " << num(n.winnerEnergy)
+                << ", \"carried\": " << (n.carried ? "true" : "false")
+                << ", \"estimation_ms\": " << num(n.estimationMs) << ", \"selection_ms\": " << num(n.selectionMs) << "}";
+        });
+
+        writeArray(out, pad, "deconvolution", deconvolution, [&](const deconvolutionMetrics& d) {
+            out << "{\"pass\": " << d.pass << ", \"region\": " << d.region << ", \"view\": " << d.view
+                << ", \"iterations\": " << d.iterations << ", \"residual\": " << num(d.residual)
+                << ", \"wall_ms\": " << num(d.wallMs) << "}";
+        });
+
+        writeArray(out, pad, "parallel", parallel, [&](const parallelMetrics& p) {
+            out << "{\"section\": \"" << p.section << "\", \"threads\": " << p.threads
+                << ", \"wall_ms\": " << num(p.wallMs) << ", \"busy_ms\": " << num(p.busyMs)
+                << ", \"utilization\": " << num(p.utilization()) << ", \"accesses\": " << p.accesses
+                << ", \"empty_accesses\": " << p.emptyAccesses << ", \"wait_ms\": " << num(p.waitMs)
+                << ", \"spin_ms\": " << num(p.spinMs) << ", \"critical_path_ms\": " << num(p.criticalPathMs)
+                << ", \"critical_path\": [";
+
+            for (int i = 0; i < p.criticalPath.size(); i++) {
+                out << ((i > 0) ? ", " : "") << p.criticalPath[i];
+            }
+
+            out << "]}";
+        }, true);
+
+        out << pad << "}";
+        stream << out.str();
+    }
+
+
+    void RunMetrics::saveJSON(const string& filename) const {
+        ofstream file(filename);
+
+        if (!file) {
+            throw runtime_error("Can not write metrics: " + filename);
+        }
+
+        writeJSON(file);
+        file << endl;
+    }
+}
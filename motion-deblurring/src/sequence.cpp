@@ -0,0 +1,327 @@
+/***********************************************************************
+ * Author:       Franziska Krüger
+ * Using:        argtable3 - http://www.argtable.org/
+ *
+ * Description:
+ * ------------
+ * Depth-Aware Motion Deblurring of the frames of a stereo video. The
+ * disparity estimation of each frame starts with the disparity map of
+ * the previous frame (see disparity_sequence.hpp) and the PSFs of the
+ * previous frame are kept if they still fit (see psf_sequence.hpp).
+ *
+ ************************************************************************
+*/
+
+#include <iostream>     // cout, cerr, endl
+#include <fstream>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <cstdio>       // snprintf
+#include <unistd.h>     // access
+
+#include "argtable3.h"  // cross platform command line parsing
+#include "depth_aware_deblurring.hpp"
+#include "depth_deblur.hpp"
+#include "disparity_sequence.hpp"
+#include "psf_sequence.hpp"
+#include "trace.hpp"
+
+using namespace std;
+
+// global structs for command line parsing
+struct arg_lit *help, *fft, *irls, *no_warm_start, *no_psf_carry;
+struct arg_file *left_pattern, *right_pattern, *out_left, *out_right, *trace_file, *metrics_file;
+struct arg_end *end_args;
+struct arg_int *psf_width, *max_toplevel_nodes, *mythreads, *max_disparity, *d_layers, *memory_budget;
+struct arg_int *first_frame, *frame_count, *band;
+struct arg_dbl *scene_cut, *psf_threshold;
+
+
+/**
+ * Parameters of the video
+ */
+struct sequenceOptions {
+    string left;            // printf pattern of the left frames, e.g. left-%04d.png
+    string right;
+    string outLeft;
+    string outRight;
+    int first = 0;          // index of the first frame
+    int frames = 0;         // number of frames (0: until a frame is missing)
+    int band = 2;           // search band around the previous disparities (0: full search)
+    double sceneCut = 25;   // mean gray value difference of a scene cut
+    double psfThreshold = 0.1;  // allowed relative increase of the selection energy of a kept PSF (<0: estimate all)
+};
+
+
+/**
+ * Saves the user input in the options.
+ * On error while parsing or used help option this function returns false.
+ */
+static bool parse_commandline_args(int argc, char** argv, sequenceOptions &sequence,
+                                   deblur::deblurOptions &options,
+                                   string &traceFile, string &metricsFile, int &exitcode) {
+
+    // command line options
+    // the global arg_xxx structs are initialized within the argtable
+    void *argtable[] = {
+        help        = arg_litn("h", "help",                        0, 1, "display this help and exit"),
+        fft         = arg_litn("f", "fft",                         0, 1, "deconvolution with FFT"),
+        irls        = arg_litn("i", "irls",                        0, 1, "deconvolution with IRLS"),
+        psf_width   = arg_intn ("w", "psf-width", "<n>",           0, 1, "approximate PSF width. Default: 35"),
+        d_layers    = arg_intn ("l", "layers", "<n>",              0, 1, "number of region/disparity layers. Default: 12"),
+        mythreads   = arg_intn ("t", "threads", "<n>",             0, 1, "number of threads. Default: 1"),
+        max_disparity        = arg_intn ("d", "max-disparity", "<n>", 0, 1, "estimated maximum disparity. Default: 160"),
+        max_toplevel_nodes   = arg_intn ("m", "max-top-nodes", "<n>", 0, 1, "max top level nodes in region tree. Default: 3"),
+        memory_budget        = arg_intn (nullptr, "memory-budget", "<MB>", 0, 1, "memory for concurrent region solves. Default: 0 (unlimited)"),
+        first_frame          = arg_intn (nullptr, "first", "<n>", 0, 1, "index of the first frame. Default: 0"),
+        frame_count          = arg_intn (nullptr, "frames", "<n>", 0, 1, "number of frames. Default: 0 (until a frame is missing)"),
+        band                 = arg_intn (nullptr, "band", "<n>", 0, 1, "search band around the disparities of the previous frame. Default: 2"),
+        scene_cut            = arg_dbln (nullptr, "scene-cut", "<x>", 0, 1, "mean gray value difference of a scene cut. Default: 25"),
+        no_warm_start        = arg_litn (nullptr, "no-warm-start", 0, 1, "search the full disparity range in each frame"),
+        psf_threshold        = arg_dbln (nullptr, "psf-threshold", "<x>", 0, 1, "allowed relative increase of the selection energy of a kept PSF. Default: 0.1"),
+        no_psf_carry         = arg_litn (nullptr, "no-psf-carry", 0, 1, "estimate all PSFs in each frame"),
+        out_left    = arg_filen(nullptr, "out-left", "<pattern>",  0, 1, "pattern of the results left. Default: deblur-left-%04d.png"),
+        out_right   = arg_filen(nullptr, "out-right", "<pattern>", 0, 1, "pattern of the results right. Default: deblur-right-%04d.png"),
+        trace_file  = arg_filen(nullptr, "trace", "<file>",        0, 1, "save a Chrome trace (JSON) and print a summary of the steps"),
+        metrics_file = arg_filen(nullptr, "metrics", "<file>",     0, 1, "save time, resources and statistics of all frames (JSON)"),
+        left_pattern  = arg_filen(nullptr, nullptr, "<left pattern>",  1, 1, "printf pattern of the left frames, e.g. left-%04d.png"),
+        right_pattern = arg_filen(nullptr, nullptr, "<right pattern>", 1, 1, "printf pattern of the right frames"),
+        end_args    = arg_end(20),
+    };
+
+    // default values (they weren't set if there is a value given)
+    psf_width->ival[0] = 35;
+    mythreads->ival[0] = 1;
+    max_toplevel_nodes->ival[0] = 3;
+    max_disparity->ival[0] = 160;
+    d_layers->ival[0] = 12;
+    memory_budget->ival[0] = 0;
+    first_frame->ival[0] = sequence.first;
+    frame_count->ival[0] = sequence.frames;
+    band->ival[0] = sequence.band;
+    scene_cut->dval[0] = sequence.sceneCut;
+    psf_threshold->dval[0] = sequence.psfThreshold;
+    out_left->filename[0] = "deblur-left-%04d.png";
+    out_right->filename[0] = "deblur-right-%04d.png";
+
+    // parsing arguments
+    int nerrors = arg_parse(argc,argv,argtable);
+
+    // special case: '--help' takes precedence over error reporting
+    if (help->count > 0)
+    {
+        cout << "Usage: " << argv[0];
+        arg_print_syntax(stdout, argtable, "\n");
+        cout << "Depth-Aware Motion Deblurring of a stereo video." << endl << endl;
+        arg_print_glossary(stdout, argtable, "  %-25s %s\n");
+
+        // deallocate each non-null entry in argtable[]
+        arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+        exitcode = 0;
+        return false;
+    }
+
+    // If the parser returned any errors then display them and exit
+    if (nerrors > 0)
+    {
+        arg_print_errors(stdout, end_args, argv[0]);
+        cout << "Try '" << argv[0] << "--help' for more information." << endl;
+
+        // deallocate each non-null entry in argtable[]
+        arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+        exitcode = 1;
+        return false;
+    }
+
+    if (fft->count > 0) {
+        options.deconvAlgo = deblur::DepthDeblur::FFT;
+    }
+
+    if (irls->count > 0) {
+        options.deconvAlgo = deblur::DepthDeblur::IRLS;
+    }
+
+    // saving arguments in variables
+    sequence.left = left_pattern->filename[0];
+    sequence.right = right_pattern->filename[0];
+    sequence.outLeft = out_left->filename[0];
+    sequence.outRight = out_right->filename[0];
+    sequence.first = first_frame->ival[0];
+    sequence.frames = frame_count->ival[0];
+    sequence.band = (no_warm_start->count > 0) ? -1 : band->ival[0];
+    sequence.sceneCut = scene_cut->dval[0];
+    sequence.psfThreshold = (no_psf_carry->count > 0) ? -1 : psf_threshold->dval[0];
+    options.psfWidth = psf_width->ival[0];
+    options.threads = mythreads->ival[0];
+    options.maxDisparity = max_disparity->ival[0];
+    options.maxTopLevelNodes = max_toplevel_nodes->ival[0];
+    options.layers = d_layers->ival[0];
+    options.memoryBudget = size_t(memory_budget->ival[0]) << 20;
+    traceFile = (trace_file->count > 0) ? trace_file->filename[0] : "";
+    metricsFile = (metrics_file->count > 0) ? metrics_file->filename[0] : "";
+
+    // deallocate each non-null entry in argtable[]
+    arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+
+    return true;
+}
+
+
+/**
+ * Filename of a frame from a printf pattern
+ */
+static string frameFilename(const string& pattern, const int frame) {
+    if (pattern.find('%') == string::npos) {
+        throw runtime_error("Filename pattern needs a frame number (e.g. %04d): " + pattern);
+    }
+
+    char filename[4096];
+    snprintf(filename, sizeof(filename), pattern.c_str(), frame);
+
+    return filename;
+}
+
+
+int main(int argc, char** argv) {
+    sequenceOptions sequence;
+    deblur::deblurOptions options;
+    string traceFile;
+    string metricsFile;
+
+    // parse command line arguments
+    int exitcode = 0;
+    bool success = parse_commandline_args(argc, argv, sequence, options, traceFile, metricsFile, exitcode);
+
+    if (success == false) {
+        return exitcode;
+    }
+
+    // run algorithm
+    cout << "Start Depth-Aware Motion Deblurring of a stereo video with" << endl;
+    cout << "   frames left:         " << sequence.left << endl;
+    cout << "   frames right:        " << sequence.right << endl;
+    cout << "   max disparity:       " << options.maxDisparity << endl;
+    cout << "   approx. PSF width:   " << options.psfWidth << endl;
+    cout << "   layers/regions:      " << options.layers << endl;
+    cout << "   max top level nodes: " << options.maxTopLevelNodes << endl;
+    cout << "   deconvolution algo:  " << ((options.deconvAlgo == deblur::DepthDeblur::FFT) ? "FFT" : "IRLS") << endl;
+    cout << "   threads:             " << options.threads << endl;
+
+    if (sequence.band >= 0) {
+        cout << "   disparity band:      " << sequence.band << endl;
+    } else {
+        cout << "   disparity band:      full search" << endl;
+    }
+
+    if (sequence.psfThreshold >= 0) {
+        cout << "   PSF threshold:       " << sequence.psfThreshold << endl;
+    } else {
+        cout << "   PSF threshold:       estimate all" << endl;
+    }
+
+    if (options.memoryBudget > 0) {
+        cout << "   memory budget:       " << (options.memoryBudget >> 20) << " MB" << endl;
+    }
+    cout << endl;
+
+    if (!traceFile.empty()) {
+        deblur::trace::enable();
+    }
+
+    try {
+        deblur::DisparitySequence disparitySequence(sequence.band, sequence.sceneCut);
+
+        deblur::PSFSequence psfSequence(sequence.psfThreshold);
+
+        if (sequence.band >= 0) {
+            options.sequence = &disparitySequence;
+        }
+
+        if (sequence.psfThreshold >= 0) {
+            options.psfSequence = &psfSequence;
+        }
+
+        vector<deblur::RunMetrics> frames;
+
+        for (int frame = sequence.first; sequence.frames == 0 || frame < sequence.first + sequence.frames; frame++) {
+            const string left = frameFilename(sequence.left, frame);
+            const string right = frameFilename(sequence.right, frame);
+
+            if (access(left.c_str(), R_OK) != 0 || access(right.c_str(), R_OK) != 0) {
+                if (sequence.frames == 0 && !frames.empty()) {
+                    break;
+                }
+
+                throw runtime_error("Can not read frame " + to_string(frame) + ": " + left + ", " + right);
+            }
+
+            cout << "Frame " << frame << endl;
+
+            frames.push_back(deblur::runDepthDeblur(left, right, options,
+                                                    frameFilename(sequence.outLeft, frame),
+                                                    frameFilename(sequence.outRight, frame)));
+
+            const deblur::stageMetrics& stage = frames.back().stage("disparity");
+            cout << "   disparity estimation " << stage.wallMs << " ms";
+
+            if (!frames.back().disparity.empty()) {
+                const deblur::disparityMetrics& disparity = frames.back().disparity.front();
+
+                if (disparity.warmStart) {
+                    cout << " (warm start, speedup " << disparity.speedup << "x)";
+                } else if (disparity.sceneCut) {
+                    cout << " (scene cut, full search)";
+                }
+            }
+            cout << endl;
+
+            // PSFs of the previous frame which were kept
+            int carried = 0;
+            int nodes = 0;
+
+            for (const auto& node : frames.back().nodes) {
+                if (node.candidates > 0) {
+                    nodes++;
+                    carried += node.carried;
+                }
+            }
+
+            cout << "   kept PSFs            " << carried << " of " << nodes << endl << endl;
+        }
+
+        cout << frames.size() << " frames, " << disparitySequence.sceneCuts() << " scene cuts" << endl;
+
+        if (!metricsFile.empty()) {
+            ofstream file(metricsFile);
+
+            if (!file.is_open()) {
+                throw runtime_error("Can not write metrics: " + metricsFile);
+            }
+
+            file << "[" << endl;
+
+            for (int i = 0; i < frames.size(); i++) {
+                file << "  ";
+                frames[i].writeJSON(file, 2);
+                file << ((i + 1 < frames.size()) ? "," : "") << endl;
+            }
+
+            file << "]" << endl;
+        }
+
+        if (!traceFile.empty()) {
+            deblur::trace::enable(false);
+            deblur::trace::writeChromeTrace(traceFile);
+
+            cout << endl;
+            deblur::trace::printSummary(cout);
+        }
+    }
+    catch(const exception& e) {
+        cerr << "ERROR: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return 0;
+}
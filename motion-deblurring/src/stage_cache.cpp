@@ -0,0 +1,334 @@
+#include <fstream>                      // entries
+#include <sstream>
+#include <iomanip>                      // setw, setfill
+#include <algorithm>                    // sort
+#include <thread>
+#include <cstdio>                       // rename, remove
+
+#include <dirent.h>                     // opendir, readdir
+#include <unistd.h>                     // getpid
+#include <utime.h>                      // utime
+#include <sys/stat.h>                   // stat
+
+#include "batch_queue.hpp"              // makeDirectories
+
+#include "stage_cache.hpp"
+
+
+using namespace std;
+using namespace cv;
+
+
+namespace deblur {
+
+    // FNV-1a 64 bit
+    static const uint64_t fnvOffset = 14695981039346656037ULL;
+    static const uint64_t fnvPrime = 1099511628211ULL;
+
+
+    CacheKey::CacheKey(const string& stage)
+                      : stage(stage)
+                      , hash(fnvOffset)
+    {
+        add(stage);
+    }
+
+
+    CacheKey& CacheKey::add(const void* data, const size_t bytes) {
+        const unsigned char* bytePtr = (const unsigned char*)data;
+
+        for (size_t i = 0; i < bytes; i++) {
+            hash ^= bytePtr[i];
+            hash *= fnvPrime;
+        }
+
+        return *this;
+    }
+
+
+    CacheKey& CacheKey::add(const Mat& image) {
+        add(image.type());
+        add(image.rows);
+        add(image.cols);
+
+        // row by row because a ROI isn't continuous
+        const size_t rowBytes = image.cols * image.elemSize();
+
+        for (int row = 0; row < image.rows; row++) {
+            add(image.ptr(row), rowBytes);
+        }
+
+        return *this;
+    }
+
+
+    CacheKey& CacheKey::add(const vector<Mat>& images) {
+        add(images.size());
+
+        for (const auto& image : images) {
+            add(image);
+        }
+
+        return *this;
+    }
+
+
+    CacheKey& CacheKey::add(const string& value) {
+        add(value.size());
+        return add(value.data(), value.size());
+    }
+
+
+    CacheKey& CacheKey::add(const char* value) {
+        return add(string(value));
+    }
+
+
+    CacheKey& CacheKey::add(const CacheKey& key) {
+        add(key.stage);
+        return add(key.hash);
+    }
+
+
+    string CacheKey::str() const {
+        stringstream name;
+        name << stage << "-" << hex << setw(16) << setfill('0') << hash;
+        return name.str();
+    }
+
+
+    StageCache::StageCache(const string& directory, const size_t maxBytes)
+                          : directory(directory)
+                          , maxBytes(maxBytes)
+    {
+        makeDirectories(directory);
+
+        // size of the entries of former runs
+        evict();
+    }
+
+
+    /**
+     * Header of a cached matrix
+     */
+    struct cachedMat {
+        int rows;
+        int cols;
+        int type;
+    };
+
+
+    /**
+     * Reads an entry and checks each header against the size of the file,
+     * so a truncated or corrupted entry can't cause a huge allocation.
+     * Returns false if the entry is invalid.
+     */
+    static bool readEntry(ifstream& in, const size_t fileBytes, vector<Mat>& mats) {
+        int count = 0;
+        char magic[4];
+
+        if (!in.read(magic, 4) || string(magic, 4) != "DBCA" || !in.read((char*)&count, sizeof(count))
+            || count < 0 || size_t(count) > fileBytes / sizeof(cachedMat)) {
+            return false;
+        }
+
+        size_t offset = 4 + sizeof(count);
+
+        for (int i = 0; i < count; i++) {
+            cachedMat header;
+
+            if (!in.read((char*)&header, sizeof(header))) {
+                return false;
+            }
+
+            offset += sizeof(header);
+
+            if (header.rows < 0 || header.cols < 0 || header.type != CV_MAT_TYPE(header.type)
+                || size_t(header.rows) * size_t(header.cols) > fileBytes) {
+                return false;
+            }
+
+            // the size is checked before anything is allocated
+            const size_t bytes = size_t(header.rows) * size_t(header.cols) * CV_ELEM_SIZE(header.type);
+
+            if (bytes > fileBytes - offset) {
+                return false;
+            }
+
+            Mat mat;
+
+            if (bytes > 0) {
+                mat.create(header.rows, header.cols, header.type);
+
+                if (!in.read((char*)mat.data, bytes)) {
+                    return false;
+                }
+
+                offset += bytes;
+            }
+
+            mats.push_back(mat);
+        }
+
+        return offset == fileBytes;
+    }
+
+
+    bool StageCache::load(const CacheKey& key, vector<Mat>& mats) {
+        const string filename = directory + "/" + key.str() + ".dbc";
+        struct stat info;
+
+        if (stat(filename.c_str(), &info) == 0) {
+            ifstream in(filename, ios::binary);
+            vector<Mat> entry;
+            bool valid = false;
+
+            try {
+                valid = in && readEntry(in, size_t(info.st_size), entry);
+            } catch (const exception&) {
+                // e.g. out of memory, the cache is optional
+                valid = false;
+            }
+
+            if (valid) {
+                mats = entry;
+
+                // most recently used
+                utime(filename.c_str(), nullptr);
+
+                lock_guard<mutex> lock(m);
+                hitCount++;
+                return true;
+            }
+
+            // a bad entry is a miss and is computed and stored again
+            remove(filename.c_str());
+        }
+
+        lock_guard<mutex> lock(m);
+        missCount++;
+        return false;
+    }
+
+
+    void StageCache::store(const CacheKey& key, const vector<Mat>& mats) {
+        const string filename = directory + "/" + key.str() + ".dbc";
+
+        // unique temporary file for concurrent threads and processes
+        stringstream tmpName;
+        tmpName << filename << ".tmp-" << getpid() << "-" << this_thread::get_id();
+        const string tmp = tmpName.str();
+
+        size_t bytes = 4 + sizeof(int);
+
+        {
+            ofstream out(tmp, ios::binary);
+
+            int count = mats.size();
+            out.write("DBCA", 4);
+            out.write((const char*)&count, sizeof(count));
+
+            for (const auto& original : mats) {
+                // the data has to be continuous
+                Mat mat = original.isContinuous() ? original : original.clone();
+
+                cachedMat header = {mat.rows, mat.cols, mat.type()};
+                out.write((const char*)&header, sizeof(header));
+                out.write((const char*)mat.data, mat.total() * mat.elemSize());
+                bytes += sizeof(header) + mat.total() * mat.elemSize();
+            }
+
+            if (!out) {
+                out.close();
+                remove(tmp.c_str());
+                return;
+            }
+        }
+
+        // an entry is complete or doesn't exist
+        if (rename(tmp.c_str(), filename.c_str()) != 0) {
+            remove(tmp.c_str());
+            return;
+        }
+
+        // the directory is only scanned if the cache may be too large
+        // (other processes sharing the cache are noticed at that time)
+        bool full;
+
+        {
+            lock_guard<mutex> lock(m);
+            cachedBytes += bytes;
+            full = (maxBytes > 0 && cachedBytes > maxBytes);
+        }
+
+        if (full) {
+            evict();
+        }
+    }
+
+
+    void StageCache::evict() {
+        struct entry {
+            string filename;
+            time_t used;
+            size_t bytes;
+        };
+
+        vector<entry> entries;
+        size_t total = 0;
+
+        DIR* dir = opendir(directory.c_str());
+
+        if (dir == nullptr) {
+            return;
+        }
+
+        while (struct dirent* file = readdir(dir)) {
+            string name = file->d_name;
+
+            if (name.size() < 4 || name.compare(name.size() - 4, 4, ".dbc") != 0) {
+                continue;
+            }
+
+            struct stat info;
+            string filename = directory + "/" + name;
+
+            if (stat(filename.c_str(), &info) == 0) {
+                entries.push_back({filename, info.st_mtime, size_t(info.st_size)});
+                total += info.st_size;
+            }
+        }
+
+        closedir(dir);
+
+        // oldest first
+        sort(entries.begin(), entries.end(), [](const entry& a, const entry& b) {
+            return a.used < b.used;
+        });
+
+        for (const auto& e : entries) {
+            if (maxBytes == 0 || total <= maxBytes) {
+                break;
+            }
+
+            // another process may have removed it already
+            remove(e.filename.c_str());
+            total -= e.bytes;
+        }
+
+        lock_guard<mutex> lock(m);
+        cachedBytes = total;
+    }
+
+
+    long StageCache::hits() {
+        lock_guard<mutex> lock(m);
+        return hitCount;
+    }
+
+
+    long StageCache::misses() {
+        lock_guard<mutex> lock(m);
+        return missCount;
+    }
+}
@@ -0,0 +1,202 @@
+/***********************************************************************
+ * Author:       Franziska Krüger
+ * Using:        argtable3 - http://www.argtable.org/
+ *
+ * Description:
+ * ------------
+ * Tiled Depth-Aware Motion Deblurring for stereo images which don't fit
+ * into the main memory. Input and output are raw images (see tools/raw-image).
+ *
+ ************************************************************************
+*/
+
+#include <iostream>     // cout, cerr, endl
+#include <string>
+#include <stdexcept>
+
+#include "argtable3.h"  // cross platform command line parsing
+#include "depth_aware_deblurring.hpp"
+#include "depth_deblur.hpp"
+#include "tiled_deblur.hpp"
+#include "trace.hpp"
+
+using namespace std;
+
+// global structs for command line parsing
+struct arg_lit *help, *fft, *irls;
+struct arg_file *left_image, *right_image, *out_left, *out_right, *trace_file, *metrics_file;
+struct arg_end *end_args;
+struct arg_int *psf_width, *max_toplevel_nodes, *mythreads, *max_disparity, *d_layers, *memory_budget;
+struct arg_int *tile_size, *overview_size, *reference_size;
+
+
+/**
+ * Saves the user input in the options.
+ * On error while parsing or used help option this function returns false.
+ */
+static bool parse_commandline_args(int argc, char** argv,
+                                   string &left, string &right, string &outLeft, string &outRight,
+                                   deblur::deblurOptions &options, deblur::tileOptions &tiles,
+                                   string &traceFile, string &metricsFile, int &exitcode) {
+
+    // command line options
+    // the global arg_xxx structs are initialized within the argtable
+    void *argtable[] = {
+        help        = arg_litn("h", "help",                        0, 1, "display this help and exit"),
+        fft         = arg_litn("f", "fft",                         0, 1, "deconvolution with FFT"),
+        irls        = arg_litn("i", "irls",                        0, 1, "deconvolution with IRLS"),
+        psf_width   = arg_intn ("w", "psf-width", "<n>",           0, 1, "approximate PSF width. Default: 35"),
+        d_layers    = arg_intn ("l", "layers", "<n>",              0, 1, "number of region/disparity layers. Default: 12"),
+        mythreads   = arg_intn ("t", "threads", "<n>",             0, 1, "number of threads. Default: 1"),
+        max_disparity        = arg_intn ("d", "max-disparity", "<n>", 0, 1, "estimated maximum disparity. Default: 160"),
+        max_toplevel_nodes   = arg_intn ("m", "max-top-nodes", "<n>", 0, 1, "max top level nodes in region tree. Default: 3"),
+        memory_budget        = arg_intn (nullptr, "memory-budget", "<MB>", 0, 1, "memory for concurrent region solves. Default: 0 (unlimited)"),
+        tile_size            = arg_intn (nullptr, "tile-size", "<n>", 0, 1, "side length of a tile (without overlap). Default: 1024"),
+        overview_size        = arg_intn (nullptr, "overview-size", "<n>", 0, 1, "side length of the overview for the disparity layers. Default: 1024"),
+        reference_size       = arg_intn (nullptr, "reference-size", "<n>", 0, 1, "side length of the crop for the PSF estimation. Default: 2048"),
+        out_left    = arg_filen(nullptr, "out-left", "<file>",     0, 1, "raw image of the result left. Default: deblur-left.raw"),
+        out_right   = arg_filen(nullptr, "out-right", "<file>",    0, 1, "raw image of the result right. Default: deblur-right.raw"),
+        trace_file  = arg_filen(nullptr, "trace", "<file>",        0, 1, "save a Chrome trace (JSON) and print a summary of the steps"),
+        metrics_file = arg_filen(nullptr, "metrics", "<file>",     0, 1, "save time, resources and statistics of the run (JSON)"),
+        left_image  = arg_filen(nullptr, nullptr, "<left raw>",    1, 1, "left raw image"),
+        right_image = arg_filen(nullptr, nullptr, "<right raw>",   1, 1, "right raw image"),
+        end_args    = arg_end(20),
+    };
+
+    // default values (they weren't set if there is a value given)
+    psf_width->ival[0] = 35;
+    mythreads->ival[0] = 1;
+    max_toplevel_nodes->ival[0] = 3;
+    max_disparity->ival[0] = 160;
+    d_layers->ival[0] = 12;
+    memory_budget->ival[0] = 0;
+    tile_size->ival[0] = tiles.tileSize;
+    overview_size->ival[0] = tiles.overviewSize;
+    reference_size->ival[0] = tiles.referenceSize;
+    out_left->filename[0] = "deblur-left.raw";
+    out_right->filename[0] = "deblur-right.raw";
+
+    // parsing arguments
+    int nerrors = arg_parse(argc,argv,argtable);
+
+    // special case: '--help' takes precedence over error reporting
+    if (help->count > 0)
+    {
+        cout << "Usage: " << argv[0];
+        arg_print_syntax(stdout, argtable, "\n");
+        cout << "Tiled Depth-Aware Motion Deblurring of raw images." << endl << endl;
+        arg_print_glossary(stdout, argtable, "  %-25s %s\n");
+
+        // deallocate each non-null entry in argtable[]
+        arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+        exitcode = 0;
+        return false;
+    }
+
+    // If the parser returned any errors then display them and exit
+    if (nerrors > 0)
+    {
+        arg_print_errors(stdout, end_args, argv[0]);
+        cout << "Try '" << argv[0] << "--help' for more information." << endl;
+
+        // deallocate each non-null entry in argtable[]
+        arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+        exitcode = 1;
+        return false;
+    }
+
+    if (fft->count > 0) {
+        options.deconvAlgo = deblur::DepthDeblur::FFT;
+    }
+
+    if (irls->count > 0) {
+        options.deconvAlgo = deblur::DepthDeblur::IRLS;
+    }
+
+    // saving arguments in variables
+    left = left_image->filename[0];
+    right = right_image->filename[0];
+    outLeft = out_left->filename[0];
+    outRight = out_right->filename[0];
+    options.psfWidth = psf_width->ival[0];
+    options.threads = mythreads->ival[0];
+    options.maxDisparity = max_disparity->ival[0];
+    options.maxTopLevelNodes = max_toplevel_nodes->ival[0];
+    options.layers = d_layers->ival[0];
+    options.memoryBudget = size_t(memory_budget->ival[0]) << 20;
+    tiles.tileSize = tile_size->ival[0];
+    tiles.overviewSize = overview_size->ival[0];
+    tiles.referenceSize = reference_size->ival[0];
+    traceFile = (trace_file->count > 0) ? trace_file->filename[0] : "";
+    metricsFile = (metrics_file->count > 0) ? metrics_file->filename[0] : "";
+
+    // deallocate each non-null entry in argtable[]
+    arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+
+    return true;
+}
+
+
+int main(int argc, char** argv) {
+    string imageLeft;
+    string imageRight;
+    string resultLeft;
+    string resultRight;
+    deblur::deblurOptions options;
+    deblur::tileOptions tiles;
+    string traceFile;
+    string metricsFile;
+
+    // parse command line arguments
+    int exitcode = 0;
+    bool success = parse_commandline_args(argc, argv, imageLeft, imageRight, resultLeft, resultRight,
+                                          options, tiles, traceFile, metricsFile, exitcode);
+
+    if (success == false) {
+        return exitcode;
+    }
+
+    // run algorithm
+    cout << "Start Tiled Depth-Aware Motion Deblurring with" << endl;
+    cout << "   image left:          " << imageLeft << endl;
+    cout << "   image right:         " << imageRight << endl;
+    cout << "   max disparity:       " << options.maxDisparity << endl;
+    cout << "   approx. PSF width:   " << options.psfWidth << endl;
+    cout << "   layers/regions:      " << options.layers << endl;
+    cout << "   max top level nodes: " << options.maxTopLevelNodes << endl;
+    cout << "   deconvolution algo:  " << ((options.deconvAlgo == deblur::DepthDeblur::FFT) ? "FFT" : "IRLS") << endl;
+    cout << "   threads:             " << options.threads << endl;
+    cout << "   tile size:           " << tiles.tileSize << endl;
+
+    if (options.memoryBudget > 0) {
+        cout << "   memory budget:       " << (options.memoryBudget >> 20) << " MB" << endl;
+    }
+    cout << endl;
+
+    if (!traceFile.empty()) {
+        deblur::trace::enable();
+    }
+
+    try {
+        deblur::RunMetrics metrics = deblur::runTiledDepthDeblur(imageLeft, imageRight, resultLeft, resultRight,
+                                                                 options, tiles);
+
+        if (!metricsFile.empty()) {
+            metrics.saveJSON(metricsFile);
+        }
+
+        if (!traceFile.empty()) {
+            deblur::trace::enable(false);
+            deblur::trace::writeChromeTrace(traceFile);
+
+            cout << endl;
+            deblur::trace::printSummary(cout);
+        }
+    }
+    catch(const exception& e) {
+        cerr << "ERROR: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return 0;
+}
@@ -0,0 +1,196 @@
+#include <iostream>                     // cout, cerr, endl
+#include <stdexcept>                    // throw exception
+#include <algorithm>                    // min, max
+#include <cmath>                        // ceil
+#include <opencv2/imgproc/imgproc.hpp>  // resize
+
+#include "depth_deblur.hpp"
+#include "mapped_image.hpp"
+#include "mat_pool.hpp"                 // ScopedMatPool
+#include "trace.hpp"                    // TRACE_SCOPE
+
+#include "tiled_deblur.hpp"
+
+
+using namespace std;
+using namespace cv;
+
+
+namespace deblur {
+
+    Size tileOverlap(const int psfWidth, const int maxDisparity) {
+        // the deconvolution of a pixel depends on a neighborhood of the PSF size,
+        // twice the PSF width keeps the ringing of the tile border out of the core.
+        // Horizontally the matching pixel of the other view has to be inside the tile too.
+        return Size(2 * psfWidth + maxDisparity, 2 * psfWidth);
+    }
+
+
+    /**
+     * Finds the disparity layers on a down sampled version of the whole image.
+     * The centers are returned for the disparity maps of the full resolution
+     * (which are down sampled by the disparity estimation too).
+     */
+    static vector<float> overviewDisparityLayers(const Mat& left, const Mat& right,
+                                                 const deblurOptions& options, const int overviewSize) {
+        TRACE_SCOPE("overview disparity");
+
+        const double scale = std::min(1.0, double(overviewSize) / std::max(left.rows, left.cols));
+
+        // reads each page of the mapped images once
+        array<Mat, 2> overview;
+        resize(left, overview[LEFT], Size(), scale, scale, INTER_AREA);
+        resize(right, overview[RIGHT], Size(), scale, scale, INTER_AREA);
+
+        DepthDeblur depthDeblur(overview[LEFT], overview[RIGHT], options.psfWidth, options.layers,
+                                options.deconvAlgo);
+        depthDeblur.disparityEstimation(overview, MATCH, std::max(4, int(ceil(options.maxDisparity * scale))),
+                                        vector<float>(), options.threads);
+
+        // disparities grow with the resolution
+        vector<float> centers = depthDeblur.getDisparityCenters();
+
+        for (auto& center : centers) {
+            center /= scale;
+        }
+
+        return centers;
+    }
+
+
+    RunMetrics runTiledDepthDeblur(const string& filenameLeft, const string& filenameRight,
+                                   const string& filenameResultLeft, const string& filenameResultRight,
+                                   const deblurOptions& options, const tileOptions& tiles) {
+        TRACE_SCOPE("runTiledDepthDeblur");
+
+        MappedImage inputLeft(filenameLeft);
+        MappedImage inputRight(filenameRight);
+
+        const Mat& left = inputLeft.image();
+        const Mat& right = inputRight.image();
+
+        if (left.size() != right.size() || left.type() != right.type()) {
+            throw runtime_error("Images aren't of same size!");
+        }
+
+        // approximate PSF width has to be greater than 0
+        if (options.psfWidth < 1) {
+            throw runtime_error("PSF width has to be greater zero!");
+        }
+
+        if (tiles.tileSize < 1 || tiles.overviewSize < 1 || tiles.referenceSize < 1) {
+            throw runtime_error("Tile sizes have to be greater zero!");
+        }
+
+        const int threads = options.threads;
+
+        MemoryBudget localBudget(options.memoryBudget);
+        MemoryBudget* budget = (options.sharedMemoryBudget != nullptr) ? options.sharedMemoryBudget : &localBudget;
+
+        ScopedMatPool pool(options.pooledAllocator);
+
+        RunMetrics metrics;
+        metrics.width = left.cols;
+        metrics.height = left.rows;
+        metrics.threads = threads;
+        metrics.psfWidth = options.psfWidth;
+        metrics.layers = options.layers;
+        metrics.passes = 1;
+
+        StageClock clock(metrics);
+
+
+        cout << " Step 1: disparity layers of the overview" << endl;
+        vector<float> centers = overviewDisparityLayers(left, right, options, tiles.overviewSize);
+        clock.tick("overview-disparity");
+
+
+        cout << " Step 2: PSF estimation on the reference crop" << endl;
+        vector<Mat> psfs;
+
+        {
+            TRACE_SCOPE("reference PSF estimation");
+
+            // crop in the middle of the image
+            Size size(std::min(tiles.referenceSize, left.cols), std::min(tiles.referenceSize, left.rows));
+            Rect crop((left.cols - size.width) / 2, (left.rows - size.height) / 2, size.width, size.height);
+
+            array<Mat, 2> reference = {left(crop).clone(), right(crop).clone()};
+
+            DepthDeblur depthDeblur(reference[LEFT], reference[RIGHT], options.psfWidth, options.layers,
+                                    options.deconvAlgo);
+            depthDeblur.setMemoryBudget(budget);
+            depthDeblur.disparityEstimation(reference, MATCH, options.maxDisparity, centers, threads);
+            depthDeblur.regionTreeReconstruction(options.maxTopLevelNodes);
+            depthDeblur.toplevelKernelEstimation(options.toplevelKernels);
+            depthDeblur.midLevelKernelEstimation(threads);
+
+            psfs = depthDeblur.getLeafPSFs();
+            depthDeblur.collectMetrics(metrics, 1);
+        }
+
+        clock.tick("reference-psf");
+
+
+        cout << " Step 3: deconvolution of the tiles" << endl;
+        MappedImage resultLeft(filenameResultLeft, left.rows, left.cols, CV_8U);
+        MappedImage resultRight(filenameResultRight, left.rows, left.cols, CV_8U);
+
+        const Size overlap = tileOverlap(options.psfWidth, options.maxDisparity);
+        const Rect image(0, 0, left.cols, left.rows);
+
+        for (int y = 0; y < left.rows; y += tiles.tileSize) {
+            for (int x = 0; x < left.cols; x += tiles.tileSize) {
+                TRACE_SCOPE_ID("tile", metrics.tiles);
+
+                // core of the tile that is written to the result
+                Rect core(x, y, std::min(tiles.tileSize, left.cols - x), std::min(tiles.tileSize, left.rows - y));
+
+                // processed part of the image with the overlap
+                Rect outer = Rect(core.x - overlap.width, core.y - overlap.height,
+                                  core.width + 2 * overlap.width, core.height + 2 * overlap.height) & image;
+
+                array<Mat, 2> tile = {left(outer).clone(), right(outer).clone()};
+
+                DepthDeblur depthDeblur(tile[LEFT], tile[RIGHT], options.psfWidth, options.layers,
+                                        options.deconvAlgo);
+                depthDeblur.setMemoryBudget(budget);
+
+                // same layers in all tiles
+                depthDeblur.disparityEstimation(tile, MATCH, options.maxDisparity, centers, threads);
+                clock.tick("tile-disparity");
+
+                depthDeblur.regionTreeReconstruction(options.maxTopLevelNodes);
+                depthDeblur.setLeafPSFs(psfs);
+                clock.tick("tile-region-tree");
+
+                Mat deconvLeft, deconvRight;
+                depthDeblur.deconvolve(deconvLeft, LEFT, threads);
+                depthDeblur.deconvolve(deconvRight, RIGHT, threads);
+
+                // keep only the core
+                Rect inner(core.x - outer.x, core.y - outer.y, core.width, core.height);
+                Mat coreLeft = resultLeft.image()(core);
+                Mat coreRight = resultRight.image()(core);
+                deconvLeft(inner).copyTo(coreLeft);
+                deconvRight(inner).copyTo(coreRight);
+                clock.tick("tile-deconvolution");
+
+                metrics.tiles++;
+                cout << "   tile " << metrics.tiles << " (" << core.x << ", " << core.y << ")" << endl;
+            }
+        }
+
+        resultLeft.flush();
+        resultRight.flush();
+
+        clock.finish();
+        metrics.memoryBudgetBytes = budget->budget();
+        metrics.peakConcurrentSolves = budget->peakTasks();
+        metrics.throttledSolves = budget->throttledTasks();
+
+        cout << "finished Algorithm" << endl;
+
+        return metrics;
+    }
+}
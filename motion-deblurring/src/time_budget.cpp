@@ -0,0 +1,131 @@
+#include <algorithm>    // min, max
+
+#include "depth_aware_deblurring.hpp"   // deblurOptions
+#include "time_budget.hpp"
+
+
+using namespace std;
+using namespace cv;
+
+
+namespace deblur {
+
+    /**
+     * ns per pixel of one conjugate gradient iteration of the IRLS deconvolution
+     * (the convolutions with the PSF dominate)
+     */
+    static double irlsNs(const int psfWidth) {
+        return 40 + 0.05 * psfWidth * psfWidth;
+    }
+
+    /**
+     * ns per pixel of the other steps
+     */
+    static const double fftNs = 150;            // FFT deconvolution
+    static const double matchNs = 100;          // graph-cut matching per label (down sampled views)
+    static const double salientEdgesNs = 300;   // shock filter and salient edge map
+    static const double jointPSFNs = 400;       // joint PSF estimation in the Fourier domain
+    static const double selectionFilterNs = 300; // smoothing, shock filter and gradient correlation
+
+    /**
+     * average number of candidates of the PSF selection (own, parent and a reliable sibling)
+     */
+    static const double candidates = 2.5;
+
+
+    stageCosts estimateStageCosts(const Size& size, const int threads, const int psfWidth,
+                                  const int maxDisparity, const qualityKnobs& knobs) {
+        const double pixels = size.area();
+        const double ms = 1e-6;
+
+        stageCosts costs;
+
+        // KZ2 on the down sampled views with about three expansion cycles
+        // (the post-processing runs in parallel)
+        costs.disparityMs = 3 * matchNs * (pixels / 4) * std::max(1, maxDisparity / 2) * ms;
+
+        // deconvolution of one view used by the PSF estimation and selection
+        const double deconvolutionNs = (knobs.psfSolver == DepthDeblur::IRLS) ? 20 * irlsNs(psfWidth) : fftNs;
+
+        // every merge of two nodes adds one node, so a forest of the layers with
+        // t top-level nodes has 2 * (layers - t) mid-level and leaf nodes
+        const int topLevel = std::min(knobs.maxTopLevelNodes, knobs.layers);
+        const int children = knobs.midLevelPSFs ? 2 * (knobs.layers - topLevel) : 0;
+
+        const double estimationNs = 2 * (deconvolutionNs + salientEdgesNs) + jointPSFNs;
+        const double selectionNs = candidates * (deconvolutionNs + selectionFilterNs);
+        const int psfThreads = std::max(1, std::min(threads, children));
+
+        costs.psfMs = children * (estimationNs + selectionNs) * pixels * ms / psfThreads;
+
+        // each leaf region of both views is deconvolved on the whole image
+        const int regionThreads = std::max(1, std::min(threads, knobs.layers));
+        costs.deconvolutionMs = 2 * knobs.layers * knobs.irlsIterations * irlsNs(psfWidth) * pixels * ms
+                                / regionThreads;
+
+        return costs;
+    }
+
+
+    budgetPlan planTimeBudget(const Size& size, const deblurOptions& options, const int toplevelKernels) {
+        budgetPlan plan;
+        plan.knobs.layers = options.layers;
+        plan.knobs.maxTopLevelNodes = options.maxTopLevelNodes;
+        plan.knobs.psfSolver = options.deconvAlgo;
+
+        qualityKnobs& knobs = plan.knobs;
+
+        auto fits = [&]() {
+            plan.costs = estimateStageCosts(size, options.threads, options.psfWidth, options.maxDisparity, knobs);
+            return options.timeBudgetMs <= 0 || plan.costs.totalMs() <= options.timeBudgetMs;
+        };
+
+        auto lowered = [&](const string& knob, const string& from, const string& to) {
+            plan.lowered.push_back(knob + " " + from + " -> " + to);
+        };
+
+        // 1. fewer iterations of the final deconvolution
+        if (!fits() && knobs.irlsIterations > 10) {
+            lowered("irls-iterations", to_string(knobs.irlsIterations), "10");
+            knobs.irlsIterations = 10;
+        }
+
+        // 2. fast solver for the PSF estimation and selection
+        if (!fits() && knobs.psfSolver == DepthDeblur::IRLS) {
+            lowered("psf-solver", "IRLS", "FFT");
+            knobs.psfSolver = DepthDeblur::FFT;
+        }
+
+        // 3. shallower trees (each top-level node needs a kernel)
+        const int maxTopLevel = std::min(knobs.layers, toplevelKernels);
+
+        if (!fits() && knobs.maxTopLevelNodes < maxTopLevel) {
+            lowered("max-top-nodes", to_string(knobs.maxTopLevelNodes), to_string(maxTopLevel));
+            knobs.maxTopLevelNodes = maxTopLevel;
+        }
+
+        // 4. fewer layers (an even number is needed)
+        while (!fits() && knobs.layers > 2) {
+            const int layers = std::max(2, (knobs.layers / 2) & ~1);
+            lowered("layers", to_string(knobs.layers), to_string(layers));
+            knobs.layers = layers;
+        }
+
+        // 5. no mid-level PSF estimation
+        if (!fits() && knobs.midLevelPSFs) {
+            lowered("mid-level-psfs", "on", "off");
+            knobs.midLevelPSFs = false;
+        }
+
+        // 6. even fewer iterations
+        if (!fits() && knobs.irlsIterations > 5) {
+            lowered("irls-iterations", to_string(knobs.irlsIterations), "5");
+            knobs.irlsIterations = 5;
+        }
+
+        // prediction with the final knobs
+        fits();
+
+        return plan;
+    }
+}
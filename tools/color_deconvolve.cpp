@@ -0,0 +1,101 @@
+/***********************************************************************
+ * Author:       Franziska Krüger
+ *
+ * Description:
+ * ------------
+ * Deconvolves a color image with a kernel once per channel with IRLS and
+ * once just its luminance with the chroma transfer of transferChroma.
+ * Prints the times and the quality (PSNR, SSIM) of the luminance result
+ * compared to the per-channel result.
+ *
+ ************************************************************************
+*/
+
+#include <iostream>                     // cout, cerr, endl
+#include <stdexcept>                    // throw exception
+#include <chrono>
+
+#include <opencv2/highgui/highgui.hpp>  // imread, imshow, imwrite
+#include <opencv2/imgproc/imgproc.hpp>  // convert
+
+#include "deconvolution.hpp"
+#include "psf_bank.hpp"
+#include "utils.hpp"
+
+using namespace std;
+using namespace cv;
+
+
+/**
+ * Milliseconds since the given time point
+ */
+static double elapsedMs(const chrono::steady_clock::time_point start) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+
+/**
+ * Converts a deconvolved float image to uchar like matlab imshow([deconv])
+ */
+static void toUchar(Mat& image) {
+    threshold(image, image, 0.0, -1, THRESH_TOZERO);
+    threshold(image, image, 1.0, -1, THRESH_TRUNC);
+    image.convertTo(image, CV_8U, 255);
+}
+
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        cerr << "usage: color-deconv <image> <kernel> [<radius>]" << endl;
+        return 1;
+    }
+
+    string image = argv[1];
+    string kernelName = argv[2];
+
+    Mat src = imread(image, 1);
+
+    if (!src.data) {
+        throw runtime_error("Can not load images!");
+    }
+
+    // kernel image or PSF of a bank (e.g. kernels.psfb:2), energy preserving
+    Mat kernel = deblur::loadKernel(kernelName);
+
+    // the windows of the chroma models should cover the blur
+    const int radius = (argc > 3) ? stoi(argv[3]) : kernel.cols / 2;
+
+    Mat mask = Mat::ones(src.size(), CV_8U);
+
+    // each channel with IRLS
+    auto start = chrono::steady_clock::now();
+
+    Mat color, perChannel;
+    src.convertTo(color, CV_32FC3, 1 / 255.0);
+    deblur::deconvolveIRLS(color, perChannel, kernel, mask);
+    toUchar(perChannel);
+
+    const double perChannelMs = elapsedMs(start);
+
+    // just the luminance with IRLS and the chroma of the blurred image
+    start = chrono::steady_clock::now();
+
+    Mat gray, luminance, restored;
+    cvtColor(src, gray, CV_BGR2GRAY);
+    gray.convertTo(gray, CV_32F, 1 / 255.0);
+    deblur::deconvolveIRLS(gray, luminance, kernel, mask);
+    toUchar(luminance);
+    deblur::transferChroma(src, luminance, restored, radius);
+
+    const double luminanceMs = elapsedMs(start);
+
+    imwrite("deconv-per-channel.png", perChannel);
+    imwrite("deconv-luminance.png", restored);
+
+    cout << "per channel: " << perChannelMs << " ms" << endl;
+    cout << "luminance:   " << luminanceMs << " ms (" << perChannelMs / luminanceMs << "x faster)" << endl;
+    cout << "PSNR:        " << PSNR(restored, perChannel) << " dB" << endl;
+    cout << "SSIM:        " << deblur::structuralSimilarity(restored, perChannel) << endl;
+
+    return 0;
+}
@@ -0,0 +1,75 @@
+/***********************************************************************
+ * Author:       Franziska Krüger
+ *
+ * Description:
+ * ------------
+ * Sends one request to a running deblur-daemon over its Unix socket
+ * and prints the reply.
+ *
+ ************************************************************************
+*/
+
+#include <iostream>                     // cout, cerr, endl
+#include <string>
+#include <cstring>                      // strncpy, strerror
+#include <cerrno>
+
+#include <unistd.h>                     // read, write, close
+#include <sys/socket.h>
+#include <sys/un.h>                     // Unix domain sockets
+
+using namespace std;
+
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        cerr << "usage: deblur-client <socket> <request>" << endl;
+        cerr << "   e.g. deblur-client deblur.sock left=l.png right=r.png out-left=a.png out-right=b.png" << endl;
+        return 1;
+    }
+
+    string socketPath = argv[1];
+
+    // the request may be given as several arguments, each one is a field
+    // (joined by tabs, so quoted paths with spaces stay together)
+    string request = argv[2];
+
+    for (int i = 3; i < argc; i++) {
+        request += "\t" + string(argv[i]);
+    }
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (server < 0 || connect(server, (sockaddr*)&address, sizeof(address)) != 0) {
+        cerr << "Can not connect to " << socketPath << ": " << strerror(errno) << endl;
+        return 1;
+    }
+
+    request += "\n";
+
+    if (write(server, request.c_str(), request.size()) != (ssize_t)request.size()) {
+        cerr << "Can not send request: " << strerror(errno) << endl;
+        close(server);
+        return 1;
+    }
+
+    // the daemon closes the connection after the reply
+    string reply;
+    char buffer[256];
+    ssize_t n;
+
+    while ((n = read(server, buffer, sizeof(buffer))) > 0) {
+        reply.append(buffer, n);
+    }
+
+    close(server);
+
+    cout << reply;
+
+    return (reply.compare(0, 2, "ok") == 0) ? 0 : 1;
+}
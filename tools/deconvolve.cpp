@@ -16,6 +16,7 @@
 #include <opencv2/imgproc/imgproc.hpp>  // convert
 
 #include "deconvolution.hpp"
+#include "psf_bank.hpp"
 
 using namespace std;
 using namespace cv;
@@ -36,14 +37,12 @@ int main(int argc, char** argv) {
     src.convertTo(src, CV_32F);
     src /= 255;
 
-    kernel = imread(kernelName, CV_LOAD_IMAGE_GRAYSCALE);
-
-    if (!src.data || !kernel.data) {
+    if (!src.data) {
         throw runtime_error("Can not load images!");
     }
 
-    kernel.convertTo(kernel, CV_32F);
-    kernel /= sum(kernel)[0];  // kernel is not energy preserving
+    // kernel image or PSF of a bank (e.g. kernels.psfb:2), energy preserving
+    kernel = deblur::loadKernel(kernelName);
 
     // load mask
     if (argc > 3) {
@@ -0,0 +1,81 @@
+/***********************************************************************
+ * Author:       Franziska Krüger
+ *
+ * Description:
+ * ------------
+ * Lists, exports and imports the PSFs of a binary PSF bank (.psfb).
+ *
+ *   list   prints node, parent, pass, size, entropy and label of each PSF
+ *   export saves each PSF as viewable image <dir>/psf-<i>.png
+ *   import appends kernel images (e.g. the top-level kernels) to a bank
+ * 
+ ************************************************************************
+*/
+
+#include <iostream>                     // cout, cerr, endl
+#include <string>
+#include <stdexcept>                    // throw exception
+
+#include <opencv2/highgui/highgui.hpp>  // imwrite
+
+#include "psf_bank.hpp"
+#include "utils.hpp"                    // convertFloatToUchar
+
+using namespace std;
+using namespace cv;
+
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        cerr << "usage: psf-bank list <bank>" << endl;
+        cerr << "       psf-bank export <bank> <dir>" << endl;
+        cerr << "       psf-bank import <bank> <kernel image> [<kernel image> ...]" << endl;
+        return 1;
+    }
+
+    string command = argv[1];
+    string filename = argv[2];
+
+    try {
+        if (command == "list") {
+            deblur::PSFBank bank(filename);
+
+            for (int i = 0; i < bank.size(); i++) {
+                const deblur::psfRecordHeader& record = bank.record(i);
+
+                cout << i << ": node " << record.id << " parent " << record.parent
+                     << " pass " << record.pass << " " << record.cols << "x" << record.rows
+                     << " entropy " << record.entropy << " " << record.label << endl;
+            }
+        } else if (command == "export" && argc > 3) {
+            deblur::PSFBank bank(filename);
+
+            for (int i = 0; i < bank.size(); i++) {
+                // scale the small values for viewing
+                Mat tmp = bank.psf(i) * 1000;
+                deblur::convertFloatToUchar(tmp, tmp);
+                imwrite(string(argv[3]) + "/psf-" + to_string(i) + ".png", tmp);
+            }
+        } else if (command == "import" && argc > 3) {
+            vector<deblur::psfEntry> psfs;
+
+            for (int i = 3; i < argc; i++) {
+                deblur::psfEntry entry;
+                entry.label = argv[i];
+                entry.psf = deblur::loadKernel(argv[i]);
+                psfs.push_back(entry);
+            }
+
+            deblur::appendPSFBank(filename, psfs);
+        } else {
+            cerr << "unknown command " << command << endl;
+            return 1;
+        }
+    }
+    catch(const exception& e) {
+        cerr << "ERROR: " << e.what() << endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -17,6 +17,7 @@
 #include "depth_deblur.hpp"
 #include "deconvolution.hpp"
 #include "utils.hpp"
+#include "psf_bank.hpp"
 
 using namespace std;
 using namespace cv;
@@ -67,7 +68,7 @@ int main(int argc, char** argv) {
     const int maxTopLevelNodes = 3;
     const int maxDisparity = 80;
 
-    Mat src, psf1, psf2, psf3;
+    Mat src;
 
     if (argc < 5) {
         cerr << "usage: psf-selection <image> <psf1> <psf2> <psf3> [<mask>]" << endl;
@@ -81,14 +82,16 @@ int main(int argc, char** argv) {
 
     // load images
     src = imread(imageName, CV_LOAD_IMAGE_GRAYSCALE);
-    psf1 = imread(psfName1, CV_LOAD_IMAGE_GRAYSCALE);
-    psf2 = imread(psfName2, CV_LOAD_IMAGE_GRAYSCALE);
-    psf3 = imread(psfName3, CV_LOAD_IMAGE_GRAYSCALE);
 
-    if (!src.data || !psf1.data || !psf2.data || !psf3.data) {
+    if (!src.data) {
         throw runtime_error("Can not load images!");
     }
 
+    // energy preserving kernels (images or PSFs of a bank, e.g. kernels.psfb:2)
+    Mat psf1 = loadKernel(psfName1);
+    Mat psf2 = loadKernel(psfName2);
+    Mat psf3 = loadKernel(psfName3);
+
     // load mask
     Mat mask;
     if (argc > 5) {
@@ -99,14 +102,6 @@ int main(int argc, char** argv) {
         mask = Mat::ones(src.size(), CV_8U);
     }
 
-    // energy preserving kernels
-    psf1.convertTo(psf1, CV_32F);
-    psf1 /= sum(psf1)[0];
-    psf2.convertTo(psf2, CV_32F);
-    psf2 /= sum(psf2)[0];
-    psf3.convertTo(psf3, CV_32F);
-    psf3 /= sum(psf3)[0];
-
     // psf selection with given candidates
     vector<Mat> candidates;
     candidates.push_back(psf1);
@@ -0,0 +1,61 @@
+/***********************************************************************
+ * Author:       Franziska Krüger
+ *
+ * Description:
+ * ------------
+ * Converts an image to a raw image (input of deblur-tiled) and back.
+ * The direction is given by the file extension ".raw".
+ *
+ ************************************************************************
+*/
+
+#include <iostream>                     // cout, cerr, endl
+#include <string>
+#include <stdexcept>                    // throw exception
+
+#include <opencv2/highgui/highgui.hpp>  // imread, imwrite
+
+#include "mapped_image.hpp"
+
+using namespace std;
+using namespace cv;
+
+
+/**
+ * Checks if the filename ends with ".raw"
+ */
+static bool isRaw(const string& filename) {
+    const string extension = ".raw";
+
+    return filename.size() >= extension.size()
+           && filename.compare(filename.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        cerr << "usage: raw-image <input> <output>" << endl;
+        return 1;
+    }
+
+    try {
+        if (isRaw(argv[1])) {
+            deblur::MappedImage input(argv[1]);
+            imwrite(argv[2], input.image());
+        } else {
+            Mat image = imread(argv[1], CV_LOAD_IMAGE_UNCHANGED);
+
+            if (!image.data) {
+                throw runtime_error("Can not load image!");
+            }
+
+            deblur::saveRawImage(argv[2], image);
+        }
+    }
+    catch(const exception& e) {
+        cerr << "ERROR: " << e.what() << endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -1,6 +1,7 @@
 #include <cmath>
 
 #include "utils.hpp"
+#include "trace.hpp"
 
 #include "deconvolution.hpp"
 
@@ -13,6 +14,7 @@ namespace deblur {
 
     void deconvolveFFT(const Mat& src, Mat& dst, const Mat& kernel, const cv::Mat& regionMask,
                        const float weight) {
+        TRACE_SCOPE("deconvolveFFT");
 
         assert(src.type() == CV_32F && "works on floating point images [0,1]");
         assert(kernel.type() == CV_32F && "works with float kernel");
@@ -229,9 +231,12 @@ namespace deblur {
      * @param df       filter of first and second order derivations
      * @param maxIt    number of iterations
      * @param weights  weights of first and second order derivatives
+     * @param stats    if not null iterations are added and the residual is saved
      */
     void deconvL2w(const Mat& src, Mat& dst, Mat& kernel, Mat& mask, const weights& weights,
-                   const derivationFilter& df, const float we = 0.001, const int maxIt = 200) {
+                   const derivationFilter& df, const float we = 0.001, const int maxIt = 200,
+                   irlsStatistics* stats = nullptr) {
+        TRACE_SCOPE("IRLS CG");
 
         // half filter size
         int hfsX = kernel.cols / 2;
@@ -289,6 +294,13 @@ namespace deblur {
             rhoPrev = rho;
         }
 
+        if (stats != nullptr) {
+            stats->iterations += maxIt;
+            // a black or fully masked region has nothing to solve
+            const double norm = b.dot(b);
+            stats->residual = (norm > 0) ? sqrt(r.dot(r) / norm) : 0;
+        }
+
         x.copyTo(dst);
     }
 
@@ -325,9 +337,10 @@ namespace deblur {
      * @param kernel energy preserving kernel
      * @param we     weight
      * @param maxIt  number of iterations
+     * @param stats  convergence statistics (may be null)
      */
     void deconvolveChannelIRLS(const Mat& src, Mat& dst, const Mat& kernel, const Mat& regionMask,
-                               const float we, const int maxIt) {
+                               const float we, const int maxIt, irlsStatistics* stats) {
         assert(src.type() == CV_32F && "works on floating point images [0,1]");
 
         // half filter size
@@ -383,7 +396,7 @@ namespace deblur {
 
         // first deconvolution of the src image
         Mat x;
-        deconvL2w(src, x, fkernel, mask, weights, df, we, maxIt);
+        deconvL2w(src, x, fkernel, mask, weights, df, we, maxIt, stats);
 
         for (int i = 0; i < 2; i++) {
             // compute first and second order gradients
@@ -400,7 +413,7 @@ namespace deblur {
             updateWeight(weights.yy, dyy, boundaries, 0.25);
             updateWeight(weights.xy, dxy, boundaries, 0.25);
 
-            deconvL2w(src, x, fkernel, mask, weights, df, we, maxIt);
+            deconvL2w(src, x, fkernel, mask, weights, df, we, maxIt, stats);
         }
 
         // crop result
@@ -415,7 +428,9 @@ namespace deblur {
 
 
     void deconvolveIRLS(const Mat& src, Mat& dst, const Mat& kernel, const Mat& regionMask,
-                        const float we, const int maxIt) {
+                        const float we, const int maxIt, irlsStatistics* stats) {
+        TRACE_SCOPE("deconvolveIRLS");
+
         assert(kernel.type() == CV_32F && "works with energy preserving kernel");
         assert((src.type() == CV_32FC3 || src.type() == CV_32F) && "works with energy preserving kernel");
 
@@ -431,14 +446,14 @@ namespace deblur {
 
             for (int i = 0; i < channels.size(); i++) {
                 deconvolveChannelIRLS(channels[i], tmp[i], kernel, regionMask,
-                                      we, maxIt);
+                                      we, maxIt, stats);
             }
 
             merge(tmp, dst);
 
         } else if (src.channels() == 1) {
             // deconvolve gray value image
-            deconvolveChannelIRLS(src, dst, kernel, regionMask, we, maxIt);
+            deconvolveChannelIRLS(src, dst, kernel, regionMask, we, maxIt, stats);
 
         } else {
             throw runtime_error("Cannot convolve this image type");
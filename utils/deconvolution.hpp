@@ -51,6 +51,14 @@ namespace deblur {
         cv::Mat xy;
     };
 
+    /**
+     * convergence of the IRLS deconvolution
+     */
+    struct irlsStatistics {
+        int iterations = 0;     // conjugate gradient iterations of all solves
+        float residual = 0;     // relative residual ||b - Ax|| / ||b|| of the last solve
+    };
+
     /**
      * Non-blind deconvolution in Fourier Domain using a 
      * gaussian prior (which leads to convex optimization problem
@@ -76,9 +84,10 @@ namespace deblur {
      * @param regionMask mask of region
      * @param we         weight
      * @param maxIt      number of iterations (levin uses 200)
+     * @param stats      if not null the number of iterations and the residual are saved
      */
     void deconvolveIRLS(const cv::Mat& src, cv::Mat& dst, const cv::Mat& kernel, const cv::Mat& regionMask = cv::Mat(),
-                        const float we = 0.001, const int maxIt = 20);
+                        const float we = 0.001, const int maxIt = 20, irlsStatistics* stats = nullptr);
 
 }
 
@@ -0,0 +1,324 @@
+#include "mat_pool.hpp"
+
+
+using namespace std;
+using namespace cv;
+
+
+namespace deblur {
+
+    /**
+     * Capacity of a size class (inverse of PoolAllocator::sizeClass)
+     */
+    static size_t classCapacity(const int c) {
+        if (c == 0) {
+            return 256;
+        }
+
+        const size_t base = size_t(1) << ((c - 1) / 4 + 8);
+        return base + ((c - 1) % 4 + 1) * (base / 4);
+    }
+
+
+    /**
+     * Free buffers of one thread. Only the owning thread uses it, so
+     * it needs no lock.
+     */
+    struct threadCache {
+        vector<vector<void*>> buffers = vector<vector<void*>>(PoolAllocator::classes);
+        long long bytes = 0;
+        int generation = 0;         // trim of the pool which the cache has seen
+
+        void clear() {
+            for (auto& sizeClass : buffers) {
+                for (void* buffer : sizeClass) {
+                    fastFree(buffer);
+                }
+
+                sizeClass.clear();
+            }
+
+            bytes = 0;
+        }
+
+        ~threadCache() {
+            // put the buffers back into the shared pool
+            // (this works because the pool is never destroyed)
+            for (int c = 0; c < PoolAllocator::classes; c++) {
+                for (void* buffer : buffers[c]) {
+                    PoolAllocator::instance().recycle(buffer, -c - 1, classCapacity(c));
+                }
+            }
+        }
+    };
+
+    static thread_local threadCache localCache;
+
+
+    PoolAllocator& PoolAllocator::instance() {
+        // never destroyed because thread caches may be released after
+        // the static objects
+        static PoolAllocator* pool = new PoolAllocator();
+        return *pool;
+    }
+
+
+    void PoolAllocator::install() {
+        lock_guard<mutex> lock(m);
+
+        if (installations == 0) {
+            previous = Mat::getDefaultAllocator();
+            Mat::setDefaultAllocator(this);
+            active = true;
+        }
+
+        installations++;
+    }
+
+
+    void PoolAllocator::uninstall() {
+        {
+            lock_guard<mutex> lock(m);
+
+            if (installations == 0 || --installations > 0) {
+                return;
+            }
+
+            Mat::setDefaultAllocator(previous);
+            active = false;
+        }
+
+        // buffers still in use are freed on deallocation
+        trim();
+    }
+
+
+    allocationStatistics PoolAllocator::statistics() const {
+        allocationStatistics statistics;
+        statistics.allocations = allocations;
+        statistics.poolHits = poolHits;
+        statistics.bytes = bytes;
+        statistics.liveBytes = liveBytes;
+        statistics.peakBytes = peakBytes;
+
+        return statistics;
+    }
+
+
+    void PoolAllocator::resetPeak() {
+        peakBytes = liveBytes.load();
+    }
+
+
+    void PoolAllocator::trim() {
+        // the other threads clear their caches when they see the new generation
+        localCache.clear();
+        localCache.generation = ++generation;
+
+        lock_guard<mutex> lock(m);
+
+        for (auto& buffers : shared) {
+            for (void* buffer : buffers) {
+                fastFree(buffer);
+            }
+
+            buffers.clear();
+        }
+
+        sharedBytes = 0;
+    }
+
+
+    int PoolAllocator::sizeClass(const size_t bytes, size_t& capacity) {
+        // the smallest class holds everything up to 256 bytes
+        if (bytes <= 256) {
+            capacity = 256;
+            return 0;
+        }
+
+        // 2^k < bytes <= 2^(k+1) with four classes in between
+        int k = 0;
+        while ((size_t(2) << k) < bytes) {
+            k++;
+        }
+
+        const size_t base = size_t(1) << k;
+        const size_t quarter = base / 4;
+        const int sub = (bytes - base + quarter - 1) / quarter;
+
+        capacity = base + sub * quarter;
+
+        // very large buffers aren't pooled
+        if (capacity > (size_t)maxSharedBytes) {
+            return -1;
+        }
+
+        return (k - 8) * 4 + sub;
+    }
+
+
+    void* PoolAllocator::reuse(const int sizeClass, const size_t capacity) const {
+        dropStaleCache();
+
+        vector<void*>& local = localCache.buffers[sizeClass];
+
+        if (!local.empty()) {
+            void* buffer = local.back();
+            local.pop_back();
+            localCache.bytes -= capacity;
+            return buffer;
+        }
+
+        lock_guard<mutex> lock(m);
+
+        if (!shared[sizeClass].empty()) {
+            void* buffer = shared[sizeClass].back();
+            shared[sizeClass].pop_back();
+            sharedBytes -= capacity;
+            return buffer;
+        }
+
+        return nullptr;
+    }
+
+
+    void PoolAllocator::recycle(void* buffer, const int sizeClass, const size_t capacity) const {
+        // negative class: buffer of an exiting thread, skip its cache
+        const int c = (sizeClass < 0) ? -sizeClass - 1 : sizeClass;
+
+        if (!active) {
+            fastFree(buffer);
+            return;
+        }
+
+        if (sizeClass >= 0) {
+            dropStaleCache();
+        }
+
+        if (sizeClass >= 0 && localCache.bytes + (long long)capacity <= maxThreadCacheBytes) {
+            localCache.buffers[c].push_back(buffer);
+            localCache.bytes += capacity;
+            return;
+        }
+
+        {
+            lock_guard<mutex> lock(m);
+
+            if (sharedBytes + (long long)capacity <= maxSharedBytes) {
+                shared[c].push_back(buffer);
+                sharedBytes += capacity;
+                return;
+            }
+        }
+
+        fastFree(buffer);
+    }
+
+
+    void PoolAllocator::dropStaleCache() const {
+        const int current = generation;
+
+        if (localCache.generation != current) {
+            localCache.clear();
+            localCache.generation = current;
+        }
+    }
+
+
+    void PoolAllocator::countAllocation(const size_t requested, const size_t capacity, const bool hit) const {
+        allocations++;
+        bytes += requested;
+
+        if (hit) {
+            poolHits++;
+        }
+
+        // update high-water mark
+        long long live = (liveBytes += capacity);
+        long long peak = peakBytes;
+
+        while (live > peak && !peakBytes.compare_exchange_weak(peak, live)) {}
+    }
+
+
+    UMatData* PoolAllocator::allocate(int dims, const int* sizes, int type, void* data0, size_t* step,
+                                      int /*flags*/, UMatUsageFlags /*usageFlags*/) const {
+        // same layout as the standard allocator of OpenCV
+        size_t total = CV_ELEM_SIZE(type);
+
+        for (int i = dims - 1; i >= 0; i--) {
+            if (step) {
+                if (data0 && step[i] != Mat::AUTO_STEP) {
+                    CV_Assert(total <= step[i]);
+                    total = step[i];
+                } else {
+                    step[i] = total;
+                }
+            }
+
+            total *= sizes[i];
+        }
+
+        UMatData* u = new UMatData(this);
+        u->size = total;
+
+        if (data0) {
+            // memory of the user
+            u->data = u->origdata = (uchar*)data0;
+            u->flags |= UMatData::USER_ALLOCATED;
+            return u;
+        }
+
+        size_t capacity;
+        int c = sizeClass(total, capacity);
+        void* buffer = nullptr;
+
+        if (c >= 0) {
+            buffer = reuse(c, capacity);
+        } else {
+            capacity = total;
+        }
+
+        countAllocation(total, capacity, buffer != nullptr);
+
+        if (buffer == nullptr) {
+            buffer = fastMalloc(capacity);
+        }
+
+        u->data = u->origdata = (uchar*)buffer;
+
+        return u;
+    }
+
+
+    bool PoolAllocator::allocate(UMatData* u, int /*accessFlags*/, UMatUsageFlags /*usageFlags*/) const {
+        return u != nullptr;
+    }
+
+
+    void PoolAllocator::deallocate(UMatData* u) const {
+        if (!u) {
+            return;
+        }
+
+        CV_Assert(u->urefcount == 0);
+        CV_Assert(u->refcount == 0);
+
+        if (!(u->flags & UMatData::USER_ALLOCATED)) {
+            size_t capacity;
+            int c = sizeClass(u->size, capacity);
+
+            if (c >= 0) {
+                liveBytes -= capacity;
+                recycle(u->origdata, c, capacity);
+            } else {
+                liveBytes -= u->size;
+                fastFree(u->origdata);
+            }
+
+            u->origdata = 0;
+        }
+
+        delete u;
+    }
+}
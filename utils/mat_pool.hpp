@@ -0,0 +1,186 @@
+/***********************************************************************
+ * Author:       Franziska Krüger
+ * Requirements: OpenCV 3
+ *
+ * Description:
+ * ------------
+ * Pooling allocator for OpenCV matrices.
+ *
+ * The algorithm creates a lot of short-lived matrices of the same size
+ * (masks, padded copies, spectra, gradients). The pool keeps freed buffers
+ * in size classes (four per power of two) and hands them out again instead
+ * of asking the system for new memory. Each thread has a small cache which
+ * needs no lock, the rest is shared.
+ *
+ * The pool and its counters are process-wide and the pool is only used
+ * while it is installed:
+ *
+ *     {
+ *         ScopedMatPool pool;
+ *         ... all new cv::Mat buffers come from the pool ...
+ *     }
+ *
+ ***********************************************************************
+ */
+
+#ifndef MAT_POOL_H
+#define MAT_POOL_H
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+
+namespace deblur {
+
+    /**
+     * Counters of the pool allocator. They are process totals, so while
+     * several runs are installed at the same time (e.g. the workers of the
+     * daemon) they include the allocations of all of them.
+     */
+    struct allocationStatistics {
+        long allocations = 0;           // number of allocated buffers
+        long poolHits = 0;              // buffers reused from the pool
+        long long bytes = 0;            // requested bytes of all allocations
+        long long liveBytes = 0;        // bytes of the buffers in use
+        long long peakBytes = 0;        // high-water mark of the live bytes
+
+        double hitRate() const {
+            return (allocations > 0) ? double(poolHits) / allocations : 0;
+        }
+    };
+
+
+    struct threadCache;
+
+    class PoolAllocator : public cv::MatAllocator {
+
+      public:
+
+        /**
+         * The pool exists as long as the process because thread caches
+         * return their buffers when a thread exits.
+         */
+        static PoolAllocator& instance();
+
+        /**
+         * Sets the pool as default allocator of OpenCV. Calls can be nested
+         * (e.g. concurrent runs), the former allocator is restored by the
+         * last uninstall.
+         */
+        void install();
+
+        /**
+         * Restores the former default allocator if this is the last
+         * installation and releases all cached buffers.
+         */
+        void uninstall();
+
+        /**
+         * Current counters
+         */
+        allocationStatistics statistics() const;
+
+        /**
+         * Sets the high-water mark to the currently used bytes, so the
+         * peak of the next step can be measured. The mark is shared by
+         * all threads of the process.
+         */
+        void resetPeak();
+
+        /**
+         * Frees the buffers of the shared pool and of the cache of the
+         * calling thread. The caches of the other threads are freed on
+         * their next allocation or deallocation or when they exit.
+         */
+        void trim();
+
+        // interface of cv::MatAllocator
+        cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+                               int flags, cv::UMatUsageFlags usageFlags) const override;
+        bool allocate(cv::UMatData* data, int accessflags, cv::UMatUsageFlags usageFlags) const override;
+        void deallocate(cv::UMatData* data) const override;
+
+        /**
+         * Returns the size class of a buffer and the capacity of the class.
+         * Returns -1 if the buffer is too large for the pool.
+         */
+        static int sizeClass(const size_t bytes, size_t& capacity);
+
+        // number of size classes
+        static const int classes = 4 * 30 + 1;
+
+      private:
+
+        // returns its buffers to the shared pool when a thread exits
+        friend struct threadCache;
+
+        PoolAllocator() {}
+
+        /**
+         * Gets a buffer of the given class from the thread cache or the
+         * shared pool. Returns nullptr if there is none.
+         */
+        void* reuse(const int sizeClass, const size_t capacity) const;
+
+        /**
+         * Puts a free buffer back into the thread cache or the shared pool
+         * or frees it if the pool is full.
+         */
+        void recycle(void* buffer, const int sizeClass, const size_t capacity) const;
+
+        /**
+         * Frees the cache of the calling thread if the pool was trimmed
+         * since the thread used it last.
+         */
+        void dropStaleCache() const;
+
+        void countAllocation(const size_t bytes, const size_t capacity, const bool hit) const;
+
+        // the allocator methods are const, so everything they touch is mutable
+        mutable std::mutex m;
+        mutable std::vector<std::vector<void*>> shared = std::vector<std::vector<void*>>(classes);
+        mutable long long sharedBytes = 0;
+
+        int installations = 0;
+        cv::MatAllocator* previous = nullptr;
+        std::atomic<bool> active{false};
+
+        mutable std::atomic<long> allocations{0};
+        mutable std::atomic<long> poolHits{0};
+        mutable std::atomic<long long> bytes{0};
+        mutable std::atomic<long long> liveBytes{0};
+        mutable std::atomic<long long> peakBytes{0};
+
+        // incremented by trim, thread caches of an older generation are stale
+        mutable std::atomic<int> generation{0};
+
+        // limits of the cached memory
+        static const long long maxThreadCacheBytes = 64LL << 20;
+        static const long long maxSharedBytes = 1LL << 30;
+    };
+
+
+    /**
+     * Installs the pool allocator for the lifetime of the object.
+     */
+    class ScopedMatPool {
+
+      public:
+
+        ScopedMatPool(const bool enable = true) : enabled(enable) {
+            if (enabled) PoolAllocator::instance().install();
+        }
+
+        ~ScopedMatPool() {
+            if (enabled) PoolAllocator::instance().uninstall();
+        }
+
+      private:
+
+        const bool enabled;
+    };
+}
+
+#endif
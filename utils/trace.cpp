@@ -0,0 +1,245 @@
+#include <vector>
+#include <map>
+#include <memory>                       // unique_ptr
+#include <mutex>
+#include <chrono>
+#include <fstream>
+#include <iomanip>                      // setw
+#include <algorithm>                    // sort, min, max
+#include <stdexcept>                    // throw exception
+
+#include "trace.hpp"
+
+
+using namespace std;
+
+
+namespace deblur {
+
+    namespace trace {
+
+        /**
+         * One finished or open section
+         */
+        struct event {
+            const char* name;
+            int id;
+            int depth;
+            int64_t start;      // ns since the epoch
+            int64_t end;
+            int64_t children;   // time of nested sections
+        };
+
+        /**
+         * Events of one thread. Only the owning thread writes to it, so
+         * recording needs no lock.
+         */
+        struct threadBuffer {
+            int tid;
+            vector<event> events;
+            vector<size_t> open;    // indices of open sections
+        };
+
+
+        atomic<bool> active(false);
+
+        // all thread buffers (they are kept after the thread has finished)
+        static mutex buffersMutex;
+        static vector<unique_ptr<threadBuffer>> buffers;
+
+        static chrono::steady_clock::time_point epoch = chrono::steady_clock::now();
+
+        static thread_local threadBuffer* localBuffer = nullptr;
+
+
+        static int64_t now() {
+            return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - epoch).count();
+        }
+
+
+        static threadBuffer* getBuffer() {
+            if (localBuffer == nullptr) {
+                lock_guard<mutex> lock(buffersMutex);
+                buffers.push_back(unique_ptr<threadBuffer>(new threadBuffer()));
+                buffers.back()->tid = buffers.size();
+                localBuffer = buffers.back().get();
+            }
+
+            return localBuffer;
+        }
+
+
+        void enable(const bool on) {
+            if (on) {
+                clear();
+            }
+
+            active = on;
+        }
+
+
+        void clear() {
+            lock_guard<mutex> lock(buffersMutex);
+
+            for (auto& buffer : buffers) {
+                buffer->events.clear();
+                buffer->open.clear();
+            }
+
+            epoch = chrono::steady_clock::now();
+        }
+
+
+        void begin(const char* name, const int id) {
+            threadBuffer* buffer = getBuffer();
+
+            buffer->open.push_back(buffer->events.size());
+            buffer->events.push_back({name, id, (int)buffer->open.size() - 1, now(), -1, 0});
+        }
+
+
+        void end() {
+            threadBuffer* buffer = getBuffer();
+
+            // the trace may be cleared in the meantime
+            if (buffer->open.empty()) {
+                return;
+            }
+
+            event& e = buffer->events[buffer->open.back()];
+            buffer->open.pop_back();
+            e.end = now();
+
+            // time of the parent that is spent in this section
+            if (!buffer->open.empty()) {
+                buffer->events[buffer->open.back()].children += e.end - e.start;
+            }
+        }
+
+
+        void writeChromeTrace(const string& filename) {
+            ofstream file(filename);
+
+            if (!file) {
+                throw runtime_error("Can not write trace: " + filename);
+            }
+
+            lock_guard<mutex> lock(buffersMutex);
+
+            file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [" << endl;
+            file << fixed << setprecision(3);
+
+            bool first = true;
+
+            for (const auto& buffer : buffers) {
+                if (buffer->events.empty()) {
+                    continue;
+                }
+
+                // name of the thread in the viewer
+                file << (first ? "" : ",\n")
+                     << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer->tid
+                     << ", \"args\": {\"name\": \"thread " << buffer->tid << "\"}}";
+                first = false;
+
+                for (const event& e : buffer->events) {
+                    // skip sections which are still open
+                    if (e.end < 0) {
+                        continue;
+                    }
+
+                    file << ",\n{\"name\": \"" << e.name << "\", \"cat\": \"deblur\", \"ph\": \"X\""
+                         << ", \"ts\": " << e.start / 1000.0 << ", \"dur\": " << (e.end - e.start) / 1000.0
+                         << ", \"pid\": 1, \"tid\": " << buffer->tid;
+
+                    if (e.id >= 0) {
+                        file << ", \"args\": {\"id\": " << e.id << "}";
+                    }
+
+                    file << "}";
+                }
+            }
+
+            file << endl << "]}" << endl;
+        }
+
+
+        void printSummary(ostream& out) {
+            struct statistic {
+                int count = 0;
+                int64_t total = 0;
+                int64_t self = 0;
+                int64_t max = 0;
+            };
+
+            map<string, statistic> sections;
+            vector<pair<int, int64_t>> busy;
+            int64_t first = -1, last = 0;
+
+            {
+                lock_guard<mutex> lock(buffersMutex);
+
+                for (const auto& buffer : buffers) {
+                    int64_t threadBusy = 0;
+
+                    for (const event& e : buffer->events) {
+                        if (e.end < 0) {
+                            continue;
+                        }
+
+                        int64_t duration = e.end - e.start;
+
+                        statistic& s = sections[e.name];
+                        s.count++;
+                        s.total += duration;
+                        s.self += duration - e.children;
+                        s.max = std::max(s.max, duration);
+
+                        if (e.depth == 0) {
+                            threadBusy += duration;
+                        }
+
+                        first = (first < 0) ? e.start : std::min(first, e.start);
+                        last = std::max(last, e.end);
+                    }
+
+                    if (threadBusy > 0) {
+                        busy.push_back(make_pair(buffer->tid, threadBusy));
+                    }
+                }
+            }
+
+            if (sections.empty()) {
+                out << "trace is empty" << endl;
+                return;
+            }
+
+            // sections with the largest total time first
+            vector<pair<string, statistic>> sorted(sections.begin(), sections.end());
+            sort(sorted.begin(), sorted.end(), [](const pair<string, statistic>& a, const pair<string, statistic>& b) {
+                return a.second.total > b.second.total;
+            });
+
+            out << fixed << setprecision(2);
+            out << left << setw(28) << "section" << right << setw(8) << "count"
+                << setw(14) << "total [ms]" << setw(14) << "self [ms]"
+                << setw(14) << "mean [ms]" << setw(14) << "max [ms]" << endl;
+
+            for (const auto& s : sorted) {
+                out << left << setw(28) << s.first << right << setw(8) << s.second.count
+                    << setw(14) << s.second.total / 1e6 << setw(14) << s.second.self / 1e6
+                    << setw(14) << s.second.total / 1e6 / s.second.count << setw(14) << s.second.max / 1e6 << endl;
+            }
+
+            // time where a thread didn't work inside a traced section
+            double wall = (last - first) / 1e6;
+            out << endl << "wall time: " << wall << " ms" << endl;
+
+            for (const auto& b : busy) {
+                double threadBusy = b.second / 1e6;
+                out << "  thread " << setw(3) << b.first << ": busy " << setw(12) << threadBusy
+                    << " ms, idle " << setw(12) << wall - threadBusy << " ms" << endl;
+            }
+        }
+    }
+}
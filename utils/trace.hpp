@@ -0,0 +1,119 @@
+/***********************************************************************
+ * Author:       Franziska Krüger
+ * Requirements: C++11
+ *
+ * Description:
+ * ------------
+ * Lightweight hierarchical tracing of the algorithm steps.
+ *
+ * Scoped timers record the start and end time, the thread and the nesting
+ * depth of a code section. The result can be saved in the Chrome trace-event
+ * format (open it with chrome://tracing or https://ui.perfetto.dev) or printed
+ * as a flat summary table.
+ *
+ * Tracing is disabled by default. A disabled scope costs one relaxed
+ * atomic load.
+ *
+ *     TRACE_SCOPE("disparity");
+ *     TRACE_SCOPE_ID("psfSelection", id);
+ *
+ ***********************************************************************
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <string>
+#include <ostream>
+
+
+namespace deblur {
+
+    namespace trace {
+
+        /**
+         * runtime switch, use enable() and enabled()
+         */
+        extern std::atomic<bool> active;
+
+        inline bool enabled() {
+            return active.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Starts or stops the recording. Starting removes all former events.
+         */
+        void enable(const bool on = true);
+
+        /**
+         * Removes all recorded events.
+         */
+        void clear();
+
+        /**
+         * Opens a section on the current thread. Has to be closed with end()
+         * on the same thread.
+         *
+         * @param name name of the section (has to live as long as the trace, e.g. a literal)
+         * @param id   optional id like the node id (-1 for none)
+         */
+        void begin(const char* name, const int id = -1);
+
+        /**
+         * Closes the last opened section of the current thread.
+         */
+        void end();
+
+        /**
+         * Saves all finished sections in the Chrome trace-event format.
+         * Call it when no thread is recording.
+         *
+         * @param filename JSON file
+         */
+        void writeChromeTrace(const std::string& filename);
+
+        /**
+         * Prints count, total, self and maximal time of each section name
+         * and the busy time of each thread.
+         * Call it when no thread is recording.
+         */
+        void printSummary(std::ostream& out);
+
+
+        /**
+         * Records the lifetime of the object as a section.
+         */
+        class Scope {
+
+          public:
+
+            Scope(const char* name, const int id = -1) : recording(enabled()) {
+                if (recording) begin(name, id);
+            }
+
+            ~Scope() {
+                if (recording) end();
+            }
+
+          private:
+
+            const bool recording;
+        };
+    }
+}
+
+#define TRACE_CONCAT_INNER(a, b) a ## b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+/**
+ * Traces the rest of the current block
+ */
+#define TRACE_SCOPE(name) deblur::trace::Scope TRACE_CONCAT(traceScope, __LINE__)(name)
+
+/**
+ * Traces the rest of the current block with an id (e.g. node id)
+ */
+#define TRACE_SCOPE_ID(name, id) deblur::trace::Scope TRACE_CONCAT(traceScope, __LINE__)(name, id)
+
+#endif
@@ -592,4 +592,99 @@ namespace deblur {
         src.copyTo(dst, mask);
     }
 
+
+    void transferChroma(const Mat& blurred, const Mat& luminance, Mat& dst,
+                        const int radius, const double eps) {
+        assert(blurred.type() == CV_8UC3 && "works on BGR images");
+        assert(luminance.type() == CV_8U && "works on gray value images");
+        assert(blurred.size() == luminance.size() && "both images have the same size");
+
+        Mat ycrcb;
+        cvtColor(blurred, ycrcb, COLOR_BGR2YCrCb);
+
+        vector<Mat> channels;
+        split(ycrcb, channels);
+
+        // the models are fitted with the blurred luminance
+        // and applied to the deblurred one
+        Mat guide, sharp;
+        channels[0].convertTo(guide, CV_32F, 1 / 255.0);
+        luminance.convertTo(sharp, CV_32F, 1 / 255.0);
+
+        const Size window(2 * radius + 1, 2 * radius + 1);
+
+        Mat meanGuide, varGuide;
+        boxFilter(guide, meanGuide, -1, window);
+        boxFilter(guide.mul(guide), varGuide, -1, window);
+        varGuide -= meanGuide.mul(meanGuide);
+        varGuide += eps;
+
+        for (int c = 1; c < 3; c++) {
+            Mat chroma, meanChroma, covariance;
+            channels[c].convertTo(chroma, CV_32F, 1 / 255.0);
+
+            boxFilter(chroma, meanChroma, -1, window);
+            boxFilter(guide.mul(chroma), covariance, -1, window);
+            covariance -= meanGuide.mul(meanChroma);
+
+            // chroma = a * luminance + b inside of each window
+            Mat a, b;
+            divide(covariance, varGuide, a);
+            b = meanChroma - a.mul(meanGuide);
+
+            // average the models of all windows covering a pixel
+            boxFilter(a, a, -1, window);
+            boxFilter(b, b, -1, window);
+
+            Mat restored = a.mul(sharp) + b;
+            restored.convertTo(channels[c], CV_8U, 255);
+        }
+
+        channels[0] = luminance;
+        merge(channels, ycrcb);
+        cvtColor(ycrcb, dst, COLOR_YCrCb2BGR);
+    }
+
+
+    double structuralSimilarity(const Mat& x, const Mat& y) {
+        assert(x.size() == y.size() && x.type() == y.type() && "images of the same size and type");
+        assert(x.depth() == CV_8U && "works on uchar images");
+
+        const double c1 = 6.5025, c2 = 58.5225;     // (0.01 * 255)^2, (0.03 * 255)^2
+        const Size window(11, 11);
+
+        Mat a, b;
+        x.convertTo(a, CV_32F);
+        y.convertTo(b, CV_32F);
+
+        Mat muA, muB, sigmaA, sigmaB, sigmaAB;
+        GaussianBlur(a, muA, window, 1.5);
+        GaussianBlur(b, muB, window, 1.5);
+        GaussianBlur(a.mul(a), sigmaA, window, 1.5);
+        GaussianBlur(b.mul(b), sigmaB, window, 1.5);
+        GaussianBlur(a.mul(b), sigmaAB, window, 1.5);
+
+        Mat muAA = muA.mul(muA);
+        Mat muBB = muB.mul(muB);
+        Mat muAB = muA.mul(muB);
+        sigmaA -= muAA;
+        sigmaB -= muBB;
+        sigmaAB -= muAB;
+
+        Mat numerator = (2 * muAB + c1).mul(2 * sigmaAB + c2);
+        Mat denominator = (muAA + muBB + c1).mul(sigmaA + sigmaB + c2);
+
+        Mat map;
+        divide(numerator, denominator, map);
+
+        Scalar means = mean(map);
+        double sum = 0;
+
+        for (int c = 0; c < x.channels(); c++) {
+            sum += means[c];
+        }
+
+        return sum / x.channels();
+    }
+
 }
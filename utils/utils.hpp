@@ -221,6 +221,27 @@ namespace deblur {
      * @param mask          mask of region
      */
     void edgeTaper(cv::Mat& taperedRegion, cv::Mat& region, cv::Mat& mask, cv::Mat& image);
+
+    /**
+     * Restores the chroma of a color image of which just the luminance was deblurred.
+     * In each window the chroma (Cr, Cb) of the blurred image is fitted as a linear
+     * function of its luminance (guided filter by He et al.). The averaged models are
+     * applied to the deblurred luminance, so the chroma edges follow the sharp ones.
+     * 
+     * @param blurred   blurred BGR image
+     * @param luminance deblurred gray image (Y channel of YCrCb)
+     * @param dst       deblurred BGR image
+     * @param radius    radius of the windows (should cover the blur)
+     * @param eps       regularization of the models (larger: smoother chroma)
+     */
+    void transferChroma(const cv::Mat& blurred, const cv::Mat& luminance, cv::Mat& dst,
+                        const int radius, const double eps = 1e-3);
+
+    /**
+     * Mean structural similarity (SSIM) of two uchar images of the same size and
+     * type. Gaussian windows with sigma 1.5, averaged over the channels.
+     */
+    double structuralSimilarity(const cv::Mat& x, const cv::Mat& y);
 }
 
 #endif
\ No newline at end of file